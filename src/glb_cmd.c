@@ -13,6 +13,7 @@
 #include <assert.h>
 #include <ctype.h> // isspace()
 #include <stdlib.h>
+#include <string.h>
 
 extern char* optarg;
 
@@ -21,16 +22,19 @@ static const char cmd_inc_addr_default[]  = "0.0.0.0";
 static const char cmd_ctrl_addr_default[] = "127.0.0.1";
 
 
-static void
-cmd_parse_options (int argc, char* argv[], glb_cnf_t* cnf)
+/* parses options, @param cmdline - whether argv comes from the command line
+ * or from the configuration file. @return 0 or -EINVAL */
+static int
+cmd_parse_options (int argc, char* argv[], glb_cnf_t* cnf, bool cmdline)
 {
     int   opt = 0;
     int   opt_idx = 0;
     char* endptr;
 
     // parse options
-    while ((opt = getopt_long (argc, argv, "DKL:STVYabc:dfhi:lm:nt:rsvw:x:",
+    while ((opt = getopt_long (argc, argv, "C:DKL:MSTVX:Yabc:dfhi:lm:nt:rsvw:x:",
                                glb_options, &opt_idx)) != -1) {
+        errno = 0; // numeric conversions below check it
         switch (opt) {
         case GLB_OPT_DISCOVER:
             cnf->discover = true;
@@ -44,9 +48,16 @@ cmd_parse_options (int argc, char* argv[], glb_cnf_t* cnf)
                 cnf->lat_factor < 0) {
                 fprintf (stderr, "Bad latency count value: %s. "
                          "Non-negative integer expected.\n", optarg);
-                exit (EXIT_FAILURE);
+                return -EINVAL;
             }
             break;
+        case GLB_OPT_MYSQL_SPLIT:
+#ifdef GLB_USE_SPLICE
+            fprintf (stderr, "MySQL read/write splitting is not supported "
+                     "with splice().\n");
+            return -EINVAL;
+#endif
+            cnf->mysql_split = true; // writer is the single top destination
         case GLB_OPT_SINGLE:
             cnf->policy = GLB_POLICY_SINGLE; // implies GLB_OPT_TOP
         case GLB_OPT_TOP:
@@ -54,7 +65,21 @@ cmd_parse_options (int argc, char* argv[], glb_cnf_t* cnf)
             break;
         case GLB_OPT_VERSION:
             glb_print_version (stdout);
-            if (argc == 2) exit(0);
+            if (cmdline && argc == 2) exit(0);
+            break;
+        case GLB_OPT_MYSQL_MUX:
+#ifdef GLB_USE_SPLICE
+            fprintf (stderr, "MySQL connection multiplexing is not supported "
+                     "with splice().\n");
+            return -EINVAL;
+#endif
+            cnf->mysql_mux = strtol (optarg, &endptr, 10);
+            if ((*endptr != '\0' && !isspace(*endptr)) || errno ||
+                cnf->mysql_mux <= 0) {
+                fprintf (stderr, "Bad MySQL server connections value: %s. "
+                         "Positive integer expected.\n", optarg);
+                return -EINVAL;
+            }
             break;
         case GLB_OPT_SYNCHRONOUS:
             cnf->synchronous = true;
@@ -67,7 +92,7 @@ cmd_parse_options (int argc, char* argv[], glb_cnf_t* cnf)
             break;
         case GLB_OPT_CONTROL:
             if (glb_parse_addr (&cnf->ctrl_addr, optarg, cmd_ctrl_addr_default))
-                exit (EXIT_FAILURE);
+                return -EINVAL;
             cnf->ctrl_set = true;
             break;
         case GLB_OPT_DAEMON:
@@ -76,18 +101,21 @@ cmd_parse_options (int argc, char* argv[], glb_cnf_t* cnf)
         case GLB_OPT_FIFO:
             cnf->fifo_name = optarg;
             break;
+        case GLB_OPT_CONFIG:
+            cnf->config = optarg;
+            break;
         case '?':
         case GLB_OPT_HELP:
+            if (!cmdline) return -EINVAL;
             glb_cmd_help(stdout, argv[0]);
             exit (EXIT_FAILURE);
             break;
         case GLB_OPT_INTERVAL:
-            cnf->interval = glb_time_from_double(strtod (optarg, &endptr));
-            if ((*endptr != '\0' && !isspace(*endptr)) || errno ||
-                cnf->interval <= 0) {
+            if (glb_parse_interval (cnf, optarg)) {
                 fprintf (stderr, "Bad check interval value: %s. "
-                         "Positive real number expected.\n", optarg);
-                exit (EXIT_FAILURE);
+                         "Positive real number expected, optionally "
+                         "followed by :MIN[:MAX] bounds.\n", optarg);
+                return -EINVAL;
             }
             break;
         case GLB_OPT_LINGER:
@@ -98,7 +126,7 @@ cmd_parse_options (int argc, char* argv[], glb_cnf_t* cnf)
             if ((*endptr != '\0' && !isspace(*endptr)) || errno) {
                 fprintf (stderr, "Bad max_conn value: %s. Integer expected.\n",
                          optarg);
-                exit (EXIT_FAILURE);
+                return -EINVAL;
             }
             break;
         case GLB_OPT_NODELAY:
@@ -109,7 +137,7 @@ cmd_parse_options (int argc, char* argv[], glb_cnf_t* cnf)
             if ((*endptr != '\0' && !isspace(*endptr)) || errno) {
                 fprintf (stderr, "Bad n_threads value: %s. Integer expected.\n",
                          optarg);
-                exit (EXIT_FAILURE);
+                return -EINVAL;
             }
             break;
         case GLB_OPT_RANDOM:
@@ -130,7 +158,7 @@ cmd_parse_options (int argc, char* argv[], glb_cnf_t* cnf)
                 cnf->extra < 0) {
                 fprintf (stderr, "Bad extra value: %s. "
                          "Non-negative real number expected.\n", optarg);
-                exit (EXIT_FAILURE);
+                return -EINVAL;
             }
             break;
         default:
@@ -138,6 +166,14 @@ cmd_parse_options (int argc, char* argv[], glb_cnf_t* cnf)
                      glb_options[opt_idx].name, opt);
         }
     }
+
+    if (cnf->mysql_split && cnf->mysql_mux) {
+        fprintf (stderr, "MySQL read/write splitting and connection "
+                 "multiplexing can't be used together.\n");
+        return -EINVAL;
+    }
+
+    return 0;
 }
 
 void
@@ -164,9 +200,14 @@ glb_cmd_help (FILE* out, const char* progname)
              "  -f|--fifo <fifo name>     "
              "name of the FIFO file for control.\n");
     fprintf (out,
-             "  -i|--interval D.DDD       "
+             "  -i|--interval D.DDD[:MIN[:MAX]]\n"
+             "                            "
              "how often to probe destinations for liveness\n"
              "                            (fractional seconds, default 1.0).\n"
+             "                            Optional MIN and MAX let probe "
+             "interval adapt\n"
+             "                            to destination behavior "
+             "(default: D.DDD).\n"
         );
     fprintf (out,
              "  -l|--linger               "
@@ -196,12 +237,16 @@ glb_cmd_help (FILE* out, const char* progname)
              "  -w|--watchdog SPEC_STR    watchdog specification.\n");
     fprintf (out,
              "  -x|--extra D.DDD          "
-             "perform extra destination poll on connection attempt\n"
+             "prefer destinations polled less than D.DDD seconds\n"
              "                            "
-             "if the previous poll happened more than D.DD seconds\n"
-             "                            ago.\n"
+             "ago and request background poll of the stale ones.\n"
              "                            "
              "(default: 0.0 - extra polling disabled)\n");
+    fprintf (out,
+             "  -C|--config FILE          "
+             "read more options and destinations from FILE,\n"
+             "                            "
+             "re-read it on SIGHUP or 'reload' control command.\n");
     fprintf (out,
              "  -D|--discover             "
              "use watchdog results to discover and set new\n"
@@ -221,6 +266,16 @@ glb_cmd_help (FILE* out, const char* progname)
              "                            "
              "(default: 0 - not using reported latency for weight\n"
              "                            adjustment)\n");
+    fprintf (out,
+             "  -M|--mysql-split          "
+             "route plain reads outside transactions to another\n"
+             "                            "
+             "destination, everything else to the top one (MySQL).\n");
+    fprintf (out,
+             "  -X|--mysql-mux N          "
+             "share at most N server connections per destination\n"
+             "                            "
+             "between MySQL clients, one transaction at a time.\n");
     fprintf (out,
              "  -S|--single               "
              "direct all connections to a single destination\n"
@@ -239,29 +294,154 @@ glb_cmd_help (FILE* out, const char* progname)
              "where to listen for incoming TCP connections at.\n"
              "                            "
              "(without IP part - bind to all interfaces)\n"
+             "  unix:PATH                 "
+             "where to listen for incoming UNIX socket connections.\n"
              );
     fprintf (out, "DESTINATION_LIST:\n"
              "  [H1[:P1[:W1]]] [H2[:P2[:W2]]]... "
              " - a space-separated list of destinations\n"
-             "                            in the form address:port:weight.\n");
+             "                            in the form address:port:weight\n"
+             "                            or unix:path:weight.\n");
     fprintf (out, "SPEC_STR:\n"
              "  BACKEND_ID[:BACKEND_SPECIFIC_STRING], "
-             "e.g. exec:'<command line>'\n");
+             "e.g. exec:'<command line>'\n"
+             "                            or mexec:'<helper command line>'\n"
+             "                            or mysql:'-u<user> -p<password>'\n"
+             "                            or tcp\n"
+             "                            or http:'[<path> [<string>]]'\n"
+             "                            "
+             "or agent:'[-t <timeout>] [<address>:]<port>'\n"
+             "                            "
+             "(agents push state of their own destinations,\n"
+             "                            "
+             "address is 127.0.0.1 by default)\n");
     exit (EXIT_FAILURE);
 }
 
 
-glb_cnf_t*
-glb_cmd_parse (int argc, char* argv[])
+/* command line is kept for configuration reload */
+static int          cmd_argc = 0;
+static char**       cmd_argv = NULL;
+static char*        cmd_file_buf[2] = { NULL, NULL }; // startup and reload
+static char*        cmd_config = NULL; // absolute config file path
+
+/* reads configuration file and splits it into argv-like token list after
+ * argv0, comments are stripped. @return 0 or negative error code */
+static int
+cmd_read_file (const char* const name, char* const argv0, char** const buf,
+               int* const argc, char*** const argv)
+{
+    FILE* const f = fopen (name, "r");
+
+    if (!f) {
+        int const err = errno;
+        fprintf (stderr, "Failed to open configuration file '%s': %d (%s)\n",
+                 name, err, strerror (err));
+        return -err;
+    }
+
+    size_t len  = 0;
+    size_t size = 0;
+    char*  str  = NULL;
+    int    ret  = 0;
+
+    do {
+        if (len + 1 >= size) {
+            char* const tmp = realloc (str, size ? size * 2 : BUFSIZ);
+            if (!tmp) { ret = -ENOMEM; break; }
+            str  = tmp;
+            size = size ? size * 2 : BUFSIZ;
+        }
+        len += fread (str + len, 1, size - len - 1, f);
+    } while (!feof (f) && !ferror (f));
+
+    if (!ret && ferror (f)) ret = -EIO;
+
+    fclose (f);
+
+    if (ret) {
+        free (str);
+        return ret;
+    }
+
+    str[len] = '\0';
+
+    /* split into tokens in place: tokens are separated by whitespace and may
+     * be quoted with '"' or '\'', comments last till the end of line */
+    int   tok_num = 0;
+    char* r = str;
+    char* w = str;
+
+    *argv = calloc (len / 2 + 2, sizeof(char*)); // enough for all tokens
+
+    if (!*argv) {
+        free (str);
+        return -ENOMEM;
+    }
+
+    while (*r) {
+        while (isspace (*r)) r++;
+
+        if ('#' == *r) {
+            while (*r && '\n' != *r) r++;
+            continue;
+        }
+
+        if (!*r) break;
+
+        (*argv)[++tok_num] = w;
+
+        char quote = '\0';
+        while (*r && (quote || !isspace (*r))) {
+            if (quote && quote == *r)            quote = '\0';
+            else if (!quote && ('"' == *r || '\'' == *r)) quote = *r;
+            else                                 *w++ = *r;
+            r++;
+        }
+
+        if (quote) {
+            fprintf (stderr, "Unterminated quote in configuration file '%s'\n",
+                     name);
+            free (*argv);
+            free (str);
+            return -EINVAL;
+        }
+
+        if (*r) r++; // w never overtakes r, so this is safe
+        *w++ = '\0';
+    }
+
+    (*argv)[0] = argv0;
+    *argc = tok_num + 1;
+    *buf  = str;
+
+    return 0;
+}
+
+/* builds configuration from command line and configuration file if any,
+ * options from the file override command line ones and destinations are
+ * added to those from command line.
+ * @param startup - false if configuration is reloaded: then the file buffer
+ *                  of the previous reload is released and nothing is fatal.
+ * @return new configuration or NULL */
+static glb_cnf_t*
+cmd_build (int argc, char* argv[], bool const startup)
 {
     glb_cnf_t*   cnf = glb_cnf_init(); // initialize to defaults
     const char** dst_list = NULL;
+    int          n_dst = 0;
+    char**       file_argv = NULL;
+    int          file_argc = 0;
+    char*        file_buf = NULL;
     uint16_t     inc_port;
 
-    if (!cnf) exit (EXIT_FAILURE);
+    if (!cnf) return NULL;
 
     // parse options
-    cmd_parse_options (argc, argv, cnf);
+    optind = 0; // full getopt reinitialization
+    if (cmd_parse_options (argc, argv, cnf, true)) goto error;
+
+    if (!startup) cnf->config = cmd_config; // relative path may be stale
 
     // first non-option argument
     if (optind >= argc) {
@@ -272,7 +452,7 @@ glb_cmd_parse (int argc, char* argv[])
 
     // parse obligatory incoming address
     if (glb_parse_addr (&cnf->inc_addr, argv[optind], cmd_inc_addr_default)) {
-        exit (EXIT_FAILURE);
+        goto error;
     }
     inc_port = glb_sockaddr_get_port (&cnf->inc_addr);
 
@@ -287,8 +467,43 @@ glb_cmd_parse (int argc, char* argv[])
     }
 #endif
 
+    int const cmd_dst = optind + 1;
+    int const cmd_n_dst = argc > cmd_dst ? argc - cmd_dst : 0;
+
+    if (cnf->config) {
+        if (cmd_read_file (cnf->config, argv[0], &file_buf,
+                           &file_argc, &file_argv)) goto error;
+
+        const char* const config = cnf->config;
+
+        optind = 0;
+        if (cmd_parse_options (file_argc, file_argv, cnf, false)) {
+            fprintf (stderr, "Bad options in configuration file '%s'.\n",
+                     config);
+            goto error;
+        }
+
+        if (cnf->config != config) {
+            fprintf (stderr, "Configuration file can't refer to another.\n");
+            goto error;
+        }
+    }
+
+    int const file_dst = optind; // getopt permuted non-options to the end
+    int const file_n_dst = file_argc > file_dst ? file_argc - file_dst : 0;
+
+    n_dst = cmd_n_dst + file_n_dst;
+    if (n_dst > 0) {
+        dst_list = calloc (n_dst, sizeof(char*));
+        if (!dst_list) goto error;
+        if (cmd_n_dst) memcpy (dst_list, argv + cmd_dst,
+                               cmd_n_dst * sizeof(char*));
+        if (file_n_dst) memcpy (dst_list + cmd_n_dst, file_argv + file_dst,
+                                file_n_dst * sizeof(char*));
+    }
+
     // if number of threads was not specified
-    if (!cnf->n_threads) cnf->n_threads = 1;
+    if (cnf->n_threads <= 0) cnf->n_threads = 1;
 
     if (cnf->max_conn > glb_get_conn_limit()) {
         int res = glb_set_conn_limit (cnf->max_conn);
@@ -298,10 +513,58 @@ glb_cmd_parse (int argc, char* argv[])
     if (cnf->daemonize) cnf->verbose = false;
 
     // parse destination list
-    if (++optind < argc) dst_list = (const char**) &(argv[optind]);
-    assert (argc >= optind);
+    cnf = glb_parse_dst_list (dst_list, n_dst, inc_port, cnf);
+
+    free (dst_list);
+    free (file_argv);
+
+    /* string options may point to the file buffer */
+    if (cnf) {
+        if (!startup) free (cmd_file_buf[1]);
+        cmd_file_buf[startup ? 0 : 1] = file_buf;
+    }
+    else {
+        free (file_buf);
+    }
+
+    return cnf;
+
+error:
+    free (dst_list);
+    free (file_argv);
+    free (file_buf);
+    free (cnf);
+    return NULL;
+}
+
+glb_cnf_t*
+glb_cmd_parse (int argc, char* argv[])
+{
+    glb_cnf_t* const cnf = cmd_build (argc, argv, true);
+
+    if (!cnf) exit (EXIT_FAILURE);
 
-    return glb_parse_dst_list (dst_list, argc - optind, inc_port, cnf);
+    if (cnf->config) {
+        /* daemon changes working directory, remember absolute path */
+        cmd_config = realpath (cnf->config, NULL);
+        if (!cmd_config) {
+            fprintf (stderr, "Failed to resolve configuration file path "
+                     "'%s': %d (%s)\n", cnf->config, errno, strerror(errno));
+            exit (EXIT_FAILURE);
+        }
+        cnf->config = cmd_config;
+    }
+
+    cmd_argc = argc;
+    cmd_argv = argv;
+
+    return cnf;
 }
 
+glb_cnf_t*
+glb_cmd_reload (void)
+{
+    assert (cmd_argv);
 
+    return cmd_build (cmd_argc, cmd_argv, false);
+}
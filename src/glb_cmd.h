@@ -17,6 +17,14 @@
 extern glb_cnf_t*
 glb_cmd_parse (int argc, char* argv[]);
 
+/*!
+ * Re-reads configuration from the original command line and configuration
+ * file. Does not exit on error. Not reentrant: callers must serialize.
+ * @return new configuration structure or NULL
+ */
+extern glb_cnf_t*
+glb_cmd_reload (void);
+
 extern void
 glb_cmd_help (FILE* out, const char* progname);
 
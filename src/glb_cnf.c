@@ -14,6 +14,7 @@ glb_cnf_t* glb_cnf = NULL;
 
 #include <errno.h>
 #include <stddef.h> // ptrdiff_t
+#include <ctype.h>  // isspace()
 #include <stdlib.h>
 #include <string.h>
 
@@ -55,7 +56,7 @@ glb_cnf_init ()
 #define glb_ip_len_max     256
 #define glb_port_max       ((1<<16) - 1)
 
-// parses [addr:]port
+// parses [addr:]port or unix:/path
 int
 glb_parse_addr (glb_sockaddr_t* addr,
                 const char*     str,
@@ -66,6 +67,8 @@ glb_parse_addr (glb_sockaddr_t* addr,
     char*       endptr;
     char        addr_str[glb_ip_len_max + 1] = { 0, };
 
+    if (glb_sockaddr_str_is_unix (str)) return glb_sockaddr_init (addr, str, 0);
+
     port_str = strchr (str, ':');
     if (!port_str) {
         // no separator - only port present
@@ -97,6 +100,40 @@ glb_parse_addr (glb_sockaddr_t* addr,
     return glb_sockaddr_init (addr, addr_str, port);
 }
 
+static int
+cnf_parse_seconds (glb_time_t* const t, const char* const str,
+                   char** const endptr)
+{
+    errno = 0;
+    *t = glb_time_from_double (strtod (str, endptr));
+    return (*endptr == str || errno || *t <= 0) ? -EINVAL : 0;
+}
+
+// parses D.DDD[:MIN[:MAX]]
+int
+glb_parse_interval (glb_cnf_t* const cnf, const char* const str)
+{
+    glb_time_t intvl, min = 0, max = 0;
+    char*      endptr;
+
+    if (cnf_parse_seconds (&intvl, str, &endptr)) return -EINVAL;
+
+    if (':' == *endptr &&
+        cnf_parse_seconds (&min, endptr + 1, &endptr)) return -EINVAL;
+
+    if (':' == *endptr &&
+        cnf_parse_seconds (&max, endptr + 1, &endptr)) return -EINVAL;
+
+    if ((*endptr != '\0' && !isspace(*endptr)) ||
+        (min && min > intvl) || (max && max < intvl)) return -EINVAL;
+
+    cnf->interval     = intvl;
+    cnf->interval_min = min;
+    cnf->interval_max = max;
+
+    return 0;
+}
+
 // parses array list of destinations
 glb_cnf_t*
 glb_parse_dst_list (const char* const dst_list[],
@@ -167,6 +204,7 @@ glb_cnf_print (FILE* out, const glb_cnf_t* cnf)
     fprintf (out, "Incoming address: %s, ", inc_addr.str);
 #if GLBD
     fprintf (out, "control FIFO: %s\n", cnf->fifo_name);
+    if (cnf->config) fprintf (out, "Configuration file: %s\n", cnf->config);
 #endif
     fprintf (out, "Control  address:  %s\n",
              cnf->ctrl_set ? ctrl_addr.str : "none");
@@ -174,7 +212,7 @@ glb_cnf_print (FILE* out, const glb_cnf_t* cnf)
 #if GLBD
              "Number of threads: %d, max conn: %d, "
              "nodelay: %s, keepalive: %s, defer accept: %s, linger: %s, "
-             "daemon: %s, "
+             "daemon: %s, mysql split: %s, mysql mux: %d, "
 #endif
              "lat.count: %d, policy: '%s', top: %s, verbose: %s\n",
 #if GLBD
@@ -185,6 +223,8 @@ glb_cnf_print (FILE* out, const glb_cnf_t* cnf)
              cnf->defer_accept ? "ON" : "OFF",
              cnf->linger ? "ON" : "OFF",
              cnf->daemonize ? "YES" : "NO",
+             cnf->mysql_split ? "YES" : "NO",
+             cnf->mysql_mux,
 #endif
              cnf->lat_factor,
              policy_str[cnf->policy],
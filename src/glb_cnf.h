@@ -30,9 +30,12 @@ typedef struct glb_cnf
     glb_sockaddr_t ctrl_addr;    // network control interface
     const char*    watchdog;     // watchdog spec string
     glb_time_t     interval;     // health check interval (nanoseconds)
+    glb_time_t     interval_min; // adaptive check interval bounds,
+    glb_time_t     interval_max; // 0 - same as interval
     glb_time_t     extra;        // extra check interval (nanoseconds)
 #ifdef GLBD
     const char*    fifo_name;    // FIFO file name
+    const char*    config;       // configuration file name
     int            n_threads;    // number of routing threads (1 .. oo)
     int            max_conn;     // max allowed client connections
     bool           nodelay;      // use TCP_NODELAY?
@@ -41,6 +44,9 @@ typedef struct glb_cnf
     bool           defer_accept; // use TCP_DEFER_ACCEPT?
     bool           daemonize;    // become a daemon?
     bool           synchronous;  // connect synchronously
+    bool           mysql_split;  // route MySQL reads to a separate server
+    int            mysql_mux;    // MySQL server connections per destination
+                                 // for multiplexing, 0 - no multiplexing
 #endif /* GLBD */
     bool           verbose;      // be verbose?
     bool           discover;     // automatically discover new destinations
@@ -75,6 +81,14 @@ glb_parse_addr (glb_sockaddr_t* addr,
                 const char*     str,
                 const char*     default_addr);
 
+/*!
+ * parses check interval: D.DDD[:MIN[:MAX]] fractional seconds
+ *
+ * @return 0 or -EINVAL
+ */
+extern int
+glb_parse_interval (glb_cnf_t* cnf, const char* str);
+
 extern void
 glb_print_version (FILE* out);
 
@@ -13,6 +13,7 @@
 #include "glb_control.h"
 
 #include "glb_cmd.h"
+#include "glb_misc.h"
 
 #include <pthread.h>
 #include <assert.h>
@@ -36,6 +37,11 @@ typedef struct pollfd pollfd_t;
 
 static const char ctrl_getinfo_cmd[] = "getinfo";
 static const char ctrl_getstat_cmd[] = "getstat";
+static const char ctrl_getlat_cmd[]  = "getlat";
+static const char ctrl_getconns_cmd[] = "getconns";
+#ifdef GLBD
+static const char ctrl_reload_cmd[]  = "reload";
+#endif
 
 #if 0
 typedef enum ctrl_fd
@@ -59,6 +65,10 @@ struct glb_ctrl
     int           fd_max;
     pollfd_t      fds[CTRL_MAX];
     uint16_t      default_port;
+#ifdef GLBD
+    pthread_mutex_t reload_lock; // reload can come from signal and control
+    glb_cnf_t*    reloaded;      // last reloaded config (destination list)
+#endif
 };
 
 static void
@@ -115,6 +125,248 @@ ctrl_respond (glb_ctrl_t* ctrl, int fd, const char* resp)
     }
 }
 
+static const char ctrl_dst_delim[] = " \t\r\n";
+
+/* Applies n destination changes and stores results in res: through
+ * watchdog if any, otherwise to router at once.
+ * @return 0 or the last error */
+static int
+ctrl_apply_dsts (glb_ctrl_t* ctrl, int n, const glb_dst_t* dst, int* res)
+{
+    int err = 0;
+    int i;
+
+    if (ctrl->wdog) {
+        for (i = 0; i < n; i++) {
+            res[i] = glb_wdog_change_dst (ctrl->wdog, &dst[i]);
+        }
+    }
+    else {
+        glb_router_change_dsts (ctrl->router, n, dst, NULL, res);
+    }
+
+    for (i = 0; i < n; i++) {
+        if (res[i] < 0) {
+#ifdef GLBD
+            char tmp[128];
+            glb_dst_print (tmp, 128, &dst[i]);
+            glb_log_info ("Ctrl: failed to apply destination change: %s", tmp);
+#endif /* GLBD */
+            err = res[i];
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        if (ctrl->pool && dst[i].weight < 0.0 && ctrl->wdog && res[i] >= 0) {
+            // destination was removed from router, drop all connections to it
+            // watchdog will do it itself
+            glb_pool_drop_dst (ctrl->pool, &dst[i].addr);
+        }
+    }
+
+    return err;
+}
+
+/* Applies one or more destination changes separated by whitespace. Without
+ * watchdog they are applied to router at once. */
+static void
+ctrl_change_dsts (glb_ctrl_t* ctrl, int fd, char* req)
+{
+    int   n = 0;
+    char* p = req;
+
+    for (;;) {
+        p += strspn (p, ctrl_dst_delim);
+        if ('\0' == *p) break;
+        n++;
+        p += strcspn (p, ctrl_dst_delim);
+    }
+
+    glb_dst_t* const dst = calloc (n + 1, sizeof(*dst));
+    int*       const res = calloc (n + 1, sizeof(*res));
+
+    if (!dst || !res) {
+        glb_log_error ("Ctrl: failed to allocate %d destination changes", n);
+        ctrl_respond (ctrl, fd, "Error\n");
+        goto out;
+    }
+
+    char* save;
+    char* tok;
+    int   i = 0;
+
+    for (tok = strtok_r (req, ctrl_dst_delim, &save); tok;
+         tok = strtok_r (NULL, ctrl_dst_delim, &save), i++) {
+        if (glb_dst_parse (&dst[i], tok, ctrl->default_port) < 0) {
+            glb_log_info ("Ctrl: malformed change destination request: %s\n",
+                          tok);
+            ctrl_respond (ctrl, fd, "Error\n");
+            goto out;
+        }
+    }
+
+    if (0 == n) {
+        glb_log_info ("Ctrl: empty change destination request\n");
+        ctrl_respond (ctrl, fd, "Error\n");
+        goto out;
+    }
+
+    int const err = ctrl_apply_dsts (ctrl, n, dst, res);
+
+    ctrl_respond (ctrl, fd, err < 0 ? "Error\n" : "Ok\n");
+
+out:
+    free (dst);
+    free (res);
+}
+
+#ifdef GLBD
+/* @return index of destination in the cnf list or -1 */
+static int
+ctrl_find_dst (const glb_cnf_t* const cnf, const glb_dst_t* const dst)
+{
+    size_t i;
+
+    for (i = 0; i < cnf->n_dst; i++) {
+        if (glb_dst_is_equal (&cnf->dst[i], dst)) return i;
+    }
+
+    return -1;
+}
+
+/* Applies the difference between configured destination lists: removed
+ * destinations are discarded, new and reweighted ones are set.
+ * @return 0 or negative error code */
+static int
+ctrl_reload_dsts (glb_ctrl_t* const ctrl, const glb_cnf_t* const old,
+                  const glb_cnf_t* const cnf)
+{
+    size_t const max = old->n_dst + cnf->n_dst;
+
+    if (0 == max) return 0;
+
+    glb_dst_t* const dst = calloc (max, sizeof(*dst));
+    int*       const res = calloc (max, sizeof(*res));
+    int              n   = 0;
+    int              ret = -ENOMEM;
+    size_t           i;
+
+    if (!dst || !res) goto out;
+
+    for (i = 0; i < old->n_dst; i++) {
+        if (ctrl_find_dst (cnf, &old->dst[i]) < 0) {
+            dst[n] = old->dst[i];
+            dst[n].weight = -1.0;
+            n++;
+        }
+    }
+
+    for (i = 0; i < cnf->n_dst; i++) {
+        int const j = ctrl_find_dst (old, &cnf->dst[i]);
+        if (j < 0 || old->dst[j].weight != cnf->dst[i].weight) {
+            dst[n++] = cnf->dst[i];
+        }
+    }
+
+    ret = n > 0 ? ctrl_apply_dsts (ctrl, n, dst, res) : 0;
+
+    if (n > 0) glb_log_info ("Ctrl: %d destination changes.", n);
+
+out:
+    free (dst);
+    free (res);
+
+    return ret;
+}
+
+/* warns about changes that take effect only after restart */
+static void
+ctrl_reload_check (const glb_cnf_t* const old, const glb_cnf_t* const cnf)
+{
+    const char* what = NULL;
+
+    if (!glb_sockaddr_is_equal (&old->inc_addr, &cnf->inc_addr))
+        what = "listen address";
+    else if (old->ctrl_set != cnf->ctrl_set ||
+             (cnf->ctrl_set &&
+              !glb_sockaddr_is_equal (&old->ctrl_addr, &cnf->ctrl_addr)))
+        what = "control address";
+    else if (strcmp (old->fifo_name, cnf->fifo_name))
+        what = "control FIFO";
+    else if (!old->watchdog != !cnf->watchdog ||
+             (cnf->watchdog && strncmp (old->watchdog, cnf->watchdog,
+                                        strlen (old->watchdog))))
+        what = "watchdog"; // backend id is separated from spec in old
+    else if (old->mysql_split != cnf->mysql_split ||
+             old->mysql_mux   != cnf->mysql_mux)
+        what = "MySQL mode";
+    else if (old->defer_accept != cnf->defer_accept ||
+             old->daemonize    != cnf->daemonize ||
+             old->verbose      != cnf->verbose)
+        what = "listener or daemon options";
+
+    if (what) {
+        glb_log_warn ("Ctrl: %s change requires restart, ignored.", what);
+    }
+}
+
+int
+glb_ctrl_reload (glb_ctrl_t* const ctrl)
+{
+    /* command line parsing is not reentrant (getopt globals, file buffers),
+     * so the whole reload is serialized */
+    GLB_MUTEX_LOCK (&ctrl->reload_lock);
+
+    glb_cnf_t* const cnf = glb_cmd_reload();
+
+    if (!cnf) {
+        GLB_MUTEX_UNLOCK (&ctrl->reload_lock);
+        glb_log_error ("Ctrl: failed to reload configuration, "
+                       "keeping the current one.");
+        return -EINVAL;
+    }
+
+    glb_cnf_t* const live = ctrl->cnf;
+    const glb_cnf_t* const old = ctrl->reloaded ? ctrl->reloaded : live;
+
+    ctrl_reload_check (live, cnf);
+
+    /* plain options are read by their users anew every time */
+    live->nodelay      = cnf->nodelay;
+    live->keepalive    = cnf->keepalive;
+    live->linger       = cnf->linger;
+    live->synchronous  = cnf->synchronous;
+    live->discover     = cnf->discover;
+    live->lat_factor   = cnf->lat_factor;
+    live->interval     = cnf->interval;
+    live->interval_min = cnf->interval_min;
+    live->interval_max = cnf->interval_max;
+
+    glb_router_reconfig (ctrl->router, cnf);
+
+    if (ctrl->wdog) glb_wdog_reconfig (ctrl->wdog);
+
+    int ret = 0;
+
+    if (ctrl->pool && cnf->n_threads != live->n_threads) {
+        ret = glb_pool_set_threads (ctrl->pool, cnf->n_threads);
+        if (!ret) live->n_threads = cnf->n_threads;
+    }
+
+    int const err = ctrl_reload_dsts (ctrl, old, cnf);
+    if (err && !ret) ret = err;
+
+    free (ctrl->reloaded);
+    ctrl->reloaded = cnf;
+
+    GLB_MUTEX_UNLOCK (&ctrl->reload_lock);
+
+    glb_log_info ("Configuration reloaded%s.", ret ? " with errors" : "");
+
+    return ret;
+}
+#endif /* GLBD */
+
 static int
 ctrl_handle_request (glb_ctrl_t* ctrl, int fd)
 {
@@ -156,42 +408,26 @@ ctrl_handle_request (glb_ctrl_t* ctrl, int fd)
         ctrl_respond (ctrl, fd, req);
         return 0;
     }
-    else { // change destiantion request
-        glb_dst_t dst;
-
-        if (glb_dst_parse (&dst, req, ctrl->default_port) < 0) {
-            glb_log_info ("Ctrl: malformed change destination request: %s\n",
-                          req);
-            ctrl_respond (ctrl, fd, "Error\n");
-            return 0;
-        }
-
-        int err;
-        if (ctrl->wdog) {
-            err = glb_wdog_change_dst (ctrl->wdog, &dst);
-        }
-        else {
-            err = glb_router_change_dst (ctrl->router, &dst, NULL);
-        }
-
-        if (err < 0) {
+    else if (ctrl->pool &&
+             !strncasecmp (ctrl_getlat_cmd, req, strlen(ctrl_getlat_cmd))) {
+        glb_pool_print_latency (ctrl->pool, req, sizeof(req));
+        ctrl_respond (ctrl, fd, req);
+        return 0;
+    }
+    else if (ctrl->pool &&
+             !strncasecmp (ctrl_getconns_cmd, req, strlen(ctrl_getconns_cmd))) {
+        glb_pool_print_conns (ctrl->pool, req, sizeof(req));
+        ctrl_respond (ctrl, fd, req);
+        return 0;
+    }
 #ifdef GLBD
-            char tmp[128];
-            glb_dst_print (tmp, 128, &dst);
-            glb_log_info ("Ctrl: failed to apply destination change: %s", tmp);
-#endif /* GLBD */
-            ctrl_respond (ctrl, fd, "Error\n");
-            return 0;
-        }
-
-        ctrl_respond (ctrl, fd, "Ok\n");
-
-        if (ctrl->pool && dst.weight < 0.0 && ctrl->wdog) {
-            // destination was removed from router, drop all connections to it
-            // watchdog will do it itself
-            glb_pool_drop_dst (ctrl->pool, &dst.addr);
-        }
-
+    else if (!strncasecmp (ctrl_reload_cmd, req, strlen(ctrl_reload_cmd))) {
+        ctrl_respond (ctrl, fd, glb_ctrl_reload (ctrl) ? "Error\n" : "Ok\n");
+        return 0;
+    }
+#endif
+    else { // change destination request
+        ctrl_change_dsts (ctrl, fd, req);
         return 0;
     }
 }
@@ -226,10 +462,10 @@ ctrl_thread (void* arg)
         if (ctrl->inet_sock > 0 && (ctrl_fd_isset (ctrl, ctrl->inet_fd))) {
             // new network client
             int             client_sock;
-            struct sockaddr client;
-            socklen_t       client_size;
+            glb_sockaddr_t  client;
+            socklen_t       client_size = sizeof(client);
 
-            client_sock = accept (ctrl->inet_sock, &client, &client_size);
+            client_sock = accept (ctrl->inet_sock, &client.sa, &client_size);
 
             if (client_sock < 0) {
                 glb_log_error ("Ctrl: failed to accept connection: %d (%s)",
@@ -296,6 +532,9 @@ glb_ctrl_create (glb_cnf_t*    const cnf,
         ret->inet_sock    = sock;
         ret->default_port = port;
         ret->fd_max       = 1; // at least one of fifo or inet_sock is present
+#ifdef GLBD
+        pthread_mutex_init (&ret->reload_lock, NULL);
+#endif
 
         *(int*)&ret->inet_fd = -1;
 
@@ -334,6 +573,10 @@ extern void
 glb_ctrl_destroy (glb_ctrl_t* ctrl)
 {
     pthread_join (ctrl->thread, NULL);
+#ifdef GLBD
+    pthread_mutex_destroy (&ctrl->reload_lock);
+    free (ctrl->reloaded);
+#endif
     free (ctrl);
 }
 
@@ -34,6 +34,18 @@ glb_ctrl_create (glb_cnf_t*    cnf,
                  int           fifo,
                  int           sock);
 
+#ifdef GLBD
+/*!
+ * Re-reads configuration file and command line and applies what can be
+ * changed at runtime: routing policy, destination list and weights, check
+ * intervals, number of pool threads and socket options of new connections.
+ * Established connections are kept.
+ * @return 0 or negative error code
+ */
+extern int
+glb_ctrl_reload (glb_ctrl_t* ctrl);
+#endif /* GLBD */
+
 extern void
 glb_ctrl_destroy (glb_ctrl_t* ctrl);
 
@@ -20,6 +20,44 @@
 #define dst_port_max       ((1 << 16) - 1)
 #define dst_default_weight 1.0
 
+// parses unix:/path[:weight] string, stores in dst. Path takes place of both
+// address and port, weight is recognized only if it is a valid number
+static long
+dst_parse_unix (glb_dst_t* dst, const char* s)
+{
+    char      addr_str[dst_ip_len_max + 1] = { 0, };
+    size_t    addr_len = strlen (s);
+    long      ret = 2;
+    // prefix contains separator, so it is always found
+    const char* const sep = strrchr (s, dst_separator);
+
+    if (sep - s >= (ptrdiff_t)sizeof(GLB_SOCKADDR_UNIX) - 1 && sep[1] != '\0')
+    {
+        char* endptr;
+        double const weight = strtod (sep + 1, &endptr);
+
+        if (*endptr == '\0') {
+            dst->weight = weight;
+            addr_len = sep - s;
+            ret = 3;
+        }
+    }
+
+    if (addr_len > dst_ip_len_max) {
+        glb_log_error ("Socket path too long: %s\n", s);
+        return -EINVAL;
+    }
+
+    memcpy (addr_str, s, addr_len);
+
+    if (glb_sockaddr_init (&dst->addr, addr_str, 0)) {
+        glb_log_error ("%s", strerror (EINVAL));
+        return -EINVAL;
+    }
+
+    return ret;
+}
+
 // parses addr:port:weight string, stores in dst
 // returns number of parsed fields or negative error code
 long
@@ -32,7 +70,10 @@ glb_dst_parse (glb_dst_t* dst, const char* s, uint16_t default_port)
     ulong       port = default_port;
     long        ret  = 0;
 
-    dst->weight = dst_default_weight;
+    dst->weight    = dst_default_weight;
+    dst->max_conns = 0;
+
+    if (glb_sockaddr_str_is_unix (s)) return dst_parse_unix (dst, s);
 
     // parse IP address
     endptr = strchr (s, dst_separator);
@@ -18,10 +18,13 @@ typedef struct glb_dst
     double         weight;       // >0: connection allocation weight (def: 1)
                                  //  0: no new conns, but keep existing (drain)
                                  // <0: discard destination entirely
+    long           max_conns;    // >0: connection limit (from watchdog)
+                                 //  0: no limit
 } glb_dst_t;
 
 /*!
- * Parse destination spec - addr[:port[:weight]]- from the string
+ * Parse destination spec - addr[:port[:weight]] or unix:/path[:weight] -
+ * from the string
  * @return number of fields parsed or negative error code
  */
 extern long
@@ -12,6 +12,7 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <stdbool.h>
 #include <errno.h>
 #include <ctype.h>
@@ -27,6 +28,8 @@ static const char env_targets[] = "GLB_TARGETS"; // balancing targets
 //static const char env_interval[]= "GLB_INTERVAL";// health check interval
 static const char env_watchdog[]= "GLB_WATCHDOG";// watchdog spec string
 
+extern char** environ; // to find names of balanced services
+
 // Defaults relevant to ENV
 static const char env_ctrl_addr_default[] = "127.0.0.1";
 static const char env_bind_addr_default[] = "127.0.0.1";
@@ -105,14 +108,8 @@ env_parse_options (glb_cnf_t* const cnf, const char* opts)
             }
             break;
         case GLB_OPT_INTERVAL:
-            if (i + 1 < argc) {
-                long long intvl =
-                    glb_time_from_double (strtod (argv[i + 1], &endptr));
-                if ((*endptr == '\0' || isspace(*endptr)) && !errno &&
-                    intvl > 0) {
-                    i++;
-                    cnf->interval = intvl;
-                }
+            if (i + 1 < argc && !glb_parse_interval (cnf, argv[i + 1])) {
+                i++;
             }
             break;
         case GLB_OPT_LATENCY_COUNT:
@@ -192,6 +189,7 @@ env_parse_policy (glb_cnf_t* cnf, const char* p)
         }
         else if (p && !strcmp(p, "random")) cnf->policy = GLB_POLICY_RANDOM;
         else if (p && !strcmp(p, "source")) cnf->policy = GLB_POLICY_SOURCE;
+        else if (p && !strcmp(p, "least"))  cnf->policy = GLB_POLICY_LEAST;
     }
 }
 
@@ -223,20 +221,65 @@ env_addr_empty (const glb_sockaddr_t* const addr)
     return glb_sockaddr_is_equal (addr, &empty);
 }
 
+/* returns value of variable var of the named service (var_name) */
+static const char*
+env_get (const char* const var, const char* const name)
+{
+    if (!name) return getenv (var);
+
+    char buf[256];
+    int const len = snprintf (buf, sizeof(buf), "%s_%s", var, name);
+
+    if (len < 0 || (size_t)len >= sizeof(buf)) return NULL;
+
+    return getenv (buf);
+}
+
+char**
+glb_env_names ()
+{
+    size_t const prefix_len = strlen (env_bind) + 1; // "GLB_BIND_"
+    char** ret = NULL;
+    int    num = 0;
+    int    i;
+
+    for (i = 0; environ && environ[i]; i++)
+    {
+        const char* const var = environ[i];
+
+        if (strncmp (var, env_bind, prefix_len - 1) ||
+            '_' != var[prefix_len - 1]) continue;
+
+        const char* const eq = strchr (var, '=');
+        if (!eq || eq == var + prefix_len) continue;
+
+        char** const tmp = realloc (ret, (num + 2) * sizeof(char*));
+        if (!tmp) break;
+
+        ret = tmp;
+        ret[num] = strndup (var + prefix_len, eq - var - prefix_len);
+        if (!ret[num]) break;
+
+        ret[++num] = NULL;
+    }
+
+    return ret;
+}
+
 glb_cnf_t*
-glb_env_parse ()
+glb_env_parse (const char* const name)
 {
     bool err = false;
 
     glb_cnf_t* ret = glb_cnf_init(); // initialize to defaults
     if (!ret) return NULL;
 
-    glb_cnf_t* tmp = env_parse_options (ret, getenv (env_options));
+    glb_cnf_t* tmp = env_parse_options (ret, env_get (env_options, name));
     if (!tmp) goto failure;
 
     ret = tmp;
 
-    const char* const bind_str = getenv (env_bind);
+    const char* const bind_str = env_get (env_bind, name);
     if (bind_str && strlen(bind_str))
     {
         err = glb_parse_addr (&ret->inc_addr, bind_str, env_bind_addr_default);
@@ -245,12 +288,12 @@ glb_env_parse ()
     err = err || env_addr_empty (&ret->inc_addr);
     if (err)
     {
-        fputs (LIBGLB_PREFIX "Unspecified or invalid \"bind\" address.\n",
-               stderr);
+        fprintf (stderr, LIBGLB_PREFIX "Unspecified or invalid \"bind\" "
+                 "address%s%s.\n", name ? " of " : "", name ? name : "");
         goto failure;
     }
 
-    const char* const targets_tmp = getenv (env_targets);
+    const char* const targets_tmp = env_get (env_targets, name);
     char* targets_str = targets_tmp ? strdup(targets_tmp) : NULL;
     if (targets_str && strlen(targets_str))
     {
@@ -277,13 +320,14 @@ glb_env_parse ()
 
     if (err)
     {
-        fputs (LIBGLB_PREFIX "Unspecified or invalid targets list.\n", stderr);
+        fprintf (stderr, LIBGLB_PREFIX "Unspecified or invalid targets "
+                 "list%s%s.\n", name ? " of " : "", name ? name : "");
         goto failure;
     }
 
-    env_parse_policy   (ret, getenv (env_policy));
-    env_parse_control  (ret, getenv (env_ctrl));
-    env_parse_watchdog (ret, getenv (env_watchdog));
+    env_parse_policy   (ret, env_get (env_policy,   name));
+    env_parse_control  (ret, env_get (env_ctrl,     name));
+    env_parse_watchdog (ret, env_get (env_watchdog, name));
 
     return ret;
 
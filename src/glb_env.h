@@ -11,10 +11,20 @@
 
 #include "glb_cnf.h"
 
+/*!
+ * Returns NULL-terminated array of names of the balanced services configured
+ * with GLB_BIND_<name> variables, NULL if there are none. Array and names
+ * are to be freed by the caller.
+ */
+extern char**
+glb_env_names ();
+
 /*!
  * Parses environment variables and creates configuration structure.
+ * @param name of the service, variables are then suffixed with _<name>
+ *        (e.g. GLB_TARGETS_<name>), NULL - unsuffixed variables.
  */
 extern glb_cnf_t*
-glb_env_parse ();
+glb_env_parse (const char* name);
 
 #endif // _glb_env_h_
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * $Id$
+ */
+
+#include "glb_hist.h"
+
+#include <assert.h>
+
+uint64_t
+glb_hist_quantile (const glb_hist_t* const h, double const q)
+{
+    assert (q >= 0.0 && q <= 1.0);
+
+    if (!h->count) return 0;
+
+    /* rank of the sample we are looking for, 1-based */
+    ulong rank = q * h->count + 0.5;
+    if (rank < 1)        rank = 1;
+    if (rank > h->count) rank = h->count;
+
+    ulong seen = 0;
+    int   i;
+
+    for (i = 0; i < GLB_HIST_BUCKETS; i++)
+    {
+        seen += h->buckets[i];
+        if (seen >= rank) return glb_hist_bucket_max (i);
+    }
+
+    assert (0);
+    return glb_hist_bucket_max (GLB_HIST_BUCKETS - 1);
+}
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * Log-bucketed (HDR-style) latency histogram.
+ *
+ * Values below 2^(GLB_HIST_SUB_BITS + 1) get a bucket each, above that every
+ * power of 2 is split into 2^GLB_HIST_SUB_BITS linear sub-buckets, so relative
+ * error stays within 1/2^GLB_HIST_SUB_BITS regardless of magnitude.
+ *
+ * Histograms are not thread-safe: each one is supposed to be updated by a
+ * single thread and merged by the same thread into some accumulator.
+ *
+ * $Id$
+ */
+
+#ifndef _glb_hist_h_
+#define _glb_hist_h_
+
+#include "glb_types.h" // ulong
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define GLB_HIST_SUB_BITS  3
+#define GLB_HIST_SUB_COUNT (1 << GLB_HIST_SUB_BITS)
+#define GLB_HIST_LINEAR    (GLB_HIST_SUB_COUNT << 1) // values with own bucket
+#define GLB_HIST_MAX_BITS  40 // ~12.7 days in microseconds
+#define GLB_HIST_MAX       ((1ULL << GLB_HIST_MAX_BITS) - 1)
+#define GLB_HIST_BUCKETS   (GLB_HIST_LINEAR + \
+    (GLB_HIST_MAX_BITS - GLB_HIST_SUB_BITS - 1) * GLB_HIST_SUB_COUNT)
+
+typedef struct glb_hist
+{
+    ulong count;
+    ulong buckets[GLB_HIST_BUCKETS];
+} glb_hist_t;
+
+static inline int
+glb_hist_msb (uint64_t v)
+{
+#if __GNUC__ >= 4
+    return 63 - __builtin_clzll (v);
+#else
+    int ret = 0;
+    while (v >>= 1) ret++;
+    return ret;
+#endif
+}
+
+static inline int
+glb_hist_bucket (uint64_t v)
+{
+    if (v < GLB_HIST_LINEAR) return v;
+    if (v > GLB_HIST_MAX) v = GLB_HIST_MAX;
+
+    int const msb   = glb_hist_msb (v);
+    int const shift = msb - GLB_HIST_SUB_BITS;
+    int const sub   = (v >> shift) & (GLB_HIST_SUB_COUNT - 1);
+
+    return GLB_HIST_LINEAR +
+        (msb - GLB_HIST_SUB_BITS - 1) * GLB_HIST_SUB_COUNT + sub;
+}
+
+/*! Returns the highest value that falls into bucket idx */
+static inline uint64_t
+glb_hist_bucket_max (int idx)
+{
+    if (idx < GLB_HIST_LINEAR) return idx;
+
+    int const msb   = (idx - GLB_HIST_LINEAR) / GLB_HIST_SUB_COUNT +
+                      GLB_HIST_SUB_BITS + 1;
+    int const sub   = (idx - GLB_HIST_LINEAR) % GLB_HIST_SUB_COUNT;
+    int const shift = msb - GLB_HIST_SUB_BITS;
+
+    return (((uint64_t)(GLB_HIST_SUB_COUNT + sub + 1)) << shift) - 1;
+}
+
+static inline void
+glb_hist_record (glb_hist_t* h, uint64_t v)
+{
+    h->buckets[glb_hist_bucket (v)]++;
+    h->count++;
+}
+
+// adds right histogram to left histogram
+static inline void
+glb_hist_add (glb_hist_t* left, const glb_hist_t* right)
+{
+    int i;
+
+    if (!right->count) return;
+
+    for (i = 0; i < GLB_HIST_BUCKETS; i++) left->buckets[i] += right->buckets[i];
+
+    left->count += right->count;
+}
+
+/*! Returns value below which the fraction q (0.0 - 1.0) of samples falls.
+ *  (Upper bound of the bucket, 0 for empty histogram) */
+extern uint64_t
+glb_hist_quantile (const glb_hist_t* h, double q);
+
+#endif // _glb_hist_h_
@@ -4,6 +4,13 @@
  * Main GLB library unit.
  *
  * It's purpose is to overload the standard libc connect() call.
+ * Several balanced services, each with its own router, can be configured,
+ * connect() finds the one for the address with a hash table lookup.
+ * close(), shutdown() and dup() family are overloaded to count connections
+ * of every destination, which LEAST policy and connection limits need.
+ * Non-blocking connects fail over transparently: poll(), epoll_wait() and
+ * getsockopt(SO_ERROR) are overloaded to hide refused connections from the
+ * application while the next destination is being connected.
  *
  * $Id$
  */
@@ -13,9 +20,21 @@
 #include "glb_router.h"
 #include "glb_wdog.h"
 #include "glb_control.h"
+#include "glb_misc.h"
+#include "glb_time.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <pthread.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <stddef.h> // offsetof()
 #include <dlfcn.h>
 #include <string.h>
 #include <stdio.h>
@@ -24,88 +43,1251 @@ static int (*glb_real_connect) (int                    sockfd,
                                   const struct sockaddr* addr,
                                   socklen_t              addrlen) = NULL;
 
-static glb_cnf_t*     glb_cnf         = NULL;
+/*! Balanced service: address connections to which are routed */
+typedef struct glb_service
+{
+    glb_cnf_t*    cnf;
+    glb_router_t* router;
+} glb_service_t;
 
-static glb_router_t*  glb_router      = NULL;
+static glb_shm_t*      glb_shm          = NULL; // shared with other processes
 
-static void glb_init() __attribute__((constructor));
+static glb_service_t*  glb_services     = NULL;
+static int             glb_services_num = 0;
 
-static void glb_init()
+/* open addressing hash table of services by incoming address, set once all
+ * services are created and is read-only afterwards */
+static glb_service_t** glb_services_map  = NULL;
+static uint32_t        glb_services_mask = 0;
+
+static int (*glb_real_getsockopt) (int sockfd, int level, int optname,
+                                   void* optval, socklen_t* optlen) = NULL;
+static int (*glb_real_poll) (struct pollfd* fds, nfds_t nfds,
+                             int timeout) = NULL;
+static int (*glb_real_epoll_ctl) (int epfd, int op, int fd,
+                                  struct epoll_event* event) = NULL;
+static int (*glb_real_epoll_pwait) (int epfd, struct epoll_event* events,
+                                    int maxevents, int timeout,
+                                    const sigset_t* sigmask) = NULL;
+static int (*glb_real_close)    (int fd) = NULL;
+static int (*glb_real_shutdown) (int fd, int how) = NULL;
+static int (*glb_real_dup)      (int oldfd) = NULL;
+static int (*glb_real_dup2)     (int oldfd, int newfd) = NULL;
+static int (*glb_real_dup3)     (int oldfd, int newfd, int flags) = NULL;
+static int (*glb_real_fcntl)    (int fd, int cmd, ...) = NULL;
+static int (*glb_real_fcntl64)  (int fd, int cmd, ...) = NULL;
+
+static void
+glb_real_resolve (void)
+{
+    glb_real_getsockopt  = dlsym (RTLD_NEXT, "getsockopt");
+    glb_real_poll        = dlsym (RTLD_NEXT, "poll");
+    glb_real_epoll_ctl   = dlsym (RTLD_NEXT, "epoll_ctl");
+    glb_real_epoll_pwait = dlsym (RTLD_NEXT, "epoll_pwait");
+    glb_real_close       = dlsym (RTLD_NEXT, "close");
+    glb_real_shutdown    = dlsym (RTLD_NEXT, "shutdown");
+    glb_real_dup         = dlsym (RTLD_NEXT, "dup");
+    glb_real_dup2        = dlsym (RTLD_NEXT, "dup2");
+    glb_real_dup3        = dlsym (RTLD_NEXT, "dup3");
+    glb_real_fcntl       = dlsym (RTLD_NEXT, "fcntl");
+    glb_real_fcntl64     = dlsym (RTLD_NEXT, "fcntl64");
+}
+
+/* other libraries may poll before glb_init() is called */
+#define GLB_REAL(func)                                                  \
+    (glb_real_##func ? glb_real_##func :                                \
+     (glb_real_resolve(), glb_real_##func))
+
+/*! Connection routed by libglb, shared by all descriptors duplicated from
+ *  the one it was connected with */
+typedef struct glb_conn
+{
+    glb_router_t*       router;
+    glb_router_handle_t handle; // GLB_ROUTER_HANDLE_NONE once discounted
+    int                 refs;   // descriptors referring to connection
+} glb_conn_t;
+
+/* descriptor table: fd-indexed connection pointers in chunks allocated on
+ * demand, so that unrelated descriptors cost no memory */
+#define GLB_FDS_CHUNK  1024
+#define GLB_FDS_CHUNKS 1024 // descriptors above 1M are not tracked
+
+static glb_conn_t**    glb_fds[GLB_FDS_CHUNKS];
+static pthread_mutex_t glb_fds_lock  = PTHREAD_MUTEX_INITIALIZER;
+static volatile int    glb_conns_num = 0; // read without lock as a hint
+
+/* table is modified under glb_fds_lock, but close() of untracked descriptor
+ * peeks into it without the lock, hence atomic chunk and entry accesses */
+#define GLB_FDS_LOAD(x)    __atomic_load_n (&(x), __ATOMIC_ACQUIRE)
+#define GLB_FDS_STORE(x,v) __atomic_store_n (&(x), (v), __ATOMIC_RELEASE)
+
+/* router replaces sockets with dup2() and close(), those must not be
+ * mistaken for application closing the connection */
+static __thread bool   glb_in_router = false;
+
+/*! Non-blocking connect in progress to a balanced destination */
+typedef struct glb_pending
 {
-//    fprintf (stderr, "GLB_OPTIONS='%s'\n", getenv ("GLB_OPTIONS"));
-//    fprintf (stderr, "GLB_BIND='%s'\n",    getenv ("GLB_BIND"));
-//    fprintf (stderr, "GLB_TARGETS='%s'\n", getenv ("GLB_TARGETS"));
+    int            fd;
+    glb_router_t*  router;
+    glb_conn_t*    conn;  // NULL if connection is not tracked
+    ino_t          ino;   // tells the socket from a reused descriptor
+    int            error; // final error to report, 0 - still connecting
+    int            refused; // error of the first destination, 0 - none yet
+    int            epfd;  // epoll instance socket was added to, -1 - none
+    uint32_t       events; // epoll events and
+    uint64_t       data;  // event data of the socket
+    glb_sockaddr_t dst;   // destination being connected to
+} glb_pending_t;
 
-    glb_cnf = glb_env_parse();
+static pthread_mutex_t glb_pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static glb_pending_t*  glb_pending      = NULL;
+static int             glb_pending_size = 0;
+static volatile int    glb_pending_num  = 0; // read without lock as a hint
 
-    if (glb_cnf)
+/*! epoll registration of a socket that is not connected yet, so that its
+ *  events can be matched once connect() is pending. Only registrations
+ *  waiting for EPOLLOUT are kept, those are what connecting needs. */
+typedef struct glb_epoll_reg
+{
+    int      fd;
+    ino_t    ino;
+    int      epfd;
+    uint32_t events;
+    uint64_t data;
+} glb_epoll_reg_t;
+
+static glb_epoll_reg_t* glb_epoll_regs      = NULL; // under glb_pending_lock
+static int              glb_epoll_regs_size = 0;
+static volatile int     glb_epoll_regs_num  = 0; // read without lock as hint
+
+/* must be called under glb_fds_lock
+ * @return pointer to fd entry or NULL if fd is not (can't be) tracked */
+static glb_conn_t**
+glb_fd_entry (int const fd, bool const alloc)
+{
+    if (fd < 0 || fd >= GLB_FDS_CHUNK * GLB_FDS_CHUNKS) return NULL;
+
+    glb_conn_t*** const chunk = &glb_fds[fd / GLB_FDS_CHUNK];
+
+    if (!*chunk)
     {
-        if (glb_cnf->verbose) glb_cnf_print(stdout, glb_cnf);
+        if (!alloc) return NULL;
 
-        glb_log_init (GLB_LOG_STDERR, glb_cnf->verbose);
+        glb_conn_t** const tmp = calloc (GLB_FDS_CHUNK, sizeof(glb_conn_t*));
 
-        glb_router = glb_router_create(glb_cnf);
+        if (!tmp) return NULL;
 
-        if (glb_router)
-        {
-            glb_wdog_t* wdog = NULL;
+        GLB_FDS_STORE (*chunk, tmp);
+    }
 
-            if (glb_cnf->watchdog)
-            {
-                wdog = glb_wdog_create(glb_cnf, glb_router, NULL);
-            }
+    return &(*chunk)[fd % GLB_FDS_CHUNK];
+}
 
-            if (glb_cnf->ctrl_set)
-            {
-                uint16_t const default_port =
-                    glb_sockaddr_get_port(&glb_cnf->inc_addr);
+/* clears fd entry, must be called under glb_fds_lock
+ * @return connection if it was the last reference to it */
+static glb_conn_t*
+glb_fd_drop (glb_conn_t** const entry)
+{
+    glb_conn_t* const conn = *entry;
 
-                int const sock = glb_socket_create(&glb_cnf->ctrl_addr, 0);
+    if (!conn) return NULL;
 
-                if (sock > 0)
-                    glb_ctrl_create(glb_cnf, glb_router, NULL, wdog,
-                                    default_port, 0, sock);
-            }
-        }
+    GLB_FDS_STORE (*entry, NULL);
+
+    if (--conn->refs > 0) return NULL;
+
+    glb_conns_num--;
+    return conn;
+}
+
+static void
+glb_conn_close (glb_conn_t* const conn)
+{
+    if (!conn) return;
+
+    glb_router_disconnect (conn->router, &conn->handle);
+    free (conn);
+}
+
+/* starts tracking connection routed by router to handle on fd
+ * @return connection or NULL if it could not be tracked and was discounted */
+static glb_conn_t*
+glb_fd_track (int const fd, glb_router_t* const router,
+              const glb_router_handle_t* const handle)
+{
+    glb_conn_t* const conn = malloc (sizeof(glb_conn_t));
+    glb_conn_t**      entry = NULL;
+    glb_conn_t*       old   = NULL;
+
+    GLB_MUTEX_LOCK (&glb_fds_lock);
+
+    if (conn) entry = glb_fd_entry (fd, true);
+
+    if (entry)
+    {
+        old = glb_fd_drop (entry); // descriptor was closed behind our back
+
+        conn->router = router;
+        conn->handle = *handle;
+        conn->refs   = 1;
+        GLB_FDS_STORE (*entry, conn);
+        glb_conns_num++;
     }
 
-    if (!glb_router)
+    GLB_MUTEX_UNLOCK (&glb_fds_lock);
+
+    glb_conn_close (old);
+
+    if (!entry)
     {
-        fputs (LIBGLB_PREFIX "Failed to initialize.\n", stderr);
-        fflush (stderr);
+        /* nothing would discount it later */
+        glb_router_disconnect (router, handle);
+        free (conn);
+        return NULL;
     }
 
-    glb_real_connect = dlsym(RTLD_NEXT, "__connect");
+    return conn;
+}
+
+/* lock-free check, so that closing unrelated descriptors does not contend
+ * on glb_fds_lock. Only a racing close() of the same descriptor can make it
+ * stale, and that is an application bug anyway.
+ * @return true if fd may be tracked */
+static inline bool
+glb_fd_tracked (int const fd)
+{
+    if (fd < 0 || fd >= GLB_FDS_CHUNK * GLB_FDS_CHUNKS) return false;
+
+    glb_conn_t** const chunk = GLB_FDS_LOAD (glb_fds[fd / GLB_FDS_CHUNK]);
+
+    return (chunk && GLB_FDS_LOAD (chunk[fd % GLB_FDS_CHUNK]));
+}
+
+/* stops tracking fd, discounts connection if it was the last reference */
+static void
+glb_fd_untrack (int const fd)
+{
+    if (!glb_fd_tracked (fd)) return;
+
+    GLB_MUTEX_LOCK (&glb_fds_lock);
+
+    glb_conn_t** const entry = glb_fd_entry (fd, false);
+    glb_conn_t*  const conn  = entry ? glb_fd_drop (entry) : NULL;
+
+    GLB_MUTEX_UNLOCK (&glb_fds_lock);
+
+    glb_conn_close (conn);
+}
+
+/* newfd became a duplicate of oldfd, whatever it was before is closed */
+static void
+glb_fd_dup (int const oldfd, int const newfd)
+{
+    GLB_MUTEX_LOCK (&glb_fds_lock);
+
+    glb_conn_t** const old_entry = glb_fd_entry (oldfd, false);
+    glb_conn_t*  const conn      = old_entry ? *old_entry : NULL;
+    glb_conn_t** const new_entry = glb_fd_entry (newfd, NULL != conn);
+    glb_conn_t*  const prev      = new_entry ? glb_fd_drop (new_entry) : NULL;
+
+    if (conn && new_entry)
+    {
+        GLB_FDS_STORE (*new_entry, conn);
+        conn->refs++;
+    }
+
+    GLB_MUTEX_UNLOCK (&glb_fds_lock);
+
+    glb_conn_close (prev);
+}
+
+/* connection is over for all its descriptors, discounts it right away */
+static void
+glb_fd_shutdown (int const fd)
+{
+    glb_router_handle_t handle = GLB_ROUTER_HANDLE_NONE;
+    glb_router_t*       router = NULL;
+
+    GLB_MUTEX_LOCK (&glb_fds_lock);
+
+    glb_conn_t** const entry = glb_fd_entry (fd, false);
+    glb_conn_t*  const conn  = entry ? *entry : NULL;
+
+    if (conn)
+    {
+        router = conn->router;
+        handle = conn->handle;
+        conn->handle = GLB_ROUTER_HANDLE_NONE;
+    }
+
+    GLB_MUTEX_UNLOCK (&glb_fds_lock);
+
+    if (router) glb_router_disconnect (router, &handle);
 }
 
+static inline glb_router_handle_t
+glb_conn_handle (const glb_conn_t* const conn)
+{
+    if (!conn) return GLB_ROUTER_HANDLE_NONE;
+
+    GLB_MUTEX_LOCK (&glb_fds_lock);
+    glb_router_handle_t const ret = conn->handle;
+    GLB_MUTEX_UNLOCK (&glb_fds_lock);
+
+    return ret;
+}
+
+/* connection was routed anew, untracked one is discounted right away */
+static void
+glb_conn_rehandle (glb_conn_t* const conn, glb_router_t* const router,
+                   const glb_router_handle_t* const handle)
+{
+    if (!conn)
+    {
+        glb_router_disconnect (router, handle);
+        return;
+    }
+
+    GLB_MUTEX_LOCK (&glb_fds_lock);
+    conn->handle = *handle;
+    GLB_MUTEX_UNLOCK (&glb_fds_lock);
+}
+
+static void
+glb_atfork_prepare (void)
+{
+    int i;
+
+    GLB_MUTEX_LOCK (&glb_pending_lock);
+    GLB_MUTEX_LOCK (&glb_fds_lock);
+
+    for (i = 0; i < glb_services_num; i++)
+        glb_router_atfork_prepare (glb_services[i].router);
+}
+
+static void
+glb_atfork_parent (void)
+{
+    int i;
+
+    for (i = 0; i < glb_services_num; i++)
+        glb_router_atfork_parent (glb_services[i].router);
+
+    GLB_MUTEX_UNLOCK (&glb_fds_lock);
+    GLB_MUTEX_UNLOCK (&glb_pending_lock);
+}
+
+/* Connections inherited by child stay open and accounted in the parent,
+ * child just forgets them, router counts included. */
+static void
+glb_atfork_child (void)
+{
+    int i, j;
+
+    for (i = 0; i < glb_services_num; i++)
+        glb_router_atfork_child (glb_services[i].router);
+
+    for (i = 0; i < GLB_FDS_CHUNKS; i++)
+    {
+        if (!glb_fds[i]) continue;
+
+        for (j = 0; j < GLB_FDS_CHUNK; j++)
+        {
+            free (glb_fd_drop (&glb_fds[i][j]));
+        }
+    }
+
+    assert (0 == glb_conns_num);
+
+    glb_pending_num = 0;
+
+    GLB_MUTEX_UNLOCK (&glb_fds_lock);
+    GLB_MUTEX_UNLOCK (&glb_pending_lock);
+}
+
+/* Hashes address the way it is passed to connect() */
+static uint32_t
+glb_service_hash (const struct sockaddr* const addr, socklen_t const addrlen)
+{
+    if (AF_UNIX == addr->sa_family)
+    {
+        const struct sockaddr_un* addr_un = (const struct sockaddr_un*) addr;
+        size_t const path_off = offsetof(struct sockaddr_un, sun_path);
+
+        if (addrlen <= path_off) return 0;
+
+        /* FNV-1a over the path up to the terminating '\0' if any */
+        const char* ptr = addr_un->sun_path;
+        const char* const end = ptr + strnlen (ptr, addrlen - path_off);
+        uint32_t ret = 2166136261U;
+
+        while (ptr != end) ret = (ret ^ (uint8_t)*ptr++) * 16777619U;
+
+        return ret;
+    }
+
+    const struct sockaddr_in* addr_in = (const struct sockaddr_in*) addr;
+
+    return ((addr_in->sin_addr.s_addr ^ ((uint32_t)addr_in->sin_port << 16))
+            * 2654435761U);
+}
 
 static inline bool
-glb_match_address(const struct sockaddr* const addr, socklen_t const addrlen)
+glb_match_address(const glb_sockaddr_t* const inc,
+                  const struct sockaddr* const addr, socklen_t const addrlen)
 {
+    if (addr->sa_family != inc->sa.sa_family) return false;
+
+    if (AF_UNIX == addr->sa_family)
+    {
+        const struct sockaddr_un* addr_un = (const struct sockaddr_un*) addr;
+        size_t const path_off = offsetof(struct sockaddr_un, sun_path);
+        size_t const inc_len  = strlen (inc->un.sun_path);
+
+        // application may or may not count the terminating '\0'
+        return (addrlen >= path_off + inc_len &&
+                !memcmp (addr_un->sun_path, inc->un.sun_path, inc_len) &&
+                (addrlen == path_off + inc_len ||
+                 addr_un->sun_path[inc_len] == '\0'));
+    }
+
     const struct sockaddr_in* addr_in = (const struct sockaddr_in*) addr;
 
     return (
-        addr->sa_family   == AF_INET &&
-        addr_in->sin_port == glb_cnf->inc_addr.sin_port &&
-        !memcmp (&addr_in->sin_addr, &glb_cnf->inc_addr.sin_addr,
+        addr_in->sin_port == inc->in.sin_port &&
+        !memcmp (&addr_in->sin_addr, &inc->in.sin_addr,
                  sizeof(struct in_addr))
         );
 }
 
+/* @return service balancing addr or NULL */
+static inline glb_service_t*
+glb_service_find (const struct sockaddr* const addr, socklen_t const addrlen)
+{
+    if (!glb_services_map || !addr ||
+        (AF_INET != addr->sa_family && AF_UNIX != addr->sa_family))
+        return NULL;
+
+    uint32_t i = glb_service_hash (addr, addrlen) & glb_services_mask;
+
+    while (glb_services_map[i])
+    {
+        if (glb_match_address (&glb_services_map[i]->cnf->inc_addr,
+                               addr, addrlen))
+            return glb_services_map[i];
+
+        i = (i + 1) & glb_services_mask;
+    }
+
+    return NULL;
+}
+
+static void
+glb_service_add (const char* const name)
+{
+    glb_cnf_t* const cnf = glb_env_parse (name);
+    glb_router_t* router = NULL;
+
+    if (!cnf) goto failure;
+
+    if (cnf->verbose) glb_cnf_print(stdout, cnf);
+
+    glb_log_init (GLB_LOG_STDERR, cnf->verbose || glb_debug);
+
+    router = glb_router_create(cnf);
+
+    if (!router) goto failure;
+
+    if (glb_shm) glb_router_share (router, glb_shm);
+
+    void* const tmp = realloc (glb_services,
+                               (glb_services_num + 1) * sizeof(glb_service_t));
+    if (!tmp) goto failure;
+
+    glb_services = tmp;
+    glb_services[glb_services_num].cnf    = cnf;
+    glb_services[glb_services_num].router = router;
+    glb_services_num++;
+
+    return;
+
+failure:
+
+    if (router) glb_router_destroy (router);
+    if (cnf) free ((void*)cnf->watchdog);
+    free (cnf);
+
+    fprintf (stderr, LIBGLB_PREFIX "Failed to initialize%s%s.\n",
+             name ? " " : "", name ? name : "");
+    fflush (stderr);
+}
+
+/* builds glb_services_map, twice as large as the number of services */
+static void
+glb_services_index (void)
+{
+    uint32_t size = 2;
+
+    while (size < 2U * glb_services_num) size <<= 1;
+
+    glb_service_t** const map = calloc (size, sizeof(glb_service_t*));
+
+    if (!map)
+    {
+        fputs (LIBGLB_PREFIX "Failed to allocate services table.\n", stderr);
+        fflush (stderr);
+        return;
+    }
+
+    int i;
+    for (i = 0; i < glb_services_num; i++)
+    {
+        glb_service_t* const svc = &glb_services[i];
+        const glb_sockaddr_t* const inc = &svc->cnf->inc_addr;
+        uint32_t j = glb_service_hash (&inc->sa, glb_sockaddr_len (inc))
+            & (size - 1);
+
+        while (map[j])
+        {
+            if (glb_sockaddr_is_equal (&map[j]->cnf->inc_addr, inc))
+            {
+                glb_sockaddr_str_t a = glb_sockaddr_to_str (inc);
+                fprintf (stderr, LIBGLB_PREFIX "Address %s is balanced more "
+                         "than once, ignoring all but the first.\n", a.str);
+                break;
+            }
+
+            j = (j + 1) & (size - 1);
+        }
+
+        if (!map[j]) map[j] = svc;
+    }
+
+    glb_services_mask = size - 1;
+    glb_services_map  = map;
+}
+
+static void
+glb_service_start (glb_service_t* const svc)
+{
+    glb_cnf_t* const cnf = svc->cnf;
+    glb_wdog_t* wdog = NULL;
+
+    if (cnf->watchdog)
+    {
+        wdog = glb_wdog_create(cnf, svc->router, NULL);
+    }
+
+    if (cnf->ctrl_set)
+    {
+        uint16_t const default_port = glb_sockaddr_get_port(&cnf->inc_addr);
+
+        int const sock = glb_socket_create(&cnf->ctrl_addr, 0);
+
+        if (sock > 0)
+            glb_ctrl_create(cnf, svc->router, NULL, wdog,
+                            default_port, 0, sock);
+    }
+}
+
+static void glb_init() __attribute__((constructor));
+
+static void glb_init()
+{
+    /* watchdog threads may connect as soon as they are started */
+    glb_real_connect = dlsym(RTLD_NEXT, "__connect");
+
+    const char* const shared = getenv ("GLB_SHARED");
+
+    if (shared && strlen (shared))
+    {
+        glb_shm = glb_shm_attach (shared);
+
+        if (!glb_shm)
+        {
+            fprintf (stderr, LIBGLB_PREFIX "Failed to attach to shared "
+                     "memory '%s', routing state will not be shared.\n",
+                     shared);
+        }
+    }
+
+    char** const names = glb_env_names();
+
+    /* unnamed service is optional only if there are named ones */
+    if (!names || getenv ("GLB_BIND") || getenv ("GLB_OPTIONS"))
+    {
+        glb_service_add (NULL);
+    }
+
+    int i;
+    for (i = 0; names && names[i]; i++)
+    {
+        glb_service_add (names[i]);
+        free (names[i]);
+    }
+    free (names);
+
+    if (!glb_services_num) return;
+
+    pthread_atfork (glb_atfork_prepare, glb_atfork_parent, glb_atfork_child);
+
+    /* services must be found by connect() before watchdogs start */
+    glb_services_index();
+
+    if (!glb_services_map) return;
+
+    for (i = 0; i < glb_services_num; i++)
+    {
+        glb_service_start (&glb_services[i]);
+    }
+}
+
+static inline ino_t
+glb_pending_ino (int const fd)
+{
+    struct stat st;
+    return (fstat (fd, &st) ? 0 : st.st_ino);
+}
+
+/* must be called under glb_pending_lock */
+static inline void
+glb_pending_del (int const i)
+{
+    glb_pending_num--;
+    glb_pending[i] = glb_pending[glb_pending_num];
+}
+
+/* must be called under glb_pending_lock. Entries of closed sockets are
+ * dropped when their descriptor is found to be reused.
+ * @return index of the socket entry or -1 */
+static int
+glb_pending_find (int const fd)
+{
+    int i;
+
+    for (i = 0; i < glb_pending_num; i++) {
+        if (glb_pending[i].fd != fd) continue;
+
+        if (glb_pending[i].ino == glb_pending_ino (fd)) return i;
+
+        glb_pending_del (i);
+        break;
+    }
+
+    return -1;
+}
+
+/* reg is epoll registration of fd made before connect() or NULL */
+static void
+glb_pending_add (int const fd, glb_router_t* const router,
+                 glb_conn_t* const conn, const glb_sockaddr_t* const dst,
+                 const glb_epoll_reg_t* const reg)
+{
+    GLB_MUTEX_LOCK (&glb_pending_lock);
+
+    int i = glb_pending_find (fd);
+
+    if (i < 0) {
+        if (glb_pending_num == glb_pending_size) {
+            int const size = glb_pending_size ? glb_pending_size * 2 : 16;
+            void* const tmp = realloc (glb_pending, size * sizeof(*glb_pending));
+
+            /* without entry connect just won't fail over */
+            if (!tmp) goto out;
+
+            glb_pending      = tmp;
+            glb_pending_size = size;
+        }
+
+        i = glb_pending_num++;
+    }
+
+    glb_pending[i].fd    = fd;
+    glb_pending[i].router = router;
+    glb_pending[i].conn  = conn;
+    glb_pending[i].ino   = glb_pending_ino (fd);
+    glb_pending[i].error = 0;
+    glb_pending[i].refused = 0;
+    glb_pending[i].epfd  = -1;
+    glb_pending[i].events = 0;
+    glb_pending[i].data  = 0;
+    glb_pending[i].dst   = *dst;
+
+    if (reg)
+    {
+        glb_pending[i].epfd   = reg->epfd;
+        glb_pending[i].events = reg->events;
+        glb_pending[i].data   = reg->data;
+    }
+
+out:
+    GLB_MUTEX_UNLOCK (&glb_pending_lock);
+}
+
+/* Socket of entry i was reported ready: if connection was refused, fail
+ * over to the next destination. Must be called under glb_pending_lock.
+ * @return true if the event must be hidden from the application */
+static bool
+glb_pending_ready (int const i)
+{
+    glb_pending_t* const p = &glb_pending[i];
+    int       error = 0;
+    socklen_t len   = sizeof(error);
+
+    if (p->error) return false; // failed for good, application is to see it
+
+    if (GLB_REAL(getsockopt) (p->fd, SOL_SOCKET, SO_ERROR, &error, &len)) {
+        return false;
+    }
+
+    if (0 == error) {
+        glb_sockaddr_t peer;
+        socklen_t      peer_len = sizeof(peer);
+
+        /* no error while still connecting too (getsockopt() may come
+         * before any event) */
+        int const err = errno;
+        bool const connecting = getpeername (p->fd, &peer.sa, &peer_len) &&
+            ENOTCONN == errno;
+
+        errno = err;
+
+        if (connecting) return true;
+
+        glb_pending_del (i); // connected
+        return false;
+    }
+
+    if (!p->refused) p->refused = error;
+
+    glb_router_handle_t handle = glb_conn_handle (p->conn);
+
+    glb_in_router = true;
+    int const ret = glb_router_reconnect (p->router, p->fd, error, &p->dst,
+                                          &handle);
+    int const err = errno;
+    glb_in_router = false;
+
+    glb_conn_rehandle (p->conn, p->router, &handle);
+
+    /* socket could be replaced with a new one under the same descriptor
+     * (e.g. of another family): remember it and put it back into epoll,
+     * the old one left it on close */
+    ino_t const ino = glb_pending_ino (p->fd);
+
+    if (ino != p->ino)
+    {
+        p->ino = ino;
+
+        if (p->epfd >= 0)
+        {
+            struct epoll_event ev;
+
+            ev.events   = p->events;
+            ev.data.u64 = p->data;
+
+            if (GLB_REAL(epoll_ctl) (p->epfd, EPOLL_CTL_ADD, p->fd, &ev))
+                p->epfd = -1;
+        }
+    }
+
+    if (ret) {
+        if (EINPROGRESS == err) return true; // wait for the next one
+
+        p->error = err; // reported by getsockopt(SO_ERROR)
+        return false;
+    }
+
+    glb_pending_del (i); // connected at once
+    return false;
+}
+
+/* descriptor is closed, connect on it is of no interest any more */
+static void
+glb_pending_forget (int const fd)
+{
+    int i;
+
+    GLB_MUTEX_LOCK (&glb_pending_lock);
+
+    for (i = 0; i < glb_pending_num; i++) {
+        if (glb_pending[i].fd == fd) {
+            glb_pending_del (i);
+            break;
+        }
+    }
+
+    for (i = 0; i < glb_epoll_regs_num; i++) {
+        if (glb_epoll_regs[i].fd == fd) {
+            glb_epoll_regs[i] = glb_epoll_regs[--glb_epoll_regs_num];
+            break;
+        }
+    }
+
+    GLB_MUTEX_UNLOCK (&glb_pending_lock);
+}
+
+/* @return true if fd is a socket that is not connected (nor connecting) */
+static bool
+glb_socket_unconnected (int const fd)
+{
+    glb_sockaddr_t peer;
+    socklen_t      peer_len = sizeof(peer);
+    int const      err = errno;
+
+    bool const ret = getpeername (fd, &peer.sa, &peer_len) &&
+        ENOTCONN == errno;
+
+    errno = err;
+    return ret;
+}
+
+/* records epoll registration of fd: for pending connect or, if fd is added
+ * unconnected and waiting for EPOLLOUT, for connect() to come. Sockets are
+ * not checked on modification, which servers do to every connection. */
+static void
+glb_epoll_reg (int const epfd, int const fd, const struct epoll_event* ev,
+               bool const add)
+{
+    bool const maybe = add && (ev->events & EPOLLOUT) &&
+        glb_socket_unconnected (fd);
+
+    if (!maybe && !glb_pending_num && !glb_epoll_regs_num) return;
+
+    GLB_MUTEX_LOCK (&glb_pending_lock);
+
+    int i = glb_pending_find (fd);
+
+    if (i >= 0)
+    {
+        glb_pending[i].epfd   = epfd;
+        glb_pending[i].events = ev->events;
+        glb_pending[i].data   = ev->data.u64;
+        goto out;
+    }
+
+    for (i = 0; i < glb_epoll_regs_num; i++) {
+        if (glb_epoll_regs[i].fd == fd) break;
+    }
+
+    if (i == glb_epoll_regs_num)
+    {
+        if (!maybe) goto out;
+
+        if (glb_epoll_regs_num == glb_epoll_regs_size)
+        {
+            int const size = glb_epoll_regs_size ? glb_epoll_regs_size * 2 : 16;
+            void* const tmp = realloc (glb_epoll_regs,
+                                       size * sizeof(*glb_epoll_regs));
+
+            /* without registration connect just won't fail over */
+            if (!tmp) goto out;
+
+            glb_epoll_regs      = tmp;
+            glb_epoll_regs_size = size;
+        }
+
+        glb_epoll_regs_num++;
+    }
+
+    glb_epoll_regs[i].fd     = fd;
+    glb_epoll_regs[i].ino    = glb_pending_ino (fd);
+    glb_epoll_regs[i].epfd   = epfd;
+    glb_epoll_regs[i].events = ev->events;
+    glb_epoll_regs[i].data   = ev->data.u64;
+
+out:
+    GLB_MUTEX_UNLOCK (&glb_pending_lock);
+}
+
+/* removes epoll registration of fd and copies it to reg
+ * @return true if fd had one and it belongs to the socket fd refers to now */
+static bool
+glb_epoll_take (int const fd, glb_epoll_reg_t* const reg)
+{
+    bool ret = false;
+    int  i;
+
+    GLB_MUTEX_LOCK (&glb_pending_lock);
+
+    for (i = 0; i < glb_epoll_regs_num; i++) {
+        if (glb_epoll_regs[i].fd == fd) {
+            *reg = glb_epoll_regs[i];
+            ret  = (reg->ino == glb_pending_ino (fd));
+            glb_epoll_regs[i] = glb_epoll_regs[--glb_epoll_regs_num];
+            break;
+        }
+    }
+
+    GLB_MUTEX_UNLOCK (&glb_pending_lock);
+
+    return ret;
+}
+
+/* router may have replaced the socket registered in epoll with a new one
+ * under the same descriptor, the old one left epoll on close */
+static void
+glb_epoll_restore (int const fd, const glb_epoll_reg_t* const reg)
+{
+    if (glb_pending_ino (fd) == reg->ino) return;
+
+    struct epoll_event ev;
+
+    ev.events   = reg->events;
+    ev.data.u64 = reg->data;
+
+    GLB_REAL(epoll_ctl) (reg->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* fd was removed from epfd */
+static void
+glb_epoll_unreg (int const epfd, int const fd)
+{
+    int i;
+
+    GLB_MUTEX_LOCK (&glb_pending_lock);
+
+    for (i = 0; i < glb_pending_num; i++) {
+        if (glb_pending[i].fd == fd && glb_pending[i].epfd == epfd) {
+            glb_pending[i].epfd = -1;
+            break;
+        }
+    }
+
+    for (i = 0; i < glb_epoll_regs_num; i++) {
+        if (glb_epoll_regs[i].fd == fd && glb_epoll_regs[i].epfd == epfd) {
+            glb_epoll_regs[i] = glb_epoll_regs[--glb_epoll_regs_num];
+            break;
+        }
+    }
+
+    GLB_MUTEX_UNLOCK (&glb_pending_lock);
+}
+
+/* @return true if poll event on fd must be hidden from the application */
+static bool
+glb_pending_fd_ready (int const fd)
+{
+    GLB_MUTEX_LOCK (&glb_pending_lock);
+
+    int const i = glb_pending_find (fd);
+    bool const ret = (i >= 0 && glb_pending_ready (i));
+
+    GLB_MUTEX_UNLOCK (&glb_pending_lock);
+
+    return ret;
+}
+
+/* @return true if epoll event with data must be hidden from the
+ *         application */
+static bool
+glb_pending_epoll_ready (int const epfd, uint64_t const data)
+{
+    bool ret = false;
+    int  i;
+
+    GLB_MUTEX_LOCK (&glb_pending_lock);
+
+    /* only registrations seen by epoll_ctl(), data is opaque */
+    for (i = 0; i < glb_pending_num; i++) {
+        if (glb_pending[i].epfd == epfd && glb_pending[i].data == data) break;
+    }
+
+    if (i < glb_pending_num) ret = glb_pending_ready (i);
+
+    GLB_MUTEX_UNLOCK (&glb_pending_lock);
+
+    return ret;
+}
+
+/* @return remaining timeout in milliseconds */
+static inline int
+glb_timeout_left (glb_time_t const deadline)
+{
+    glb_time_t const left = deadline - glb_time_mono();
+    return (left > 0 ? (left + 999999) / 1000000 : 0);
+}
 
 int connect(int const              sockfd,
             const struct sockaddr* addr,
             socklen_t const        addrlen)
 {
-    if (glb_router)
+    glb_service_t* const svc = glb_service_find (addr, addrlen);
+
+    if (svc)
     {
-        if (glb_match_address (addr, addrlen))
+        glb_sockaddr_t      dst;
+        glb_router_handle_t handle;
+        glb_epoll_reg_t     reg;
+        bool const          has_reg = glb_epoll_regs_num > 0 &&
+            glb_epoll_take (sockfd, &reg);
+
+        glb_in_router = true;
+        int ret = glb_router_connect(svc->router, sockfd, addr->sa_family,
+                                     &dst, &handle);
+        glb_in_router = false;
+        assert (ret == 0 || ret == -1);
+
+        int const err = errno;
+
+        if (has_reg) glb_epoll_restore (sockfd, &reg);
+
+        if (0 == ret || EINPROGRESS == err)
         {
-            int ret = glb_router_connect(glb_router, sockfd);
-            assert (ret == 0 || ret == -1);
-            return ret;
+            glb_conn_t* const conn = glb_fd_track (sockfd, svc->router,
+                                                   &handle);
+
+            if (ret) glb_pending_add (sockfd, svc->router, conn, &dst,
+                                      has_reg ? &reg : NULL);
         }
+
+        errno = err;
+
+        return ret;
     }
 
+    /* socket is connected elsewhere, registration is of no use */
+    if (glb_epoll_regs_num > 0) glb_pending_forget (sockfd);
+
     return glb_real_connect(sockfd, addr, addrlen);
 }
+
+int getsockopt(int const       sockfd,
+               int const       level,
+               int const       optname,
+               void*           optval,
+               socklen_t*      optlen)
+{
+    if (glb_pending_num > 0 && SOL_SOCKET == level && SO_ERROR == optname &&
+        optval && optlen && *optlen >= sizeof(int))
+    {
+        GLB_MUTEX_LOCK (&glb_pending_lock);
+
+        int const i = glb_pending_find (sockfd);
+
+        if (i >= 0)
+        {
+            glb_pending_ready (i);
+
+            /* entry is gone if connection is established */
+            int const j = (i < glb_pending_num && glb_pending[i].fd == sockfd)
+                ? i : -1;
+            int error = 0;
+
+            if (j >= 0)
+            {
+                /* select() is not overloaded and its caller may have seen
+                 * the refusal already, so it is reported while replacement
+                 * is in progress. Still connecting to the first one is 0. */
+                error = glb_pending[j].error ? glb_pending[j].error :
+                    glb_pending[j].refused;
+
+                if (error) glb_pending_del (j);
+            }
+
+            GLB_MUTEX_UNLOCK (&glb_pending_lock);
+
+            *(int*)optval = error;
+            *optlen       = sizeof(int);
+            return 0;
+        }
+
+        GLB_MUTEX_UNLOCK (&glb_pending_lock);
+    }
+
+    return GLB_REAL(getsockopt) (sockfd, level, optname, optval, optlen);
+}
+
+int poll(struct pollfd* const fds, nfds_t const nfds, int const timeout)
+{
+    if (!glb_pending_num) return GLB_REAL(poll) (fds, nfds, timeout);
+
+    glb_time_t const deadline = glb_time_mono() + timeout * 1000000LL;
+    int              tout     = timeout;
+
+    for (;;)
+    {
+        int ret = GLB_REAL(poll) (fds, nfds, tout);
+
+        if (ret <= 0 || !glb_pending_num) return ret;
+
+        nfds_t i;
+        for (i = 0; i < nfds; i++)
+        {
+            if ((fds[i].revents & (POLLOUT | POLLERR | POLLHUP)) &&
+                glb_pending_fd_ready (fds[i].fd))
+            {
+                fds[i].revents = 0;
+                ret--;
+            }
+        }
+
+        if (ret > 0 || 0 == timeout) return ret;
+
+        if (timeout > 0 && (tout = glb_timeout_left (deadline)) == 0)
+            return 0;
+    }
+}
+
+int epoll_ctl(int const epfd, int const op, int const fd,
+              struct epoll_event* const event)
+{
+    int const ret = GLB_REAL(epoll_ctl) (epfd, op, fd, event);
+
+    if (ret || !glb_services_num) return ret;
+
+    if (EPOLL_CTL_DEL == op)
+    {
+        if (glb_pending_num > 0 || glb_epoll_regs_num > 0)
+            glb_epoll_unreg (epfd, fd);
+    }
+    else if (event)
+    {
+        glb_epoll_reg (epfd, fd, event, EPOLL_CTL_ADD == op);
+    }
+
+    return ret;
+}
+
+int epoll_pwait(int const epfd, struct epoll_event* const events,
+                int const maxevents, int const timeout,
+                const sigset_t* const sigmask)
+{
+    if (!glb_pending_num)
+        return GLB_REAL(epoll_pwait) (epfd, events, maxevents, timeout,
+                                      sigmask);
+
+    glb_time_t const deadline = glb_time_mono() + timeout * 1000000LL;
+    int              tout     = timeout;
+
+    for (;;)
+    {
+        int ret = GLB_REAL(epoll_pwait) (epfd, events, maxevents, tout,
+                                         sigmask);
+
+        if (ret <= 0 || !glb_pending_num) return ret;
+
+        int i, n = 0;
+        for (i = 0; i < ret; i++)
+        {
+            if (!(events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) ||
+                !glb_pending_epoll_ready (epfd, events[i].data.u64))
+            {
+                events[n++] = events[i];
+            }
+        }
+
+        if (n > 0 || 0 == timeout) return n;
+
+        if (timeout > 0 && (tout = glb_timeout_left (deadline)) == 0)
+            return 0;
+    }
+}
+
+int epoll_wait(int const epfd, struct epoll_event* const events,
+               int const maxevents, int const timeout)
+{
+    return epoll_pwait (epfd, events, maxevents, timeout, NULL);
+}
+
+int close(int const fd)
+{
+    /* router closes only its own temporary sockets, and may do it while
+     * pending connect lock is held */
+    if (!glb_in_router)
+    {
+        if (glb_pending_num > 0 || glb_epoll_regs_num > 0)
+            glb_pending_forget (fd);
+
+        /* after close() descriptor could be reused by another thread */
+        if (glb_conns_num > 0) glb_fd_untrack (fd);
+    }
+
+    return GLB_REAL(close) (fd);
+}
+
+int shutdown(int const fd, int const how)
+{
+    int const ret = GLB_REAL(shutdown) (fd, how);
+
+    if (0 == ret && SHUT_RDWR == how && glb_conns_num > 0) glb_fd_shutdown (fd);
+
+    return ret;
+}
+
+int dup(int const oldfd)
+{
+    int const ret = GLB_REAL(dup) (oldfd);
+
+    if (ret >= 0 && glb_conns_num > 0) glb_fd_dup (oldfd, ret);
+
+    return ret;
+}
+
+static inline void
+glb_dup_to (int const oldfd, int const newfd)
+{
+    if (oldfd != newfd && !glb_in_router)
+    {
+        if (glb_pending_num > 0 || glb_epoll_regs_num > 0)
+            glb_pending_forget (newfd);
+
+        if (glb_conns_num > 0) glb_fd_dup (oldfd, newfd);
+    }
+}
+
+int dup2(int const oldfd, int const newfd)
+{
+    int const ret = GLB_REAL(dup2) (oldfd, newfd);
+
+    if (ret >= 0) glb_dup_to (oldfd, newfd);
+
+    return ret;
+}
+
+int dup3(int const oldfd, int const newfd, int const flags)
+{
+    int const ret = GLB_REAL(dup3) (oldfd, newfd, flags);
+
+    if (ret >= 0) glb_dup_to (oldfd, newfd);
+
+    return ret;
+}
+
+/* all fcntl() arguments are either int or pointer, so it is safe to pass
+ * them on as a pointer */
+static inline int
+glb_fcntl (int (*real) (int, int, ...), int const fd, int const cmd,
+           void* const arg)
+{
+    int const ret = real (fd, cmd, arg);
+
+    if (ret >= 0 && (F_DUPFD == cmd || F_DUPFD_CLOEXEC == cmd) &&
+        glb_conns_num > 0)
+        glb_fd_dup (fd, ret);
+
+    return ret;
+}
+
+int fcntl(int const fd, int const cmd, ...)
+{
+    va_list ap;
+
+    va_start (ap, cmd);
+    void* const arg = va_arg (ap, void*);
+    va_end (ap);
+
+    return glb_fcntl (GLB_REAL(fcntl), fd, cmd, arg);
+}
+
+int fcntl64(int const fd, int const cmd, ...)
+{
+    va_list ap;
+
+    va_start (ap, cmd);
+    void* const arg = va_arg (ap, void*);
+    va_end (ap);
+
+    return glb_fcntl (GLB_REAL(fcntl64), fd, cmd, arg);
+}
@@ -45,6 +45,7 @@ listener_thread (void* arg)
         socklen_t      client_size = sizeof(client);
         int            server_sock;
         glb_sockaddr_t server;
+        glb_router_handle_t server_handle;
 
 #if defined(_GNU_SOURCE) && defined(SOCK_CLOEXEC)
         client_sock = accept4(listener->sock,
@@ -55,6 +56,8 @@ listener_thread (void* arg)
                               (struct sockaddr*) &client, &client_size);
 #endif /* _GNU_SOURCE && SOCK_CLOEXEC*/
 
+        glb_time_t const accepted = glb_time_mono();
+
         if (client_sock < 0 || glb_terminate) {
             if (client_sock < 0) {
                 glb_log_error ("Failed to accept connection: %d (%s)",
@@ -67,12 +70,15 @@ listener_thread (void* arg)
             goto err;
         }
 
+        if (client_size <= offsetof(struct sockaddr_un, sun_path))
+            client.un.sun_path[0] = '\0'; // unnamed UNIX socket peer
+
 #if !defined(_GNU_SOURCE) || !defined(SOCK_CLOEXEC)
 	(void) glb_fd_setfd (client_sock, FD_CLOEXEC, true);
 #endif /* !_GNU_SOURCE || !SOCK_CLOEXEC */
 
         ret = glb_router_connect(listener->router, &client ,&server,
-                                 &server_sock);
+                                 &server_handle, &server_sock);
         if (server_sock < 0 && ret != -EINPROGRESS) {
             if (server_sock != -EMFILE)
                 glb_log_error("Failed to connect to destination: %d (%s)",
@@ -82,12 +88,13 @@ listener_thread (void* arg)
 
         assert (0 == ret || -EINPROGRESS == ret);
 
-        glb_socket_setopt(client_sock, GLB_SOCK_NODELAY); // ignore error here
+        if (!glb_sockaddr_is_unix (&listener->cnf->inc_addr))
+            glb_socket_setopt(client_sock, GLB_SOCK_NODELAY); // ignore error
 
         ret = glb_pool_add_conn (listener->pool,
                                  client_sock, &client,
-                                 server_sock, &server,
-                                 0 == ret);
+                                 server_sock, &server, server_handle,
+                                 0 == ret, accepted);
         if (ret < 0) {
             glb_log_error ("Failed to add connection to pool: "
                            "%d (%s)", -ret, strerror (-ret));
@@ -104,7 +111,7 @@ listener_thread (void* arg)
     err2:
         assert (server_sock > 0);
         close  (server_sock);
-        glb_router_disconnect (listener->router, &server, false);
+        glb_router_disconnect (listener->router, &server_handle, false);
 
     err1:
         assert (client_sock > 0);
@@ -161,11 +168,11 @@ glb_listener_destroy (glb_listener_t* listener)
     /* need to connect to own socket to break the accept() call */
     glb_sockaddr_t sockaddr;
     glb_sockaddr_init (&sockaddr, "0.0.0.0", 0);
-    int socket = glb_socket_create (&sockaddr, 0);
+    int socket = glb_socket_create_to (&listener->cnf->inc_addr, &sockaddr, 0);
     if (socket >= 0)
     {
-        int err = connect (socket, (struct sockaddr*)&listener->cnf->inc_addr,
-                           sizeof (listener->cnf->inc_addr));
+        int err = connect (socket, &listener->cnf->inc_addr.sa,
+                           glb_sockaddr_len (&listener->cnf->inc_addr));
         close (socket);
         if (err) {
             glb_log_error ("Failed to connect to listener socket: %d (%s)",
@@ -15,5 +15,12 @@
 #  define GLB_UNLIKELY(x) (x)
 #endif
 
+#define GLB_CACHE_LINE 64 // should be good enough for most platforms
+
+#if __GNUC__ >= 3
+#  define GLB_CACHE_ALIGNED __attribute__((aligned(GLB_CACHE_LINE)))
+#else
+#  define GLB_CACHE_ALIGNED
+#endif
 
 #endif // _glb_macros_h_
@@ -96,16 +96,24 @@ cleanup1:
 }
 
 static void
-free_resources (const char* const fifo_name,
+free_resources (const glb_cnf_t* const cnf,
                 int const ctrl_fifo,
                 int const ctrl_sock,
                 int const lsock)
 {
-    if (lsock) close (lsock);
-    if (ctrl_sock) close (ctrl_sock);
+    if (lsock) {
+        close (lsock);
+        if (glb_sockaddr_is_unix (&cnf->inc_addr))
+            unlink (cnf->inc_addr.un.sun_path);
+    }
+    if (ctrl_sock) {
+        close (ctrl_sock);
+        if (glb_sockaddr_is_unix (&cnf->ctrl_addr))
+            unlink (cnf->ctrl_addr.un.sun_path);
+    }
     if (ctrl_fifo) {
         close (ctrl_fifo);
-        remove (fifo_name);
+        remove (cnf->fifo_name);
     }
 }
 
@@ -214,7 +222,16 @@ int main (int argc, char* argv[])
             puts (stats);
         }
 
-        sleep (5);
+        int i;
+        for (i = 0; i < 5 && !glb_terminate && !glb_reload; i++) sleep (1);
+
+        if (glb_reload) {
+            glb_reload = 0;
+            glb_log_info ("Received SIGHUP. Reloading configuration.");
+            glb_ctrl_reload (ctrl);
+        }
+
+        glb_pool_reap (pool);
     }
 
 cleanup:
@@ -231,7 +248,7 @@ cleanup:
         glb_log_info ("Exit.");
     }
 
-    free_resources (cnf->fifo_name, ctrl_fifo, ctrl_sock, listen_sock);
+    free_resources (cnf, ctrl_fifo, ctrl_sock, listen_sock);
     free (cnf);
 
     if (success)
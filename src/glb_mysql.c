@@ -0,0 +1,728 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * $Id$
+ */
+
+#include "glb_mysql.h"
+
+#include <errno.h>
+#include <string.h>
+#include <strings.h> // strncasecmp()
+#include <ctype.h>
+
+size_t
+glb_mysql_lenenc (const uint8_t* const p, size_t const len, uint64_t* value)
+{
+    size_t n;
+
+    if (len < 1) return 0;
+
+    switch (p[0]) {
+    case 0xfc: n = 3; break;
+    case 0xfd: n = 4; break;
+    case 0xfe: n = 9; break;
+    case 0xfb: /* NULL */
+    case 0xff: return 0;
+    default:
+        *value = p[0];
+        return 1;
+    }
+
+    if (len < n) return 0;
+
+    *value = 0;
+
+    size_t i;
+    for (i = n - 1; i > 0; i--) *value = (*value << 8) | p[i];
+
+    return n;
+}
+
+int
+glb_mysql_ok_status (const uint8_t* const payload, size_t const len)
+{
+    size_t off;
+
+    if (glb_mysql_is_eof (payload, len)) {
+        off = 3; // header + warnings
+    }
+    else if (len >= 7 && GLB_MYSQL_OK == payload[0]) {
+        uint64_t tmp;
+        size_t   n;
+
+        off = 1;
+        if (!(n = glb_mysql_lenenc (payload + off, len - off, &tmp))) return -1;
+        off += n; // affected rows
+        if (!(n = glb_mysql_lenenc (payload + off, len - off, &tmp))) return -1;
+        off += n; // last insert id
+    }
+    else {
+        return -1;
+    }
+
+    if (off + 2 > len) return -1;
+
+    return (payload[off] | (payload[off + 1] << 8));
+}
+
+/* finds offsets of capability flags in greeting, returns false if none */
+static bool
+mysql_greeting_caps (const uint8_t* const p, size_t const len,
+                     size_t* const lower, size_t* const upper)
+{
+    if (len < 1 || 10 != p[0]) return false;
+
+    const uint8_t* const ver_end = memchr (p + 1, '\0', len - 1);
+    if (!ver_end) return false;
+
+    *lower = (ver_end - p) + 1 + 4 + 8 + 1; // conn id, scramble 1, filler
+    if (*lower + 2 > len) return false;
+
+    *upper = *lower + 2 + 1 + 2; // charset, status
+    if (*upper + 2 > len) *upper = 0;
+
+    return true;
+}
+
+int
+glb_mysql_greeting_parse (glb_mysql_greeting_t* const g,
+                          const uint8_t*        const p,
+                          size_t                const len)
+{
+    size_t lower, upper;
+
+    if (!mysql_greeting_caps (p, len, &lower, &upper) || !upper)
+        return -EPROTO;
+
+    memset (g, 0, sizeof(*g));
+
+    g->caps = p[lower] | (p[lower + 1] << 8);
+    if (upper) g->caps |= (p[upper] << 16) | ((uint32_t)p[upper + 1] << 24);
+
+    if (!(g->caps & GLB_MYSQL_CLIENT_PROTOCOL_41) ||
+        !(g->caps & GLB_MYSQL_CLIENT_SECURE_CONNECTION) ||
+        !(g->caps & GLB_MYSQL_CLIENT_PLUGIN_AUTH)) return -EPROTO;
+
+    size_t const auth_len = p[upper + 2];
+    size_t       part2    = auth_len > 21 ? auth_len - 8 : 13;
+    size_t       off      = upper + 2 + 1 + 10; // auth len, reserved
+
+    if (off + part2 > len || 8 + part2 > sizeof(g->scramble)) return -EPROTO;
+
+    memcpy (g->scramble, p + lower - 1 - 8, 8);
+    memcpy (g->scramble + 8, p + off, part2);
+    g->scramble_len = 8 + part2;
+    off += part2;
+
+    size_t const plugin_len = strnlen ((const char*)p + off, len - off);
+    if (0 == plugin_len || plugin_len >= sizeof(g->plugin)) return -EPROTO;
+
+    memcpy (g->plugin, p + off, plugin_len);
+
+    return 0;
+}
+
+void
+glb_mysql_greeting_mask (uint8_t* const p, size_t const len)
+{
+    size_t lower, upper;
+
+    if (!mysql_greeting_caps (p, len, &lower, &upper)) return;
+
+    p[lower] &= ~(GLB_MYSQL_CLIENT_UNSUPPORTED & 0xff);
+    p[lower + 1] &= ~((GLB_MYSQL_CLIENT_UNSUPPORTED >> 8) & 0xff);
+
+    if (upper) {
+        p[upper] &= ~((GLB_MYSQL_CLIENT_UNSUPPORTED >> 16) & 0xff);
+        p[upper + 1] &= ~((GLB_MYSQL_CLIENT_UNSUPPORTED >> 24) & 0xff);
+    }
+}
+
+/* copies nul-terminated string, returns offset past it or 0 on failure */
+static size_t
+mysql_copy_str (char* const dst, size_t const dst_len,
+                const uint8_t* const p, size_t const off, size_t const len)
+{
+    if (off >= len) return 0;
+
+    size_t const n = strnlen ((const char*)p + off, len - off);
+    if (off + n >= len || n >= dst_len) return 0;
+
+    memcpy (dst, p + off, n);
+    dst[n] = '\0';
+
+    return off + n + 1;
+}
+
+int
+glb_mysql_login_parse (glb_mysql_login_t* const l,
+                       uint8_t*           const p,
+                       size_t             const len)
+{
+    if (len < sizeof(l->head)) return -EPROTO;
+
+    memset (l, 0, sizeof(*l));
+
+    l->caps = glb_mysql_uint4 (p);
+
+    if (!(l->caps & GLB_MYSQL_CLIENT_PROTOCOL_41) ||
+        (l->caps & GLB_MYSQL_CLIENT_SSL)) return -EPROTO;
+
+    l->caps &= ~GLB_MYSQL_CLIENT_UNSUPPORTED;
+    p[0] = l->caps; p[1] = l->caps >> 8; p[2] = l->caps >> 16;
+    p[3] = l->caps >> 24;
+
+    memcpy (l->head, p, sizeof(l->head));
+
+    size_t off = mysql_copy_str (l->user, sizeof(l->user), p,
+                                 sizeof(l->head), len);
+    if (!off) return -EPROTO;
+
+    uint64_t auth_len;
+
+    if (l->caps & GLB_MYSQL_CLIENT_PLUGIN_AUTH_LENENC) {
+        size_t const n = glb_mysql_lenenc (p + off, len - off, &auth_len);
+        if (!n) return -EPROTO;
+        off += n;
+    }
+    else if (l->caps & GLB_MYSQL_CLIENT_SECURE_CONNECTION) {
+        if (off >= len) return -EPROTO;
+        auth_len = p[off];
+        off += 1;
+    }
+    else {
+        return -EPROTO; // pre-4.1 authentication
+    }
+
+    off += auth_len;
+    if (off > len) return -EPROTO;
+
+    if ((l->caps & GLB_MYSQL_CLIENT_CONNECT_WITH_DB) && off < len) {
+        if (!mysql_copy_str (l->db, sizeof(l->db), p, off, len))
+            return -EPROTO;
+    }
+
+    return 0;
+}
+
+long
+glb_mysql_login_write (const glb_mysql_login_t* const l,
+                       const char*              const plugin,
+                       const uint8_t*           const auth,
+                       size_t                   const auth_len,
+                       uint8_t                  const seq,
+                       uint8_t*                 const buf,
+                       size_t                   const buf_len)
+{
+    size_t const user_len   = strlen (l->user) + 1;
+    size_t const db_len     = (l->caps & GLB_MYSQL_CLIENT_CONNECT_WITH_DB) ?
+                              strlen (l->db) + 1 : 0;
+    size_t const plugin_len = strlen (plugin) + 1;
+    size_t const len = sizeof(l->head) + user_len + 1 + auth_len + db_len +
+                       plugin_len;
+
+    if (auth_len > 250 || GLB_MYSQL_HDR_LEN + len > buf_len) return -ENOBUFS;
+
+    uint32_t const caps = (l->caps & ~GLB_MYSQL_CLIENT_CONNECT_ATTRS) |
+                          GLB_MYSQL_CLIENT_PLUGIN_AUTH;
+    uint8_t* p = buf;
+
+    glb_mysql_pkt_hdr (p, len, seq);  p += GLB_MYSQL_HDR_LEN;
+    memcpy (p, l->head, sizeof(l->head));
+    p[0] = caps; p[1] = caps >> 8; p[2] = caps >> 16; p[3] = caps >> 24;
+    p += sizeof(l->head);
+    memcpy (p, l->user, user_len);    p += user_len;
+    *p = auth_len;                    p += 1; // same in lenenc and 1-byte
+    memcpy (p, auth, auth_len);       p += auth_len;
+    memcpy (p, l->db, db_len);        p += db_len;
+    memcpy (p, plugin, plugin_len);   p += plugin_len;
+
+    return (p - buf);
+}
+
+long
+glb_mysql_auth_switch_write (const glb_mysql_greeting_t* const g,
+                             uint8_t                     const seq,
+                             uint8_t*                    const buf,
+                             size_t                      const buf_len)
+{
+    size_t const plugin_len = strlen (g->plugin) + 1;
+    size_t const len        = 1 + plugin_len + g->scramble_len;
+
+    if (GLB_MYSQL_HDR_LEN + len > buf_len) return -ENOBUFS;
+
+    uint8_t* p = buf;
+
+    glb_mysql_pkt_hdr (p, len, seq);              p += GLB_MYSQL_HDR_LEN;
+    *p = GLB_MYSQL_EOF;                           p += 1;
+    memcpy (p, g->plugin, plugin_len);            p += plugin_len;
+    memcpy (p, g->scramble, g->scramble_len);     p += g->scramble_len;
+
+    return (p - buf);
+}
+
+void
+glb_mysql_resp_start (glb_mysql_resp_t* const r, uint8_t const cmd)
+{
+    r->cmd = cmd;
+
+    switch (cmd) {
+    case GLB_MYSQL_COM_QUIT:
+    case GLB_MYSQL_COM_STMT_SEND_LONG_DATA:
+    case GLB_MYSQL_COM_STMT_CLOSE:
+        r->state = GLB_MYSQL_RESP_DONE;
+        break;
+    case GLB_MYSQL_COM_INIT_DB:
+    case GLB_MYSQL_COM_QUERY:
+    case GLB_MYSQL_COM_PING:
+    case GLB_MYSQL_COM_STMT_PREPARE:
+    case GLB_MYSQL_COM_STMT_EXECUTE:
+    case GLB_MYSQL_COM_STMT_RESET:
+    case GLB_MYSQL_COM_SET_OPTION:
+    case GLB_MYSQL_COM_RESET_CONNECTION:
+        r->state = GLB_MYSQL_RESP_FIRST;
+        break;
+    case GLB_MYSQL_COM_FIELD_LIST:
+    case GLB_MYSQL_COM_STMT_FETCH:
+        r->state = GLB_MYSQL_RESP_ROWS;
+        break;
+    case GLB_MYSQL_COM_STATISTICS:
+        r->state = GLB_MYSQL_RESP_SKIP;
+        r->count = 1;
+        break;
+    default:
+        r->state = GLB_MYSQL_RESP_UNKNOWN;
+    }
+}
+
+/* OK or EOF that may be followed by more results */
+static inline void
+mysql_resp_end (glb_mysql_resp_t* const r, const uint8_t* const payload,
+                size_t const len)
+{
+    int const status = glb_mysql_ok_status (payload, len);
+
+    if (status >= 0) r->status = status;
+
+    r->state = (status >= 0 && (status & GLB_MYSQL_STATUS_MORE_RESULTS)) ?
+        GLB_MYSQL_RESP_FIRST : GLB_MYSQL_RESP_DONE;
+}
+
+void
+glb_mysql_resp_packet (glb_mysql_resp_t* const r,
+                       const uint8_t*    const payload,
+                       size_t            const len)
+{
+    size_t const n = len < GLB_MYSQL_PEEK ? len : GLB_MYSQL_PEEK;
+    uint8_t const h = n ? payload[0] : 0;
+
+    switch (r->state) {
+    case GLB_MYSQL_RESP_FIRST:
+        if (0 == n) {
+            r->state = GLB_MYSQL_RESP_UNKNOWN;
+        }
+        else if (GLB_MYSQL_ERR == h) {
+            r->state = GLB_MYSQL_RESP_DONE;
+        }
+        else if (GLB_MYSQL_OK == h && GLB_MYSQL_COM_STMT_PREPARE == r->cmd) {
+            if (n < 9) {
+                r->state = GLB_MYSQL_RESP_UNKNOWN;
+                break;
+            }
+            ulong const cols   = payload[5] | (payload[6] << 8);
+            ulong const params = payload[7] | (payload[8] << 8);
+            r->count = params + (params > 0) + cols + (cols > 0);
+            r->state = r->count ? GLB_MYSQL_RESP_SKIP : GLB_MYSQL_RESP_DONE;
+        }
+        else if (GLB_MYSQL_OK == h || glb_mysql_is_eof (payload, len)) {
+            mysql_resp_end (r, payload, n);
+        }
+        else if (0xfb == h) {
+            /* LOCAL INFILE request: client sends the file, then OK follows */
+        }
+        else {
+            uint64_t cols;
+            if (glb_mysql_lenenc (payload, n, &cols) && cols > 0) {
+                r->count = cols;
+                r->state = GLB_MYSQL_RESP_COLUMNS;
+            }
+            else {
+                r->state = GLB_MYSQL_RESP_UNKNOWN;
+            }
+        }
+        break;
+    case GLB_MYSQL_RESP_COLUMNS:
+        if (0 == --r->count) r->state = GLB_MYSQL_RESP_COL_EOF;
+        break;
+    case GLB_MYSQL_RESP_COL_EOF:
+        if (glb_mysql_is_eof (payload, len)) {
+            int const status = glb_mysql_ok_status (payload, n);
+            if (status >= 0) r->status = status;
+            /* with a cursor rows are fetched by COM_STMT_FETCH */
+            r->state = (status >= 0 &&
+                        (status & GLB_MYSQL_STATUS_CURSOR_EXISTS)) ?
+                GLB_MYSQL_RESP_DONE : GLB_MYSQL_RESP_ROWS;
+        }
+        else {
+            r->state = GLB_MYSQL_RESP_UNKNOWN;
+        }
+        break;
+    case GLB_MYSQL_RESP_ROWS:
+        if (GLB_MYSQL_ERR == h && n > 0) {
+            r->state = GLB_MYSQL_RESP_DONE;
+        }
+        else if (glb_mysql_is_eof (payload, len)) {
+            mysql_resp_end (r, payload, n);
+        }
+        break;
+    case GLB_MYSQL_RESP_SKIP:
+        if (0 == --r->count) r->state = GLB_MYSQL_RESP_DONE;
+        break;
+    case GLB_MYSQL_RESP_DONE:
+        r->state = GLB_MYSQL_RESP_UNKNOWN; // unsolicited packet
+        break;
+    case GLB_MYSQL_RESP_UNKNOWN:
+        break;
+    }
+}
+
+/* skips whitespace and comments, returns NULL on executable comment */
+static const char*
+mysql_skip_space (const char* q, const char* const end)
+{
+    while (q < end) {
+        if (isspace ((unsigned char)*q)) {
+            q++;
+        }
+        else if ('#' == *q || (q + 2 < end && '-' == q[0] && '-' == q[1] &&
+                               isspace ((unsigned char)q[2]))) {
+            while (q < end && '\n' != *q) q++;
+        }
+        else if (q + 1 < end && '/' == q[0] && '*' == q[1]) {
+            if (q + 2 < end && ('!' == q[2] || '+' == q[2])) return NULL;
+            q += 2;
+            while (q + 1 < end && !('*' == q[0] && '/' == q[1])) q++;
+            q = (q + 2 <= end) ? q + 2 : end; // unterminated comment
+        }
+        else {
+            break;
+        }
+    }
+
+    return q;
+}
+
+static bool
+mysql_keyword (const char* const q, const char* const end, const char* kw)
+{
+    size_t const len = strlen (kw);
+
+    return (q < end && (size_t)(end - q) >= len && !strncasecmp (q, kw, len) &&
+            ((size_t)(end - q) == len ||
+             !(isalnum ((unsigned char)q[len]) || '_' == q[len])));
+}
+
+static bool
+mysql_contains (const char* q, const char* const end, const char* const s)
+{
+    size_t const len = strlen (s);
+
+    for (; q < end && (size_t)(end - q) >= len; q++) {
+        if (!strncasecmp (q, s, len)) return true;
+    }
+
+    return false;
+}
+
+static bool
+mysql_contains_any (const char* const q, const char* const end,
+                    const char* const list[])
+{
+    int i;
+
+    for (i = 0; list[i]; i++) {
+        if (mysql_contains (q, end, list[i])) return true;
+    }
+
+    return false;
+}
+
+/* SELECTs that lock rows, assign variables or depend on the session */
+static const char* const mysql_not_read[] =
+{
+    "FOR UPDATE", "FOR SHARE", "LOCK IN SHARE MODE", "INTO", "@", ";",
+    "LAST_INSERT_ID", "FOUND_ROWS", "ROW_COUNT", "CONNECTION_ID", "_LOCK",
+    "NEXTVAL", "LASTVAL", "SETVAL",
+    NULL
+};
+
+/* SETs that must not be repeated on other servers */
+static const char* const mysql_not_session[] =
+{
+    "GLOBAL", "PERSIST", "PASSWORD", "DEFAULT ROLE", ";",
+    NULL
+};
+
+/* statements that leave state behind in the session */
+static const char* const mysql_pin[] =
+{
+    "PREPARE", "EXECUTE", "DEALLOCATE", "HANDLER", "XA",
+    NULL
+};
+
+glb_mysql_stmt_t
+glb_mysql_stmt_class (const char* const query, size_t const len)
+{
+    const char* const end = query + len;
+    const char* const q   = mysql_skip_space (query, end);
+    int i;
+
+    if (!q) return GLB_MYSQL_STMT_WRITE;
+
+    for (i = 0; mysql_pin[i]; i++) {
+        if (mysql_keyword (q, end, mysql_pin[i])) return GLB_MYSQL_STMT_PIN;
+    }
+
+    if (mysql_contains (q, end, "GET_LOCK")) return GLB_MYSQL_STMT_PIN;
+
+    if (mysql_keyword (q, end, "SELECT")) {
+        return (mysql_contains_any (q, end, mysql_not_read) ?
+                GLB_MYSQL_STMT_WRITE : GLB_MYSQL_STMT_READ);
+    }
+
+    if (mysql_keyword (q, end, "SET")) {
+        return (mysql_contains_any (q, end, mysql_not_session) ?
+                GLB_MYSQL_STMT_WRITE : GLB_MYSQL_STMT_SESSION);
+    }
+
+    if (mysql_keyword (q, end, "USE")) {
+        return (mysql_contains (q, end, ";") ?
+                GLB_MYSQL_STMT_WRITE : GLB_MYSQL_STMT_SESSION);
+    }
+
+    if (mysql_keyword (q, end, "LOCK") ||
+        (mysql_keyword (q, end, "FLUSH") &&
+         mysql_contains (q, end, "READ LOCK"))) {
+        return GLB_MYSQL_STMT_PIN;
+    }
+
+    if (mysql_keyword (q, end, "CREATE")) {
+        const char* const t = mysql_skip_space (q + 6, end);
+        if (t && mysql_keyword (t, end, "TEMPORARY")) return GLB_MYSQL_STMT_PIN;
+    }
+
+    return GLB_MYSQL_STMT_WRITE;
+}
+
+bool
+glb_mysql_use_db (const char* const query, size_t const len,
+                  char* const db, size_t const db_len)
+{
+    const char* const end = query + len;
+    const char*       q   = mysql_skip_space (query, end);
+
+    if (!q || !mysql_keyword (q, end, "USE")) return false;
+
+    q = mysql_skip_space (q + 3, end);
+    if (!q || q == end) return false;
+
+    size_t n = 0;
+
+    if ('`' == *q) {
+        for (q++; q < end; q++) {
+            if ('`' == *q) {
+                if (q + 1 < end && '`' == q[1]) q++; // escaped backtick
+                else break;
+            }
+            if (n + 1 >= db_len) return false;
+            db[n++] = *q;
+        }
+        if (q == end) return false;
+        q++;
+    }
+    else {
+        for (; q < end && !isspace ((unsigned char)*q) && ';' != *q; q++) {
+            if (n + 1 >= db_len) return false;
+            db[n++] = *q;
+        }
+    }
+
+    q = mysql_skip_space (q, end);
+    if (!q || q != end || 0 == n) return false;
+
+    db[n] = '\0';
+
+    return true;
+}
+
+long
+glb_mysql_cmd_write (uint8_t const cmd, const void* const arg,
+                     size_t const arg_len, uint8_t* const buf,
+                     size_t const buf_len)
+{
+    size_t const len = 1 + arg_len;
+
+    if (GLB_MYSQL_HDR_LEN + len > buf_len) return -ENOBUFS;
+
+    glb_mysql_pkt_hdr (buf, len, 0);
+    buf[GLB_MYSQL_HDR_LEN] = cmd;
+    if (arg_len) memcpy (buf + GLB_MYSQL_HDR_LEN + 1, arg, arg_len);
+
+    return (GLB_MYSQL_HDR_LEN + len);
+}
+
+long
+glb_mysql_ok_write (int const status, uint8_t const seq, uint8_t* const buf,
+                    size_t const buf_len)
+{
+    static size_t const len = 7;
+
+    if (GLB_MYSQL_HDR_LEN + len > buf_len) return -ENOBUFS;
+
+    uint8_t* const p = buf + GLB_MYSQL_HDR_LEN;
+
+    glb_mysql_pkt_hdr (buf, len, seq);
+    p[0] = GLB_MYSQL_OK;
+    p[1] = 0;                      // affected rows
+    p[2] = 0;                      // last insert id
+    p[3] = status; p[4] = status >> 8;
+    p[5] = 0;      p[6] = 0;       // warnings
+
+    return (GLB_MYSQL_HDR_LEN + len);
+}
+
+long
+glb_mysql_err_write (uint16_t const code, const char* const msg,
+                     uint8_t const seq, uint8_t* const buf,
+                     size_t const buf_len)
+{
+    size_t const msg_len = strlen (msg);
+    size_t const len     = 9 + msg_len;
+
+    if (GLB_MYSQL_HDR_LEN + len > buf_len) return -ENOBUFS;
+
+    uint8_t* const p = buf + GLB_MYSQL_HDR_LEN;
+
+    glb_mysql_pkt_hdr (buf, len, seq);
+    p[0] = GLB_MYSQL_ERR;
+    p[1] = code; p[2] = code >> 8;
+    memcpy (p + 3, "#HY000", 6);   // general error SQLSTATE
+    memcpy (p + 9, msg, msg_len);
+
+    return (GLB_MYSQL_HDR_LEN + len);
+}
+
+/* SHA1 is needed only for mysql_native_password, so straightforward
+ * implementation of RFC 3174 will do. */
+
+typedef struct mysql_sha1
+{
+    uint32_t h[5];
+    uint64_t len;
+    uint8_t  block[64];
+} mysql_sha1_t;
+
+#define MYSQL_ROTL32(x,r) (((x) << (r)) | ((x) >> (32 - (r))))
+
+static void
+mysql_sha1_block (mysql_sha1_t* const s, const uint8_t* const b)
+{
+    uint32_t w[80];
+    int      i;
+
+    for (i = 0; i < 16; i++)
+        w[i] = ((uint32_t)b[4*i] << 24) | (b[4*i + 1] << 16) |
+               (b[4*i + 2] << 8) | b[4*i + 3];
+
+    for (; i < 80; i++)
+        w[i] = MYSQL_ROTL32 (w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+    uint32_t a = s->h[0], bb = s->h[1], c = s->h[2], d = s->h[3], e = s->h[4];
+
+    for (i = 0; i < 80; i++) {
+        uint32_t f, k;
+
+        if      (i < 20) { f = (bb & c) | (~bb & d);           k = 0x5a827999; }
+        else if (i < 40) { f = bb ^ c ^ d;                     k = 0x6ed9eba1; }
+        else if (i < 60) { f = (bb & c) | (bb & d) | (c & d);  k = 0x8f1bbcdc; }
+        else             { f = bb ^ c ^ d;                     k = 0xca62c1d6; }
+
+        uint32_t const tmp = MYSQL_ROTL32 (a, 5) + f + e + k + w[i];
+        e = d; d = c; c = MYSQL_ROTL32 (bb, 30); bb = a; a = tmp;
+    }
+
+    s->h[0] += a; s->h[1] += bb; s->h[2] += c; s->h[3] += d; s->h[4] += e;
+}
+
+static void
+mysql_sha1_init (mysql_sha1_t* const s)
+{
+    s->h[0] = 0x67452301; s->h[1] = 0xefcdab89; s->h[2] = 0x98badcfe;
+    s->h[3] = 0x10325476; s->h[4] = 0xc3d2e1f0;
+    s->len  = 0;
+}
+
+static void
+mysql_sha1_update (mysql_sha1_t* const s, const void* const data,
+                   size_t const len)
+{
+    const uint8_t* p = data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        s->block[s->len % 64] = p[i];
+        s->len++;
+        if (0 == s->len % 64) mysql_sha1_block (s, s->block);
+    }
+}
+
+static void
+mysql_sha1_final (mysql_sha1_t* const s, uint8_t* const md)
+{
+    uint64_t const bits = s->len * 8;
+    uint8_t  const pad  = 0x80;
+    uint8_t  const zero = 0;
+    uint8_t  tail[8];
+    int      i;
+
+    mysql_sha1_update (s, &pad, 1);
+    while (56 != s->len % 64) mysql_sha1_update (s, &zero, 1);
+
+    for (i = 0; i < 8; i++) tail[i] = bits >> (56 - 8*i);
+    mysql_sha1_update (s, tail, sizeof(tail));
+
+    for (i = 0; i < 20; i++) md[i] = s->h[i / 4] >> (24 - 8*(i % 4));
+}
+
+size_t
+glb_mysql_native_password (const char*    const password,
+                           const uint8_t* const scramble,
+                           uint8_t*       const auth)
+{
+    size_t const pass_len = strlen (password);
+
+    if (0 == pass_len) return 0;
+
+    mysql_sha1_t s;
+    uint8_t      stage1[GLB_MYSQL_AUTH_LEN];
+    uint8_t      stage2[GLB_MYSQL_AUTH_LEN];
+    int          i;
+
+    mysql_sha1_init   (&s);
+    mysql_sha1_update (&s, password, pass_len);
+    mysql_sha1_final  (&s, stage1);
+
+    mysql_sha1_init   (&s);
+    mysql_sha1_update (&s, stage1, sizeof(stage1));
+    mysql_sha1_final  (&s, stage2);
+
+    mysql_sha1_init   (&s);
+    mysql_sha1_update (&s, scramble, GLB_MYSQL_AUTH_LEN);
+    mysql_sha1_update (&s, stage2, sizeof(stage2));
+    mysql_sha1_final  (&s, auth);
+
+    for (i = 0; i < GLB_MYSQL_AUTH_LEN; i++) auth[i] ^= stage1[i];
+
+    return GLB_MYSQL_AUTH_LEN;
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * Bits of MySQL client/server protocol needed to route statements:
+ * packet framing, handshake, response tracking and statement classification,
+ * and native password authentication for the watchdog.
+ *
+ * $Id$
+ */
+
+#ifndef _glb_mysql_h_
+#define _glb_mysql_h_
+
+#include "glb_types.h" // ulong
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define GLB_MYSQL_HDR_LEN  4
+#define GLB_MYSQL_MAX_PKT  0xffffff  // longer payloads are split
+#define GLB_MYSQL_PEEK     32        // payload bytes needed to track responses
+
+/* capability flags */
+#define GLB_MYSQL_CLIENT_LONG_PASSWORD       0x00000001
+#define GLB_MYSQL_CLIENT_CONNECT_WITH_DB     0x00000008
+#define GLB_MYSQL_CLIENT_COMPRESS            0x00000020
+#define GLB_MYSQL_CLIENT_PROTOCOL_41         0x00000200
+#define GLB_MYSQL_CLIENT_SSL                 0x00000800
+#define GLB_MYSQL_CLIENT_SECURE_CONNECTION   0x00008000
+#define GLB_MYSQL_CLIENT_PLUGIN_AUTH         0x00080000
+#define GLB_MYSQL_CLIENT_CONNECT_ATTRS       0x00100000
+#define GLB_MYSQL_CLIENT_PLUGIN_AUTH_LENENC  0x00200000
+#define GLB_MYSQL_CLIENT_DEPRECATE_EOF       0x01000000
+#define GLB_MYSQL_CLIENT_QUERY_ATTRIBUTES    0x08000000
+
+/* capabilities that change framing or payload in ways we can't follow */
+#define GLB_MYSQL_CLIENT_UNSUPPORTED (GLB_MYSQL_CLIENT_COMPRESS       | \
+                                      GLB_MYSQL_CLIENT_SSL            | \
+                                      GLB_MYSQL_CLIENT_DEPRECATE_EOF  | \
+                                      GLB_MYSQL_CLIENT_QUERY_ATTRIBUTES)
+
+/* server status flags */
+#define GLB_MYSQL_STATUS_IN_TRANS       0x0001
+#define GLB_MYSQL_STATUS_AUTOCOMMIT     0x0002
+#define GLB_MYSQL_STATUS_MORE_RESULTS   0x0008
+#define GLB_MYSQL_STATUS_CURSOR_EXISTS  0x0040
+
+/* commands */
+#define GLB_MYSQL_COM_QUIT              0x01
+#define GLB_MYSQL_COM_INIT_DB           0x02
+#define GLB_MYSQL_COM_QUERY             0x03
+#define GLB_MYSQL_COM_FIELD_LIST        0x04
+#define GLB_MYSQL_COM_STATISTICS        0x09
+#define GLB_MYSQL_COM_PING              0x0e
+#define GLB_MYSQL_COM_CHANGE_USER       0x11
+#define GLB_MYSQL_COM_STMT_PREPARE      0x16
+#define GLB_MYSQL_COM_STMT_EXECUTE      0x17
+#define GLB_MYSQL_COM_STMT_SEND_LONG_DATA 0x18
+#define GLB_MYSQL_COM_STMT_CLOSE        0x19
+#define GLB_MYSQL_COM_STMT_RESET        0x1a
+#define GLB_MYSQL_COM_SET_OPTION        0x1b
+#define GLB_MYSQL_COM_STMT_FETCH        0x1c
+#define GLB_MYSQL_COM_RESET_CONNECTION  0x1f
+
+/* response packet headers */
+#define GLB_MYSQL_OK     0x00
+#define GLB_MYSQL_EOF    0xfe
+#define GLB_MYSQL_ERR    0xff
+
+static inline size_t
+glb_mysql_pkt_len (const uint8_t* const hdr)
+{
+    return (hdr[0] | (hdr[1] << 8) | (hdr[2] << 16));
+}
+
+static inline uint8_t
+glb_mysql_pkt_seq (const uint8_t* const hdr)
+{
+    return hdr[3];
+}
+
+static inline void
+glb_mysql_pkt_hdr (uint8_t* const hdr, size_t const len, uint8_t const seq)
+{
+    hdr[0] = len; hdr[1] = len >> 8; hdr[2] = len >> 16; hdr[3] = seq;
+}
+
+static inline uint32_t
+glb_mysql_uint4 (const uint8_t* const p)
+{
+    return (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+static inline bool
+glb_mysql_is_eof (const uint8_t* const payload, size_t const len)
+{
+    return (len > 0 && len < 9 && GLB_MYSQL_EOF == payload[0]);
+}
+
+/*! Reads length-encoded integer, returns number of bytes consumed or 0 if
+ *  there is not enough data */
+extern size_t
+glb_mysql_lenenc (const uint8_t* p, size_t len, uint64_t* value);
+
+/*! Server status from OK (or EOF) packet payload, -1 if it can't be found */
+extern int
+glb_mysql_ok_status (const uint8_t* payload, size_t len);
+
+/*! Initial handshake (protocol 10) details relevant to authentication */
+typedef struct glb_mysql_greeting
+{
+    uint32_t caps;
+    uint8_t  scramble_len;
+    uint8_t  scramble[32];
+    char     plugin[64];
+} glb_mysql_greeting_t;
+
+/*! Parses server greeting
+ *  @return 0 or -EPROTO */
+extern int
+glb_mysql_greeting_parse (glb_mysql_greeting_t* g, const uint8_t* payload,
+                          size_t len);
+
+/*! Clears unsupported capability flags in server greeting, in place */
+extern void
+glb_mysql_greeting_mask (uint8_t* payload, size_t len);
+
+/*! Client handshake response (protocol 41) details needed to log in
+ *  another server on behalf of the same client */
+typedef struct glb_mysql_login
+{
+    uint32_t caps;
+    uint8_t  head[32];  // capabilities, max packet size, charset, filler
+    char     user[128];
+    char     db[128];
+} glb_mysql_login_t;
+
+/*! Parses client handshake response and clears unsupported capability flags
+ *  in it, in place.
+ *  @return 0 or -EPROTO if can't be followed (e.g. SSL request) */
+extern int
+glb_mysql_login_parse (glb_mysql_login_t* l, uint8_t* payload, size_t len);
+
+/*! Writes handshake response packet (with header) that logs in the same
+ *  client with the given authentication data and plugin.
+ *  @return packet length or -ENOBUFS */
+extern long
+glb_mysql_login_write (const glb_mysql_login_t* l, const char* plugin,
+                       const uint8_t* auth, size_t auth_len, uint8_t seq,
+                       uint8_t* buf, size_t buf_len);
+
+/*! Writes authentication switch request packet (with header)
+ *  @return packet length or -ENOBUFS */
+extern long
+glb_mysql_auth_switch_write (const glb_mysql_greeting_t* g, uint8_t seq,
+                             uint8_t* buf, size_t buf_len);
+
+#define GLB_MYSQL_NATIVE_PASSWORD "mysql_native_password"
+#define GLB_MYSQL_AUTH_LEN        20 // scramble used and response produced
+
+/*! Computes mysql_native_password response to the scramble:
+ *  SHA1(password) XOR SHA1(scramble + SHA1(SHA1(password))).
+ *  @param auth buffer of at least GLB_MYSQL_AUTH_LEN bytes
+ *  @return response length: GLB_MYSQL_AUTH_LEN or 0 for empty password */
+extern size_t
+glb_mysql_native_password (const char* password, const uint8_t* scramble,
+                           uint8_t* auth);
+
+/*! Response tracking: figures out where the response to a command ends
+ *  and what server status it leaves the session in */
+typedef enum glb_mysql_resp_state
+{
+    GLB_MYSQL_RESP_DONE = 0, // no response expected
+    GLB_MYSQL_RESP_FIRST,    // first packet of a response
+    GLB_MYSQL_RESP_COLUMNS,  // column definitions
+    GLB_MYSQL_RESP_COL_EOF,  // EOF after column definitions
+    GLB_MYSQL_RESP_ROWS,     // rows until EOF
+    GLB_MYSQL_RESP_SKIP,     // fixed number of packets to skip
+    GLB_MYSQL_RESP_UNKNOWN   // can't follow the response
+} glb_mysql_resp_state_t;
+
+typedef struct glb_mysql_resp
+{
+    glb_mysql_resp_state_t state;
+    uint8_t                cmd;
+    ulong                  count;  // packets left in COLUMNS and SKIP
+    int                    status; // server status, -1 if unknown
+} glb_mysql_resp_t;
+
+/*! Starts tracking response to the command */
+extern void
+glb_mysql_resp_start (glb_mysql_resp_t* r, uint8_t cmd);
+
+/*! Advances response state by one packet.
+ *  @param payload first min(len, GLB_MYSQL_PEEK) bytes of packet payload
+ *  @param len     full payload length */
+extern void
+glb_mysql_resp_packet (glb_mysql_resp_t* r, const uint8_t* payload,
+                       size_t len);
+
+/*! Statement classes relevant for routing */
+typedef enum glb_mysql_stmt
+{
+    GLB_MYSQL_STMT_WRITE = 0, // anything that must go to writer
+    GLB_MYSQL_STMT_READ,      // plain SELECT that can go anywhere
+    GLB_MYSQL_STMT_SESSION,   // changes session state (SET, USE)
+    GLB_MYSQL_STMT_PIN        // creates state only this server will have
+} glb_mysql_stmt_t;
+
+extern glb_mysql_stmt_t
+glb_mysql_stmt_class (const char* query, size_t len);
+
+/*! If the query is a lone USE statement, copies database name to db */
+extern bool
+glb_mysql_use_db (const char* query, size_t len, char* db, size_t db_len);
+
+/*! Writes command packet (with header)
+ *  @return packet length or -ENOBUFS */
+extern long
+glb_mysql_cmd_write (uint8_t cmd, const void* arg, size_t arg_len,
+                     uint8_t* buf, size_t buf_len);
+
+/*! Writes OK packet (with header) with the given server status
+ *  @return packet length or -ENOBUFS */
+extern long
+glb_mysql_ok_write (int status, uint8_t seq, uint8_t* buf, size_t buf_len);
+
+/*! Writes ERR packet (with header)
+ *  @return packet length or -ENOBUFS */
+extern long
+glb_mysql_err_write (uint16_t code, const char* msg, uint8_t seq,
+                     uint8_t* buf, size_t buf_len);
+
+#endif // _glb_mysql_h_
@@ -20,12 +20,15 @@ typedef struct option glb_option_t;
 typedef enum glb_opt
 {
     GLB_OPT_NOOPT        = 0,
+    GLB_OPT_CONFIG       = 'C',
     GLB_OPT_DISCOVER     = 'D',
     GLB_OPT_KEEPALIVE    = 'K',
     GLB_OPT_LATENCY_COUNT= 'L',
+    GLB_OPT_MYSQL_SPLIT  = 'M',
     GLB_OPT_SINGLE       = 'S',
     GLB_OPT_TOP          = 'T',
     GLB_OPT_VERSION      = 'V',
+    GLB_OPT_MYSQL_MUX    = 'X',
     GLB_OPT_SYNCHRONOUS  = 'Y',
     GLB_OPT_DEFER_ACCEPT = 'a',
     GLB_OPT_ROUND_ROBIN  = 'b',
@@ -47,12 +50,15 @@ typedef enum glb_opt
 
 static glb_option_t glb_options[] =
 {
+    { "config",          GLB_RA, NULL, GLB_OPT_CONFIG        },
     { "discover",        GLB_NA, NULL, GLB_OPT_DISCOVER      },
     { "keepalive",       GLB_NA, NULL, GLB_OPT_KEEPALIVE     },
     { "latency",         GLB_RA, NULL, GLB_OPT_LATENCY_COUNT },
+    { "mysql-split",     GLB_NA, NULL, GLB_OPT_MYSQL_SPLIT   },
     { "single",          GLB_NA, NULL, GLB_OPT_SINGLE        },
     { "top",             GLB_NA, NULL, GLB_OPT_TOP           },
     { "version",         GLB_NA, NULL, GLB_OPT_VERSION       },
+    { "mysql-mux",       GLB_RA, NULL, GLB_OPT_MYSQL_MUX     },
     { "defer-accept",    GLB_NA, NULL, GLB_OPT_DEFER_ACCEPT  },
     { "round",           GLB_NA, NULL, GLB_OPT_ROUND_ROBIN   },
     { "round-robin",     GLB_NA, NULL, GLB_OPT_ROUND_ROBIN   },
@@ -8,6 +8,8 @@
 #include "glb_time.h"
 #include "glb_log.h"
 #include "glb_pool.h"
+#include "glb_hist.h"
+#include "glb_mysql.h"
 
 #include "glb_cmd.h"
 #include "glb_types.h" // ulong
@@ -16,6 +18,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <limits.h>
+#include <stddef.h> // ptrdiff_t
 #include <unistd.h>
 #include <errno.h>
 #include <assert.h>
@@ -37,11 +41,24 @@
 #include <fcntl.h>
 #endif
 
+#ifdef GLB_USE_SOCKMAP
+#include "glb_sockmap.h"
+#include <sys/ioctl.h>
+
+typedef enum pool_sm_state
+{
+    POOL_SM_NONE = 0, // not forwarded by kernel yet
+    POOL_SM_KERNEL,   // data forwarded by kernel, only close events are seen
+    POOL_SM_FAILED    // sockmap unavailable for this connection
+} pool_sm_state_t;
+#endif
+
 typedef enum pool_ctl_code
 {
     POOL_CTL_ADD_CONN,
     POOL_CTL_DROP_DST,
-    POOL_CTL_STATS,
+    POOL_CTL_LATENCY,
+    POOL_CTL_CONNS,
     POOL_CTL_SHUTDOWN,
     POOL_CTL_MAX
 } pool_ctl_code_t;
@@ -64,15 +81,26 @@ typedef enum pool_end
 typedef struct pool_conn_end
 {
     glb_sockaddr_t addr;
+    glb_router_handle_t handle; // server: router destination handle
     size_t         sent;
     size_t         total;
 #ifdef GLB_USE_SPLICE
     int            splice[2];
 #endif
+#ifdef GLB_USE_SOCKMAP
+    glb_sockmap_key_t sm_key;   // 4-tuple to remove from the sockmap
+    pool_sm_state_t   sm_state; // server: kernel forwarding state
+#endif
+    glb_time_t     start;    // client: accept time, server: connect start
     int            sock;     // fd of connection
     int            fds_idx;  // index in the file descriptor set (for poll())
+    int            lat_idx;  // server: latency record slot, -1 if not conn.
+    int            dst_idx;  // server: index in pool->dst, -1 if not listed
+    struct pool_conn_end* dst_prev; // server: connections to the same dst
+    struct pool_conn_end* dst_next;
     uint32_t       events;   // events waited by descriptor
     pool_end_t     end;      // to differentiate between the ends
+    bool           replied;  // client: server response started
     uint8_t        buf[];    // has pool_buf_size
 } pool_conn_end_t;
 
@@ -87,6 +115,179 @@ typedef struct pool_conn_end
 #define POOL_MAX_FD (1 << 16) // highest possible file descriptor + 1
                               // only affects the map size
 
+/* MySQL read/write splitting (cnf->mysql_split).
+ * Connection gets the third end for the reader and the session state:
+ * |inc end|..inc buf..|dst end|..dst buf..|reader end|..reader buf..|session|
+ * Client authenticates with the writer (dst end) as usual, then is asked to
+ * authenticate once more (AuthSwitchRequest carrying the reader scramble), so
+ * the reader session belongs to the same user without knowing credentials.
+ * In command phase plain reads outside transactions go to the reader,
+ * everything else goes to the writer. */
+typedef enum pool_mysql_phase
+{
+    POOL_MYSQL_AUTH = 0, // client authenticates with the writer
+    POOL_MYSQL_HOLD,     // writer accepted the client, reader greeting awaited
+    POOL_MYSQL_SWITCH,   // client authenticates with the reader
+    POOL_MYSQL_CMD,      // command phase, statements are routed
+    POOL_MYSQL_RAW       // no reader, plain forwarding to the writer
+} pool_mysql_phase_t;
+
+typedef enum pool_mysql_reader
+{
+    POOL_MYSQL_READER_NONE = 0,
+    POOL_MYSQL_READER_GREETING, // connecting or waiting for the greeting
+    POOL_MYSQL_READER_GREETED,  // waiting for the client to authenticate
+    POOL_MYSQL_READER_LOGIN,    // client login sent
+    POOL_MYSQL_READER_READY
+} pool_mysql_reader_t;
+
+// follows server packets in command phase
+typedef struct pool_mysql_walk
+{
+    size_t  len;   // payload length of the current packet
+    size_t  left;  // payload bytes not seen yet
+    size_t  have;  // bytes collected in peek
+    bool    drop;  // packet is not forwarded to the client
+    bool    cont;  // packet continues the previous max length one
+    bool    seen;  // packet was inspected
+    uint8_t peek[GLB_MYSQL_HDR_LEN + GLB_MYSQL_PEEK];
+} pool_mysql_walk_t;
+
+#define POOL_MYSQL_CBUF 4096 // client packets waiting to be routed
+#define POOL_MYSQL_SBUF 2048 // server packets in authentication phase
+
+typedef struct pool_mysql
+{
+    pool_mysql_phase_t   phase;
+    pool_mysql_reader_t  reader;
+    pool_conn_end_t*     target;      // where the long client packet goes
+    size_t               target_left; // bytes of it left to route
+    int                  discard;     // reader responses to drop
+    bool                 greeted;     // writer greeting was seen
+    bool                 login_ok;    // client login can be replayed
+    bool                 pinned;      // session state only the writer has
+    bool                 await_client;// SWITCH: client is to reply
+    bool                 last_reader; // last command went to the reader
+    uint8_t              seq;         // last client sequence number (auth)
+    uint8_t              seq_off;     // client - reader sequence numbers
+    glb_mysql_resp_t     w_resp;      // keeps writer session status
+    glb_mysql_resp_t     r_resp;
+    pool_mysql_walk_t    w_walk;
+    pool_mysql_walk_t    r_walk;
+    glb_mysql_login_t    login;
+    glb_mysql_greeting_t greeting;    // reader's
+    size_t               ok_len;
+    size_t               cbuf_len;
+    size_t               wbuf_len;
+    size_t               rbuf_len;
+    uint8_t              ok[256];     // writer OK held during SWITCH
+    uint8_t              cbuf[POOL_MYSQL_CBUF];
+    uint8_t              wbuf[POOL_MYSQL_SBUF];
+    uint8_t              rbuf[POOL_MYSQL_SBUF];
+} pool_mysql_t;
+
+#define pool_mysql_conn_size \
+    (pool_conn_size + pool_end_size + sizeof(pool_mysql_t))
+
+/* MySQL connection multiplexing (cnf->mysql_mux).
+ * Client and server connections are separate objects here:
+ * |client end|..client buf..|mux client| and |server end|..server buf..|mux
+ * server|, route_map points to the end that owns the descriptor.
+ * Client logs in through a fresh server connection which then stays in the
+ * pool as authenticated for that user, unless the destination has enough
+ * connections already. Afterwards client borrows an idle server connection of
+ * the same user for each transaction: from a command till the response that
+ * leaves no transaction open. Before the command goes to a connection last
+ * used by another client, the connection is reset with COM_RESET_CONNECTION
+ * and the client database and SET statements are replayed there. */
+typedef enum pool_mux_state
+{
+    POOL_MUX_LOGIN = 0, // client logs in through this connection
+    POOL_MUX_IDLE,      // in the pool
+    POOL_MUX_BUSY       // attached to a client
+} pool_mux_state_t;
+
+#define POOL_MUX_NAME   128  // user and database names, as in login
+#define POOL_MUX_REPLAY 1024 // client SET statements
+
+typedef struct pool_mux_server
+{
+    pool_conn_end_t*  client;  // attached client
+    pool_conn_end_t*  owner;   // client whose session state this is
+    pool_conn_end_t*  prev;    // idle list
+    pool_conn_end_t*  next;
+    pool_conn_end_t*  all;     // all server connections of the pool
+    pool_mux_state_t  state;
+    int               discard; // responses to reset and replay to drop
+    bool              dirty;   // used since the last reset
+    bool              taint;   // session can't be reset or followed
+    uint8_t           charset;
+    glb_mysql_resp_t  resp;
+    pool_mysql_walk_t walk;
+    char              user[POOL_MUX_NAME];
+    char              db[POOL_MUX_NAME];
+} pool_mux_server_t;
+
+typedef struct pool_mux_client
+{
+    pool_conn_end_t*  server;  // attached server connection
+    pool_conn_end_t*  last;    // server connection with client's session
+    pool_conn_end_t*  next;    // wait list
+    bool              login;   // logging in
+    bool              greeted; // login: greeting was passed
+    bool              hello;   // login: handshake response was passed
+    bool              raw;     // plain forwarding to the login server
+    bool              pinned;  // session state that can't be replayed
+    bool              waiting; // for a server connection
+    uint8_t           charset;
+    int               status;  // last known server status
+    size_t            stage;   // login: server bytes after total in buf
+    size_t            target_left; // rest of a long packet
+    size_t            replay_len;
+    int               replay_n;    // packets in replay
+    size_t            cbuf_len;
+    char              user[POOL_MUX_NAME];
+    char              db[POOL_MUX_NAME];
+    uint8_t           replay[POOL_MUX_REPLAY]; // COM_QUERY packets
+    uint8_t           cbuf[POOL_MYSQL_CBUF];
+} pool_mux_client_t;
+
+#define pool_mux_client_size (pool_end_size + sizeof(pool_mux_client_t))
+#define pool_mux_server_size (pool_end_size + sizeof(pool_mux_server_t))
+
+/* per-destination latency histograms (microseconds). Pool records are
+ * indexed by router handle slot, so the table does not outgrow the router
+ * one and the record of a removed destination is reused with its slot. */
+typedef struct pool_lat
+{
+    glb_sockaddr_t addr;
+    uint32_t       gen;      // handle generation, 0 - unused record
+    glb_hist_t     connect;  // backend connect latency
+    glb_hist_t     ttfb;     // from accept to the first byte from backend
+    glb_hist_t     lifetime; // from accept to close
+} pool_lat_t;
+
+typedef struct pool_lat_set
+{
+    pool_lat_t* lat;
+    int         n_lat;
+} pool_lat_set_t;
+
+/* per-destination list of server connection ends, so that dropping
+ * a destination touches only its own connections */
+typedef struct pool_dst
+{
+    glb_sockaddr_t   addr;
+    pool_conn_end_t* head;
+    int              n_conns;
+} pool_dst_t;
+
+typedef struct pool_dst_set
+{
+    pool_dst_t* dst;
+    int         n_dst;
+} pool_dst_set_t;
+
 typedef struct pool
 {
     const glb_cnf_t* cnf;
@@ -98,6 +299,7 @@ typedef struct pool
     int              ctl_recv; // fd to receive commands in pool thread
     int              ctl_send; // fd to send commands to pool - other function
     volatile int     n_conns;  // how many connecitons this pool serves
+    int              n_adding; // connections being passed, under glb_pool lock
 #ifdef USE_EPOLL
     int              epoll_fd;
 #endif
@@ -105,19 +307,32 @@ typedef struct pool
     size_t           pollfds_len;
     int              fd_max;
     glb_router_t*    router;
-    glb_pool_stats_t stats;
+    pool_lat_set_t   lat;      // only accessed by the pool thread
+    pool_dst_set_t   dst;      // only accessed by the pool thread
+    pool_conn_end_t* mux_idle; // idle MySQL server connections
+    pool_conn_end_t* mux_all;  // all MySQL server connections
+    pool_conn_end_t* mux_wait; // clients waiting for a server connection
+    pool_conn_end_t* mux_wait_tail;
+    volatile int     mux_servers; // MySQL server connections
+    volatile int     mux_busy;    // of them attached to clients
     bool             shutdown;
+    glb_pool_stats_t stats;    // own cache line(s), readable from anywhere
+    glb_pool_stats_t info_stats; // stats at last glb_pool_print_info()
     pool_conn_end_t* route_map[ POOL_MAX_FD ]; // connection ctx look-up by fd
 } pool_t;
 
 struct glb_pool
 {
     const glb_cnf_t* cnf;
+    glb_router_t*   router;
     pthread_mutex_t lock;
+    glb_time_t      started;
     glb_time_t      last_info;
-    glb_time_t      last_stats;
-    int             n_pools;
-    pool_t          pool[];  // pool array, can't be changed in runtime
+    int             n_pools; // active pools receiving new connections
+    int             n_all;   // active plus retiring pools
+    int             next_id; // id for the next pool thread
+    glb_pool_stats_t retired; // stats of the pools that are gone
+    pool_t**        pool;    // active pools first, then retiring ones
 };
 
 typedef enum pool_fd_ops
@@ -134,6 +349,100 @@ typedef enum pool_fd_ops
 
 //#define FD_SETSIZE 1024; // leater get it from select.h
 
+/*!
+ * @return index of the latency record for addr, adding one if necessary,
+ *         or negative error code. Used to merge records of all pools.
+ */
+static int
+pool_lat_find (pool_lat_set_t* const set, const glb_sockaddr_t* const addr)
+{
+    int i;
+
+    for (i = 0; i < set->n_lat; i++) {
+        if (glb_sockaddr_is_equal (&set->lat[i].addr, addr)) return i;
+    }
+
+    pool_lat_t* const tmp = realloc (set->lat, (i + 1) * sizeof(pool_lat_t));
+    if (!tmp) return -ENOMEM;
+
+    set->lat = tmp;
+    memset (&set->lat[i], 0, sizeof(pool_lat_t));
+    set->lat[i].addr = *addr;
+    set->lat[i].gen  = 1;
+    set->n_lat++;
+
+    return i;
+}
+
+/*!
+ * @return index of the latency record for destination handle h, O(1),
+ *         resetting the record if the slot got another destination,
+ *         or negative error code
+ */
+static int
+pool_lat_slot (pool_lat_set_t* const set, const glb_router_handle_t* const h,
+               const glb_sockaddr_t* const addr)
+{
+    if (GLB_UNLIKELY(h->slot >= (uint32_t)set->n_lat)) {
+        if (h->slot >= (uint32_t)INT_MAX) return -EINVAL; // no destination
+
+        pool_lat_t* const tmp = realloc (set->lat,
+                                         (h->slot + 1) * sizeof(pool_lat_t));
+        if (!tmp) return -ENOMEM;
+
+        memset (tmp + set->n_lat, 0,
+                (h->slot + 1 - set->n_lat) * sizeof(pool_lat_t));
+        set->lat   = tmp;
+        set->n_lat = h->slot + 1;
+    }
+
+    pool_lat_t* const l = &set->lat[h->slot];
+
+    if (GLB_UNLIKELY(l->gen != h->gen)) {
+        memset (l, 0, sizeof(pool_lat_t));
+        l->addr = *addr;
+        l->gen  = h->gen;
+    }
+
+    return h->slot;
+}
+
+static inline void
+pool_lat_record (glb_hist_t* const hist, glb_time_t const from,
+                 glb_time_t const to)
+{
+    glb_hist_record (hist, to > from ? (to - from) / 1000 : 0);
+}
+
+// server connection established, start tracking latencies for it
+static inline void
+pool_lat_connected (pool_t* const pool, pool_conn_end_t* const dst_end,
+                    glb_time_t const now)
+{
+    assert (POOL_END_CLIENT != dst_end->end);
+
+    dst_end->lat_idx = pool_lat_slot (&pool->lat, &dst_end->handle,
+                                      &dst_end->addr);
+
+    if (GLB_LIKELY(dst_end->lat_idx >= 0)) {
+        pool_lat_record (&pool->lat.lat[dst_end->lat_idx].connect,
+                         dst_end->start, now);
+    }
+}
+
+// first response bytes from the server
+static inline void
+pool_lat_replied (pool_t* const pool, pool_conn_end_t* const inc_end,
+                  const pool_conn_end_t* const dst_end)
+{
+    inc_end->replied = true;
+
+    if (dst_end->lat_idx >= 0) {
+        pool_lat_record (&pool->lat.lat[dst_end->lat_idx].ttfb,
+                         inc_end->start, glb_time_mono());
+    }
+}
+
 #ifndef USE_EPOLL
 static const pollfd_t zero_pollfd = { 0, };
 #endif /* !EPOLL */
@@ -190,16 +499,48 @@ pool_fds_add (pool_t* pool, int fd, pool_fd_ops_t events)
     return ret;
 }
 
+// returns n-th connection end after (or before if negative) this one
+static inline pool_conn_end_t*
+pool_end_next (pool_conn_end_t* const end, int const n)
+{
+    return (pool_conn_end_t*)((uint8_t*)end + n * (ptrdiff_t)pool_end_size);
+}
+
+static inline pool_conn_end_t*
+pool_mysql_reader (pool_conn_end_t* const inc_end)
+{
+    return pool_end_next (inc_end, 2);
+}
+
+static inline pool_mysql_t*
+pool_mysql_sess (pool_conn_end_t* const inc_end)
+{
+    return (pool_mysql_t*)pool_end_next (inc_end, 3);
+}
+
+// server end is a MySQL reader if it does not follow client end
+static inline bool
+pool_mysql_is_reader (pool_conn_end_t* const end)
+{
+    return (POOL_END_CLIENT != pool_end_next (end, -1)->end);
+}
+
 // returns corresponding pool_conn_end_t*
 static inline pool_conn_end_t*
 pool_conn_end_by_fd (pool_t* pool, int fd)
 {
+    // MySQL multiplexing maps descriptors to their own ends
+    if (pool->cnf->mysql_mux) return pool->route_map[fd];
+
     // map points to the other end, but that's enough
     pool_conn_end_t* other_end = pool->route_map[fd];
     if (POOL_END_CLIENT == other_end->end) {
-        return (pool_conn_end_t*)((uint8_t*)other_end + pool_end_size);
+        pool_conn_end_t* const dst_end = pool_end_next (other_end, 1);
+        // MySQL reader end is mapped to client end too
+        return (GLB_LIKELY(dst_end->sock == fd) ?
+                dst_end : pool_mysql_reader (other_end));
     } else {
-        return (pool_conn_end_t*)((uint8_t*)other_end - pool_end_size);
+        return pool_end_next (other_end, -1);
     }
 }
 
@@ -266,6 +607,70 @@ pool_fds_wait (pool_t* pool)
 #endif /* POLL */
 }
 
+/*! @return index of destination record for addr or set->n_dst if none */
+static inline int
+pool_dst_find (const pool_dst_set_t* const set, const glb_sockaddr_t* const addr)
+{
+    int i;
+
+    for (i = 0; i < set->n_dst; i++) {
+        if (glb_sockaddr_is_equal (&set->dst[i].addr, addr)) break;
+    }
+
+    return i;
+}
+
+// puts server end in the list of its destination connections
+static void
+pool_dst_link (pool_t* const pool, pool_conn_end_t* const end)
+{
+    pool_dst_set_t* const set = &pool->dst;
+    int const i = pool_dst_find (set, &end->addr);
+
+    assert (POOL_END_CLIENT != end->end);
+    assert (end->dst_idx < 0);
+
+    if (i == set->n_dst) {
+        pool_dst_t* const tmp = realloc (set->dst, (i + 1) * sizeof(pool_dst_t));
+
+        if (!tmp) {
+            glb_log_error ("Pool %d: failed to add destination record: "
+                           "%d (%s)", pool->id, ENOMEM, strerror (ENOMEM));
+            return; // won't be dropped with destination, only closed
+        }
+
+        set->dst = tmp;
+        set->dst[i].addr    = end->addr;
+        set->dst[i].head    = NULL;
+        set->dst[i].n_conns = 0;
+        set->n_dst++;
+    }
+
+    pool_dst_t* const d = &set->dst[i];
+
+    end->dst_idx  = i;
+    end->dst_prev = NULL;
+    end->dst_next = d->head;
+    if (d->head) d->head->dst_prev = end;
+    d->head = end;
+    d->n_conns++;
+}
+
+static void
+pool_dst_unlink (pool_t* const pool, pool_conn_end_t* const end)
+{
+    if (end->dst_idx < 0) return;
+
+    pool_dst_t* const d = &pool->dst.dst[end->dst_idx];
+
+    if (end->dst_prev) end->dst_prev->dst_next = end->dst_next;
+    else               d->head = end->dst_next;
+    if (end->dst_next) end->dst_next->dst_prev = end->dst_prev;
+
+    d->n_conns--; assert (d->n_conns >= 0);
+    end->dst_idx = -1;
+}
+
 // performs necessary magic (adds end-to-end mapping, alters fd_max and fd_min)
 // when new file descriptor is added to fd_set
 static inline void
@@ -279,6 +684,8 @@ pool_set_conn_end (pool_t* pool, pool_conn_end_t* end1, pool_conn_end_t* end2)
 
     end1->events = event;
     pool->route_map[end1->sock] = end2;
+
+    if (POOL_END_CLIENT != end1->end) pool_dst_link (pool, end1);
 }
 
 // removing traces of connection end - reverse to what pool_set_conn_end() did
@@ -289,317 +696,2364 @@ pool_reset_conn_end (pool_t* const pool, pool_conn_end_t* const end,
     pool_fds_del (pool, end);
     if (cl) close (end->sock);
     pool->route_map[end->sock] = NULL;
+
+    if (POOL_END_CLIENT != end->end) pool_dst_unlink (pool, end);
 }
 
-static void
-pool_remove_conn (pool_t* const pool, int const fd, bool const notify_router)
-{
-    pool_conn_end_t* inc_end;
-    pool_conn_end_t* dst_end;
-    bool             full; // whether to do full cleanup
+static inline size_t
+pool_min (size_t const a, size_t const b) { return (a < b ? a : b); }
 
-    if (pool->route_map[fd]->end != POOL_END_CLIENT) { // close from client
-        dst_end = pool->route_map[fd];
-        inc_end = (pool_conn_end_t*)(((uint8_t*)dst_end) - pool_end_size);
-        full    = true;
+static inline void
+pool_set_read (pool_t* const pool, pool_conn_end_t* const end, bool const on)
+{
+    if (on != !!(end->events & POOL_FD_READ)) {
+        if (on) end->events |=  POOL_FD_READ;
+        else    end->events &= ~POOL_FD_READ;
+        pool_fds_set_events (pool, end);
     }
-    else {
-        inc_end = pool->route_map[fd];
-        dst_end = (pool_conn_end_t*)(((uint8_t*)inc_end) + pool_end_size);
-        full    = POOL_END_INCOMPLETE != dst_end->end;
+}
 
-#ifndef NDEBUG
-        if (notify_router) { glb_log_warn ("Connection close from server"); }
-#endif
+static inline void
+pool_set_write (pool_t* const pool, pool_conn_end_t* const end)
+{
+    if (!(end->events & POOL_FD_WRITE)) {
+        end->events |= POOL_FD_WRITE;
+        pool_fds_set_events (pool, end);
     }
+}
 
-    pool->n_conns--;
-    pool->stats.conns_closed++;
-    pool_reset_conn_end (pool, dst_end, true);
-
-    if (full) {
-        pool_reset_conn_end (pool, inc_end, true);
+// queues packet to the end, returns false if there is no space for it
+static inline bool
+pool_mysql_queue (pool_conn_end_t* const end, const uint8_t* const pkt,
+                  size_t const len)
+{
+    if (GLB_UNLIKELY(len > pool_buf_size - end->total)) return false;
 
-        if (notify_router)
-            glb_router_disconnect (pool->router, &dst_end->addr, false);
+    memcpy (end->buf + end->total, pkt, len);
+    end->total += len;
 
-#ifdef GLB_USE_SPLICE
-        close (dst_end->splice[0]); close (dst_end->splice[1]);
-        close (inc_end->splice[0]); close (inc_end->splice[1]);
-#endif
-        free (inc_end); // frees both ends
-    }
-    else {
-        pool_reset_conn_end (pool, inc_end, false);
-        assert (false == notify_router);
-        /* at this point we should be as if before pool_handle_add_conn() */
-    }
+    return true;
 }
 
-static inline int
-pool_handle_async_conn (pool_t*          pool,
-                        pool_conn_end_t* dst_end)
+static inline bool
+pool_mysql_reader_idle (const pool_mysql_t* const s)
 {
-    uint32_t const ka_opt = pool->cnf->keepalive * GLB_SOCK_KEEPALIVE;
-
-    dst_end->sock = glb_socket_create(&pool->addr_out,
-                                      GLB_SOCK_NODELAY  |
-                                      GLB_SOCK_NONBLOCK |
-                                      ka_opt);
-    int error;
-    if (dst_end->sock > 0) {
-        int ret = connect (dst_end->sock, (struct sockaddr*)&dst_end->addr,
-                           sizeof (dst_end->addr));
-        error = ret ? errno : 0;
-        assert (error); /* should be EINPROGRESS in case of success */
-        if (GLB_UNLIKELY(error != EINPROGRESS) && error != 0) {
-            glb_log_error ("Async connect() failed: %d (%s)",
-                           error, strerror(error));
-            close (dst_end->sock);
-        }
-        else error = 0;
-    }
-    else {
-        error = errno;
-        if (error != EINPROGRESS) {
-            glb_log_error ("Creating destination socket failed: %d (%s)",
-                           error, strerror(error));
-        }
-    }
-
-    return error;
+    return (GLB_MYSQL_RESP_DONE == s->r_resp.state && 0 == s->discard &&
+            0 == s->r_walk.have);
 }
 
 static void
-pool_handle_add_conn (pool_t* pool, pool_ctl_t* ctl)
+pool_mysql_inspect (const pool_mysql_walk_t* const w,
+                    glb_mysql_resp_t* const resp, bool* const pinned)
 {
-    pool_conn_end_t* inc_end = ctl->data;
-    pool_conn_end_t* dst_end = ctl->data + pool_end_size;
-
-    assert (POOL_END_CLIENT == inc_end->end);
-    assert (inc_end->sock > 0);
+    const uint8_t* const payload = w->peek + GLB_MYSQL_HDR_LEN;
 
-    if (dst_end->sock < 0) {
-        assert (POOL_END_INCOMPLETE == dst_end->end);
-        if (pool_handle_async_conn (pool, dst_end)) {
-            glb_router_disconnect (pool->router, &dst_end->addr, true);
-            close (inc_end->sock);
-            free (inc_end);
-            return;
-        }
-    }
-    else {
-        assert (POOL_END_COMPLETE   == dst_end->end);
+    if (w->drop) {
+        /* dropped statement failed, sessions may differ now */
+        if (w->len > 0 && GLB_MYSQL_ERR == payload[0]) *pinned = true;
+        return;
     }
 
-    pool_set_conn_end (pool, inc_end, dst_end);
-    pool_set_conn_end (pool, dst_end, inc_end);
+    if (w->cont) return; // tail of a long packet
 
-    pool->n_conns++;
-    pool->stats.conns_opened++;
+    glb_mysql_resp_packet (resp, payload, w->len);
 
-    if (pool->cnf->verbose) {
-        glb_log_info ("Pool %d: added connection "
-                      "(total pool connections: %d)", pool->id, pool->n_conns);
-    }
+    if (GLB_UNLIKELY(GLB_MYSQL_RESP_UNKNOWN == resp->state)) *pinned = true;
 }
 
-static inline const glb_sockaddr_t*
-pool_conn_end_dstaddr (pool_conn_end_t* end)
+/* Follows server packets in place: feeds response tracker and drops
+ * responses to the statements the client did not send.
+ * @param discard how many responses to drop, NULL if none
+ * @param pinned  set when session state can't be followed any more
+ * @return how many bytes are left in data */
+static size_t
+pool_mysql_walk (pool_mysql_walk_t* const w, glb_mysql_resp_t* const resp,
+                 int* const discard, bool* const pinned,
+                 uint8_t* const data, size_t const len)
 {
-    const glb_sockaddr_t* const ret =
-        ((glb_sockaddr_t*)(POOL_END_CLIENT == end->end ?
-                           (uint8_t*)end : ((uint8_t*)end) - pool_end_size)) -1;
-    return ret;
-}
+    size_t in  = 0;
+    size_t out = 0;
 
-static void
-pool_handle_drop_dst (pool_t* pool, pool_ctl_t* ctl)
-{
-    assert (POOL_CTL_DROP_DST == ctl->code);
+    while (in < len) {
+        size_t n;
 
-    const glb_sockaddr_t* const dst = ctl->data;
-    int fd;
-    int count = pool->fd_max - 1; // ctl_recv is not in route_map
+        if (w->have < GLB_MYSQL_HDR_LEN) {
+            if (0 == w->have) w->drop = discard && *discard > 0;
 
-    for (fd = 0; count; fd++) {
-        pool_conn_end_t* const end = pool->route_map[fd];
+            n = pool_min (GLB_MYSQL_HDR_LEN - w->have, len - in);
+            memcpy (w->peek + w->have, data + in, n);
+            w->have += n;
 
-        assert (fd < POOL_MAX_FD);
+            if (GLB_MYSQL_HDR_LEN == w->have)
+                w->len = w->left = glb_mysql_pkt_len (w->peek);
+        }
+        else {
+            size_t const peek = GLB_MYSQL_HDR_LEN +
+                                pool_min (w->len, GLB_MYSQL_PEEK);
 
-        if (end) {
-            count--;
-            const glb_sockaddr_t* const end_dst = pool_conn_end_dstaddr (end);
-            if (glb_sockaddr_is_equal (dst, end_dst)) {
-                // remove conn, but don't try to notify router 'cause it's
-                // already dropped this destination
-                pool_remove_conn (pool, fd, false);
-                count--; // removing connection removes 2 file descriptors
+            n = pool_min (w->left, len - in);
+
+            if (w->have < peek) {
+                size_t const m = pool_min (peek - w->have, n);
+                memcpy (w->peek + w->have, data + in, m);
+                w->have += m;
             }
+
+            w->left -= n;
+        }
+
+        if (!w->drop) {
+            if (out != in) memmove (data + out, data + in, n);
+            out += n;
+        }
+        in += n;
+
+        if (w->have < GLB_MYSQL_HDR_LEN) continue;
+
+        if (!w->seen &&
+            w->have == GLB_MYSQL_HDR_LEN + pool_min (w->len, GLB_MYSQL_PEEK)) {
+            pool_mysql_inspect (w, resp, pinned);
+            w->seen = true;
+        }
+
+        if (0 == w->left) { // end of packet
+            if (w->drop) (*discard)--;
+            w->cont = (GLB_MYSQL_MAX_PKT == w->len);
+            w->have = 0;
+            w->seen = false;
         }
     }
+
+    return out;
 }
 
-static inline void
-pool_handle_stats (pool_t* pool, pool_ctl_t* ctl)
+// passes writer packets that followed authentication to the client
+static void
+pool_mysql_flush_wbuf (pool_mysql_t* const s, pool_conn_end_t* const inc_end)
 {
-    glb_pool_stats_t* stats = ctl->data;
-    pool->stats.n_conns = pool->n_conns;
-    glb_pool_stats_add (stats, &pool->stats);
-    pool->stats = glb_zero_stats;
+    size_t const n = pool_min (s->wbuf_len, pool_buf_size - inc_end->total);
+    uint8_t* const buf = inc_end->buf + inc_end->total;
+
+    if (!n) return;
+
+    memcpy (buf, s->wbuf, n);
+    inc_end->total += POOL_MYSQL_RAW == s->phase ?
+        n : pool_mysql_walk (&s->w_walk, &s->w_resp, NULL, &s->pinned, buf, n);
+
+    s->wbuf_len -= n;
+    memmove (s->wbuf, s->wbuf + n, s->wbuf_len);
 }
 
+// completes client authentication with the held writer OK
 static void
-pool_handle_shutdown (pool_t* pool)
+pool_mysql_send_ok (pool_t* const pool, pool_conn_end_t* const inc_end,
+                    uint8_t const seq, pool_mysql_phase_t const phase)
 {
-    int fd;
-    int count = pool->fd_max - 1; // ctl_recv is not in route_map
+    pool_mysql_t* const s = pool_mysql_sess (inc_end);
 
-    for (fd = 0; count; fd++) {
-        pool_conn_end_t* end = pool->route_map[fd];
-
-        assert (fd < POOL_MAX_FD);
+    s->ok[3] = seq;
 
-        if (end) {
-            pool_remove_conn (pool, fd, false);
-            count -= 2;
-        }
+    /* client buffer can hold just a few authentication packets now */
+    if (GLB_UNLIKELY(!pool_mysql_queue (inc_end, s->ok, s->ok_len))) {
+        glb_log_error ("No space for MySQL OK packet, closing connection.");
+        shutdown (inc_end->sock, SHUT_RDWR); // will be seen as close
     }
 
-    close (pool->ctl_recv);
-    pool->shutdown = true;
+    s->phase = phase;
+    pool_mysql_flush_wbuf (s, inc_end);
+    pool_set_write (pool, inc_end);
 }
 
-static int
-pool_handle_ctl (pool_t* pool)
+/* Closes reader connection. Session goes on with the writer only,
+ * the caller decides if it can. */
+static void
+pool_mysql_reader_close (pool_t* const pool, pool_conn_end_t* const inc_end,
+                         bool const notify_router, bool const failed)
 {
-    pool_ctl_t ctl;
-
-    // remove ctls from poll count to get only traffic polls
-    pool->stats.n_polls--;
+    pool_mysql_t*    const s      = pool_mysql_sess (inc_end);
+    pool_conn_end_t* const reader = pool_mysql_reader (inc_end);
 
-    ssize_t ret = read (pool->ctl_recv, &ctl, sizeof(ctl));
+    if (reader->sock < 0) return;
 
-    if (sizeof(ctl) != ret) { // incomplete ctl read, should never happen
-        glb_log_fatal ("Incomplete read from ctl, errno: %d (%s)",
-                       errno, strerror (errno));
-        abort();
+    if (pool->cnf->verbose) {
+        glb_sockaddr_str_t a = glb_sockaddr_to_str (&reader->addr);
+        glb_log_info ("Pool %d: closing MySQL reader connection to %s",
+                      pool->id, a.str);
     }
 
-    switch (ctl.code) {
-    case POOL_CTL_ADD_CONN:
-        pool_handle_add_conn (pool, &ctl);
+    pool_reset_conn_end (pool, reader, true);
+
+    if (notify_router)
+        glb_router_disconnect (pool->router, &reader->handle,
+                               failed ? GLB_ROUTER_FAILED : GLB_ROUTER_NONE);
+
+    reader->sock  = -1;
+    reader->end   = POOL_END_INCOMPLETE;
+    reader->handle = GLB_ROUTER_HANDLE_NONE;
+    reader->sent  = reader->total = 0;
+    s->reader     = POOL_MYSQL_READER_NONE;
+    s->discard    = 0;
+    s->rbuf_len   = 0;
+    s->r_resp.state = GLB_MYSQL_RESP_DONE;
+    memset (&s->r_walk, 0, sizeof(s->r_walk));
+
+    switch (s->phase) {
+    case POOL_MYSQL_HOLD:
+        pool_mysql_send_ok (pool, inc_end, s->ok[3], POOL_MYSQL_RAW);
         break;
-    case POOL_CTL_DROP_DST:
-        pool_handle_drop_dst (pool, &ctl);
+    case POOL_MYSQL_SWITCH:
+        /* if the client is to reply, OK goes in response to that */
+        if (!s->await_client)
+            pool_mysql_send_ok (pool, inc_end, s->seq + 1, POOL_MYSQL_RAW);
         break;
-    case POOL_CTL_STATS:
-        pool_handle_stats    (pool, &ctl);
+    case POOL_MYSQL_CMD:
+        s->phase = POOL_MYSQL_RAW;
         break;
-    case POOL_CTL_SHUTDOWN:
-        pool_handle_shutdown (pool);
+    default:
         break;
-    default: // nothing else is implemented
-        glb_log_warn ("Unsupported CTL: %d\n", ctl.code);
     }
+}
 
-    // Notify ctl sender
-    GLB_MUTEX_LOCK (&pool->lock);
-    pthread_cond_signal (&pool->cond);
-    GLB_MUTEX_UNLOCK (&pool->lock);
+// stops following the protocol
+static inline void
+pool_mysql_raw (pool_t* const pool, pool_conn_end_t* const inc_end)
+{
+    pool_mysql_sess(inc_end)->phase = POOL_MYSQL_RAW;
+    pool_mysql_reader_close (pool, inc_end, true, false);
+}
+
+/* Reader connection closed by server.
+ * @return true if the session can go on without it */
+static bool
+pool_mysql_reader_lost (pool_t* const pool, pool_conn_end_t* const inc_end,
+                        bool const notify_router)
+{
+    pool_mysql_t*    const s      = pool_mysql_sess (inc_end);
+    pool_conn_end_t* const reader = pool_mysql_reader (inc_end);
+
+    /* client waits for reader response */
+    bool const busy = POOL_MYSQL_CMD == s->phase &&
+        (GLB_MYSQL_RESP_DONE != s->r_resp.state || s->r_walk.have > 0 ||
+         (reader == s->target && s->target_left > 0));
+
+    pool_mysql_reader_close (pool, inc_end, notify_router, false);
+
+    return !busy;
+}
+
+static inline pool_mux_client_t*
+pool_mux_cli (pool_conn_end_t* const end)
+{
+    return (pool_mux_client_t*)pool_end_next (end, 1);
+}
+
+static inline pool_mux_server_t*
+pool_mux_srv (pool_conn_end_t* const end)
+{
+    return (pool_mux_server_t*)pool_end_next (end, 1);
+}
+
+// server connection can serve the client: same user and character set
+static inline bool
+pool_mux_match (pool_mux_server_t* const ms, const pool_mux_client_t* const mc)
+{
+    return (ms->charset == mc->charset && !strcmp (ms->user, mc->user));
+}
+
+/* @param mc   count only connections that can serve this client, or NULL
+ * @param addr count only connections to this destination, or NULL
+ * @return number of server connections */
+static int
+pool_mux_count (pool_t* const pool, const pool_mux_client_t* const mc,
+                const glb_sockaddr_t* const addr)
+{
+    pool_conn_end_t* srv;
+    int ret = 0;
+
+    for (srv = pool->mux_all; srv; srv = pool_mux_srv(srv)->all) {
+        if ((!mc   || pool_mux_match (pool_mux_srv (srv), mc)) &&
+            (!addr || glb_sockaddr_is_equal (&srv->addr, addr))) ret++;
+    }
+
+    return ret;
+}
+
+static void
+pool_mux_idle_del (pool_t* const pool, pool_conn_end_t* const srv)
+{
+    pool_mux_server_t* const ms = pool_mux_srv (srv);
+
+    if (ms->prev) pool_mux_srv(ms->prev)->next = ms->next;
+    else          pool->mux_idle = ms->next;
+    if (ms->next) pool_mux_srv(ms->next)->prev = ms->prev;
+
+    ms->prev = ms->next = NULL;
+}
+
+static void
+pool_mux_wait_del (pool_t* const pool, pool_conn_end_t* const cli)
+{
+    pool_conn_end_t** p = &pool->mux_wait;
+    pool_conn_end_t*  prev = NULL;
+
+    while (*p != cli) { prev = *p; p = &pool_mux_cli(*p)->next; }
+
+    *p = pool_mux_cli(cli)->next;
+    if (pool->mux_wait_tail == cli) pool->mux_wait_tail = prev;
+
+    pool_mux_cli(cli)->next    = NULL;
+    pool_mux_cli(cli)->waiting = false;
+}
+
+// attached server connection stays with the client no more
+static void
+pool_mux_detach (pool_t* const pool, pool_conn_end_t* const cli)
+{
+    pool_mux_client_t* const mc = pool_mux_cli (cli);
+
+    pool_mux_srv(mc->server)->client = NULL;
+    mc->server = NULL;
+    pool->mux_busy--;
+}
+
+// server connection can be given to another client after this one
+static bool
+pool_mux_reusable (pool_conn_end_t* const cli, pool_conn_end_t* const srv)
+{
+    const pool_mux_client_t* const mc = pool_mux_cli (cli);
+    const pool_mux_server_t* const ms = pool_mux_srv (srv);
+
+    return (!mc->raw && !mc->login && !ms->taint &&
+            POOL_END_COMPLETE == srv->end &&
+            GLB_MYSQL_RESP_DONE == ms->resp.state && 0 == ms->walk.have &&
+            0 == ms->discard && 0 == mc->target_left && 0 == srv->total &&
+            ms->resp.status >= 0 &&
+            !(ms->resp.status & GLB_MYSQL_STATUS_IN_TRANS));
+}
+
+// client connection that has no server connection attached
+static void
+pool_mux_client_free (pool_t* const pool, pool_conn_end_t* const cli)
+{
+    pool_mux_client_t* const mc = pool_mux_cli (cli);
+
+    assert (NULL == mc->server);
+
+    if (mc->waiting) pool_mux_wait_del (pool, cli);
+    if (mc->last) pool_mux_srv(mc->last)->owner = NULL;
+
+    pool_reset_conn_end (pool, cli, true);
+
+    pool->n_conns--;
+    GLB_STATS_INC (pool->stats.conns_closed);
+
+    free (cli);
+}
+
+// tells the client why it is disconnected
+static void
+pool_mux_client_fail (pool_t* const pool, pool_conn_end_t* const cli,
+                      uint16_t const code, const char* const msg)
+{
+    long const len = glb_mysql_err_write (code, msg, 1, cli->buf + cli->total,
+                                          pool_buf_size - cli->total);
+    if (len > 0) {
+        cli->total += len;
+        if (send (cli->sock, cli->buf + cli->sent, cli->total - cli->sent,
+                  MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+            glb_log_debug ("Failed to send MySQL error: %d (%s)",
+                           errno, strerror (errno));
+        }
+    }
+
+    pool_mux_client_free (pool, cli);
+}
+
+// waiting clients that no server connection can serve any more
+static void
+pool_mux_orphans (pool_t* const pool)
+{
+    pool_conn_end_t* cli = pool->mux_wait;
+
+    while (cli) {
+        pool_conn_end_t* const next = pool_mux_cli(cli)->next;
+
+        if (0 == pool_mux_count (pool, pool_mux_cli (cli), NULL)) {
+            pool_mux_client_fail (pool, cli, 1040,
+                                  "No MySQL server connection for the user");
+        }
+
+        cli = next;
+    }
+}
+
+/* Closes server connection, attached client is left without it.
+ * @param notify_router whether router should know that connection is gone
+ * @param result what the close tells about the destination health */
+static void
+pool_mux_server_close (pool_t* const pool, pool_conn_end_t* const srv,
+                       bool const notify_router,
+                       glb_router_result_t const result)
+{
+    pool_mux_server_t* const ms = pool_mux_srv (srv);
+    pool_conn_end_t**        p;
+
+    if (srv->sock >= 0) {
+        pool_reset_conn_end (pool, srv, true);
+        if (notify_router)
+            glb_router_disconnect (pool->router, &srv->handle, result);
+    }
+
+    if (srv->lat_idx >= 0) {
+        pool_lat_record (&pool->lat.lat[srv->lat_idx].lifetime, srv->start,
+                         glb_time_mono());
+    }
+
+    if (POOL_MUX_IDLE == ms->state) pool_mux_idle_del (pool, srv);
+    if (ms->client) pool_mux_detach (pool, ms->client);
+    if (ms->owner) pool_mux_cli(ms->owner)->last = NULL;
+
+    for (p = &pool->mux_all; *p != srv; p = &pool_mux_srv(*p)->all);
+    *p = ms->all;
+    pool->mux_servers--;
+
+    free (srv);
+
+    pool_mux_orphans (pool);
+}
+
+/* Attaches server connection to the client. If it was last used by another
+ * client, queues the statements that give it the client session state,
+ * their responses are dropped in pool_mysql_walk(). */
+static void
+pool_mux_bind (pool_t* const pool, pool_conn_end_t* const cli,
+               pool_conn_end_t* const srv)
+{
+    pool_mux_client_t* const mc = pool_mux_cli (cli);
+    pool_mux_server_t* const ms = pool_mux_srv (srv);
+
+    assert (0 == srv->total);
+
+    if (ms->owner != cli) {
+        long len;
+
+        if (ms->dirty) {
+            len = glb_mysql_cmd_write (GLB_MYSQL_COM_RESET_CONNECTION, NULL, 0,
+                                       srv->buf + srv->total,
+                                       pool_buf_size - srv->total);
+            assert (len > 0);
+            srv->total += len;
+            ms->discard++;
+        }
+
+        if (mc->db[0] && strcmp (mc->db, ms->db)) {
+            len = glb_mysql_cmd_write (GLB_MYSQL_COM_INIT_DB, mc->db,
+                                       strlen (mc->db), srv->buf + srv->total,
+                                       pool_buf_size - srv->total);
+            assert (len > 0);
+            srv->total += len;
+            ms->discard++;
+            strcpy (ms->db, mc->db);
+        }
+
+        pool_mysql_queue (srv, mc->replay, mc->replay_len);
+        ms->discard += mc->replay_n;
+
+        if (ms->owner) pool_mux_cli(ms->owner)->last = NULL;
+        if (mc->last)  pool_mux_srv(mc->last)->owner = NULL;
+
+        ms->owner = cli;
+        mc->last  = srv;
+    }
+
+    ms->dirty  = true;
+    ms->state  = POOL_MUX_BUSY;
+    ms->client = cli;
+    mc->server = srv;
+    pool->mux_busy++;
+
+    pool_set_read (pool, cli, true);
+}
+
+/* Returns server connection to the pool or hands it over to the first
+ * client waiting for it. */
+static void
+pool_mux_server_idle (pool_t* const pool, pool_conn_end_t* const srv)
+{
+    pool_mux_server_t* const ms = pool_mux_srv (srv);
+    pool_conn_end_t*         cli;
+
+    assert (NULL == ms->client);
+
+    ms->state = POOL_MUX_IDLE;
+    pool_set_read (pool, srv, true);
+
+    for (cli = pool->mux_wait; cli; cli = pool_mux_cli(cli)->next) {
+        if (pool_mux_match (ms, pool_mux_cli (cli))) {
+            pool_mux_wait_del (pool, cli);
+            pool_mux_bind (pool, cli, srv);
+            /* client packets are moved in pool_mux_handle_write() */
+            pool_set_write (pool, srv);
+            return;
+        }
+    }
+
+    ms->prev = NULL;
+    ms->next = pool->mux_idle;
+    if (ms->next) pool_mux_srv(ms->next)->prev = srv;
+    pool->mux_idle = srv;
+}
+
+static void
+pool_mux_client_close (pool_t* const pool, pool_conn_end_t* const cli)
+{
+    pool_conn_end_t* const srv = pool_mux_cli(cli)->server;
+
+    if (srv) {
+        bool const reuse = pool_mux_reusable (cli, srv);
+
+        pool_mux_detach (pool, cli);
+
+        if (reuse) pool_mux_server_idle  (pool, srv);
+        else       pool_mux_server_close (pool, srv, true, GLB_ROUTER_OK);
+    }
+
+    pool_mux_client_free (pool, cli);
+}
+
+/* server connection is lost together with the attached client. Losing it
+ * in the middle of a client transaction or statement says the server is
+ * unhealthy, idle connection may just have timed out on the server. */
+static void
+pool_mux_server_fail (pool_t* const pool, pool_conn_end_t* const srv,
+                      bool const notify_router)
+{
+    pool_conn_end_t* const cli = pool_mux_srv(srv)->client;
+
+    pool_mux_server_close (pool, srv, notify_router,
+                           cli ? GLB_ROUTER_ERROR : GLB_ROUTER_OK);
+
+    if (cli) pool_mux_client_close (pool, cli);
+}
+
+static void
+pool_mux_remove (pool_t* const pool, int const fd, bool const notify_router)
+{
+    pool_conn_end_t* const end = pool->route_map[fd];
+
+    if (POOL_END_CLIENT == end->end) pool_mux_client_close (pool, end);
+    else pool_mux_server_fail (pool, end, notify_router);
+}
+
+static void
+pool_remove_conn (pool_t* const pool, int const fd, bool const notify_router)
+{
+    pool_conn_end_t* inc_end;
+    pool_conn_end_t* dst_end;
+    bool             full; // whether to do full cleanup
+    bool             from_server;
+
+    if (pool->cnf->mysql_mux) {
+        pool_mux_remove (pool, fd, notify_router);
+        return;
+    }
+
+    if (pool->route_map[fd]->end != POOL_END_CLIENT) { // close from client
+        dst_end = pool->route_map[fd];
+        inc_end = (pool_conn_end_t*)(((uint8_t*)dst_end) - pool_end_size);
+        full    = true;
+        from_server = false;
+    }
+    else {
+        inc_end = pool->route_map[fd];
+        dst_end = (pool_conn_end_t*)(((uint8_t*)inc_end) + pool_end_size);
+        full    = POOL_END_INCOMPLETE != dst_end->end;
+        from_server = true;
+
+        if (GLB_UNLIKELY(dst_end->sock != fd)) { // MySQL reader
+            if (pool_mysql_reader_lost (pool, inc_end, notify_router)) return;
+            full = true;
+        }
+
+#ifndef NDEBUG
+        if (notify_router) { glb_log_warn ("Connection close from server"); }
+#endif
+    }
+
+    pool->n_conns--;
+    GLB_STATS_INC (pool->stats.conns_closed);
+
+#ifdef GLB_USE_SOCKMAP
+    if (POOL_SM_KERNEL == dst_end->sm_state) {
+        glb_sockmap_del (&inc_end->sm_key, &dst_end->sm_key);
+        dst_end->sm_state = POOL_SM_NONE;
+    }
+#endif
+
+    pool_reset_conn_end (pool, dst_end, true);
+
+    if (dst_end->lat_idx >= 0) {
+        pool_lat_record (&pool->lat.lat[dst_end->lat_idx].lifetime,
+                         inc_end->start, glb_time_mono());
+        dst_end->lat_idx = -1;
+    }
+
+    if (full) {
+        pool_reset_conn_end (pool, inc_end, true);
+
+        if (notify_router) {
+            /* server that drops (or resets) connection before sending
+             * anything is likely unhealthy, client leaving is not a sign */
+            glb_router_result_t const result = inc_end->replied ?
+                GLB_ROUTER_OK :
+                (from_server ? GLB_ROUTER_ERROR : GLB_ROUTER_NONE);
+
+            glb_router_disconnect (pool->router, &dst_end->handle, result);
+        }
+
+        if (pool->cnf->mysql_split) {
+            pool_mysql_sess(inc_end)->phase = POOL_MYSQL_RAW; // nothing to send
+            pool_mysql_reader_close (pool, inc_end, notify_router, false);
+        }
+
+#ifdef GLB_USE_SPLICE
+        close (dst_end->splice[0]); close (dst_end->splice[1]);
+        close (inc_end->splice[0]); close (inc_end->splice[1]);
+#endif
+        free (inc_end); // frees both ends
+    }
+    else {
+        pool_reset_conn_end (pool, inc_end, false);
+        assert (false == notify_router);
+        /* at this point we should be as if before pool_handle_add_conn() */
+    }
+}
+
+static inline int
+pool_handle_async_conn (pool_t*          pool,
+                        pool_conn_end_t* dst_end)
+{
+    uint32_t const ka_opt = pool->cnf->keepalive * GLB_SOCK_KEEPALIVE;
+
+    dst_end->sock = glb_socket_create_to(&dst_end->addr, &pool->addr_out,
+                                         GLB_SOCK_NODELAY  |
+                                         GLB_SOCK_NONBLOCK |
+                                         ka_opt);
+    int error;
+    if (dst_end->sock > 0) {
+        dst_end->start = glb_time_mono();
+        int ret = connect (dst_end->sock, &dst_end->addr.sa,
+                           glb_sockaddr_len (&dst_end->addr));
+        error = ret ? errno : 0;
+        /* should be EINPROGRESS in case of success, UNIX socket connection
+         * may complete immediately */
+        assert (error || glb_sockaddr_is_unix (&dst_end->addr));
+        if (GLB_UNLIKELY(error != EINPROGRESS) && error != 0) {
+            glb_log_error ("Async connect() failed: %d (%s)",
+                           error, strerror(error));
+            close (dst_end->sock);
+        }
+        else error = 0;
+    }
+    else {
+        error = errno;
+        if (error != EINPROGRESS) {
+            glb_log_error ("Creating destination socket failed: %d (%s)",
+                           error, strerror(error));
+        }
+    }
+
+    return error;
+}
+
+// connects to MySQL reader, on failure reads just go to the writer
+static void
+pool_mysql_reader_open (pool_t* const pool, pool_conn_end_t* const inc_end)
+{
+    pool_conn_end_t* const dst_end = pool_end_next (inc_end, 1);
+    pool_conn_end_t* const reader  = pool_mysql_reader (inc_end);
+
+    if (glb_router_choose_reader (pool->router, &dst_end->handle,
+                                  &reader->addr, &reader->handle))
+        return;
+
+    if (pool_handle_async_conn (pool, reader)) {
+        glb_router_disconnect (pool->router, &reader->handle,
+                               GLB_ROUTER_FAILED);
+        reader->sock = -1;
+        return;
+    }
+
+    pool_set_conn_end (pool, reader, inc_end);
+    pool_mysql_sess(inc_end)->reader = POOL_MYSQL_READER_GREETING;
+}
+
+static void
+pool_mux_add_conn (pool_t* const pool, pool_conn_end_t* const cli)
+{
+    pool_conn_end_t* const srv = pool_mux_cli(cli)->server;
+
+    if (srv->sock < 0) {
+        if (pool_handle_async_conn (pool, srv)) {
+            glb_router_disconnect (pool->router, &srv->handle,
+                                   GLB_ROUTER_FAILED);
+            close (cli->sock);
+            free (srv);
+            free (cli);
+            return;
+        }
+    }
+    else {
+        pool_lat_connected (pool, srv, glb_time_mono());
+    }
+
+    pool_set_conn_end (pool, cli, cli);
+    pool_set_conn_end (pool, srv, srv);
+
+    pool_mux_srv(srv)->all = pool->mux_all;
+    pool->mux_all = srv;
+    pool->mux_servers++;
+    pool->mux_busy++;
+
+    pool->n_conns++;
+    GLB_STATS_INC (pool->stats.conns_opened);
+
+    if (pool->cnf->verbose) {
+        glb_log_info ("Pool %d: added MySQL client (total pool connections: "
+                      "%d, server connections: %d)",
+                      pool->id, pool->n_conns, pool->mux_servers);
+    }
+}
+
+static void
+pool_handle_add_conn (pool_t* pool, pool_ctl_t* ctl)
+{
+    pool_conn_end_t* inc_end = ctl->data;
+    pool_conn_end_t* dst_end = ctl->data + pool_end_size;
+
+    if (pool->cnf->mysql_mux) {
+        pool_mux_add_conn (pool, inc_end);
+        return;
+    }
+
+    assert (POOL_END_CLIENT == inc_end->end);
+    assert (inc_end->sock > 0);
+
+    if (dst_end->sock < 0) {
+        assert (POOL_END_INCOMPLETE == dst_end->end);
+        if (pool_handle_async_conn (pool, dst_end)) {
+            glb_router_disconnect (pool->router, &dst_end->handle,
+                                   GLB_ROUTER_FAILED);
+            if (pool->cnf->mysql_split) { // could be open if reconnecting
+                pool_mysql_reader_close (pool, inc_end, true, false);
+            }
+            close (inc_end->sock);
+            free (inc_end);
+            return;
+        }
+    }
+    else {
+        assert (POOL_END_COMPLETE   == dst_end->end);
+        /* connected synchronously by the listener, dst_end->start is the
+         * accept time */
+        pool_lat_connected (pool, dst_end, glb_time_mono());
+    }
+
+    pool_set_conn_end (pool, inc_end, dst_end);
+    pool_set_conn_end (pool, dst_end, inc_end);
+
+    if (pool->cnf->mysql_split &&
+        POOL_MYSQL_READER_NONE == pool_mysql_sess(inc_end)->reader &&
+        POOL_MYSQL_AUTH == pool_mysql_sess(inc_end)->phase) {
+        pool_mysql_reader_open (pool, inc_end);
+    }
+
+    pool->n_conns++;
+    GLB_STATS_INC (pool->stats.conns_opened);
+
+    if (pool->cnf->verbose) {
+        glb_log_info ("Pool %d: added connection "
+                      "(total pool connections: %d)", pool->id, pool->n_conns);
+    }
+}
+
+/* closes all connections in the destination list
+ * @param notify_router false if router has dropped this destination already */
+static void
+pool_dst_drop (pool_t* const pool, pool_dst_t* const d,
+               bool const notify_router)
+{
+    pool_conn_end_t* end;
+
+    while ((end = d->head)) {
+        pool_conn_end_t* const other = pool->route_map[end->sock];
+
+        /* whole connection goes from the client side, unless it is MySQL
+         * reader or multiplexed server connection which have their own
+         * handling. */
+        if (!pool->cnf->mysql_mux && pool_end_next (other, 1) == end)
+            pool_remove_conn (pool, other->sock, notify_router);
+        else
+            pool_remove_conn (pool, end->sock, notify_router);
+
+        assert (d->head != end);
+    }
+}
+
+static void
+pool_handle_drop_dst (pool_t* pool, pool_ctl_t* ctl)
+{
+    assert (POOL_CTL_DROP_DST == ctl->code);
+
+    const glb_sockaddr_t* const dst = ctl->data;
+    int const i = pool_dst_find (&pool->dst, dst);
+
+    if (i < pool->dst.n_dst) pool_dst_drop (pool, &pool->dst.dst[i], false);
+
+    /* destination is gone from the router, forget its latencies */
+    int j;
+    for (j = 0; j < pool->lat.n_lat; j++) {
+        pool_lat_t* const l = &pool->lat.lat[j];
+        if (l->gen && glb_sockaddr_is_equal (&l->addr, dst)) l->gen = 0;
+    }
+}
+
+static void
+pool_handle_latency (pool_t* pool, pool_ctl_t* ctl)
+{
+    pool_lat_set_t* const set = ctl->data;
+    int i;
+
+    for (i = 0; i < pool->lat.n_lat; i++) {
+        const pool_lat_t* const from = &pool->lat.lat[i];
+
+        if (!from->gen) continue;
+
+        int const idx = pool_lat_find (set, &from->addr);
+
+        if (GLB_UNLIKELY(idx < 0)) {
+            glb_log_error ("Failed to merge latency histograms: %d (%s)",
+                           -idx, strerror (-idx));
+            return;
+        }
+
+        pool_lat_t* const to = &set->lat[idx];
+        glb_hist_add (&to->connect,  &from->connect);
+        glb_hist_add (&to->ttfb,     &from->ttfb);
+        glb_hist_add (&to->lifetime, &from->lifetime);
+    }
+}
+
+// text buffer that pool threads append their connection lists to
+typedef struct pool_conns_buf
+{
+    char*  buf;
+    size_t buf_len;
+    size_t len;
+} pool_conns_buf_t;
+
+static void
+pool_handle_conns (pool_t* pool, pool_ctl_t* ctl)
+{
+    pool_conns_buf_t* const b = ctl->data;
+    int i;
+
+    for (i = 0; i < pool->dst.n_dst && b->len < b->buf_len - 1; i++) {
+        const pool_dst_t* const d = &pool->dst.dst[i];
+        pool_conn_end_t* end;
+
+        if (0 == d->n_conns) continue;
+
+        glb_sockaddr_str_t const addr = glb_sockaddr_to_astr (&d->addr);
+        b->len += snprintf (b->buf + b->len, b->buf_len - b->len,
+                            "%s : %4d %6d\n", addr.str, pool->id, d->n_conns);
+
+        for (end = d->head; end && b->len < b->buf_len - 1;
+             end = end->dst_next) {
+            pool_conn_end_t* const client = pool->cnf->mysql_mux ?
+                pool_mux_srv(end)->client : pool->route_map[end->sock];
+
+            if (!client) { // idle multiplexed server connection
+                b->len += snprintf (b->buf + b->len, b->buf_len - b->len,
+                                    "                      :   (idle)\n");
+                continue;
+            }
+
+            bool const reader = !pool->cnf->mysql_mux &&
+                pool_end_next (client, 1) != end;
+            glb_sockaddr_str_t const caddr = glb_sockaddr_to_astr(&client->addr);
+
+            b->len += snprintf (b->buf + b->len, b->buf_len - b->len,
+                                "                      :   %s%s%s\n", caddr.str,
+                                reader ? " (reader)" : "",
+                                POOL_END_INCOMPLETE == end->end ?
+                                " (connecting)" : "");
+        }
+    }
+
+    if (b->len >= b->buf_len) {
+        b->len = b->buf_len - 1;
+        b->buf[b->len] = '\0';
+    }
+}
+
+static void
+pool_handle_shutdown (pool_t* pool)
+{
+    int i, fd;
+
+    /* retiring pool still may have idle multiplexed server connections,
+     * those are not counted in n_conns, but are in the router */
+    for (i = 0; i < pool->dst.n_dst; i++) {
+        pool_dst_drop (pool, &pool->dst.dst[i], pool->cnf->mysql_mux > 0);
+    }
+
+    /* what is left are multiplexed clients without server connection */
+    for (fd = 0; pool->fd_max > 1; fd++) { // ctl_recv is not in route_map
+        pool_conn_end_t* end = pool->route_map[fd];
+
+        assert (fd < POOL_MAX_FD);
+
+        if (end) pool_remove_conn (pool, fd, false);
+    }
+
+    close (pool->ctl_recv);
+    pool->shutdown = true;
+}
+
+static int
+pool_handle_ctl (pool_t* pool)
+{
+    pool_ctl_t ctl;
+
+    // remove ctls from poll count to get only traffic polls
+    GLB_STATS_DEC (pool->stats.n_polls);
+
+    ssize_t ret = read (pool->ctl_recv, &ctl, sizeof(ctl));
+
+    if (sizeof(ctl) != ret) { // incomplete ctl read, should never happen
+        glb_log_fatal ("Incomplete read from ctl, errno: %d (%s)",
+                       errno, strerror (errno));
+        abort();
+    }
+
+    switch (ctl.code) {
+    case POOL_CTL_ADD_CONN:
+        pool_handle_add_conn (pool, &ctl);
+        break;
+    case POOL_CTL_DROP_DST:
+        pool_handle_drop_dst (pool, &ctl);
+        break;
+    case POOL_CTL_LATENCY:
+        pool_handle_latency  (pool, &ctl);
+        break;
+    case POOL_CTL_CONNS:
+        pool_handle_conns    (pool, &ctl);
+        break;
+    case POOL_CTL_SHUTDOWN:
+        pool_handle_shutdown (pool);
+        break;
+    default: // nothing else is implemented
+        glb_log_warn ("Unsupported CTL: %d\n", ctl.code);
+    }
+
+    // Notify ctl sender
+    GLB_MUTEX_LOCK (&pool->lock);
+    pthread_cond_signal (&pool->cond);
+    GLB_MUTEX_UNLOCK (&pool->lock);
+
+    return 0;
+}
+
+#ifdef GLB_USE_SOCKMAP
+static inline bool
+pool_sm_idle (int const fd)
+{
+    int pending = 0;
+    return (!ioctl (fd, FIONREAD, &pending) && 0 == pending);
+}
+
+/* Hands connection over to kernel. Only done when nothing is buffered or
+ * queued in either direction, otherwise kernel could overtake our data.
+ * Waits for the server reply so that TTFB is still recorded. */
+static void
+pool_sm_offload (pool_t* const pool, pool_conn_end_t* const end)
+{
+    pool_conn_end_t* inc_end;
+    pool_conn_end_t* dst_end;
+
+    /* multiplexed connections have separate client and server objects */
+    if (pool->cnf->mysql_mux) return;
+
+    if (POOL_END_CLIENT == end->end) {
+        inc_end = end;
+        dst_end = (pool_conn_end_t*)((uint8_t*)end + pool_end_size);
+    }
+    else {
+        inc_end = (pool_conn_end_t*)((uint8_t*)end - pool_end_size);
+        dst_end = end;
+    }
+
+    if (GLB_LIKELY(POOL_SM_NONE != dst_end->sm_state) ||
+        pool->cnf->mysql_split /* protocol must be followed */ ||
+        POOL_END_COMPLETE != dst_end->end || !inc_end->replied ||
+        inc_end->total || dst_end->total ||
+        !pool_sm_idle (inc_end->sock) || !pool_sm_idle (dst_end->sock)) return;
+
+    int const err = glb_sockmap_add (inc_end->sock, &inc_end->sm_key,
+                                     dst_end->sock, &dst_end->sm_key);
+    if (!err) {
+        dst_end->sm_state = POOL_SM_KERNEL;
+        if (pool->cnf->verbose) {
+            glb_log_info ("Pool %d: connection %d <-> %d forwarded by kernel",
+                          pool->id, inc_end->sock, dst_end->sock);
+        }
+    }
+    else {
+        dst_end->sm_state = POOL_SM_FAILED;
+        glb_log_debug ("Failed to add connection %d <-> %d to sockmap: %d (%s)",
+                       inc_end->sock, dst_end->sock, -err, strerror(-err));
+    }
+}
+#endif /* GLB_USE_SOCKMAP */
+
+static inline ssize_t
+pool_send_data (pool_t* pool, pool_conn_end_t* dst, pool_conn_end_t* src)
+{
+    ssize_t  ret;
+    uint32_t dst_events = dst->events;
+
+#ifndef GLB_USE_SPLICE
+#ifdef MSG_NOSIGNAL
+    ret = send (dst->sock, &dst->buf[dst->sent], dst->total - dst->sent,
+                MSG_DONTWAIT | MSG_NOSIGNAL);
+#else
+    ret = send (dst->sock, &dst->buf[dst->sent], dst->total - dst->sent,
+                MSG_DONTWAIT);
+#endif
+#else
+    ret = splice (dst->splice[0], NULL, dst->sock, NULL,
+                  dst->total - dst->sent, SPLICE_F_NONBLOCK);
+#endif
+
+    if (GLB_LIKELY(ret > 0)) {
+        GLB_STATS_ADD (pool->stats.send_bytes, ret);
+        if (POOL_END_CLIENT == dst->end)
+            GLB_STATS_ADD (pool->stats.tx_bytes, ret);
+
+        dst->sent += ret;
+        if (dst->sent == dst->total) {        // all data sent, reset pointers
+            dst->sent  =  dst->total = 0;
+            /* UNIX socket may accept data before connection completion
+             * is handled, keep WRITE flag for pool_handle_write() then */
+            if (GLB_LIKELY(POOL_END_INCOMPLETE != dst->end))
+                dst_events &= ~POOL_FD_WRITE; // clear WRITE flag
+#ifdef GLB_USE_SOCKMAP
+            pool_sm_offload (pool, dst);
+#endif
+        }
+        else {                                // there is unsent data left
+            glb_log_debug ("Setting WRITE flag on %s: sent = %zu, total = "
+                           "%zu, bufsiz = %zu",
+                           POOL_END_CLIENT == dst->end ? "client" : "server",
+                           dst->sent, dst->total,pool_buf_size);
+            dst_events |= POOL_FD_WRITE;      // set   WRITE flag
+        }
+
+        if (src && !(src->events & POOL_FD_READ) &&
+            (dst->total < pool_buf_size)) {
+            // some space exists in the buffer, reestablish READ flag in src
+            src->events |= POOL_FD_READ;
+            pool_fds_set_events (pool, src);
+        }
+    }
+    else {
+        ret = -errno;
+        switch (-ret) {
+        case EINTR:    // 4
+        case EAGAIN:   // 11
+        case EBUSY:    // 16
+        case ENOBUFS:  // 105
+        case ENOTCONN: // 107
+            glb_log_debug ("Send data error: %d (%s)", -ret, strerror(-ret));
+            dst_events |= POOL_FD_WRITE;
+            ret = 0; // pretend nothing happened
+            break;
+        case EPIPE:    // 32
+            /* according to man 2 send,
+             * Linux can return EPIPE on unconnected socket. WTF? */
+            if (POOL_END_INCOMPLETE != dst->end) {
+                glb_log_debug ("pool_remove_conn() from pool_send_data()");
+                pool_remove_conn(pool, dst->sock, true);
+            }
+            else {
+                /* POOL_FD_WRITE is already set there, just wait for it */
+                ret = 0;
+            }
+            return ret;
+        default:
+            glb_log_warn ("Send data failed, unhandled error: %d (%s)",
+                          -ret, strerror(-ret));
+        }
+    }
+
+    GLB_STATS_INC (pool->stats.n_send);
+
+    if (dst_events != dst->events) { // events changed
+        glb_log_debug ("Old flags on %s: %s %s",
+                       POOL_END_CLIENT == dst->end ? "client":"server",
+                       dst->events & POOL_FD_READ  ? "POOL_FD_READ":"",
+                       dst->events & POOL_FD_WRITE ? "POOL_FD_WRITE":"");
+        dst->events = dst_events;
+        pool_fds_set_events (pool, dst);
+        glb_log_debug ("New flags on %s: %s %s",
+                       POOL_END_CLIENT == dst->end ? "client":"server",
+                       dst->events & POOL_FD_READ  ? "POOL_FD_READ":"",
+                       dst->events & POOL_FD_WRITE ? "POOL_FD_WRITE":"");
+    }
+
+    return ret;
+}
+
+/* Sends whatever is queued on connection ends that are not waiting for
+ * POOL_FD_WRITE already.
+ * @return -EPIPE if connection was removed, 0 otherwise */
+static int
+pool_mysql_flush (pool_t* const pool, pool_conn_end_t* const inc_end)
+{
+    pool_conn_end_t* const ends[3] = {
+        inc_end, pool_end_next (inc_end, 1), pool_mysql_reader (inc_end)
+    };
+    int i;
+
+    for (i = 0; i < 3; i++) {
+        pool_conn_end_t* const end = ends[i];
+
+        if (end->total > 0 && end->sock >= 0 &&
+            POOL_END_INCOMPLETE != end->end &&
+            !(end->events & POOL_FD_WRITE) &&
+            -EPIPE == pool_send_data (pool, end, NULL)) return -EPIPE;
+    }
+
+    /* servers may have stopped reading on full client buffer */
+    if (inc_end->total < pool_buf_size) {
+        for (i = 1; i < 3; i++) {
+            if (POOL_END_COMPLETE == ends[i]->end)
+                pool_set_read (pool, ends[i], true);
+        }
+    }
+
+    return 0;
+}
+
+// asks the client to authenticate with the reader
+static void
+pool_mysql_switch (pool_t* const pool, pool_conn_end_t* const inc_end)
+{
+    pool_mysql_t* const s = pool_mysql_sess (inc_end);
+    uint8_t const seq = s->ok[3]; // request goes in place of the OK
+
+    long const len = glb_mysql_auth_switch_write (&s->greeting, seq,
+                                                  inc_end->buf + inc_end->total,
+                                                  pool_buf_size-inc_end->total);
+    if (len < 0) {
+        pool_mysql_reader_close (pool, inc_end, true, false);
+        return;
+    }
+
+    inc_end->total += len;
+    s->seq_off      = seq;
+    s->seq          = seq;
+    s->await_client = true;
+    s->phase        = POOL_MYSQL_SWITCH;
+}
+
+// writer packets during client authentication
+static void
+pool_mysql_writer_auth (pool_t* const pool, pool_conn_end_t* const inc_end)
+{
+    pool_mysql_t* const s = pool_mysql_sess (inc_end);
+    size_t off = 0;
+
+    while (POOL_MYSQL_AUTH == s->phase &&
+           s->wbuf_len - off >= GLB_MYSQL_HDR_LEN) {
+        uint8_t* const p   = s->wbuf + off;
+        size_t   const len = glb_mysql_pkt_len (p);
+        size_t   const pkt = GLB_MYSQL_HDR_LEN + len;
+        uint8_t* const payload = p + GLB_MYSQL_HDR_LEN;
+
+        if (pkt > s->wbuf_len - off || pkt > pool_buf_size - inc_end->total)
+            break;
+
+        if (!s->greeted) {
+            glb_mysql_greeting_mask (payload, len);
+            s->greeted = true;
+        }
+        else if (len > 0 && GLB_MYSQL_OK == payload[0]) {
+            s->w_resp.status = glb_mysql_ok_status (payload, len);
+
+            if (s->login_ok && POOL_MYSQL_READER_NONE != s->reader &&
+                pkt <= sizeof(s->ok)) {
+                /* hold it until the client is logged in the reader */
+                memcpy (s->ok, p, pkt);
+                s->ok_len = pkt;
+                s->phase  = POOL_MYSQL_HOLD;
+                off += pkt;
+
+                if (POOL_MYSQL_READER_GREETED == s->reader)
+                    pool_mysql_switch (pool, inc_end);
+                break;
+            }
+
+            pool_mysql_raw (pool, inc_end);
+        }
+        else if (len > 0 && GLB_MYSQL_ERR == payload[0]) {
+            pool_mysql_raw (pool, inc_end);
+        }
+        else if (len > 0 && GLB_MYSQL_EOF == payload[0]) {
+            /* clients don't take a second method switch from the reader */
+            pool_mysql_reader_close (pool, inc_end, true, false);
+        }
+
+        pool_mysql_queue (inc_end, p, pkt);
+        off += pkt;
+    }
+
+    s->wbuf_len -= off;
+    memmove (s->wbuf, s->wbuf + off, s->wbuf_len);
+
+    if (POOL_MYSQL_RAW == s->phase) pool_mysql_flush_wbuf (s, inc_end);
+}
+
+// reader packets until it accepts the client
+static void
+pool_mysql_reader_auth (pool_t* const pool, pool_conn_end_t* const inc_end)
+{
+    pool_mysql_t* const s = pool_mysql_sess (inc_end);
+    size_t off = 0;
+
+    while (s->rbuf_len - off >= GLB_MYSQL_HDR_LEN) {
+        uint8_t* const p   = s->rbuf + off;
+        size_t   const len = glb_mysql_pkt_len (p);
+        size_t   const pkt = GLB_MYSQL_HDR_LEN + len;
+        uint8_t* const payload = p + GLB_MYSQL_HDR_LEN;
+
+        if (pkt > s->rbuf_len - off) break;
+
+        if (POOL_MYSQL_READER_GREETING == s->reader) {
+            if (glb_mysql_greeting_parse (&s->greeting, payload, len)) {
+                glb_log_warn ("Unsupported MySQL reader greeting.");
+                pool_mysql_reader_close (pool, inc_end, true, false);
+                return;
+            }
+
+            s->reader = POOL_MYSQL_READER_GREETED;
+            off += pkt;
+
+            if (POOL_MYSQL_HOLD == s->phase) pool_mysql_switch (pool, inc_end);
+            continue;
+        }
+
+        if (POOL_MYSQL_READER_LOGIN != s->reader) { // nothing was asked
+            pool_mysql_reader_close (pool, inc_end, true, false);
+            return;
+        }
+
+        if ((pkt > s->ok_len ? pkt : s->ok_len) >
+            pool_buf_size - inc_end->total) break;
+
+        uint8_t const seq = glb_mysql_pkt_seq (p) + s->seq_off;
+
+        if (len > 0 && GLB_MYSQL_OK == payload[0]) {
+            pool_conn_end_t* const dst_end = pool_end_next (inc_end, 1);
+
+            if (pool->cnf->verbose) {
+                glb_sockaddr_str_t w = glb_sockaddr_to_str (&dst_end->addr);
+                glb_sockaddr_str_t r = glb_sockaddr_to_str (
+                    &pool_mysql_reader(inc_end)->addr);
+                glb_log_info ("Pool %d: MySQL client %d writes to %s, "
+                              "reads from %s", pool->id, inc_end->sock,
+                              w.str, r.str);
+            }
+
+            s->reader   = POOL_MYSQL_READER_READY;
+            s->rbuf_len = 0; // nothing should follow
+            pool_mysql_send_ok (pool, inc_end, seq, POOL_MYSQL_CMD);
+            return;
+        }
+
+        if (len > 0 && GLB_MYSQL_ERR == payload[0]) {
+            glb_log_info ("MySQL reader refused client login.");
+            pool_mysql_reader_close (pool, inc_end, true, false);
+            return;
+        }
+
+        /* more authentication data or method switch, client must reply
+         * unless it is "fast authentication succeeded" */
+        pool_mysql_queue (inc_end, p, pkt);
+        inc_end->buf[inc_end->total - pkt + 3] = seq;
+        s->seq = seq;
+        s->await_client = !(2 == len && 0x01 == payload[0] &&
+                            0x03 == payload[1]);
+        off += pkt;
+    }
+
+    s->rbuf_len -= off;
+    memmove (s->rbuf, s->rbuf + off, s->rbuf_len);
+}
+
+// closes reader once session is pinned to the writer and reader is idle
+static inline void
+pool_mysql_reader_check (pool_t* const pool, pool_conn_end_t* const inc_end)
+{
+    pool_mysql_t* const s = pool_mysql_sess (inc_end);
+
+    if (GLB_UNLIKELY(s->pinned) && POOL_MYSQL_READER_READY == s->reader &&
+        pool_mysql_reader_idle (s) &&
+        !(pool_mysql_reader (inc_end) == s->target && s->target_left > 0)) {
+        pool_mysql_reader_close (pool, inc_end, true, false);
+    }
+}
+
+/* Copies (beginning of) client packet to the target end.
+ * @return bytes copied */
+static size_t
+pool_mysql_forward (pool_mysql_t* const s, pool_conn_end_t* const target,
+                    const uint8_t* const p, size_t const have,
+                    size_t const pkt)
+{
+    size_t const space = pool_buf_size - target->total;
+    size_t n = have;
+
+    if (have == pkt) {
+        if (pkt > space) return 0;
+    }
+    else { // long packet, the rest follows
+        n = pool_min (have, space);
+        if (0 == n) return 0;
+        s->target      = target;
+        s->target_left = pkt - n;
+    }
+
+    memcpy (target->buf + target->total, p, n);
+    target->total += n;
+
+    return n;
+}
+
+// client packets during authentication with the writer
+static size_t
+pool_mysql_client_login (pool_t* const pool, pool_conn_end_t* const inc_end,
+                         uint8_t* const p, size_t const have, size_t const pkt)
+{
+    pool_mysql_t* const s = pool_mysql_sess (inc_end);
+
+    if (0 == s->seq) { // handshake response
+        s->login_ok = have == pkt &&
+            !glb_mysql_login_parse (&s->login, p + GLB_MYSQL_HDR_LEN,
+                                    pkt - GLB_MYSQL_HDR_LEN) &&
+            (s->login.caps & GLB_MYSQL_CLIENT_PLUGIN_AUTH);
+
+        s->seq = glb_mysql_pkt_seq (p);
+
+        /* e.g. SSL, nothing to follow */
+        if (!s->login_ok) pool_mysql_raw (pool, inc_end);
+    }
+    else {
+        s->seq = glb_mysql_pkt_seq (p);
+    }
+
+    return pool_mysql_forward (s, pool_end_next (inc_end, 1), p, have, pkt);
+}
+
+// client packets during authentication with the reader
+static size_t
+pool_mysql_client_switch (pool_t* const pool, pool_conn_end_t* const inc_end,
+                          uint8_t* const p, size_t const have, size_t const pkt)
+{
+    pool_mysql_t*    const s      = pool_mysql_sess (inc_end);
+    pool_conn_end_t* const reader = pool_mysql_reader (inc_end);
+
+    if (have != pkt) { // can't be authentication data
+        pool_mysql_raw (pool, inc_end);
+        return 0;
+    }
+
+    s->seq = glb_mysql_pkt_seq (p);
+    s->await_client = false;
+
+    if (POOL_MYSQL_READER_NONE == s->reader) {
+        /* reader is gone, client is logged in the writer already */
+        pool_mysql_send_ok (pool, inc_end, s->seq + 1, POOL_MYSQL_RAW);
+        return pkt;
+    }
+
+    if (POOL_MYSQL_READER_GREETED == s->reader) {
+        long const len = glb_mysql_login_write (
+            &s->login, s->greeting.plugin, p + GLB_MYSQL_HDR_LEN,
+            pkt - GLB_MYSQL_HDR_LEN, 1, reader->buf + reader->total,
+            pool_buf_size - reader->total);
+
+        if (len < 0) {
+            pool_mysql_reader_close (pool, inc_end, true, false);
+        }
+        else {
+            reader->total += len;
+            s->reader = POOL_MYSQL_READER_LOGIN;
+        }
+
+        return pkt;
+    }
+
+    if (!pool_mysql_queue (reader, p, pkt)) return 0;
+
+    reader->buf[reader->total - pkt + 3] = s->seq - s->seq_off;
+
+    return pkt;
+}
+
+// client packets in command phase
+static size_t
+pool_mysql_client_cmd (pool_t* const pool, pool_conn_end_t* const inc_end,
+                       uint8_t* const p, size_t const have, size_t const pkt)
+{
+    pool_mysql_t*    const s      = pool_mysql_sess (inc_end);
+    pool_conn_end_t* const writer = pool_end_next (inc_end, 1);
+    pool_conn_end_t* const reader = pool_mysql_reader (inc_end);
+
+    if (0 != glb_mysql_pkt_seq (p) || pkt == GLB_MYSQL_HDR_LEN) {
+        /* continues previous command, e.g. LOCAL INFILE data */
+        return pool_mysql_forward (s, s->last_reader ? reader : writer,
+                                   p, have, pkt);
+    }
+
+    uint8_t const cmd   = p[GLB_MYSQL_HDR_LEN];
+    bool    const ready = POOL_MYSQL_READER_READY == s->reader && !s->pinned &&
+                          GLB_MYSQL_RESP_DONE == s->r_resp.state;
+    bool    const whole = (have == pkt);
+    pool_conn_end_t* target = writer;
+    bool             needs_mirror = false;
+    bool             mirror = false;
+    bool             pin    = false;
+
+    switch (cmd) {
+    case GLB_MYSQL_COM_QUERY:
+        switch (whole ? glb_mysql_stmt_class ((const char*)p +
+                                              GLB_MYSQL_HDR_LEN + 1,
+                                              pkt - GLB_MYSQL_HDR_LEN - 1) :
+                GLB_MYSQL_STMT_WRITE) {
+        case GLB_MYSQL_STMT_READ:
+            /* reader may still owe responses to mirrored statements,
+             * those come first and are dropped in pool_mysql_walk() */
+            if (ready && GLB_MYSQL_RESP_DONE == s->w_resp.state &&
+                s->w_resp.status >= 0 &&
+                (s->w_resp.status & GLB_MYSQL_STATUS_AUTOCOMMIT) &&
+                !(s->w_resp.status & GLB_MYSQL_STATUS_IN_TRANS)) {
+                target = reader;
+            }
+            break;
+        case GLB_MYSQL_STMT_SESSION:
+            needs_mirror = true;
+            break;
+        case GLB_MYSQL_STMT_PIN:
+            pin = true;
+            break;
+        case GLB_MYSQL_STMT_WRITE:
+            break;
+        }
+        break;
+    case GLB_MYSQL_COM_INIT_DB:
+    case GLB_MYSQL_COM_SET_OPTION:
+    case GLB_MYSQL_COM_RESET_CONNECTION:
+        needs_mirror = true;
+        break;
+    case GLB_MYSQL_COM_CHANGE_USER:
+        pin = true;
+        break;
+    }
+
+    mirror = needs_mirror && ready && whole;
+
+    /* whole packet must fit before anything is changed */
+    if (whole && (pkt > pool_buf_size - target->total ||
+                  (mirror && pkt > pool_buf_size - reader->total))) return 0;
+
+    if (mirror) {
+        pool_mysql_queue (reader, p, pkt);
+        s->discard++;
+    }
+
+    /* session change that the reader can't get now, or unknown command */
+    if (pin || (needs_mirror && !mirror)) s->pinned = true;
+
+    s->last_reader = (target == reader);
+    glb_mysql_resp_start (s->last_reader ? &s->r_resp : &s->w_resp, cmd);
+
+    if (GLB_MYSQL_RESP_UNKNOWN == s->w_resp.state) s->pinned = true;
+
+    return pool_mysql_forward (s, target, p, have, pkt);
+}
+
+// routes client packets, returns bytes consumed
+static size_t
+pool_mysql_client_pkt (pool_t* const pool, pool_conn_end_t* const inc_end,
+                       uint8_t* const p, size_t const have, size_t const pkt)
+{
+    switch (pool_mysql_sess(inc_end)->phase) {
+    case POOL_MYSQL_AUTH:
+        return pool_mysql_client_login (pool, inc_end, p, have, pkt);
+    case POOL_MYSQL_HOLD:
+        return 0; // client should not send anything now
+    case POOL_MYSQL_SWITCH:
+        return pool_mysql_client_switch (pool, inc_end, p, have, pkt);
+    case POOL_MYSQL_CMD:
+        return pool_mysql_client_cmd (pool, inc_end, p, have, pkt);
+    case POOL_MYSQL_RAW:
+        break;
+    }
+
+    assert (0);
+    return 0;
+}
+
+// moves client data to server ends
+static int
+pool_mysql_c2s (pool_t* const pool, pool_conn_end_t* const inc_end)
+{
+    pool_mysql_t*    const s      = pool_mysql_sess (inc_end);
+    pool_conn_end_t* const writer = pool_end_next (inc_end, 1);
+    size_t off = 0;
+
+    while (off < s->cbuf_len) {
+        uint8_t* const p     = s->cbuf + off;
+        size_t   const avail = s->cbuf_len - off;
+        size_t   n;
+
+        if (s->target_left > 0 || POOL_MYSQL_RAW == s->phase) {
+            /* the rest of a long packet or no routing at all */
+            pool_conn_end_t* const t = s->target_left > 0 ? s->target : writer;
+
+            n = pool_min (avail, pool_buf_size - t->total);
+            if (s->target_left > 0) {
+                n = pool_min (n, s->target_left);
+                s->target_left -= n;
+            }
+
+            memcpy (t->buf + t->total, p, n);
+            t->total += n;
+        }
+        else if (avail < GLB_MYSQL_HDR_LEN) {
+            break;
+        }
+        else {
+            size_t const pkt = GLB_MYSQL_HDR_LEN + glb_mysql_pkt_len (p);
+
+            // packets that fit in the buffer are routed whole
+            if (pkt > avail && pkt <= sizeof(s->cbuf)) break;
+
+            n = pool_mysql_client_pkt (pool, inc_end, p, pool_min (pkt, avail),
+                                       pkt);
+        }
+
+        if (0 == n) break;
+
+        off += n;
+    }
+
+    s->cbuf_len -= off;
+    memmove (s->cbuf, s->cbuf + off, s->cbuf_len);
+
+    if (s->cbuf_len < sizeof(s->cbuf)) pool_set_read (pool, inc_end, true);
+
+    pool_mysql_reader_check (pool, inc_end);
+
+    return pool_mysql_flush (pool, inc_end);
+}
+
+static ssize_t
+pool_mysql_read_error (pool_t* const pool, int const fd, ssize_t const ret)
+{
+    if (0 == ret) { // socket closed
+        pool_remove_conn (pool, fd, true);
+        return -EPIPE;
+    }
+
+    if (errno != EAGAIN) {
+        if (errno != ECONNRESET || pool->cnf->verbose) {
+            glb_log_warn ("pool_handle_read(): %d (%s)",
+                          errno, strerror(errno));
+        }
+        return -errno;
+    }
+
+    return 0;
+}
+
+static ssize_t
+pool_mysql_client_read (pool_t* const pool, pool_conn_end_t* const inc_end)
+{
+    pool_mysql_t* const s     = pool_mysql_sess (inc_end);
+    size_t        const space = sizeof(s->cbuf) - s->cbuf_len;
+
+    if (GLB_UNLIKELY(0 == space)) {
+        pool_set_read (pool, inc_end, false);
+        return 0;
+    }
+
+    ssize_t const ret = recv (inc_end->sock, s->cbuf + s->cbuf_len, space, 0);
+
+    GLB_STATS_INC (pool->stats.n_recv);
+
+    if (GLB_UNLIKELY(ret <= 0))
+        return pool_mysql_read_error (pool, inc_end->sock, ret);
+
+    GLB_STATS_ADD (pool->stats.recv_bytes, ret);
+    GLB_STATS_ADD (pool->stats.rx_bytes, ret);
+
+    s->cbuf_len += ret;
+
+    return pool_mysql_c2s (pool, inc_end);
+}
+
+static ssize_t
+pool_mysql_server_read (pool_t* const pool, pool_conn_end_t* const inc_end,
+                        pool_conn_end_t* const src)
+{
+    pool_mysql_t* const s      = pool_mysql_sess (inc_end);
+    bool          const reader = (pool_mysql_reader (inc_end) == src);
+    /* until authentication is over packets are inspected whole */
+    bool          const staged = reader ?
+        s->reader < POOL_MYSQL_READER_READY : s->phase < POOL_MYSQL_CMD;
+    size_t* const staged_len   = reader ? &s->rbuf_len : &s->wbuf_len;
+    uint8_t*      buf;
+    size_t        space;
+
+    if (staged) {
+        buf   = (reader ? s->rbuf : s->wbuf) + *staged_len;
+        space = POOL_MYSQL_SBUF - *staged_len;
+    }
+    else {
+        buf   = inc_end->buf + inc_end->total;
+        space = pool_buf_size - inc_end->total;
+    }
+
+    if (GLB_UNLIKELY(0 == space)) {
+        if (staged && (reader || POOL_MYSQL_AUTH == s->phase)) {
+            glb_log_warn ("MySQL %s authentication packet is too long.",
+                          reader ? "reader" : "writer");
+            if (reader) {
+                pool_mysql_reader_close (pool, inc_end, true, false);
+                return pool_mysql_flush (pool, inc_end);
+            }
+            pool_remove_conn (pool, inc_end->sock, true);
+            return -EPIPE;
+        }
+
+        pool_set_read (pool, src, false);
+        return 0;
+    }
+
+    ssize_t const ret = recv (src->sock, buf, space, 0);
+
+    GLB_STATS_INC (pool->stats.n_recv);
+
+    if (GLB_UNLIKELY(ret <= 0))
+        return pool_mysql_read_error (pool, src->sock, ret);
+
+    GLB_STATS_ADD (pool->stats.recv_bytes, ret);
+
+    if (GLB_UNLIKELY(!reader && !inc_end->replied))
+        pool_lat_replied (pool, inc_end, pool_end_next (inc_end, 1));
+
+    if (staged) {
+        *staged_len += ret;
+        if (reader)
+            pool_mysql_reader_auth (pool, inc_end);
+        else if (POOL_MYSQL_AUTH == s->phase)
+            pool_mysql_writer_auth (pool, inc_end);
+    }
+    else {
+        inc_end->total += POOL_MYSQL_RAW == s->phase ? (size_t)ret :
+            reader ? pool_mysql_walk (&s->r_walk, &s->r_resp, &s->discard,
+                                      &s->pinned, buf, ret) :
+            pool_mysql_walk (&s->w_walk, &s->w_resp, NULL, &s->pinned, buf,ret);
+
+        // no space for next read, clear POOL_FD_READ
+        if (pool_buf_size == inc_end->total) pool_set_read (pool, src, false);
+
+        pool_mysql_reader_check (pool, inc_end);
+    }
+
+    /* client packets may wait for the phase change */
+    return (s->cbuf_len > 0 ? pool_mysql_c2s (pool, inc_end) :
+            pool_mysql_flush (pool, inc_end));
+}
+
+static int
+pool_mysql_reader_connected (pool_t* const pool, pool_conn_end_t* const inc_end)
+{
+    pool_conn_end_t* const reader = pool_mysql_reader (inc_end);
+    int ret = -1;
+    socklen_t ret_size = sizeof(ret);
+
+    getsockopt (reader->sock, SOL_SOCKET, SO_ERROR, &ret, &ret_size);
+
+    if (ret) {
+        glb_sockaddr_str_t a = glb_sockaddr_to_str (&reader->addr);
+        glb_log_info ("Async connection to %s failed: %d (%s)",
+                      a.str, ret, strerror (ret));
+
+        pool_mysql_reader_close (pool, inc_end, true, true);
+        return pool_mysql_flush (pool, inc_end);
+    }
+
+    reader->end    = POOL_END_COMPLETE;
+    reader->events = POOL_FD_READ;
+    pool_fds_set_events (pool, reader);
+
+    return 0;
+}
+
+// there is more space on the end after POOL_FD_WRITE event
+static int
+pool_mysql_write_done (pool_t* const pool, pool_conn_end_t* const inc_end,
+                       pool_conn_end_t* const dst)
+{
+    pool_mysql_t* const s = pool_mysql_sess (inc_end);
+
+    if (POOL_MYSQL_RAW == s->phase && 0 == s->cbuf_len && 0 == s->wbuf_len)
+        return 0; // ordinary forwarding
+
+    if (dst != inc_end) return pool_mysql_c2s (pool, inc_end);
+
+    /* resume what was stopped by the lack of space in client buffer */
+    if (s->wbuf_len > 0) {
+        if (POOL_MYSQL_AUTH == s->phase)
+            pool_mysql_writer_auth (pool, inc_end);
+        else if (s->phase >= POOL_MYSQL_CMD)
+            pool_mysql_flush_wbuf (s, inc_end);
+    }
+
+    if (s->rbuf_len > 0 && POOL_MYSQL_READER_NONE != s->reader)
+        pool_mysql_reader_auth (pool, inc_end);
+
+    pool_conn_end_t* const reader = pool_mysql_reader (inc_end);
+
+    if (POOL_END_COMPLETE == reader->end && inc_end->total < pool_buf_size)
+        pool_set_read (pool, reader, true);
+
+    return pool_mysql_flush (pool, inc_end);
+}
+
+static ssize_t
+pool_mysql_handle_read (pool_t* const pool, pool_conn_end_t* const inc_end,
+                        int const src_fd)
+{
+    if (src_fd == inc_end->sock) return pool_mysql_client_read (pool, inc_end);
+
+    pool_conn_end_t* const dst_end = pool_end_next (inc_end, 1);
+
+    return pool_mysql_server_read (pool, inc_end, dst_end->sock == src_fd ?
+                                   dst_end : pool_mysql_reader (inc_end));
+}
+
+/* Sends client buffer. Login server packets are staged after the total,
+ * they move to the buffer start when everything before them is sent.
+ * @return -EPIPE if connection was removed, 0 otherwise */
+static int
+pool_mux_send (pool_t* const pool, pool_conn_end_t* const cli)
+{
+    pool_mux_client_t* const mc = pool_mux_cli (cli);
+    size_t const total = cli->total;
+
+    if (-EPIPE == pool_send_data (pool, cli, NULL)) return -EPIPE;
+
+    if (mc->stage > 0 && 0 == cli->total && total > 0)
+        memmove (cli->buf, cli->buf + total, mc->stage);
+
+    return 0;
+}
+
+/* Sends whatever is queued on both ends that are not waiting for
+ * POOL_FD_WRITE already.
+ * @return -EPIPE if client connection was removed, 0 otherwise */
+static int
+pool_mux_flush (pool_t* const pool, pool_conn_end_t* const cli)
+{
+    pool_mux_client_t* const mc = pool_mux_cli (cli);
+
+    if (cli->total > 0 && !(cli->events & POOL_FD_WRITE) &&
+        -EPIPE == pool_mux_send (pool, cli)) return -EPIPE;
+
+    pool_conn_end_t* const srv = mc->server;
+
+    if (!srv || POOL_END_COMPLETE != srv->end) return 0;
+
+    if (srv->total > 0 && !(srv->events & POOL_FD_WRITE) &&
+        -EPIPE == pool_send_data (pool, srv, NULL)) return -EPIPE;
+
+    /* server may have stopped reading on full client buffer */
+    if (cli->total + mc->stage < pool_buf_size) pool_set_read (pool, srv, true);
+
+    return 0;
+}
+
+// login can't be followed, client stays with the login server till the end
+static void
+pool_mux_raw (pool_conn_end_t* const cli)
+{
+    pool_mux_client_t* const mc = pool_mux_cli (cli);
+
+    mc->raw    = true;
+    mc->login  = false;
+    cli->total += mc->stage;
+    mc->stage  = 0;
+    pool_mux_srv(mc->server)->taint = true;
+}
+
+/* Client is logged in: login server connection now has the client session
+ * and joins the pool unless the destination has enough of them. */
+static void
+pool_mux_logged_in (pool_t* const pool, pool_conn_end_t* const cli,
+                    int const status)
+{
+    pool_mux_client_t* const mc  = pool_mux_cli (cli);
+    pool_conn_end_t*   const srv = mc->server;
+    pool_mux_server_t* const ms  = pool_mux_srv (srv);
+    int const cap = (pool->cnf->mysql_mux + pool->cnf->n_threads - 1) /
+                    pool->cnf->n_threads;
+
+    mc->login  = false;
+    mc->status = status;
+    mc->last   = srv;
+
+    strcpy (ms->user, mc->user);
+    strcpy (ms->db, mc->db);
+    ms->charset     = mc->charset;
+    ms->owner       = cli;
+    ms->dirty       = false;
+    ms->resp.state  = GLB_MYSQL_RESP_DONE;
+    ms->resp.status = status;
+
+    pool_mux_detach (pool, cli);
+
+    if (1 == pool_mux_count (pool, mc, NULL) ||
+        pool_mux_count (pool, NULL, &srv->addr) <= cap) {
+        pool_mux_server_idle (pool, srv);
+    }
+    else {
+        uint8_t quit[GLB_MYSQL_HDR_LEN + 1];
+
+        glb_mysql_cmd_write (GLB_MYSQL_COM_QUIT, NULL, 0, quit, sizeof(quit));
+        if (send (srv->sock, quit, sizeof(quit), MSG_DONTWAIT|MSG_NOSIGNAL) < 0)
+            glb_log_debug ("Failed to send COM_QUIT: %d (%s)",
+                           errno, strerror (errno));
+
+        pool_mux_server_close (pool, srv, true, GLB_ROUTER_OK);
+    }
+}
+
+// passes login server packets to the client whole, watches for login result
+static void
+pool_mux_login_read (pool_t* const pool, pool_conn_end_t* const cli)
+{
+    pool_mux_client_t* const mc = pool_mux_cli (cli);
+
+    while (mc->login && mc->stage >= GLB_MYSQL_HDR_LEN) {
+        uint8_t* const p   = cli->buf + cli->total;
+        size_t   const len = glb_mysql_pkt_len (p);
+        size_t   const pkt = GLB_MYSQL_HDR_LEN + len;
+        uint8_t* const payload = p + GLB_MYSQL_HDR_LEN;
+
+        if (pkt > mc->stage) {
+            if (pkt > pool_buf_size) {
+                glb_log_warn ("MySQL login packet is too long.");
+                pool_mux_raw (cli);
+            }
+            break;
+        }
+
+        cli->total += pkt;
+        mc->stage  -= pkt;
+
+        if (!mc->greeted) {
+            glb_mysql_greeting_mask (payload, len);
+            mc->greeted = true;
+        }
+        else if (mc->hello && len > 0 && GLB_MYSQL_OK == payload[0]) {
+            int const status = glb_mysql_ok_status (payload, len);
+
+            if (status >= 0 && 0 == mc->stage)
+                pool_mux_logged_in (pool, cli, status);
+            else
+                pool_mux_raw (cli);
+        }
+        else if (mc->hello && len > 0 && GLB_MYSQL_ERR == payload[0]) {
+            pool_mux_raw (cli); // server closes the connection
+        }
+    }
+
+    /* no space for the rest of the packet */
+    if (mc->login && cli->total + mc->stage == pool_buf_size)
+        pool_set_read (pool, mc->server, false);
+}
+
+/* Copies (beginning of) client packet to the attached server.
+ * @return bytes copied */
+static size_t
+pool_mux_forward (pool_mux_client_t* const mc, const uint8_t* const p,
+                  size_t const have, size_t const pkt)
+{
+    pool_conn_end_t* const srv   = mc->server;
+    size_t           const space = pool_buf_size - srv->total;
+    size_t n = have;
+
+    if (have == pkt) {
+        if (pkt > space) return 0;
+    }
+    else { // long packet, the rest follows
+        n = pool_min (have, space);
+        if (0 == n) return 0;
+        mc->target_left = pkt - n;
+    }
+
+    memcpy (srv->buf + srv->total, p, n);
+    srv->total += n;
+
+    return n;
+}
+
+/* Gives the client a server connection.
+ * @return 1 if attached, 0 if client waits, -EPIPE if client was closed */
+static int
+pool_mux_attach (pool_t* const pool, pool_conn_end_t* const cli)
+{
+    pool_mux_client_t* const mc  = pool_mux_cli (cli);
+    pool_conn_end_t*         srv = mc->last;
+
+    if (!srv || POOL_MUX_IDLE != pool_mux_srv(srv)->state) {
+        for (srv = pool->mux_idle; srv; srv = pool_mux_srv(srv)->next) {
+            if (pool_mux_match (pool_mux_srv (srv), mc)) break;
+        }
+    }
+
+    if (srv) {
+        pool_mux_idle_del (pool, srv);
+        pool_mux_bind (pool, cli, srv);
+        return 1;
+    }
+
+    if (0 == pool_mux_count (pool, mc, NULL)) {
+        pool_mux_client_fail (pool, cli, 1040,
+                              "No MySQL server connection for the user");
+        return -EPIPE;
+    }
+
+    mc->waiting = true;
+    if (pool->mux_wait_tail) pool_mux_cli(pool->mux_wait_tail)->next = cli;
+    else                     pool->mux_wait = cli;
+    pool->mux_wait_tail = cli;
+
+    pool_set_read (pool, cli, false);
+
+    return 0;
+}
+
+// remembers client session state that can be replayed on another connection
+static void
+pool_mux_session (pool_mux_client_t* const mc, const uint8_t* const p,
+                  size_t const pkt)
+{
+    const char* const q   = (const char*)p + GLB_MYSQL_HDR_LEN + 1;
+    size_t      const len = pkt - GLB_MYSQL_HDR_LEN - 1;
+    char db[POOL_MUX_NAME];
+
+    if (glb_mysql_use_db (q, len, db, sizeof(db))) {
+        strcpy (mc->db, db);
+    }
+    else if (pkt <= sizeof(mc->replay) - mc->replay_len) {
+        memcpy (mc->replay + mc->replay_len, p, pkt);
+        mc->replay_len += pkt;
+        mc->replay_n++;
+    }
+    else {
+        mc->pinned = true;
+    }
+}
+
+/* Routes client packet.
+ * @return bytes consumed or -EPIPE if client connection was closed */
+static long
+pool_mux_client_pkt (pool_t* const pool, pool_conn_end_t* const cli,
+                     uint8_t* const p, size_t const have, size_t const pkt)
+{
+    pool_mux_client_t* const mc = pool_mux_cli (cli);
+
+    if (mc->login) {
+        if (!mc->hello) { // handshake response
+            glb_mysql_login_t login;
+
+            mc->hello = true;
+
+            if (have == pkt &&
+                !glb_mysql_login_parse (&login, p + GLB_MYSQL_HDR_LEN,
+                                        pkt - GLB_MYSQL_HDR_LEN)) {
+                strcpy (mc->user, login.user);
+                strcpy (mc->db, login.db);
+                mc->charset = login.head[8];
+            }
+            else {
+                pool_mux_raw (cli); // e.g. SSL, nothing to follow
+            }
+        }
+
+        return pool_mux_forward (mc, p, have, pkt);
+    }
+
+    if (0 != glb_mysql_pkt_seq (p) || pkt == GLB_MYSQL_HDR_LEN) {
+        /* continues previous command, e.g. LOCAL INFILE data */
+        if (GLB_LIKELY(mc->server != NULL))
+            return pool_mux_forward (mc, p, have, pkt);
+
+        glb_log_warn ("Unexpected MySQL packet from client, closing.");
+        pool_mux_client_close (pool, cli);
+        return -EPIPE;
+    }
+
+    uint8_t const cmd   = p[GLB_MYSQL_HDR_LEN];
+    bool    const whole = (have == pkt);
+
+    if (GLB_MYSQL_COM_QUIT == cmd) {
+        pool_mux_client_close (pool, cli);
+        return -EPIPE;
+    }
+
+    /* one command at a time, next one waits for the response */
+    if (mc->server &&
+        GLB_MYSQL_RESP_DONE != pool_mux_srv(mc->server)->resp.state) return 0;
+
+    if (!mc->server) {
+        if (GLB_MYSQL_COM_PING == cmd) { // no need to bother servers
+            long const len = glb_mysql_ok_write (mc->status, 1,
+                                                 cli->buf + cli->total,
+                                                 pool_buf_size - cli->total);
+            if (len < 0) return 0;
+
+            cli->total += len;
+            return pkt;
+        }
+
+        int const ret = pool_mux_attach (pool, cli);
+        if (ret <= 0) return ret;
+    }
+
+    pool_mux_server_t* const ms = pool_mux_srv (mc->server);
+
+    /* whole packet must fit before anything is changed */
+    if (whole && pkt > pool_buf_size - mc->server->total) return 0;
+
+    switch (cmd) {
+    case GLB_MYSQL_COM_QUERY:
+        switch (whole ? glb_mysql_stmt_class ((const char*)p +
+                                              GLB_MYSQL_HDR_LEN + 1,
+                                              pkt - GLB_MYSQL_HDR_LEN - 1) :
+                GLB_MYSQL_STMT_PIN) {
+        case GLB_MYSQL_STMT_SESSION:
+            pool_mux_session (mc, p, pkt);
+            break;
+        case GLB_MYSQL_STMT_PIN:
+            mc->pinned = true;
+            break;
+        case GLB_MYSQL_STMT_READ:
+        case GLB_MYSQL_STMT_WRITE:
+            break;
+        }
+        break;
+    case GLB_MYSQL_COM_INIT_DB:
+        if (whole && pkt - GLB_MYSQL_HDR_LEN <= sizeof(mc->db)) {
+            size_t const len = pkt - GLB_MYSQL_HDR_LEN - 1;
+            memcpy (mc->db, p + GLB_MYSQL_HDR_LEN + 1, len);
+            mc->db[len] = '\0';
+            strcpy (ms->db, mc->db);
+        }
+        else mc->pinned = true;
+        break;
+    case GLB_MYSQL_COM_RESET_CONNECTION:
+        mc->replay_len = 0;
+        mc->replay_n   = 0;
+        mc->pinned     = false;
+        break;
+    case GLB_MYSQL_COM_FIELD_LIST:
+    case GLB_MYSQL_COM_STATISTICS:
+    case GLB_MYSQL_COM_PING:
+        break;
+    case GLB_MYSQL_COM_CHANGE_USER:
+        ms->taint = true;
+        /* fall through */
+    default: // prepared statements and whatever else
+        mc->pinned = true;
+    }
+
+    glb_mysql_resp_start (&ms->resp, cmd);
+
+    if (GLB_MYSQL_RESP_UNKNOWN == ms->resp.state) mc->pinned = true;
+
+    return pool_mux_forward (mc, p, have, pkt);
+}
+
+// moves client data to the attached server
+static int
+pool_mux_c2s (pool_t* const pool, pool_conn_end_t* const cli)
+{
+    pool_mux_client_t* const mc = pool_mux_cli (cli);
+    size_t off = 0;
+
+    while (off < mc->cbuf_len && !mc->waiting) {
+        uint8_t* const p     = mc->cbuf + off;
+        size_t   const avail = mc->cbuf_len - off;
+        long     n;
+
+        if (mc->target_left > 0 || mc->raw) {
+            /* the rest of a long packet or no routing at all */
+            pool_conn_end_t* const srv = mc->server;
+
+            n = pool_min (avail, pool_buf_size - srv->total);
+            if (mc->target_left > 0) {
+                n = pool_min (n, mc->target_left);
+                mc->target_left -= n;
+            }
+
+            memcpy (srv->buf + srv->total, p, n);
+            srv->total += n;
+        }
+        else if (avail < GLB_MYSQL_HDR_LEN) {
+            break;
+        }
+        else {
+            size_t const pkt = GLB_MYSQL_HDR_LEN + glb_mysql_pkt_len (p);
+
+            // packets that fit in the buffer are routed whole
+            if (pkt > avail && pkt <= sizeof(mc->cbuf)) break;
+
+            n = pool_mux_client_pkt (pool, cli, p, pool_min (pkt, avail), pkt);
+            if (n < 0) return n; // client is gone
+        }
+
+        if (0 == n) break;
+
+        off += n;
+    }
+
+    mc->cbuf_len -= off;
+    memmove (mc->cbuf, mc->cbuf + off, mc->cbuf_len);
+
+    if (mc->cbuf_len < sizeof(mc->cbuf) && !mc->waiting)
+        pool_set_read (pool, cli, true);
+
+    return pool_mux_flush (pool, cli);
+}
+
+// attached server connection goes back to the pool after a transaction
+static void
+pool_mux_check_release (pool_t* const pool, pool_conn_end_t* const cli)
+{
+    pool_mux_client_t* const mc  = pool_mux_cli (cli);
+    pool_conn_end_t*   const srv = mc->server;
+
+    if (mc->pinned || !pool_mux_reusable (cli, srv)) return;
+
+    mc->status = pool_mux_srv(srv)->resp.status;
+
+    pool_mux_detach (pool, cli);
+    pool_mux_server_idle (pool, srv);
+}
+
+static ssize_t
+pool_mux_client_read (pool_t* const pool, pool_conn_end_t* const cli)
+{
+    pool_mux_client_t* const mc    = pool_mux_cli (cli);
+    size_t             const space = sizeof(mc->cbuf) - mc->cbuf_len;
+
+    if (GLB_UNLIKELY(0 == space)) {
+        pool_set_read (pool, cli, false);
+        return 0;
+    }
+
+    ssize_t const ret = recv (cli->sock, mc->cbuf + mc->cbuf_len, space, 0);
+
+    GLB_STATS_INC (pool->stats.n_recv);
+
+    if (GLB_UNLIKELY(ret <= 0))
+        return pool_mysql_read_error (pool, cli->sock, ret);
+
+    GLB_STATS_ADD (pool->stats.recv_bytes, ret);
+    GLB_STATS_ADD (pool->stats.rx_bytes, ret);
+
+    mc->cbuf_len += ret;
+
+    return pool_mux_c2s (pool, cli);
+}
+
+// idle server connection is not supposed to say anything
+static ssize_t
+pool_mux_idle_read (pool_t* const pool, pool_conn_end_t* const srv)
+{
+    pool_mux_server_t* const ms = pool_mux_srv (srv);
+    uint8_t buf[256];
+
+    ssize_t const ret = recv (srv->sock, buf, sizeof(buf), 0);
+
+    GLB_STATS_INC (pool->stats.n_recv);
+
+    if (GLB_UNLIKELY(ret <= 0))
+        return pool_mysql_read_error (pool, srv->sock, ret);
+
+    GLB_STATS_ADD (pool->stats.recv_bytes, ret);
+
+    if (pool_mysql_walk (&ms->walk, &ms->resp, &ms->discard, &ms->taint, buf,
+                         ret) > 0 || ms->taint) {
+        glb_log_debug ("Unexpected data from idle MySQL server, closing.");
+        pool_mux_server_close (pool, srv, true, GLB_ROUTER_ERROR);
+        return -EPIPE;
+    }
+
+    return 0;
+}
+
+static ssize_t
+pool_mux_server_read (pool_t* const pool, pool_conn_end_t* const srv)
+{
+    pool_mux_server_t* const ms  = pool_mux_srv (srv);
+    pool_conn_end_t*   const cli = ms->client;
+
+    if (!cli) return pool_mux_idle_read (pool, srv);
+
+    pool_mux_client_t* const mc = pool_mux_cli (cli);
+    size_t   const busy  = cli->total + mc->stage;
+    uint8_t* const buf   = cli->buf + busy;
+    size_t   const space = pool_buf_size - busy;
+
+    if (GLB_UNLIKELY(0 == space)) {
+        pool_set_read (pool, srv, false);
+        return 0;
+    }
+
+    ssize_t const ret = recv (srv->sock, buf, space, 0);
+
+    GLB_STATS_INC (pool->stats.n_recv);
+
+    if (GLB_UNLIKELY(ret <= 0))
+        return pool_mysql_read_error (pool, srv->sock, ret);
+
+    GLB_STATS_ADD (pool->stats.recv_bytes, ret);
+
+    if (GLB_UNLIKELY(!cli->replied)) pool_lat_replied (pool, cli, srv);
+
+    if (mc->login) {
+        mc->stage += ret;
+        pool_mux_login_read (pool, cli);
+    }
+    else {
+        cli->total += mc->raw ? (size_t)ret :
+            pool_mysql_walk (&ms->walk, &ms->resp, &ms->discard, &ms->taint,
+                             buf, ret);
+
+        // no space for next read, clear POOL_FD_READ
+        if (pool_buf_size == cli->total) pool_set_read (pool, srv, false);
+
+        pool_mux_check_release (pool, cli);
+    }
+
+    /* client packets may wait for the response */
+    return (mc->cbuf_len > 0 ? pool_mux_c2s (pool, cli) :
+            pool_mux_flush (pool, cli));
+}
+
+static inline ssize_t
+pool_mux_handle_read (pool_t* const pool, pool_conn_end_t* const end)
+{
+    return (POOL_END_CLIENT == end->end ? pool_mux_client_read (pool, end) :
+            pool_mux_server_read (pool, end));
+}
+
+// asynchronous connect of the login server connection is over
+static int
+pool_mux_connected (pool_t* const pool, pool_conn_end_t* const srv)
+{
+    pool_conn_end_t* const cli = pool_mux_srv(srv)->client;
+    int ret = -1;
+    socklen_t ret_size = sizeof(ret);
+
+    getsockopt (srv->sock, SOL_SOCKET, SO_ERROR, &ret, &ret_size);
+
+    if (!ret) {
+        srv->end    = POOL_END_COMPLETE;
+        srv->events = POOL_FD_READ;
+        pool_fds_set_events (pool, srv);
+        pool_lat_connected (pool, srv, glb_time_mono());
+        return 0;
+    }
+
+    glb_sockaddr_str_t a = glb_sockaddr_to_str (&srv->addr);
+    glb_log_info ("Async connection to %s failed: %d (%s)",
+                  a.str, ret, strerror (ret));
+
+    uint32_t const hint = pool->cnf->policy < GLB_POLICY_SOURCE ?
+        0 : glb_sockaddr_hash (&cli->addr);
+
+    pool_reset_conn_end (pool, srv, true);
+    srv->sock = -1;
+
+    if (!glb_router_choose_dst_again (pool->router, hint, &srv->addr,
+                                      &srv->handle)) {
+        a = glb_sockaddr_to_str (&srv->addr);
+        glb_log_info ("Reconnecting to %s", a.str);
+
+        if (!pool_handle_async_conn (pool, srv)) {
+            pool_set_conn_end (pool, srv, srv);
+            return 0;
+        }
+
+        glb_router_disconnect (pool->router, &srv->handle,
+                               GLB_ROUTER_FAILED);
+        srv->sock = -1;
+    }
 
-    return 0;
+    /* router didn't give us any destination */
+    pool_mux_server_fail (pool, srv, false);
+
+    return -EPIPE;
 }
 
-static inline ssize_t
-pool_send_data (pool_t* pool, pool_conn_end_t* dst, pool_conn_end_t* src)
+static int
+pool_mux_handle_write (pool_t* const pool, pool_conn_end_t* const end)
 {
-    ssize_t  ret;
-    uint32_t dst_events = dst->events;
+    if (POOL_END_CLIENT == end->end) {
+        pool_mux_client_t* const mc = pool_mux_cli (end);
 
-#ifndef GLB_USE_SPLICE
-#ifdef MSG_NOSIGNAL
-    ret = send (dst->sock, &dst->buf[dst->sent], dst->total - dst->sent,
-                MSG_DONTWAIT | MSG_NOSIGNAL);
-#else
-    ret = send (dst->sock, &dst->buf[dst->sent], dst->total - dst->sent,
-                MSG_DONTWAIT);
-#endif
-#else
-    ret = splice (dst->splice[0], NULL, dst->sock, NULL,
-                  dst->total - dst->sent, SPLICE_F_NONBLOCK);
-#endif
+        if (end->total > 0 && -EPIPE == pool_mux_send (pool, end))
+            return -EPIPE;
 
-    if (GLB_LIKELY(ret > 0)) {
-        pool->stats.send_bytes += ret;
-        pool->stats.tx_bytes   += (POOL_END_CLIENT == dst->end) * ret;
+        /* server may have stopped reading on full client buffer,
+         * local replies may have been waiting for space */
+        return (mc->cbuf_len > 0 ? pool_mux_c2s (pool, end) :
+                pool_mux_flush (pool, end));
+    }
 
-        dst->sent += ret;
-        if (dst->sent == dst->total) {        // all data sent, reset pointers
-            dst->sent  =  dst->total = 0;
-            dst_events &= ~POOL_FD_WRITE;     // clear WRITE flag
-        }
-        else {                                // there is unsent data left
-            glb_log_debug ("Setting WRITE flag on %s: sent = %zu, total = "
-                           "%zu, bufsiz = %zu",
-                           POOL_END_CLIENT == dst->end ? "client" : "server",
-                           dst->sent, dst->total,pool_buf_size);
-            dst_events |= POOL_FD_WRITE;      // set   WRITE flag
-        }
+    if (GLB_UNLIKELY(POOL_END_INCOMPLETE == end->end))
+        return pool_mux_connected (pool, end);
 
-        if (src && !(src->events & POOL_FD_READ) &&
-            (dst->total < pool_buf_size)) {
-            // some space exists in the buffer, reestablish READ flag in src
-            src->events |= POOL_FD_READ;
-            pool_fds_set_events (pool, src);
-        }
+    if (end->total > 0) {
+        if (-EPIPE == pool_send_data (pool, end, NULL)) return -EPIPE;
     }
     else {
-        ret = -errno;
-        switch (-ret) {
-        case EINTR:    // 4
-        case EAGAIN:   // 11
-        case EBUSY:    // 16
-        case ENOBUFS:  // 105
-        case ENOTCONN: // 107
-            glb_log_debug ("Send data error: %d (%s)", -ret, strerror(-ret));
-            dst_events |= POOL_FD_WRITE;
-            ret = 0; // pretend nothing happened
-            break;
-        case EPIPE:    // 32
-            /* according to man 2 send,
-             * Linux can return EPIPE on unconnected socket. WTF? */
-            if (POOL_END_INCOMPLETE != dst->end) {
-                glb_log_debug ("pool_remove_conn() from pool_send_data()");
-                pool_remove_conn(pool, dst->sock, true);
-            }
-            else {
-                /* POOL_FD_WRITE is already set there, just wait for it */
-                ret = 0;
-            }
-            return ret;
-        default:
-            glb_log_warn ("Send data failed, unhandled error: %d (%s)",
-                          -ret, strerror(-ret));
-        }
+        end->events &= ~POOL_FD_WRITE;
+        pool_fds_set_events (pool, end);
     }
 
-    pool->stats.n_send++;
-
-    if (dst_events != dst->events) { // events changed
-        glb_log_debug ("Old flags on %s: %s %s",
-                       POOL_END_CLIENT == dst->end ? "client":"server",
-                       dst->events & POOL_FD_READ  ? "POOL_FD_READ":"",
-                       dst->events & POOL_FD_WRITE ? "POOL_FD_WRITE":"");
-        dst->events = dst_events;
-        pool_fds_set_events (pool, dst);
-        glb_log_debug ("New flags on %s: %s %s",
-                       POOL_END_CLIENT == dst->end ? "client":"server",
-                       dst->events & POOL_FD_READ  ? "POOL_FD_READ":"",
-                       dst->events & POOL_FD_WRITE ? "POOL_FD_WRITE":"");
-    }
+    pool_conn_end_t* const cli = pool_mux_srv(end)->client;
 
-    return ret;
+    return (cli ? pool_mux_c2s (pool, cli) : 0);
 }
 
 // inline because frequent
@@ -609,6 +3063,17 @@ pool_handle_read (pool_t* pool, int src_fd)
     ssize_t ret = 0;
     pool_conn_end_t* dst = pool->route_map[src_fd];
 
+    if (pool->cnf->mysql_mux) return pool_mux_handle_read (pool, dst);
+
+    if (pool->cnf->mysql_split) {
+        pool_conn_end_t* const inc_end =
+            POOL_END_CLIENT == dst->end ? dst : pool_end_next (dst, -1);
+        const pool_mysql_t* const s = pool_mysql_sess (inc_end);
+
+        if (POOL_MYSQL_RAW != s->phase || s->cbuf_len > 0 || s->wbuf_len > 0)
+            return pool_mysql_handle_read (pool, inc_end, src_fd);
+    }
+
 //    glb_log_debug ("pool_handle_read()");
 
     // first, try read data from source, if there's enough space
@@ -622,6 +3087,10 @@ pool_handle_read (pool_t* pool, int src_fd)
                       SPLICE_F_MORE | SPLICE_F_MOVE);
 #endif
         if (GLB_LIKELY(ret > 0)) {
+            if (GLB_UNLIKELY(POOL_END_CLIENT == dst->end && !dst->replied)) {
+                pool_lat_replied (pool, dst, pool_end_next (dst, 1));
+            }
+
             dst->total += ret;
             // now try to send whatever we have received so far
             // (since we're here, POOL_FD_READ on src is not cleared, no need
@@ -644,10 +3113,11 @@ pool_handle_read (pool_t* pool, int src_fd)
                 pool_fds_set_events (pool, src);
             }
 
-            pool->stats.recv_bytes += ret;
+            GLB_STATS_ADD (pool->stats.recv_bytes, ret);
 
             // increment only if it's coming from incoming interface
-            pool->stats.rx_bytes   += (POOL_END_CLIENT != dst->end) * ret;
+            if (POOL_END_CLIENT != dst->end)
+                GLB_STATS_ADD (pool->stats.rx_bytes, ret);
         }
         else {
             if (0 == ret) { // socket closed, must close another end and cleanup
@@ -666,7 +3136,7 @@ pool_handle_read (pool_t* pool, int src_fd)
             }
         }
 
-        pool->stats.n_recv++;
+        GLB_STATS_INC (pool->stats.n_recv);
     }
     return ret;
 }
@@ -692,7 +3162,8 @@ pool_handle_conn_complete (pool_t* pool, pool_conn_end_t* dst_end)
         uint32_t const hint = pool->cnf->policy < GLB_POLICY_SOURCE ?
             0 : glb_sockaddr_hash (&inc_end->addr);
 
-        int err = glb_router_choose_dst_again (pool->router, hint, &dst_end->addr);
+        int err = glb_router_choose_dst_again (pool->router, hint,
+                                               &dst_end->addr, &dst_end->handle);
 
         if (!err) {
             a = glb_sockaddr_to_str (&dst_end->addr);
@@ -712,6 +3183,7 @@ pool_handle_conn_complete (pool_t* pool, pool_conn_end_t* dst_end)
         dst_end->end = POOL_END_COMPLETE;
         dst_end->events = POOL_FD_READ;
         pool_fds_set_events (pool, dst_end);
+        pool_lat_connected (pool, dst_end, glb_time_mono());
     }
 
     return ret;
@@ -721,7 +3193,9 @@ static inline int
 pool_handle_write (pool_t* pool, int dst_fd)
 {
     pool_conn_end_t* src = pool->route_map[dst_fd];
-    pool_conn_end_t* dst = pool->route_map[src->sock];
+    pool_conn_end_t* dst = pool_conn_end_by_fd (pool, dst_fd);
+
+    if (pool->cnf->mysql_mux) return pool_mux_handle_write (pool, src);
 
     if (pool->cnf->verbose) {
         glb_log_debug ("pool_handle_write() to %s: %zu",
@@ -729,8 +3203,12 @@ pool_handle_write (pool_t* pool, int dst_fd)
                        dst->total - dst->sent);
     }
 
-    if (GLB_UNLIKELY(POOL_END_INCOMPLETE == dst->end) &&
-        pool_handle_conn_complete (pool, dst)) return 0;
+    if (GLB_UNLIKELY(POOL_END_INCOMPLETE == dst->end)) {
+        if (pool->cnf->mysql_split && pool_mysql_is_reader (dst))
+            return pool_mysql_reader_connected (pool, src);
+
+        if (pool_handle_conn_complete (pool, dst)) return 0;
+    }
 
     assert (dst->end != POOL_END_INCOMPLETE);
 
@@ -742,17 +3220,25 @@ pool_handle_write (pool_t* pool, int dst_fd)
         if ((send_err = pool_send_data (pool, dst, src)) < 0) {
             glb_log_warn ("pool_send_data(): %zd (%s)",
                           -send_err, strerror(-send_err));
+            if (-EPIPE == send_err) return send_err;
         }
     }
 
+    if (pool->cnf->mysql_split) {
+        return pool_mysql_write_done (pool, POOL_END_CLIENT == dst->end ?
+                                      dst : src, dst);
+    }
+
     return 0;
 }
 
-// returns on error or after handling ctl - the latter may cause changes in
-// file descriptors.
+// returns on error, after handling ctl or after connection removal - these
+// may cause changes in file descriptors.
 static inline int
 pool_handle_events (pool_t* pool, int count)
 {
+    /* descriptors removed by a handler may be still in the list */
+    int const fd_max = pool->fd_max;
     int idx;
 #ifdef USE_EPOLL
     for (idx = 0; idx < count; idx++) {
@@ -761,10 +3247,10 @@ pool_handle_events (pool_t* pool, int count)
 
             if (GLB_LIKELY(pfd->data.fd != pool->ctl_recv)) { // normal read
                 ssize_t ret;
-                pool->stats.poll_reads++;
+                GLB_STATS_INC (pool->stats.poll_reads);
 
                 ret = pool_handle_read (pool, pfd->data.fd);
-                if (ret < 0) return ret;
+                if (ret < 0 || fd_max != pool->fd_max) return ret;
             }
             else {                                // ctl read
                 return pool_handle_ctl (pool);
@@ -772,11 +3258,11 @@ pool_handle_events (pool_t* pool, int count)
         }
         if (pfd->events & POOL_FD_WRITE) {
             int ret;
-            pool->stats.poll_writes++;
+            GLB_STATS_INC (pool->stats.poll_writes);
 
             assert (pfd->data.fd != pool->ctl_recv);
             ret = pool_handle_write (pool, pfd->data.fd);
-            if (ret < 0) return ret;
+            if (ret < 0 || fd_max != pool->fd_max) return ret;
         }
     }
 #else /* POLL */
@@ -797,17 +3283,17 @@ pool_handle_events (pool_t* pool, int count)
 
             if (revents & POOL_FD_READ) {
                 ssize_t ret;
-                pool->stats.poll_reads++;
+                GLB_STATS_INC (pool->stats.poll_reads);
 
                 ret = pool_handle_read (pool, pfd->fd);
-                if (ret < 0) return ret;
+                if (ret < 0 || fd_max != pool->fd_max) return ret;
             }
             if (revents & POOL_FD_WRITE) {
                 int ret;
-                pool->stats.poll_writes++;
+                GLB_STATS_INC (pool->stats.poll_writes);
 
                 ret = pool_handle_write (pool, pfd->fd);
-                if (ret < 0) return ret;
+                if (ret < 0 || fd_max != pool->fd_max) return ret;
             }
             count--;
         }
@@ -832,7 +3318,7 @@ pool_thread (void* arg)
 
         if (ret > 0) {
 
-            pool->stats.n_polls++;
+            GLB_STATS_INC (pool->stats.n_polls);
 
             pool_handle_events (pool, ret);
 
@@ -875,6 +3361,8 @@ pool_fds_init (pool_t* pool, int ctl_fd)
 static void
 pool_fds_release (pool_t* pool)
 {
+    free (pool->lat.lat);
+    free (pool->dst.dst);
     free (pool->pollfds);
 #ifdef USE_EPOLL
     close (pool->epoll_fd);
@@ -890,7 +3378,8 @@ pool_init (const glb_cnf_t* cnf, pool_t* pool, long id, glb_router_t* router)
     pool->cnf    = cnf;
     pool->id     = id;
     pool->router = router;
-    pool->stats  = glb_zero_stats;
+    pool->stats      = glb_zero_stats;
+    pool->info_stats = glb_zero_stats;
 
     glb_sockaddr_init  (&pool->addr_out, "0.0.0.0", 0); //for outgoing conn
     pthread_mutex_init (&pool->lock, NULL);
@@ -926,36 +3415,190 @@ pool_init (const glb_cnf_t* cnf, pool_t* pool, long id, glb_router_t* router)
     return 0;
 }
 
+// Sends ctl and waits for confirmation from the pool thread
+static int
+pool_send_ctl (pool_t* p, pool_ctl_t* ctl)
+{
+    ssize_t ret;
+
+    GLB_MUTEX_LOCK (&p->lock);
+    ret = write (p->ctl_send, ctl, sizeof (*ctl));
+    if (ret != sizeof (*ctl)) {
+        glb_log_error ("Sending ctl failed: %d (%s)", errno, strerror(errno));
+        if (ret > 0) abort(); // partial ctl was sent, don't know what to do
+    }
+    else ret = 0;
+    pthread_cond_wait (&p->cond, &p->lock);
+    GLB_MUTEX_UNLOCK (&p->lock);
+
+    return ret;
+}
+
+/* allocates and starts a new pool thread, @return pool or NULL */
+static pool_t*
+pool_create (const glb_cnf_t* const cnf, int const id,
+             glb_router_t* const router)
+{
+    pool_t* ret = NULL;
+
+    /* pool_t contains cache line aligned members */
+    if (posix_memalign ((void**)&ret, GLB_CACHE_LINE, sizeof(pool_t))) {
+        glb_log_error ("Could not allocate memory for pool %d.", id);
+        return NULL;
+    }
+
+    memset (ret, 0, sizeof(*ret));
+
+    if (pool_init (cnf, ret, id, router)) {
+        glb_log_error ("Failed to initialize pool %d.", id);
+        free (ret);
+        return NULL;
+    }
+
+    return ret;
+}
+
+/* stops pool thread and releases the pool, pool must have no connections */
+static void
+pool_free (pool_t* const p)
+{
+    pool_ctl_t shutdown_ctl = { POOL_CTL_SHUTDOWN, NULL };
+
+    if (pool_send_ctl (p, &shutdown_ctl)) {
+        glb_log_debug ("pool %d shutdown failed", p->id);
+    }
+
+    pthread_join (p->thread, NULL);
+    close (p->ctl_send);
+    pool_fds_release (p);
+    pthread_cond_destroy  (&p->cond);
+    pthread_mutex_destroy (&p->lock);
+    free (p);
+}
+
+/* activates retiring pools or starts new ones to have n active pools,
+ * or retires the excess: retiring pool gets no new connections and is
+ * freed by pool_reap() once its last connection is closed.
+ * Must be called under pool->lock. @return 0 or negative error code */
+static int
+pool_set_active (glb_pool_t* const pool, int const n)
+{
+    if (n <= pool->n_all) {
+        pool->n_pools = n;
+        return 0;
+    }
+
+    pool_t** const tmp = realloc (pool->pool, n * sizeof(pool_t*));
+    if (!tmp) return -ENOMEM;
+    pool->pool = tmp;
+
+    pool->n_pools = pool->n_all;
+
+    while (pool->n_all < n) {
+        pool_t* const p = pool_create (pool->cnf, pool->next_id,
+                                       pool->router);
+        if (!p) return -ENOMEM;
+        pool->next_id++;
+        pool->pool[pool->n_all++] = p;
+        pool->n_pools = pool->n_all;
+    }
+
+    return 0;
+}
+
+/* frees retiring pools that have no connections left,
+ * must be called under pool->lock. @return number of pools left retiring */
+static int
+pool_reap (glb_pool_t* const pool)
+{
+    int i = pool->n_pools;
+
+    while (i < pool->n_all) {
+        pool_t* const p = pool->pool[i];
+
+        if (p->n_conns > 0 || p->n_adding > 0) { i++; continue; }
+
+        glb_log_info ("Pool %d thread retired.", p->id);
+
+        glb_pool_stats_add (&pool->retired, &p->stats);
+        pool_free (p);
+
+        pool->n_all--;
+        pool->pool[i] = pool->pool[pool->n_all];
+    }
+
+    return pool->n_all - pool->n_pools;
+}
+
 glb_pool_t*
 glb_pool_create (const glb_cnf_t* cnf, glb_router_t* router)
 {
-    size_t ret_size = sizeof(glb_pool_t) + cnf->n_threads * sizeof(pool_t);
-    glb_pool_t* ret = malloc (ret_size);
+    glb_pool_t* ret = calloc (1, sizeof(glb_pool_t));
 
     if (ret) {
-        int err;
-        int i;
-
-        memset (ret, 0, ret_size);
         pthread_mutex_init (&ret->lock, NULL);
         ret->cnf     = cnf;
-        ret->n_pools = ret->cnf->n_threads;
+        ret->router  = router;
+        ret->retired = glb_zero_stats;
+
+#ifdef GLB_USE_SOCKMAP
+        /* on failure connections are just forwarded by pool threads */
+        if (!glb_sockmap_init (POOL_MAX_FD) && cnf->verbose) {
+            glb_log_info ("Established connections will be forwarded by "
+                          "kernel.");
+        }
+#endif
 
-        for (i = 0; i < ret->n_pools; i++) {
-            if ((err = pool_init(ret->cnf, &ret->pool[i], i, router))) {
-                glb_log_fatal ("Failed to initialize pool %d.", i);
-                abort();
-            }
+        if (pool_set_active (ret, cnf->n_threads)) {
+            glb_log_fatal ("Failed to initialize %d pools.", cnf->n_threads);
+            abort();
         }
     }
     else {
-        glb_log_fatal ("Could not allocate memory for %zu pools.",
+        glb_log_fatal ("Could not allocate memory for %d pools.",
                        cnf->n_threads);
         abort();
     }
 
-    ret->last_info  = glb_time_now();
-    ret->last_stats = ret->last_info;
+    ret->started   = glb_time_now();
+    ret->last_info = ret->started;
+
+    return ret;
+}
+
+int
+glb_pool_set_threads (glb_pool_t* const pool, int const n)
+{
+    int ret = -EINVAL;
+
+    if (n < 1) return ret;
+
+    GLB_MUTEX_LOCK (&pool->lock);
+
+    int const old = pool->n_pools;
+
+    ret = pool_set_active (pool, n);
+    if (ret) {
+        glb_log_error ("Failed to start %d pool threads, %d running.",
+                       n, pool->n_pools);
+    }
+    else if (n != old) {
+        glb_log_info ("Pool threads: %d -> %d.", old, n);
+    }
+
+    pool_reap (pool);
+
+    GLB_MUTEX_UNLOCK (&pool->lock);
+
+    return ret;
+}
+
+int
+glb_pool_reap (glb_pool_t* const pool)
+{
+    GLB_MUTEX_LOCK (&pool->lock);
+    int const ret = pool_reap (pool);
+    GLB_MUTEX_UNLOCK (&pool->lock);
 
     return ret;
 }
@@ -964,36 +3607,60 @@ glb_pool_create (const glb_cnf_t* cnf, glb_router_t* router)
 static inline pool_t*
 pool_get_pool (glb_pool_t* pool)
 {
-    pool_t* ret       = pool->pool;
+    pool_t* ret       = pool->pool[0];
     int     min_conns = ret->n_conns;
     int     i;
 
     for (i = 1; i < pool->n_pools; i++) {
-        if (min_conns > pool->pool[i].n_conns) {
-            min_conns = pool->pool[i].n_conns;
-            ret = pool->pool + i;
+        if (min_conns > pool->pool[i]->n_conns) {
+            min_conns = pool->pool[i]->n_conns;
+            ret = pool->pool[i];
         }
     }
     return ret;
 }
 
-// Sends ctl and waits for confirmation from the pool thread
+static void
+pool_mysql_init (pool_conn_end_t* const inc_end)
+{
+    pool_conn_end_t* const reader = pool_mysql_reader (inc_end);
+    pool_mysql_t*    const s      = pool_mysql_sess (inc_end);
+
+    memset (reader, 0, sizeof(*reader));
+    reader->sock    = -1;
+    reader->lat_idx = -1;
+    reader->dst_idx = -1;
+    reader->end     = POOL_END_INCOMPLETE;
+    reader->handle  = GLB_ROUTER_HANDLE_NONE;
+
+    memset (s, 0, offsetof(pool_mysql_t, ok)); // buffers need no init
+    s->w_resp.status = -1;
+    s->r_resp.status = -1;
+}
+
+/* Makes separate server connection object for the multiplexed client,
+ * moves the server end there.
+ * @return 0 or -ENOMEM */
 static int
-pool_send_ctl (pool_t* p, pool_ctl_t* ctl)
+pool_mux_init (pool_conn_end_t* const cli)
 {
-    ssize_t ret;
+    pool_mux_client_t* const mc  = pool_mux_cli (cli);
+    pool_conn_end_t*   const srv = malloc (pool_mux_server_size);
 
-    GLB_MUTEX_LOCK (&p->lock);
-    ret = write (p->ctl_send, ctl, sizeof (*ctl));
-    if (ret != sizeof (*ctl)) {
-        glb_log_error ("Sending ctl failed: %d (%s)", errno, strerror(errno));
-        if (ret > 0) abort(); // partial ctl was sent, don't know what to do
-    }
-    else ret = 0;
-    pthread_cond_wait (&p->cond, &p->lock);
-    GLB_MUTEX_UNLOCK (&p->lock);
+    if (!srv) return -ENOMEM;
 
-    return ret;
+    memcpy (srv, pool_end_next (cli, 1), sizeof(pool_conn_end_t));
+    memset (pool_mux_srv (srv), 0, sizeof(pool_mux_server_t));
+    pool_mux_srv(srv)->client      = cli;
+    pool_mux_srv(srv)->state       = POOL_MUX_LOGIN;
+    pool_mux_srv(srv)->resp.status = -1;
+
+    memset (mc, 0, offsetof(pool_mux_client_t, replay)); // buffers need no init
+    mc->server = srv;
+    mc->login  = true;
+    mc->status = -1;
+
+    return 0;
 }
 
 int
@@ -1002,27 +3669,53 @@ glb_pool_add_conn (glb_pool_t*           const pool,
                    const glb_sockaddr_t* const inc_addr,
                    int                   const dst_sock,
                    const glb_sockaddr_t* const dst_addr,
-                   bool                  const complete)
+                   glb_router_handle_t   const dst_handle,
+                   bool                  const complete,
+                   glb_time_t            const accepted)
 {
     int   ret   = -ENOMEM;
     void* route = NULL;
 
-    route = malloc (pool_conn_size);
+    /* multiplexed client temporarily has server end in place of mux client
+     * state, pool_mux_init() moves it out */
+    route = malloc (pool->cnf->mysql_split ? pool_mysql_conn_size :
+                    pool->cnf->mysql_mux   ? pool_mux_client_size :
+                    pool_conn_size);
     if (route) {
         pool_conn_end_t* const inc_end = route;
         pool_conn_end_t* const dst_end = route + pool_end_size;
 
         inc_end->addr     = *inc_addr;
+        inc_end->handle   = GLB_ROUTER_HANDLE_NONE;
         inc_end->end      = POOL_END_CLIENT;
         inc_end->sock     = inc_sock;
         inc_end->sent     = 0;
         inc_end->total    = 0;
+        inc_end->start    = accepted;
+        inc_end->lat_idx  = -1;
+        inc_end->replied  = false;
 
         dst_end->addr     = *dst_addr;
+        dst_end->handle   = dst_handle;
         dst_end->end      = complete ? POOL_END_COMPLETE : POOL_END_INCOMPLETE;
         dst_end->sock     = dst_sock;
         dst_end->sent     = 0;
         dst_end->total    = 0;
+        dst_end->start    = accepted;
+        dst_end->lat_idx  = -1;
+        dst_end->dst_idx  = -1;
+        dst_end->replied  = false;
+
+#ifdef GLB_USE_SOCKMAP
+        dst_end->sm_state = glb_sockmap_enabled() ?
+            POOL_SM_NONE : POOL_SM_FAILED;
+#endif
+        if (pool->cnf->mysql_split) pool_mysql_init (inc_end);
+
+        if (pool->cnf->mysql_mux && pool_mux_init (inc_end)) {
+            free (route);
+            return -ENOMEM;
+        }
 
 #ifdef GLB_USE_SPLICE
         if (pipe (inc_end->splice)) abort();
@@ -1030,17 +3723,25 @@ glb_pool_add_conn (glb_pool_t*           const pool,
 #endif
         pool_ctl_t add_conn_ctl = { POOL_CTL_ADD_CONN, inc_end };
 
+        /* pool can't be reaped while the connection is being passed to it,
+         * but other connections need not wait for the handshake */
         GLB_MUTEX_LOCK (&pool->lock);
-        pool_t* p = pool_get_pool (pool);
+        pool_t* const p = pool_get_pool (pool);
+        p->n_adding++;
         GLB_MUTEX_UNLOCK (&pool->lock);
 
         ret = pool_send_ctl (p, &add_conn_ctl);
+
+        GLB_MUTEX_LOCK (&pool->lock);
+        p->n_adding--;
+        GLB_MUTEX_UNLOCK (&pool->lock);
     }
 
     return ret;
 }
 
-// Sends the same ctl to all pools. Returns 0 minus how many ctls failed
+/* Sends the same ctl to all pools including retiring ones.
+ * Returns 0 minus how many ctls failed */
 static inline int
 pool_bcast_ctl (glb_pool_t* pool, pool_ctl_t* ctl)
 {
@@ -1049,8 +3750,8 @@ pool_bcast_ctl (glb_pool_t* pool, pool_ctl_t* ctl)
 
     GLB_MUTEX_LOCK (&pool->lock);
 
-    for (i = 0; i < pool->n_pools; i++) {
-        ret -= (pool_send_ctl (&pool->pool[i], ctl) < 0);
+    for (i = 0; i < pool->n_all; i++) {
+        ret -= (pool_send_ctl (pool->pool[i], ctl) < 0);
     }
 
     GLB_MUTEX_UNLOCK (&pool->lock);
@@ -1069,32 +3770,125 @@ ssize_t
 glb_pool_print_stats (glb_pool_t* pool, char* buf, size_t buf_len)
 {
     glb_pool_stats_t stats = glb_zero_stats;
-    pool_ctl_t stats_ctl   = { POOL_CTL_STATS, (void*)&stats };
-    ssize_t    ret;
-    glb_time_t now = glb_time_now();
+    glb_time_t const now   = glb_time_now();
+    int i;
 
-    ret = pool_bcast_ctl (pool, &stats_ctl);
-    if (!ret) {
-        double elapsed = glb_time_seconds(now - pool->last_stats);
-        ret = snprintf (buf, buf_len, "in: %lu out: %lu "
-                        "recv: %lu / %lu send: %lu / %lu "
-                        "conns: %lu / %lu poll: %lu / %lu / %lu "
-                        "elapsed: %.5f\n",
-                        stats.rx_bytes, stats.tx_bytes,
-                        stats.recv_bytes, stats.n_recv,
-                        stats.send_bytes, stats.n_send,
-                        stats.conns_opened, stats.n_conns,
-                        stats.poll_reads, stats.poll_writes, stats.n_polls,
-                        elapsed);
+    /* pool threads are not involved: counters are monotonic and can be read
+     * concurrently, lock only keeps the set of pools from changing */
+    GLB_MUTEX_LOCK (&pool->lock);
+    glb_pool_stats_add (&stats, &pool->retired);
+    for (i = 0; i < pool->n_all; i++) {
+        glb_pool_stats_add (&stats, &pool->pool[i]->stats);
+        stats.n_conns += pool->pool[i]->n_conns;
     }
-    else {
-        assert (ret < 0);
-        glb_log_error ("Failed to get stats from %d thread pools.", ret);
+    GLB_MUTEX_UNLOCK (&pool->lock);
+
+    double const elapsed = glb_time_seconds(now - pool->started);
+
+    return snprintf (buf, buf_len, "in: %lu out: %lu "
+                     "recv: %lu / %lu send: %lu / %lu "
+                     "conns: %lu / %lu poll: %lu / %lu / %lu "
+                     "elapsed: %.5f\n",
+                     stats.rx_bytes, stats.tx_bytes,
+                     stats.recv_bytes, stats.n_recv,
+                     stats.send_bytes, stats.n_send,
+                     stats.conns_opened, stats.n_conns,
+                     stats.poll_reads, stats.poll_writes, stats.n_polls,
+                     elapsed);
+}
+
+static inline double
+pool_lat_msec (const glb_hist_t* const h, double const q)
+{
+    return (glb_hist_quantile (h, q) * 1.0e-03);
+}
+
+ssize_t
+glb_pool_print_latency (glb_pool_t* pool, char* buf, size_t buf_len)
+{
+    pool_lat_set_t set = { NULL, 0 };
+    pool_ctl_t     lat_ctl = { POOL_CTL_LATENCY, (void*)&set };
+    size_t         len = 0;
+    int            i;
+
+    int const err = pool_bcast_ctl (pool, &lat_ctl);
+    if (err) {
+        glb_log_error ("Failed to get latencies from %d thread pools.", -err);
     }
 
-    pool->last_stats = now;
+    len += snprintf (buf + len, buf_len - len, "Latency (ms):\n"
+"--------------------------------------------------------------------------\n"
+"        Address       :  what    count      p50      p99     p999\n");
+    if (len >= buf_len) {
+        len = buf_len - 1;
+        buf[len] = '\0';
+        goto out;
+    }
 
-    return ret;
+    for (i = 0; i < set.n_lat; i++) {
+        const pool_lat_t* const l = &set.lat[i];
+        glb_sockaddr_str_t const addr = glb_sockaddr_to_astr (&l->addr);
+        const glb_hist_t* const hists[3] = {&l->connect,&l->ttfb,&l->lifetime};
+        static const char* const names[3] = { "conn", "ttfb", "life" };
+        int j;
+
+        for (j = 0; j < 3; j++) {
+            len += snprintf (buf + len, buf_len - len,
+                             "%s : %5s %8lu %8.3f %8.3f %8.3f\n",
+                             j ? "                     " : addr.str,
+                             names[j], hists[j]->count,
+                             pool_lat_msec (hists[j], 0.5),
+                             pool_lat_msec (hists[j], 0.99),
+                             pool_lat_msec (hists[j], 0.999));
+            if (len >= buf_len) {
+                len = buf_len - 1;
+                buf[len] = '\0';
+                goto out;
+            }
+        }
+    }
+
+    len += snprintf (buf + len, buf_len - len,
+"--------------------------------------------------------------------------\n"
+"Destinations: %d\n", set.n_lat);
+    if (len >= buf_len) {
+        len = buf_len - 1;
+        buf[len] = '\0';
+    }
+
+out:
+    free (set.lat);
+    return len;
+}
+
+ssize_t
+glb_pool_print_conns (glb_pool_t* pool, char* buf, size_t buf_len)
+{
+    pool_conns_buf_t b = { buf, buf_len, 0 };
+    pool_ctl_t       conns_ctl = { POOL_CTL_CONNS, (void*)&b };
+
+    b.len = snprintf (buf, buf_len, "Connections:\n"
+"------------------------------------------------------\n"
+"        Address       : pool  conns\n");
+    if (b.len >= buf_len) {
+        b.len = buf_len - 1;
+        buf[b.len] = '\0';
+        return b.len;
+    }
+
+    int const err = pool_bcast_ctl (pool, &conns_ctl);
+    if (err) {
+        glb_log_error ("Failed to get connections from %d thread pools.", -err);
+    }
+
+    b.len += snprintf (buf + b.len, buf_len - b.len,
+"------------------------------------------------------\n");
+    if (b.len >= buf_len) {
+        b.len = buf_len - 1;
+        buf[b.len] = '\0';
+    }
+
+    return b.len;
 }
 
 ssize_t
@@ -1104,9 +3898,9 @@ glb_pool_print_info (glb_pool_t* pool, char* buf, size_t buf_len)
 
 #ifndef GLB_POOL_STATS
     len += snprintf (buf + len, buf_len - len, "Pool: connections per thread:");
-    if (len == buf_len) {
-        buf[len - 1] = '\0';
-        return (len - 1);
+    if (len >= buf_len) {
+        buf[buf_len - 1] = '\0';
+        return (buf_len - 1);
     }
 #endif
 
@@ -1119,17 +3913,21 @@ glb_pool_print_info (glb_pool_t* pool, char* buf, size_t buf_len)
 #endif
 
     int i;
-    for (i = 0; i < pool->n_pools; i++) {
+    for (i = 0; i < pool->n_all; i++) {
 #ifdef GLB_POOL_STATS
-        glb_pool_stats_t s = pool->pool[i].stats;
+        glb_pool_stats_t s = glb_zero_stats;
 
-        pool->pool[i].stats = glb_zero_stats;
+        glb_pool_stats_add (&s, &pool->pool[i]->stats);
+        glb_pool_stats_t const total = s;
+        glb_pool_stats_sub (&s, &pool->pool[i]->info_stats);
+        pool->pool[i]->info_stats = total;
 
         len += snprintf (buf + len, buf_len - len,
         "Pool %2d: conns: %5d, selects: %9zu (%9.2f sel/sec)\n"
         "recv   : %9zuB %9zuR %9zuS %9.2fB/R %9.2fB/sec %9.2fR/S %9.2fR/sec\n"
         "send   : %9zuB %9zuW %9zuS %9.2fB/W %9.2fB/sec %9.2fW/S %9.2fW/sec\n",
-         i, pool->pool[i].n_conns, s.n_polls, (double)s.n_polls/elapsed,
+         pool->pool[i]->id, pool->pool[i]->n_conns,
+         s.n_polls, (double)s.n_polls/elapsed,
          s.recv_bytes,s.n_recv,s.poll_reads,(double)s.recv_bytes/s.n_recv,
          (double)s.recv_bytes/elapsed,(double)s.n_recv/s.n_polls,
          (double)s.n_recv/elapsed,
@@ -1137,17 +3935,17 @@ glb_pool_print_info (glb_pool_t* pool, char* buf, size_t buf_len)
          (double)s.send_bytes/elapsed,(double)s.n_send/s.n_polls,
          (double)s.n_send/elapsed
         );
-        if (len == buf_len) {
-            buf[len - 1] = '\0';
+        if (len >= buf_len) {
+            buf[buf_len - 1] = '\0';
             GLB_MUTEX_UNLOCK (&pool->lock);
-            return (len - 1);
+            return (buf_len - 1);
         }
 #else
-        len += snprintf (buf + len, buf_len - len," %5d",pool->pool[i].n_conns);
-        if (len == buf_len) {
-            buf[len - 1] = '\0';
+        len += snprintf (buf + len, buf_len - len," %5d",pool->pool[i]->n_conns);
+        if (len >= buf_len) {
+            buf[buf_len - 1] = '\0';
             GLB_MUTEX_UNLOCK (&pool->lock);
-            return (len - 1);
+            return (buf_len - 1);
         }
 #endif
     }
@@ -1157,12 +3955,46 @@ glb_pool_print_info (glb_pool_t* pool, char* buf, size_t buf_len)
     }
 #endif
 
+    if (pool->n_all > pool->n_pools) {
+        len += snprintf (buf + len, buf_len - len, "%slast %d retiring",
+#ifdef GLB_POOL_STATS
+                         "",
+#else
+                         ", ",
+#endif
+                         pool->n_all - pool->n_pools);
+        if (len >= buf_len) {
+            buf[buf_len - 1] = '\0';
+            GLB_MUTEX_UNLOCK (&pool->lock);
+            return (buf_len - 1);
+        }
+    }
+
     GLB_MUTEX_UNLOCK (&pool->lock);
 
     len += snprintf (buf + len, buf_len - len,"\n");
-    if (len == buf_len) {
-        buf[len - 1] = '\0';
-        return (len - 1);
+    if (len >= buf_len) {
+        buf[buf_len - 1] = '\0';
+        return (buf_len - 1);
+    }
+
+    if (pool->cnf->mysql_mux) {
+        int j;
+
+        len += snprintf (buf + len, buf_len - len,
+                         "MySQL server connections per thread (busy):");
+        GLB_MUTEX_LOCK (&pool->lock);
+        for (j = 0; j < pool->n_all && len < buf_len; j++) {
+            len += snprintf (buf + len, buf_len - len, " %5d (%d)",
+                             pool->pool[j]->mux_servers,
+                             pool->pool[j]->mux_busy);
+        }
+        GLB_MUTEX_UNLOCK (&pool->lock);
+        if (len < buf_len) len += snprintf (buf + len, buf_len - len, "\n");
+        if (len >= buf_len) {
+            buf[buf_len - 1] = '\0';
+            return (buf_len - 1);
+        }
     }
 
     return len;
@@ -1177,16 +4009,22 @@ glb_pool_destroy (glb_pool_t* pool)
 
     if (err) glb_log_debug ("shutdown broadcast failed: %d", -err);
 
-    for (i = 0; i < pool->n_pools; i++) {
-        pool_t* p = &pool->pool[i];
+    for (i = 0; i < pool->n_all; i++) {
+        pool_t* p = pool->pool[i];
         pthread_join (p->thread, NULL);
         close (p->ctl_send);
         pool_fds_release (p);
         pthread_cond_destroy  (&p->cond);
         pthread_mutex_destroy (&p->lock);
+        free (p);
     }
 
+#ifdef GLB_USE_SOCKMAP
+    glb_sockmap_destroy ();
+#endif
+
     pthread_mutex_destroy (&pool->lock);
+    free (pool->pool);
     free (pool);
 }
 
@@ -20,6 +20,18 @@ glb_pool_create (const glb_cnf_t* cnf, glb_router_t* router);
 extern void
 glb_pool_destroy (glb_pool_t* pool);
 
+/* Changes number of pool threads that receive new connections: new threads
+ * are started immediately, excess ones retire - keep serving their
+ * connections and exit after the last one is closed.
+ * @return 0 or negative error code */
+extern int
+glb_pool_set_threads (glb_pool_t* pool, int n);
+
+/* Stops retired pool threads that have no connections left.
+ * @return number of threads still retiring */
+extern int
+glb_pool_reap (glb_pool_t* pool);
+
 // Adds connection to conneciton pool
 extern int
 glb_pool_add_conn (glb_pool_t*           pool,
@@ -27,7 +39,9 @@ glb_pool_add_conn (glb_pool_t*           pool,
                    const glb_sockaddr_t* inc_addr,
                    int                   dst_sock,
                    const glb_sockaddr_t* dst_addr,
-                   bool                  complete);
+                   glb_router_handle_t   dst_handle,
+                   bool                  complete,
+                   glb_time_t            accepted); // glb_time_mono()
 
 // Closes all connecitons to a given destination
 extern int
@@ -36,6 +50,14 @@ glb_pool_drop_dst (glb_pool_t* pool, const glb_sockaddr_t* dst);
 extern ssize_t
 glb_pool_print_stats (glb_pool_t* pool, char* buf, size_t buf_len);
 
+// Prints per-destination connect, time-to-first-byte and lifetime percentiles
+extern ssize_t
+glb_pool_print_latency (glb_pool_t* pool, char* buf, size_t buf_len);
+
+// Prints server connections of each pool thread grouped by destination
+extern ssize_t
+glb_pool_print_conns (glb_pool_t* pool, char* buf, size_t buf_len);
+
 extern ssize_t
 glb_pool_print_info (glb_pool_t* pool, char* buf, size_t buf_len);
 
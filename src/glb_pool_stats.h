@@ -1,5 +1,10 @@
 /*
- * Copyright (C) 2008 Codership Oy <info@codership.com>
+ * Copyright (C) 2008-2013 Codership Oy <info@codership.com>
+ *
+ * Pool statistics counters are monotonic totals. Each set is written only by
+ * its own pool thread and can be read by any other thread at any time without
+ * synchronization with the writer: all accesses are relaxed atomics, so readers
+ * never see torn values, just not necessarily the latest ones.
  *
  * $Id: glb_pool_stats.h 160 2013-11-03 14:49:02Z alex $
  */
@@ -7,7 +12,8 @@
 #ifndef _glb_pool_stats_h_
 #define _glb_pool_stats_h_
 
-#include "glb_types.h" // ulong
+#include "glb_types.h"  // ulong
+#include "glb_macros.h" // GLB_CACHE_ALIGNED
 
 typedef struct glb_pool_stats
 {
@@ -23,26 +29,58 @@ typedef struct glb_pool_stats
     ulong poll_reads;   // number of read-ready fd's returned by poll()
     ulong poll_writes;  // number of write-ready fd's returned by poll()
     ulong n_polls;      // number of poll() calls
-} glb_pool_stats_t;
+} GLB_CACHE_ALIGNED glb_pool_stats_t;
 
 static const glb_pool_stats_t glb_zero_stats = { 0, };
 
-// adds right stats to left stats
+#if defined(__ATOMIC_RELAXED)
+#  define GLB_STATS_LOAD(x)    __atomic_load_n (&(x), __ATOMIC_RELAXED)
+#  define GLB_STATS_STORE(x,v) __atomic_store_n (&(x), (v), __ATOMIC_RELAXED)
+#else
+#  define GLB_STATS_LOAD(x)    (*(volatile ulong*)&(x))
+#  define GLB_STATS_STORE(x,v) (*(volatile ulong*)&(x) = (v))
+#endif
+
+/*! Updates counter. Must be called only by the thread owning the stats,
+ *  so no read-modify-write atomicity is needed. */
+#define GLB_STATS_ADD(x,v) GLB_STATS_STORE(x, GLB_STATS_LOAD(x) + (v))
+#define GLB_STATS_INC(x)   GLB_STATS_ADD(x, 1)
+#define GLB_STATS_DEC(x)   GLB_STATS_STORE(x, GLB_STATS_LOAD(x) - 1)
+
+// adds right stats to left stats, right can be concurrently updated
+static inline void
+glb_pool_stats_add (glb_pool_stats_t* left, const glb_pool_stats_t* right)
+{
+    left->rx_bytes     += GLB_STATS_LOAD(right->rx_bytes);
+    left->tx_bytes     += GLB_STATS_LOAD(right->tx_bytes);
+    left->recv_bytes   += GLB_STATS_LOAD(right->recv_bytes);
+    left->n_recv       += GLB_STATS_LOAD(right->n_recv);
+    left->send_bytes   += GLB_STATS_LOAD(right->send_bytes);
+    left->n_send       += GLB_STATS_LOAD(right->n_send);
+    left->conns_opened += GLB_STATS_LOAD(right->conns_opened);
+    left->conns_closed += GLB_STATS_LOAD(right->conns_closed);
+    left->n_conns      += GLB_STATS_LOAD(right->n_conns);
+    left->poll_reads   += GLB_STATS_LOAD(right->poll_reads);
+    left->poll_writes  += GLB_STATS_LOAD(right->poll_writes);
+    left->n_polls      += GLB_STATS_LOAD(right->n_polls);
+}
+
+// subtracts right stats from left stats (to get the difference of snapshots)
 static inline void
-glb_pool_stats_add (glb_pool_stats_t* left, glb_pool_stats_t* right)
+glb_pool_stats_sub (glb_pool_stats_t* left, const glb_pool_stats_t* right)
 {
-    left->rx_bytes     += right->rx_bytes;
-    left->tx_bytes     += right->tx_bytes;
-    left->recv_bytes   += right->recv_bytes;
-    left->n_recv       += right->n_recv;
-    left->send_bytes   += right->send_bytes;
-    left->n_send       += right->n_send;
-    left->conns_opened += right->conns_opened;
-    left->conns_closed += right->conns_closed;
-    left->n_conns      += right->n_conns;
-    left->poll_reads   += right->poll_reads;
-    left->poll_writes  += right->poll_writes;
-    left->n_polls      += right->n_polls;
+    left->rx_bytes     -= right->rx_bytes;
+    left->tx_bytes     -= right->tx_bytes;
+    left->recv_bytes   -= right->recv_bytes;
+    left->n_recv       -= right->n_recv;
+    left->send_bytes   -= right->send_bytes;
+    left->n_send       -= right->n_send;
+    left->conns_opened -= right->conns_opened;
+    left->conns_closed -= right->conns_closed;
+    /* n_conns is not a total */
+    left->poll_reads   -= right->poll_reads;
+    left->poll_writes  -= right->poll_writes;
+    left->n_polls      -= right->n_polls;
 }
 
 #endif // _glb_pool_stats_h_
@@ -71,7 +71,16 @@ proc_pipe_fds (posix_spawn_file_actions_t* fact,
         return err;
     }
 
-    if (pipe(pipe_fds))
+    /* Parent's ends must not leak into other children, or those will keep
+     * the pipe open after the parent closes its stream. Child's end loses
+     * FD_CLOEXEC when it is dup2()-ed in place of child_fd. */
+#if defined(_GNU_SOURCE) && defined(O_CLOEXEC)
+    if (pipe2(pipe_fds, O_CLOEXEC))
+#else
+    if (pipe(pipe_fds) ||
+        fcntl(pipe_fds[0], F_SETFD, FD_CLOEXEC) ||
+        fcntl(pipe_fds[1], F_SETFD, FD_CLOEXEC))
+#endif /* _GNU_SOURCE && O_CLOEXEC */
     {
         err = errno;
         glb_log_error ("pipe() failed: %d (%s)", err, strerror(err));
@@ -1,8 +1,10 @@
 /*
  * Copyright (C) 2008-2013 Codership Oy <info@codership.com>
  *
- * NOTE: connection count and usage make sense only for standalone balancer
- *       so all operations on them are #ifdef GLBD ... #endif
+ * NOTE: connection outcomes and ejection make sense only for standalone
+ *       balancer so all operations on them are #ifdef GLBD ... #endif
+ *       libglb counts connections it was told were closed and can share
+ *       counts and failure marks with other processes (see glb_shm.h).
  *
  * $Id: glb_router.c 156 2013-08-23 08:24:56Z vlad $
  */
@@ -12,6 +14,7 @@
 #include "glb_cmd.h"
 #include "glb_misc.h"
 #include "glb_socket.h"
+#include "glb_select.h"
 
 #include <pthread.h>
 #include <stdbool.h>
@@ -22,12 +25,15 @@
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <float.h> // for DBL_EPSILON
+#include <stdint.h>
+#include <stdlib.h>
 
 static double const GLB_DBL_EPSILON = (DBL_EPSILON * 2.0);
 
 #ifdef GLBD
 #  include <stdio.h>
 #else /* GLBD */
+#  include "glb_shm.h"
 #  include <dlfcn.h>
 static int (*__glb_real_connect) (int                    sockfd,
                                   const struct sockaddr* addr,
@@ -46,17 +52,42 @@ typedef struct router_dst
 {
     glb_dst_t  dst;
     glb_backend_thread_ctx_t* probe_ctx;
-#ifdef GLBD
-    double     usage;   // usage measure: weight/(conns + 1) - bigger wins
-#endif
-    double     map;     // is used to break (0.0, 1.0) proportionally to weight
-    glb_time_t checked; // last time this destination was checked
-    time_t     failed;  // last time connection to this destination failed
-#ifdef GLBD
+    glb_time_t checked; // time this destination was added
+    glb_time_t kicked;  // last time on-demand probe was requested
+    uint32_t   slot;    // handle slot, stays with destination when it moves
     int        conns;   // how many connections use this destination
+#ifdef GLBD
+    time_t     win_start;  // start of the current outcome window
+    int        win_ok[2];  // good outcomes in current and previous windows
+    int        win_err[2]; // bad outcomes in current and previous windows
+    int        ejections;  // consecutive ejections, defines ejection time
+    time_t     ejected;    // end of the last ejection
+#else
+    int        shm_dst;    // record in shared memory, -1 if none
 #endif
 } router_dst_t;
 
+/*! Handle slot: maps stable handles to current index in router->dst
+ *  (it changes when other destination is removed). Free slots are linked
+ *  through idx. */
+typedef struct router_slot
+{
+    int      idx;
+    uint32_t gen;
+} router_slot_t;
+
+/*! Fields scanned on every routing decision, kept in separate cache-aligned
+ *  arrays indexed like router->dst, so that selection kernels (glb_select.h)
+ *  can process several destinations at a time. */
+typedef struct router_hot
+{
+    double*  weight; // copy of dst.weight
+    double*  usage;  // usage measure: weight/(conns + 1) - bigger wins
+    double*  map;    // is used to break (0.0, 1.0) proportionally to weight
+    int64_t* failed; // last time connection to this destination failed
+    int      size;   // allocated length of the arrays
+} router_hot_t;
+
 struct glb_router
 {
     const volatile glb_cnf_t* cnf;
@@ -66,9 +97,7 @@ struct glb_router
     long            busy_count;
     long            wait_count;
     pthread_cond_t  free;
-#ifdef GLBD
     int             conns;
-#endif
     unsigned int    seed;     // seed for rng
     int             rrb_next; // round-robin cursor
     int             n_dst;
@@ -76,10 +105,34 @@ struct glb_router
     time_t          top_failed; // last time top dst was redone after failed dst
     router_dst_t*   top_dst;
     router_dst_t*   dst;
+    router_hot_t    hot;
+    router_slot_t*  slots;
+    int             n_slots;
+    int             free_slot; // head of free slots list, -1 if empty
+    uint64_t        stale_hits;   // extra check found destination stale
+    uint64_t        stale_routed; // ... and there was no fresh alternative
+    uint64_t        stale_kicks;  // on-demand probes requested
+#ifdef GLBD
+    time_t          eject_end; // earliest end of ejection, 0 if none
+#else
+    glb_shm_t*      shm;       // state shared with other processes
+#endif
 };
 
 static const double router_div_prot = 1.0e-09; // protection against div by 0
 
+#ifdef GLBD
+/* Passive outlier detection: connection outcomes are counted in two
+ * consecutive windows, the previous one weighted by how much of it still
+ * overlaps with the sliding window. Destination with at least
+ * ROUTER_EJECT_ERRORS errors that make at least half of its outcomes is
+ * ejected for retry interval doubled with every consecutive ejection. */
+#define ROUTER_OUTLIER_WINDOW 10  // seconds
+#define ROUTER_EJECT_ERRORS   5
+#define ROUTER_EJECT_MAX      300 // seconds, also resets ejection backoff
+#define ROUTER_EJECT_SHARE    2   // never eject more than 1/2 of destinations
+#endif /* GLBD */
+
 // seconds (should be >= 1 due to time_t precision)
 static inline long
 router_retry_interval (const glb_router_t* const router)
@@ -87,44 +140,155 @@ router_retry_interval (const glb_router_t* const router)
     return (glb_time_approx_seconds(router->cnf->interval) + 1);
 }
 
-static bool
-router_dst_probe (router_dst_t* const d, glb_time_t now)
+static inline int
+router_dst_idx (const glb_router_t* const router, const router_dst_t* const d)
 {
-    glb_wdog_check_t p;
-    struct timespec until = glb_time_to_timespec(now);
-    until.tv_sec += 1; // 1 second timeout
+    return (d - router->dst);
+}
 
-    glb_backend_probe (d->probe_ctx, &p, &until);
+#define ROUTER_HOT_ALIGN 64 // cache line
+#define ROUTER_HOT_ARRAYS 4
 
-    if (GLB_DST_READY == p.state)
+/*! makes sure hot arrays can hold size elements, preserves n_dst of them */
+static int
+router_hot_reserve (router_hot_t* const hot, int const n_dst, int const size)
+{
+    if (size <= hot->size) return 0;
+
+    /* keep every array cache-aligned */
+    int const step = ROUTER_HOT_ALIGN / sizeof(double);
+    int const new_size = ((size > 2*hot->size ? size : 2*hot->size) + step - 1)
+        / step * step;
+    size_t const len = new_size * sizeof(double);
+    void* block;
+
+    if (posix_memalign (&block, ROUTER_HOT_ALIGN, len * ROUTER_HOT_ARRAYS))
+        return -ENOMEM;
+
+    router_hot_t tmp;
+    tmp.weight = block;
+    tmp.usage  = (double*) ((char*)block + len);
+    tmp.map    = (double*) ((char*)block + 2 * len);
+    tmp.failed = (int64_t*)((char*)block + 3 * len);
+    tmp.size   = new_size;
+
+    if (hot->size > 0)
     {
-        d->checked = p.timestamp;
+        memcpy (tmp.weight, hot->weight, n_dst * sizeof(double));
+        memcpy (tmp.usage,  hot->usage,  n_dst * sizeof(double));
+        memcpy (tmp.map,    hot->map,    n_dst * sizeof(double));
+        memcpy (tmp.failed, hot->failed, n_dst * sizeof(int64_t));
+        free (hot->weight);
+    }
+
+    *hot = tmp;
+
+    return 0;
+}
+
+static inline void
+router_hot_copy (router_hot_t* const hot, int const to, int const from)
+{
+    hot->weight[to] = hot->weight[from];
+    hot->usage[to]  = hot->usage[from];
+    hot->map[to]    = hot->map[from];
+    hot->failed[to] = hot->failed[from];
+}
+
+/*! @return free slot pointing at idx or negative error code */
+static int
+router_slot_alloc (glb_router_t* const router, int const idx)
+{
+    int slot = router->free_slot;
+
+    if (slot < 0)
+    {
+        router_slot_t* const tmp = realloc (router->slots,
+            (router->n_slots + 1) * sizeof(router_slot_t));
+
+        if (!tmp) return -ENOMEM;
+
+        router->slots = tmp;
+        slot = router->n_slots++;
+        router->slots[slot].gen = 1; // generation 0 is never valid
     }
     else
     {
-        d->failed = time (NULL);
+        router->free_slot = router->slots[slot].idx;
+    }
+
+    router->slots[slot].idx = idx;
+
+    return slot;
+}
+
+static inline void
+router_slot_free (glb_router_t* const router, uint32_t const slot)
+{
+    router->slots[slot].gen++; // invalidate outstanding handles
+    if (0 == router->slots[slot].gen) router->slots[slot].gen = 1;
+    router->slots[slot].idx = router->free_slot;
+    router->free_slot = slot;
+}
+
+static inline glb_router_handle_t
+router_dst_handle (const glb_router_t* const router, const router_dst_t* const d)
+{
+    glb_router_handle_t const ret = { d->slot, router->slots[d->slot].gen };
+    return ret;
+}
+
+/*! @return destination referenced by handle or NULL if it is stale */
+static inline router_dst_t*
+router_dst_by_handle (const glb_router_t*        const router,
+                      const glb_router_handle_t* const h)
+{
+    if (GLB_LIKELY(h->slot < (uint32_t)router->n_slots &&
+                   h->gen == router->slots[h->slot].gen))
+    {
+        int const idx = router->slots[h->slot].idx;
+        assert (idx >= 0 && idx < router->n_dst);
+        assert (router->dst[idx].slot == h->slot);
+        return &router->dst[idx];
     }
 
-    return (GLB_DST_READY == p.state);
+    return NULL;
+}
+
+static inline void
+router_dst_set_failed (glb_router_t* const router,
+                       router_dst_t* const d,
+                       time_t        const t)
+{
+    router->hot.failed[router_dst_idx (router, d)] = t;
+}
+
+/* failed timestamps earlier than that are old enough to retry */
+static inline int64_t
+router_deadline (time_t const now, long const retry)
+{
+    return ((int64_t)now - retry);
 }
 
 static inline bool
-router_dst_is_good_base (const router_dst_t* const d,
+router_dst_is_good_base (const glb_router_t* const router,
+                         int                 const i,
                          time_t              const now,
                          long                const retry)
 {
-    return (difftime (now, d->failed) > retry);
+    return (router->hot.failed[i] < router_deadline (now, retry));
 }
 
 
 static inline bool
-router_dst_is_good (const router_dst_t* const d,
+router_dst_is_good (const glb_router_t* const router,
+                    int                 const i,
                     double              const min_weight,
                     time_t              const now,
                     long                const retry)
 {
-    return (d->dst.weight >= min_weight &&
-            router_dst_is_good_base (d, now, retry));
+    return (router->hot.weight[i] >= min_weight &&
+            router_dst_is_good_base (router, i, now, retry));
 }
 
 static inline bool
@@ -132,7 +296,8 @@ router_top_dst_is_good (const glb_router_t* const router)
 {
     const router_dst_t* const d = router->top_dst;
     return (d && d->dst.weight >= GLB_DBL_EPSILON &&
-            router_dst_is_good_base (d, router->ctx.now, router->ctx.retry));
+            router_dst_is_good_base (router, router_dst_idx (router, d),
+                                     router->ctx.now, router->ctx.retry));
 }
 
 static inline double
@@ -175,13 +340,11 @@ router_redo_top (glb_router_t* router)
 
     for (i = 0; i < router->n_dst; i++)
     {
-        router_dst_t* d = &router->dst[i];
-
-        if (router_dst_is_good (d, top_weight, router->ctx.now,
+        if (router_dst_is_good (router, i, top_weight, router->ctx.now,
                                 router->ctx.retry))
         {
-            router->top_dst = d;
-            router->ctx.min_weight = d->dst.weight;
+            router->top_dst = &router->dst[i];
+            router->ctx.min_weight = router->hot.weight[i];
             top_weight = router->ctx.min_weight * factor;
         }
     }
@@ -192,63 +355,96 @@ router_redo_map (glb_router_t* router)
 {
     int i;
 
-    // pass 1: calculate total weight of available destinations
-    double total = 0.0;
-    for (i = 0; i < router->n_dst; i++)
-    {
-        router_dst_t* d = &router->dst[i];
+    double* const map = router->hot.map;
 
-        if (router_dst_is_good (d, router->ctx.min_weight, router->ctx.now,
-                                router->ctx.retry))
-        {
-            total += d->dst.weight;
-            d->map = d->dst.weight;
-        }
-        else
-        {
-            d->map = 0.0;
-        }
-    }
+    // pass 1: calculate total weight of available destinations
+    double const total = glb_select_weights (
+        map, router->hot.weight, router->hot.failed, router->n_dst,
+        router->ctx.min_weight,
+        router_deadline (router->ctx.now, router->ctx.retry));
 
     if (0.0 == total) return;
 
-    // pass 2: normalize weights in a map
+    /* pass 2: normalize weights in a map. Map is non-decreasing, so the
+     * destination for a point can be found by binary search. */
     double m = 0;
     for (i = 0; i < router->n_dst; i++)
     {
-        router_dst_t* d = &router->dst[i];
-
-        d->map = d->map / total + m;
-        m = d->map;
+        map[i] = map[i] / total + m;
+        m = map[i];
     }
 }
 
-#ifdef GLBD
-static inline double
-router_dst_usage (router_dst_t* d)
-/* +1 stands for what would be the usage of dst if we connect to it */
-{ return (d->dst.weight / (d->conns + 1)); }
+/*! @return number of connections to destination: from all processes if
+ *          it is shared */
+static inline int
+router_dst_conns (const glb_router_t* const router, const router_dst_t* const d)
+{
+#ifndef GLBD
+    if (d->shm_dst >= 0) return glb_shm_conns (router->shm, d->shm_dst);
+#else
+    (void)router;
 #endif
+    return d->conns;
+}
 
-/*! return index of the deleted destination or negative error code*/
-int
-glb_router_change_dst (glb_router_t*             const router,
-                       const glb_dst_t*          const dst,
-                       glb_backend_thread_ctx_t* const probe_ctx)
+/*! @return true if destination reached connection limit set by watchdog */
+static inline bool
+router_dst_full (const glb_router_t* const router, const router_dst_t* const d)
 {
-    int           i;
-    router_dst_t* d = NULL;
+    return (d->dst.max_conns > 0 &&
+            router_dst_conns (router, d) >= d->dst.max_conns);
+}
 
-    GLB_MUTEX_LOCK (&router->lock);
+/* +1 stands for what would be the usage of dst if we connect to it,
+ * full destination has no usage to offer */
+static inline void
+router_dst_update_usage (glb_router_t* const router, router_dst_t* const d)
+{
+    int const i = router_dst_idx (router, d);
+    router->hot.usage[i] = router_dst_full (router, d) ?
+        0.0 : router->hot.weight[i] / (router_dst_conns (router, d) + 1);
+}
+
+/* accounts delta connections to destination */
+static inline void
+router_dst_conns_add (glb_router_t* const router, router_dst_t* const d,
+                      int const delta)
+{
+    d->conns += delta; router->conns += delta;
+    assert (d->conns >= 0);
+#ifndef GLBD
+    if (d->shm_dst >= 0) glb_shm_conns_add (router->shm, d->shm_dst, delta);
+#endif
+    router_dst_update_usage (router, d);
+}
+
+/*! @return index of destination in the list or n_dst if it is not there */
+static inline int
+router_find_dst (const glb_router_t* const router, const glb_dst_t* const dst)
+{
+    int i;
 
-    // try to find destination in the list
     for (i = 0; i < router->n_dst; i++) {
-        if (glb_dst_is_equal(&((&router->dst[i])->dst), dst)) {
-            d = &router->dst[i];
-            break;
-        }
+        if (glb_dst_is_equal(&((&router->dst[i])->dst), dst)) break;
     }
 
+    return i;
+}
+
+/*! Applies single destination change without redoing top and map. Router
+ *  must be locked and, if destination is added or removed, idle.
+ *  @param changed set to true if change was effective
+ *  @return index of the record changed or negative error code */
+static int
+router_apply_change (glb_router_t*             const router,
+                     const glb_dst_t*          const dst,
+                     glb_backend_thread_ctx_t* const probe_ctx,
+                     bool*                     const changed)
+{
+    int           i = router_find_dst (router, dst);
+    router_dst_t* d = i < router->n_dst ? &router->dst[i] : NULL;
+
     // sanity check
     if (!d && dst->weight < 0) {
 #ifdef GLBD
@@ -256,20 +452,10 @@ glb_router_change_dst (glb_router_t*             const router,
         glb_dst_print (tmp, sizeof(tmp), dst);
         glb_log_warn ("Command to remove inexisting destination: %s", tmp);
 #endif
-        i = -ENONET;
-        goto out;
+        return -ENONET;
     }
 
-    if (!d || dst->weight < 0) {
-        // cant remove/add destination while someone's connecting
-        while (router->busy_count > 0) {
-            router->wait_count++;
-            pthread_cond_wait (&router->free, &router->lock);
-            router->wait_count--;
-            assert (router->wait_count >= 0);
-        }
-        assert (0 == router->busy_count);
-    }
+    assert ((d && dst->weight >= 0) || 0 == router->busy_count);
 
     router_dst_t* tmp;
 
@@ -277,9 +463,17 @@ glb_router_change_dst (glb_router_t*             const router,
 
         assert (i == router->n_dst);
 
+        if (router_hot_reserve (&router->hot, router->n_dst, router->n_dst+1))
+            return -ENOMEM;
+
+        int const slot = router_slot_alloc (router, i);
+
+        if (slot < 0) return slot;
+
         tmp = realloc (router->dst, (router->n_dst + 1) * sizeof(router_dst_t));
 
         if (!tmp) {
+            router_slot_free (router, slot);
             i = -ENOMEM;
         }
         else {
@@ -289,12 +483,23 @@ glb_router_change_dst (glb_router_t*             const router,
             router->n_dst++;
             d->dst       = *dst;
             d->probe_ctx = probe_ctx;
-#ifdef GLBD
+            d->slot      = slot;
+            router->hot.weight[i] = dst->weight;
+            router->hot.map[i]    = 0.0;
+            router->hot.failed[i] = 0;
             d->conns     = 0;
-            d->usage     = router_dst_usage(d);
+#ifdef GLBD
+            d->win_start = time (NULL);
+            d->win_ok[0] = d->win_ok[1] = d->win_err[0] = d->win_err[1] = 0;
+            d->ejections = 0;
+            d->ejected   = 0;
+#else
+            d->shm_dst   = router->shm ?
+                glb_shm_dst (router->shm, &dst->addr) : -1;
 #endif
+            router_dst_update_usage (router, d);
             d->checked   = glb_time_now();
-            d->failed    = 0;
+            d->kicked    = 0;
         }
     }
     else if (dst->weight < 0) { // remove destination from the list
@@ -304,12 +509,16 @@ glb_router_change_dst (glb_router_t*             const router,
 
         router->top_dst = NULL;
 
-#ifdef GLBD
-        router->conns -= d->conns; assert (router->conns >= 0);
-#endif
+        /* handles of its connections become stale, so they are
+         * discounted here */
+        router_dst_conns_add (router, d, -d->conns);
+        router_slot_free (router, d->slot);
+
         if ((i + 1) < router->n_dst) {
             // it is not the last, copy the last one over
             *d = router->dst[router->n_dst - 1];
+            router_hot_copy (&router->hot, i, router->n_dst - 1);
+            router->slots[d->slot].idx = i;
         }
 
         router->n_dst--;
@@ -329,26 +538,82 @@ glb_router_change_dst (glb_router_t*             const router,
             router->dst = tmp;
         }
     }
-    else if (d->dst.weight != dst->weight) {
-        // update weight and usage
-        d->dst.weight = dst->weight;
-#ifdef GLBD
-        d->usage      = router_dst_usage (d);
-#endif
+    else if (d->dst.weight != dst->weight ||
+             d->dst.max_conns != dst->max_conns) {
+        // update weight, connection limit and usage
+        d->dst.weight    = dst->weight;
+        d->dst.max_conns = dst->max_conns;
+        router->hot.weight[i] = dst->weight;
+        router_dst_update_usage (router, d);
     }
     else {
-        goto out; // ineffective change
+        return i; // ineffective change
     }
 
-    router_update_ctx (router);
-    if (router->cnf->top) router_redo_top (router);
-    if (router_uses_map(router)) router_redo_map (router);
-
     assert (router->n_dst >= 0);
-out:
+    *changed = true;
+    return i;
+}
+
+int
+glb_router_change_dsts (glb_router_t*                   const router,
+                        int                             const n,
+                        const glb_dst_t*                const dst,
+                        glb_backend_thread_ctx_t* const* const probe_ctx,
+                        int*                            const res)
+{
+    bool changed = false;
+    int  ret = 0;
+    int  k;
+
+    GLB_MUTEX_LOCK (&router->lock);
+
+    for (k = 0; k < n; k++) {
+        if (dst[k].weight < 0 || router_find_dst (router, &dst[k]) ==
+            router->n_dst) {
+            // cant remove/add destination while someone's connecting
+            while (router->busy_count > 0) {
+                router->wait_count++;
+                pthread_cond_wait (&router->free, &router->lock);
+                router->wait_count--;
+                assert (router->wait_count >= 0);
+            }
+            assert (0 == router->busy_count);
+            break;
+        }
+    }
+
+    for (k = 0; k < n; k++) {
+        int const i = router_apply_change (router, &dst[k],
+                                           probe_ctx ? probe_ctx[k] : NULL,
+                                           &changed);
+        if (res) res[k] = i;
+        if (i < 0 && 0 == ret) ret = i;
+    }
+
+    if (changed) {
+        router_update_ctx (router);
+        if (router->cnf->top) router_redo_top (router);
+        if (router_uses_map(router)) router_redo_map (router);
+    }
+
     if (router->wait_count > 0) pthread_cond_signal (&router->free);
     GLB_MUTEX_UNLOCK (&router->lock);
-    return i;
+
+    return ret;
+}
+
+/*! return index of the deleted destination or negative error code*/
+int
+glb_router_change_dst (glb_router_t*             const router,
+                       const glb_dst_t*          const dst,
+                       glb_backend_thread_ctx_t* const probe_ctx)
+{
+    int ret;
+
+    glb_router_change_dsts (router, 1, dst, &probe_ctx, &ret);
+
+    return ret;
 }
 
 static uint32_t
@@ -371,6 +636,8 @@ router_cleanup (glb_router_t* router)
     pthread_mutex_destroy (&router->lock);
     pthread_cond_destroy (&router->free);
     if (router->dst) free (router->dst);
+    if (router->hot.size > 0) free (router->hot.weight);
+    free (router->slots);
     free (router);
 }
 
@@ -394,13 +661,17 @@ glb_router_create (const glb_cnf_t* cnf/*size_t n_dst, glb_dst_t const dst[]*/)
 
         ret->cnf        = cnf;
         ret->busy_count = 0;
-#ifdef GLBD
         ret->conns      = 0;
-#endif
         ret->seed       = router_generate_seed();
         ret->rrb_next   = 0;
         ret->n_dst      = 0;
         ret->dst        = NULL;
+        ret->slots      = NULL;
+        ret->n_slots    = 0;
+        ret->free_slot  = -1;
+
+        glb_log_debug ("Destination selection kernels: %s",
+                       glb_select_impl());
 
         if (!cnf->watchdog) {
             for (i = 0; i < cnf->n_dst; i++) {
@@ -423,72 +694,130 @@ glb_router_destroy (glb_router_t* router)
     router_cleanup (router);
 }
 
-/* This will run extra destination check depending on uncheckd_intvl value */
+/* Extra destination checks (-x): destination is fresh if watchdog reported
+ * it ready less than uncheckd_intvl ago. Routing never waits for a probe,
+ * fresh destinations are preferred and stale ones are probed in background. */
 static inline bool
-router_dst_check (router_dst_t* const d,
-                  glb_time_t    const uncheckd_intvl)
+router_dst_fresh (const router_dst_t* const d,
+                  glb_time_t          const uncheckd_intvl,
+                  glb_time_t          const now)
 {
-    glb_time_t now;
-    return (0    == uncheckd_intvl                                 ||
-            NULL == d->probe_ctx                                   ||
-            ((now = glb_time_now()) - d->checked) < uncheckd_intvl ||
-            router_dst_probe (d, now));
+    return (NULL == d->probe_ctx ||
+            now - d->checked < uncheckd_intvl ||
+            now - glb_backend_checked (d->probe_ctx) < uncheckd_intvl);
+}
+
+/* routing hit stale destination, request probe if not requested recently */
+static void
+router_dst_stale (glb_router_t* const router,
+                  router_dst_t* const d,
+                  glb_time_t    const uncheckd_intvl,
+                  glb_time_t    const now)
+{
+    router->stale_hits++;
+
+    if (now - d->kicked >= uncheckd_intvl) {
+        d->kicked = now;
+        router->stale_kicks++;
+        glb_backend_probe_async (d->probe_ctx);
+    }
 }
 
-#ifdef GLBD
 // find a ready destination with minimal usage
 static router_dst_t*
 router_choose_dst_least (glb_router_t* const router)
 {
-    router_dst_t* ret = NULL;
+    int const i = glb_select_max (
+        router->hot.usage, router->hot.weight, router->hot.failed,
+        router->n_dst, router->ctx.min_weight,
+        router_deadline (router->ctx.now, router->ctx.retry));
 
-    if (router->n_dst > 0) {
-        double max_usage = 0.0;
-        int    i;
+    if (i < 0) return NULL;
 
-        for (i = 0; i < router->n_dst; i++) {
-            router_dst_t* d = &router->dst[i];
+    router_dst_t* ret = &router->dst[i];
 
-            if (d->usage > max_usage &&
-                router_dst_is_good (d, router->ctx.min_weight, router->ctx.now,
-                                    router->ctx.retry)) {
-                ret = d;
-                max_usage = d->usage;
-            }
-        }
+    glb_time_t const intvl = router->cnf->extra;
+    if (0 == intvl) return ret;
+
+    glb_time_t const now = glb_time_now();
+    if (GLB_LIKELY(router_dst_fresh (ret, intvl, now))) return ret;
+
+    router_dst_stale (router, ret, intvl, now);
+
+    // fall back to the least used fresh destination if any
+    double max_usage = 0.0;
+    router_dst_t* alt = NULL;
+    int j;
 
-        if (!(ret && router_dst_check (ret, router->cnf->extra))) ret = NULL;
+    for (j = 0; j < router->n_dst; j++) {
+        if (router->hot.usage[j] > max_usage &&
+            router_dst_is_good (router, j, router->ctx.min_weight,
+                                router->ctx.now, router->ctx.retry) &&
+            router_dst_fresh (&router->dst[j], intvl, now))
+        {
+            alt = &router->dst[j];
+            max_usage = router->hot.usage[j];
+        }
     }
 
+    if (alt) return alt;
+
+    router->stale_routed++;
     return ret;
 }
-#endif /* GLBD */
 
 // find next suitable destination by round robin
 static router_dst_t*
 router_choose_dst_round (glb_router_t* const router)
 {
+    glb_time_t const intvl = router->cnf->extra;
+    glb_time_t const now   = intvl ? glb_time_now() : 0;
+    router_dst_t*    stale = NULL;
     int offset;
 
     for (offset = 0; offset < router->n_dst; offset++)
     {
-        router_dst_t* d = &router->dst[router->rrb_next];
+        int const i = router->rrb_next;
+        router_dst_t* d = &router->dst[i];
 
         router->rrb_next = (router->rrb_next + 1) % router->n_dst;
 
-        if (router_dst_is_good (d, router->ctx.min_weight, router->ctx.now,
-                                router->ctx.retry) &&
-            router_dst_check (d, router->cnf->extra))
-            return d;
+        if (router_dst_is_good (router, i, router->ctx.min_weight,
+                                router->ctx.now, router->ctx.retry) &&
+            !router_dst_full (router, d))
+        {
+            if (0 == intvl || router_dst_fresh (d, intvl, now)) return d;
+
+            router_dst_stale (router, d, intvl, now);
+            if (!stale) stale = d;
+        }
     }
 
-    return NULL;
+    if (stale) router->stale_routed++;
+
+    return stale;
 }
 
 static inline router_dst_t*
 router_choose_dst_single (glb_router_t* const router)
 {
-    return (router_top_dst_is_good (router) ? router->top_dst : NULL);
+    if (!router_top_dst_is_good (router)) return NULL;
+
+    router_dst_t* const d = router->top_dst;
+
+    if (router_dst_full (router, d)) return NULL;
+    glb_time_t const intvl = router->cnf->extra;
+
+    if (intvl) {
+        glb_time_t const now = glb_time_now();
+
+        if (!router_dst_fresh (d, intvl, now)) {
+            router_dst_stale (router, d, intvl, now);
+            router->stale_routed++; // no alternative by definition
+        }
+    }
+
+    return d;
 }
 
 // find a ready destination by client source hint
@@ -515,7 +844,7 @@ router_choose_dst_hint (glb_router_t* const router, uint32_t const hint)
 
         router_dst_t* d = &router->dst[i];
 
-        if (router_dst_is_good (d, now)) return d;
+        if (router_dst_is_good (router, i, now)) return d;
 
         i = hint + n;
         n -= 1;
@@ -532,16 +861,39 @@ router_choose_dst_hint (glb_router_t* const router, uint32_t const hint)
     // make sure it is strictly < 1.0
     double const m = ((double)hint) / 0xffffffff - router_div_prot;
 
-    int i;
-    for (i = 0; i < router->n_dst; i++)
+    /* all destinations starting from the first one with map above m
+     * satisfy m < map, so the rest are failover candidates. Those before it
+     * are tried last, when the rest are stale or full. If every map is 0
+     * there are no candidates and we return NULL */
+    glb_time_t const intvl = router->cnf->extra;
+    glb_time_t const now   = intvl ? glb_time_now() : 0;
+    router_dst_t*    stale = NULL;
+    int const        first = glb_select_above (router->hot.map,
+                                               router->n_dst, m);
+
+    int k;
+    for (k = 0; first < router->n_dst && k < router->n_dst; k++)
     {
+        int const i = (first + k) % router->n_dst;
+
+        // failover candidates must have a share in the map too
+        if (k > 0 && router->hot.map[i] <= (i ? router->hot.map[i - 1] : 0.0))
+            continue;
+
         router_dst_t* d = &router->dst[i];
-        if (m < d->map && router_dst_check (d, router->cnf->extra)) return d;
-        /* if every map is 0 we fall through and return NULL */
+
+        if (router_dst_full (router, d)) continue;
+
+        if (0 == intvl || router_dst_fresh (d, intvl, now)) return d;
+
+        router_dst_stale (router, d, intvl, now);
+        if (!stale) stale = d;
     }
 #endif /* OLD */
 
-    return NULL;
+    if (stale) router->stale_routed++;
+
+    return stale;
 }
 
 static inline uint32_t
@@ -553,11 +905,112 @@ router_random_hint (glb_router_t* router)
     return ret ^ (ret << 1);
 }
 
+/* marks dst failed at time t, router context must be up to date */
+static void
+router_dst_failed_at (glb_router_t* const router, router_dst_t* const dst,
+                      time_t const t)
+{
+    /* this is to avoid redundant redoing top|map if the dst was already marked
+     * failed just now or was of lower than top weight and so didn't participate
+     * in balancing. */
+    bool const dst_was_good = router_dst_is_good (
+        router, router_dst_idx (router, dst), router->ctx.min_weight,
+        router->ctx.now, router->ctx.retry);
+
+    router_dst_set_failed (router, dst, t);
+
+    if (dst_was_good)
+    {
+        if (dst == router->top_dst)
+        {
+            router->ctx.min_weight = GLB_DBL_EPSILON;
+            router_redo_top (router);
+            router->top_failed = router->ctx.now;
+        }
+
+        if (router_uses_map (router))
+        {
+            router_redo_map(router);
+            router->map_failed = router->ctx.now;
+        }
+    }
+}
+
+static inline void
+router_dst_failed (glb_router_t* const router, router_dst_t* const dst)
+{
+    router->ctx.now   = time(NULL);
+    router->ctx.retry = router_retry_interval (router);
+
+#ifdef GLBD
+    if (dst->ejected > router->ctx.now) return; // failed till ejection end
+#endif
+
+    router_dst_failed_at (router, dst, router->ctx.now);
+
+#ifndef GLBD
+    if (dst->shm_dst >= 0)
+        glb_shm_set_failed (router->shm, dst->shm_dst, router->ctx.now);
+#endif
+}
+
+#ifndef GLBD
+/* applies failure marks and connection counts of other processes */
+static void
+router_shm_sync (glb_router_t* const router)
+{
+    int64_t const deadline = router_deadline (router->ctx.now,
+                                              router->ctx.retry);
+    int i;
+
+    for (i = 0; i < router->n_dst; i++) {
+        router_dst_t* const d = &router->dst[i];
+
+        if (d->shm_dst < 0) continue;
+
+        int64_t const t = glb_shm_failed (router->shm, d->shm_dst);
+
+        if (t > router->hot.failed[i] && t >= deadline)
+            router_dst_failed_at (router, d, t);
+
+        router_dst_update_usage (router, d);
+    }
+}
+#endif /* GLBD */
+
+#ifdef GLBD
+/* brings back destinations whose ejection is over */
+static void
+router_eject_expire (glb_router_t* const router)
+{
+    time_t next = 0;
+    int i;
+
+    for (i = 0; i < router->n_dst; i++) {
+        time_t const e = router->dst[i].ejected;
+        if (e > router->ctx.now && (0 == next || e < next)) next = e;
+    }
+
+    router->eject_end = next;
+
+    if (router->cnf->top) router_redo_top (router);
+    if (router_uses_map (router)) router_redo_map (router);
+}
+#endif /* GLBD */
+
 static inline router_dst_t*
 router_choose_dst (glb_router_t* const router, uint32_t hint)
 {
     router_update_ctx (router);
 
+#ifdef GLBD
+    if (GLB_UNLIKELY(router->eject_end != 0 &&
+                     router->ctx.now > router->eject_end))
+        router_eject_expire (router);
+#else
+    if (router->shm) router_shm_sync (router);
+#endif
+
     if (router->cnf->top && router->top_failed != 0 &&
         difftime (router->ctx.now, router->top_failed) > router->ctx.retry)
     {
@@ -569,9 +1022,7 @@ router_choose_dst (glb_router_t* const router, uint32_t hint)
 
     switch (router->cnf->policy) {
     case GLB_POLICY_LEAST:
-#ifdef GLBD
         ret = router_choose_dst_least (router);
-#endif /* GLBD */
         break;
     case GLB_POLICY_ROUND:  ret = router_choose_dst_round (router); break;
     case GLB_POLICY_SINGLE: ret = router_choose_dst_single(router); break;
@@ -579,24 +1030,45 @@ router_choose_dst (glb_router_t* const router, uint32_t hint)
     case GLB_POLICY_SOURCE: ret = router_choose_dst_hint (router, hint);
     }
 
-#ifdef GLBD
-    if (GLB_LIKELY(ret != NULL)) {
-        ret->conns++; router->conns++;
-        ret->usage = router_dst_usage(ret);
-    }
-#endif /* GLBD */
+    if (GLB_LIKELY(ret != NULL)) router_dst_conns_add (router, ret, 1);
 
     return ret;
 }
 
+#ifdef GLBD
+void
+glb_router_reconfig (glb_router_t* const router, const glb_cnf_t* const cnf)
+{
+    /* router does not own configuration, but routing parameters are read
+     * under router lock, so this is the place to change them */
+    glb_cnf_t* const live = (glb_cnf_t*)router->cnf;
+
+    GLB_MUTEX_LOCK (&router->lock);
+
+    live->policy   = cnf->policy;
+    live->top      = cnf->top;
+    live->extra    = cnf->extra;
+    live->max_conn = cnf->max_conn;
+
+    if (!live->top) router->top_dst = NULL;
+
+    router_update_ctx (router);
+    if (live->top) router_redo_top (router);
+    if (router_uses_map (router)) router_redo_map (router);
+
+    GLB_MUTEX_UNLOCK (&router->lock);
+}
+#endif /* GLBD */
+
 #ifdef GLBD
 
 #define glb_connect connect
 
 int
-glb_router_choose_dst (glb_router_t*   const router,
-                       uint32_t        const src_hint,
-                       glb_sockaddr_t* const dst_addr)
+glb_router_choose_dst (glb_router_t*        const router,
+                       uint32_t             const src_hint,
+                       glb_sockaddr_t*      const dst_addr,
+                       glb_router_handle_t* const dst_handle)
 {
     int ret;
 
@@ -605,7 +1077,8 @@ glb_router_choose_dst (glb_router_t*   const router,
     router_dst_t* const dst = router_choose_dst (router, src_hint);
 
     if (GLB_LIKELY(dst != NULL)) {
-        *dst_addr = dst->dst.addr;
+        *dst_addr   = dst->dst.addr;
+        *dst_handle = router_dst_handle (router, dst);
         ret = 0;
     }
     else {
@@ -623,43 +1096,111 @@ glb_router_choose_dst (glb_router_t*   const router,
 
 #endif /* GLBD */
 
-static inline void
-router_dst_failed (glb_router_t* const router, router_dst_t* const dst)
+#ifdef GLBD
+/* sliding window error and total outcome counts of destination */
+static void
+router_dst_window (const router_dst_t* const d, time_t const now,
+                   double* const errors, double* const total)
 {
-    router->ctx.now   = time(NULL);
-    router->ctx.retry = router_retry_interval (router);
+    time_t const age = now - d->win_start;
 
-    /* this is to avoid redundant redoing top|map if the dst was already marked
-     * failed just now or was of lower than top weight and so didn't participate
-     * in balancing. */
-    bool const dst_was_good = router_dst_is_good (
-        dst, router->ctx.min_weight, router->ctx.now, router->ctx.retry);
+    if (age < ROUTER_OUTLIER_WINDOW) {
+        double const prev = 1.0 - (double)age / ROUTER_OUTLIER_WINDOW;
+        *errors = d->win_err[0] + d->win_err[1] * prev;
+        *total  = *errors + d->win_ok[0] + d->win_ok[1] * prev;
+    }
+    else if (age < 2 * ROUTER_OUTLIER_WINDOW) { // current window is previous
+        double const prev = 2.0 - (double)age / ROUTER_OUTLIER_WINDOW;
+        *errors = d->win_err[0] * prev;
+        *total  = *errors + d->win_ok[0] * prev;
+    }
+    else {
+        *errors = *total = 0.0;
+    }
+}
 
-    dst->failed = router->ctx.now;
+static void
+router_dst_eject (glb_router_t* const router, router_dst_t* const d,
+                  time_t const now, double const errors, double const total)
+{
+    int ejected = 0;
+    int i;
 
-    if (dst_was_good)
-    {
-        if (dst == router->top_dst)
-        {
-            router->ctx.min_weight = GLB_DBL_EPSILON;
-            router_redo_top (router);
-            router->top_failed = dst->failed;
-        }
+    for (i = 0; i < router->n_dst; i++) {
+        if (router->dst[i].ejected > now) ejected++;
+    }
 
-        if (router_uses_map (router))
-        {
-            router_redo_map(router);
-            router->map_failed = dst->failed;
-        }
+    // leave enough destinations to take the load
+    if ((ejected + 1) * ROUTER_EJECT_SHARE > router->n_dst) return;
+
+    if (now - d->ejected > ROUTER_EJECT_MAX) d->ejections = 0;
+
+    router_dst_failed (router, d); // redoes top and map without d
+
+    long t = router->ctx.retry << (d->ejections < 8 ? d->ejections : 8);
+    if (t > ROUTER_EJECT_MAX) t = ROUTER_EJECT_MAX;
+
+    d->ejections++;
+    d->ejected = now + t;
+    router_dst_set_failed (router, d, d->ejected - router->ctx.retry);
+
+    if (0 == router->eject_end || d->ejected < router->eject_end)
+        router->eject_end = d->ejected;
+
+    // start afresh when it is back
+    d->win_start = now;
+    d->win_ok[0] = d->win_ok[1] = d->win_err[0] = d->win_err[1] = 0;
+
+    glb_sockaddr_str_t a = glb_sockaddr_to_str (&d->dst.addr);
+    glb_log_warn ("Ejecting %s for %ld seconds: %.0f errors in %.0f "
+                  "connections", a.str, t, errors, total);
+}
+
+/* accounts connection outcome, ejects destination if errors dominate */
+static void
+router_dst_outcome (glb_router_t* const router, router_dst_t* const d,
+                    glb_router_result_t const result)
+{
+    if (GLB_ROUTER_NONE == result) return;
+
+    time_t const now = time (NULL);
+
+    // connections established before ejection are of no interest
+    if (d->ejected > now) return;
+
+    time_t const age = now - d->win_start;
+
+    if (age >= ROUTER_OUTLIER_WINDOW) {
+        bool const adjacent = (age < 2 * ROUTER_OUTLIER_WINDOW);
+        d->win_ok[1]  = adjacent ? d->win_ok[0]  : 0;
+        d->win_err[1] = adjacent ? d->win_err[0] : 0;
+        d->win_ok[0]  = d->win_err[0] = 0;
+        d->win_start  = now - age % ROUTER_OUTLIER_WINDOW;
+    }
+
+    if (GLB_ROUTER_OK == result) {
+        d->win_ok[0]++;
+        return;
     }
+
+    d->win_err[0]++;
+
+    double errors, total;
+    router_dst_window (d, now, &errors, &total);
+
+    if (errors >= ROUTER_EJECT_ERRORS && 2 * errors >= total)
+        router_dst_eject (router, d, now, errors, total);
 }
+#endif /* GLBD */
 
 // connect to a best destination, possiblly failing over to a next best
 static int
-router_connect_dst (glb_router_t*   const router,
-                    int             const sock,
-                    uint32_t        const hint,
-                    glb_sockaddr_t* const addr)
+router_connect_dst (glb_router_t*        const router,
+                    int                  const sock,
+                    int                        family, // of sock
+                    uint32_t             const hint,
+                    glb_sockaddr_t*      const addr,
+                    glb_router_handle_t* const handle) // can be NULL
 {
     router_dst_t* dst;
     int  error    = EHOSTDOWN;
@@ -680,8 +1221,16 @@ router_connect_dst (glb_router_t*   const router,
             glb_log_debug ("Connecting to %s", a.str);
         }
 
-        ret = glb_connect (sock, (struct sockaddr*)&dst->dst.addr,
-                           sizeof (dst->dst.addr));
+        if (GLB_UNLIKELY(dst->dst.addr.sa.sa_family != family)) {
+            // UNIX socket destination or back: replace socket under same fd
+            family = dst->dst.addr.sa.sa_family;
+            ret = glb_socket_reopen (sock, family);
+            if (ret) errno = -ret;
+        }
+        else ret = 0;
+
+        if (!ret) ret = glb_connect (sock, &dst->dst.addr.sa,
+                                     glb_sockaddr_len (&dst->dst.addr));
 
         error = ret ? errno : 0;
 
@@ -689,22 +1238,22 @@ router_connect_dst (glb_router_t*   const router,
 
         if (error && error != EINPROGRESS) {
             // connect failed, undo usage count, update destination failed mark
-#ifdef GLBD
-            dst->conns--; router->conns--;
-            assert (dst->conns >= 0);
-            dst->usage = router_dst_usage(dst);
-#endif
+            router_dst_conns_add (router, dst, -1);
             if (GLB_UNLIKELY(router->cnf->verbose)) {
                 glb_sockaddr_str_t a = glb_sockaddr_to_str (&dst->dst.addr);
                 glb_log_warn ("Failed to connect to %s: %d (%s)",
                               a.str, error, strerror(error));
             }
 
+#ifdef GLBD
+            router_dst_outcome (router, dst, GLB_ROUTER_FAILED);
+#endif
             router_dst_failed (router, dst);
             redirect = true;
         }
         else {
             *addr = dst->dst.addr;
+            if (handle) *handle = router_dst_handle (router, dst);
             if (GLB_UNLIKELY(redirect && router->cnf->verbose)) {
                 glb_sockaddr_str_t a = glb_sockaddr_to_str (addr);
                 glb_log_warn ("Redirecting to %s", a.str);
@@ -730,7 +1279,8 @@ router_connect_dst (glb_router_t*   const router,
 // returns 0 or negative error code
 int
 glb_router_connect (glb_router_t* router, const glb_sockaddr_t* src_addr,
-                    glb_sockaddr_t* dst_addr, int* sock)
+                    glb_sockaddr_t* dst_addr, glb_router_handle_t* dst_handle,
+                    int* sock)
 {
     int ret;
 
@@ -746,7 +1296,7 @@ glb_router_connect (glb_router_t* router, const glb_sockaddr_t* src_addr,
         0 : glb_sockaddr_hash (src_addr);
 
     if (!router->cnf->synchronous) {
-        ret = glb_router_choose_dst (router, hint, dst_addr);
+        ret = glb_router_choose_dst (router, hint, dst_addr, dst_handle);
         if (!ret) ret = -EINPROGRESS;
         *sock = -1;
     }
@@ -762,7 +1312,9 @@ glb_router_connect (glb_router_t* router, const glb_sockaddr_t* src_addr,
         }
 
         // attmept to connect until we run out of destinations
-        ret = router_connect_dst (router, *sock, hint, dst_addr);
+        ret = router_connect_dst (router, *sock,
+                                  router->sock_out.sa.sa_family,
+                                  hint, dst_addr, dst_handle);
 
         // avoid socket leak
         if (ret < 0 /* && ret != -EINPROGRESS*/) {
@@ -775,49 +1327,46 @@ glb_router_connect (glb_router_t* router, const glb_sockaddr_t* src_addr,
     return ret;
 }
 
-static inline int
-router_disconnect (glb_router_t*         const router,
-                   const glb_sockaddr_t* const dst,
-                   bool                  const failed)
+/*! @return false if handle is stale (destination was removed) */
+static inline bool
+router_disconnect (glb_router_t*              const router,
+                   const glb_router_handle_t* const h,
+                   glb_router_result_t        const result)
 {
-    int i;
+    router_dst_t* const d = router_dst_by_handle (router, h);
 
-    for (i = 0; i < router->n_dst; i++) {
-        router_dst_t* d = &router->dst[i];
-        if (glb_sockaddr_is_equal (&d->dst.addr, dst)) {
-            d->conns--; router->conns--;
-            assert(d->conns >= 0);
-            d->usage = router_dst_usage (d);
-            if (failed) router_dst_failed (router, d);
-            break;
-        }
-    }
+    if (GLB_UNLIKELY(!d)) return false;
 
-    return i;
+    router_dst_conns_add (router, d, -1);
+    router_dst_outcome (router, d, result);
+    if (GLB_ROUTER_FAILED == result) router_dst_failed (router, d);
+
+    return true;
 }
 
 void
-glb_router_disconnect (glb_router_t*         const router,
-                       const glb_sockaddr_t* const dst,
-                       bool                  const failed)
+glb_router_disconnect (glb_router_t*              const router,
+                       const glb_router_handle_t* const dst_handle,
+                       glb_router_result_t        const result)
 {
     GLB_MUTEX_LOCK (&router->lock);
 
-    int const i = router_disconnect (router, dst, failed);
+    bool const found = router_disconnect (router, dst_handle, result);
 
     GLB_MUTEX_UNLOCK (&router->lock);
 
-    if (i == router->n_dst) {
-        glb_sockaddr_str_t a = glb_sockaddr_to_str (dst);
-        glb_log_warn ("Attempt to disconnect from non-existing destination: %s",
-                      a.str);
+    if (!found) {
+        // connection outlived its destination, already discounted
+        glb_log_debug ("Disconnect from removed destination: slot %u, gen %u",
+                       dst_handle->slot, dst_handle->gen);
     }
 }
 
 int
-glb_router_choose_dst_again (glb_router_t*   const router,
-                             uint32_t        const src_hint,
-                             glb_sockaddr_t* const dst_addr)
+glb_router_choose_dst_again (glb_router_t*        const router,
+                             uint32_t             const src_hint,
+                             glb_sockaddr_t*      const dst_addr,
+                             glb_router_handle_t* const dst_handle)
 {
     int ret;
 
@@ -825,17 +1374,17 @@ glb_router_choose_dst_again (glb_router_t*   const router,
 
 #ifndef NDEBUG
     int const old_conns = router->conns;
+    bool const found =
 #endif
-
-    ret = router_disconnect (router, dst_addr, true);
-    assert (ret != router->n_dst);
+    router_disconnect (router, dst_handle, GLB_ROUTER_FAILED);
 
     router_dst_t* const dst = router_choose_dst (router, src_hint);
 
-    assert (old_conns == router->conns);
+    assert (!found || !dst || old_conns == router->conns);
 
     if (GLB_LIKELY(dst != NULL)) {
-        *dst_addr = dst->dst.addr;
+        *dst_addr   = dst->dst.addr;
+        *dst_handle = router_dst_handle (router, dst);
         ret = 0;
     }
     else {
@@ -847,6 +1396,64 @@ glb_router_choose_dst_again (glb_router_t*   const router,
     return ret;
 }
 
+int
+glb_router_choose_reader (glb_router_t*              const router,
+                          const glb_router_handle_t* const writer,
+                          glb_sockaddr_t*            const dst_addr,
+                          glb_router_handle_t*       const dst_handle)
+{
+    router_dst_t* dst   = NULL;
+    router_dst_t* fresh = NULL;
+    double max_usage    = 0.0;
+    double fresh_usage  = 0.0;
+    int i;
+
+    GLB_MUTEX_LOCK (&router->lock);
+
+    router_update_ctx (router);
+
+    glb_time_t const intvl = router->cnf->extra;
+    glb_time_t const now   = intvl ? glb_time_now() : 0;
+
+    /* writer may be gone already, then any live destination will do */
+    const router_dst_t* const w = router_dst_by_handle (router, writer);
+
+    /* least used of all live destinations except the writer */
+    for (i = 0; i < router->n_dst; i++) {
+        router_dst_t* const d = &router->dst[i];
+
+        if (d != w && router_dst_is_good (router, i, GLB_DBL_EPSILON,
+                                          router->ctx.now, router->ctx.retry))
+        {
+            if (router->hot.usage[i] > max_usage) {
+                dst = d;
+                max_usage = router->hot.usage[i];
+            }
+
+            if (intvl && router->hot.usage[i] > fresh_usage &&
+                router_dst_fresh (d, intvl, now)) {
+                fresh = d;
+                fresh_usage = router->hot.usage[i];
+            }
+        }
+    }
+
+    if (intvl && dst && dst != fresh) {
+        router_dst_stale (router, dst, intvl, now);
+        if (fresh) dst = fresh; else router->stale_routed++;
+    }
+
+    if (GLB_LIKELY(dst != NULL)) {
+        router_dst_conns_add (router, dst, 1);
+        *dst_addr   = dst->dst.addr;
+        *dst_handle = router_dst_handle (router, dst);
+    }
+
+    GLB_MUTEX_UNLOCK (&router->lock);
+
+    return (dst ? 0 : -EHOSTDOWN);
+}
+
 size_t
 glb_router_print_info (glb_router_t* router, char* buf, size_t buf_len)
 {
@@ -856,54 +1463,93 @@ glb_router_print_info (glb_router_t* router, char* buf, size_t buf_len)
     int    i;
 
     len += snprintf(buf + len, buf_len - len, "Router:\n"
-                    "------------------------------------------------------\n"
-                    "        Address       :   weight   usage    map  conns\n");
-    if (len == buf_len) {
-        buf[len - 1] = '\0';
-        return (len - 1);
+                    "--------------------------------------------------------"
+                    "-----------------------\n"
+                    "        Address       :   weight   usage    map  conns"
+                    "   errors/total ejected\n");
+    if (len >= buf_len) {
+        buf[buf_len - 1] = '\0';
+        return (buf_len - 1);
     }
 
     GLB_MUTEX_LOCK (&router->lock);
 
+    time_t const now = time (NULL);
+
     for (i = 0; i < router->n_dst; i++) {
         router_dst_t* d = &router->dst[i];
         glb_sockaddr_str_t addr = glb_sockaddr_to_astr (&d->dst.addr);
 
         if (router_uses_map (router)) {
             len += snprintf (buf + len, buf_len - len,
-                             "%s : %8.3f %7.3f %7.3f %5d\n",
+                             "%s : %8.3f %7.3f %7.3f %5d",
                              addr.str,
-                             d->dst.weight, 1.0 - (d->usage/d->dst.weight),
-                             d->map, d->conns);
+                             d->dst.weight,
+                             1.0 - (router->hot.usage[i]/d->dst.weight),
+                             router->hot.map[i], d->conns);
         }
         else {
             len += snprintf (buf + len, buf_len - len,
-                             "%s : %8.3f %7.3f    N/A  %5d\n",
+                             "%s : %8.3f %7.3f    N/A  %5d",
                              addr.str,
-                             d->dst.weight, 1.0 - (d->usage/d->dst.weight),
+                             d->dst.weight,
+                             1.0 - (router->hot.usage[i]/d->dst.weight),
                              d->conns);
         }
 
-        if (len == buf_len) {
-            buf[len - 1] = '\0';
+        if (len >= buf_len) {
+            buf[buf_len - 1] = '\0';
+            GLB_MUTEX_UNLOCK (&router->lock);
+            return (buf_len - 1);
+        }
+
+        double errors, total;
+        router_dst_window (d, now, &errors, &total);
+
+        if (d->ejected > now) {
+            len += snprintf (buf + len, buf_len - len,
+                             " %7.0f/%-6.0f %6lds\n", errors, total,
+                             (long)(d->ejected - now));
+        }
+        else {
+            len += snprintf (buf + len, buf_len - len,
+                             " %7.0f/%-6.0f       -\n", errors, total);
+        }
+
+        if (len >= buf_len) {
+            buf[buf_len - 1] = '\0';
             GLB_MUTEX_UNLOCK (&router->lock);
-            return (len - 1);
+            return (buf_len - 1);
         }
     }
 
     n_dst = router->n_dst;
     total_conns = router->conns;
 
+    uint64_t const stale_hits   = router->stale_hits;
+    uint64_t const stale_routed = router->stale_routed;
+    uint64_t const stale_kicks  = router->stale_kicks;
+
     GLB_MUTEX_UNLOCK (&router->lock);
 
     len += snprintf (buf + len, buf_len - len,
-                     "------------------------------------------------------\n"
+                     "--------------------------------------------------------"
+                     "-----------------------\n"
                      "Destinations: %d, total connections: %d of %d max\n",
                      n_dst, total_conns, router->cnf->max_conn);
 
-    if (len == buf_len) {
-        buf[len - 1] = '\0';
-        return (len - 1);
+    if (router->cnf->extra && len < buf_len) {
+        len += snprintf (buf + len, buf_len - len,
+                         "Stale destinations: %llu hits, %llu routed to, "
+                         "%llu probes requested\n",
+                         (unsigned long long)stale_hits,
+                         (unsigned long long)stale_routed,
+                         (unsigned long long)stale_kicks);
+    }
+
+    if (len >= buf_len) {
+        buf[buf_len - 1] = '\0';
+        return (buf_len - 1);
     }
 
     return len;
@@ -911,59 +1557,151 @@ glb_router_print_info (glb_router_t* router, char* buf, size_t buf_len)
 
 #else /* GLBD */
 
-int glb_router_connect(glb_router_t* const router, int const sockfd)
+int glb_router_connect(glb_router_t* const router, int const sockfd,
+                       int const family, glb_sockaddr_t* const dst,
+                       glb_router_handle_t* const handle)
 {
-    glb_sockaddr_t dst;
-
     uint32_t hint = router->seed;
     // random hint will be generated in router_connect_dst()
 
-    // need to temporarily make socket blocking
-    int const orig_flags = fcntl (sockfd, F_GETFL);
-    if (orig_flags >= 0) {
-        int const block_flags = orig_flags & (~O_NONBLOCK);
+    /* for non-blocking socket connect is only initiated here:
+     * router_connect_dst() returns -EINPROGRESS as soon as some destination
+     * accepts it, the caller fails over with glb_router_reconnect() if it
+     * is refused later */
+    int const ret = router_connect_dst (router, sockfd, family, hint, dst,
+                                        handle);
+    assert (ret <= 0);
+
+    if (GLB_UNLIKELY(ret < 0)) {
+        errno = -ret;
+        return -1;
+    }
 
-        if (orig_flags != block_flags) fcntl (sockfd, F_SETFL, block_flags);
+    return 0;
+}
 
-        int const ret = router_connect_dst (router, sockfd, hint, &dst);
+int glb_router_reconnect(glb_router_t* const router, int const sockfd,
+                         int const error, glb_sockaddr_t* const dst,
+                         glb_router_handle_t* const handle)
+{
+    GLB_MUTEX_LOCK (&router->lock);
+
+    router_dst_t* const d = router_dst_by_handle (router, handle);
+
+    if (d) {
+        if (GLB_UNLIKELY(router->cnf->verbose)) {
+            glb_sockaddr_str_t a = glb_sockaddr_to_str (dst);
+            glb_log_warn ("Failed to connect to %s: %d (%s)",
+                          a.str, error, strerror(error));
+        }
+
+        router_dst_conns_add (router, d, -1);
+        router_dst_failed (router, d);
+    }
 
-        assert (ret <= 0);
+    *handle = GLB_ROUTER_HANDLE_NONE;
 
-        if (orig_flags != block_flags) fcntl (sockfd, F_SETFL, orig_flags);
+    GLB_MUTEX_UNLOCK (&router->lock);
+
+    int family = dst->sa.sa_family;
 
-        if (GLB_UNLIKELY(ret < 0)) {
+    /* socket that failed to connect must be disconnected before it can
+     * connect again. This keeps it in the application poll sets, unlike
+     * reopening, which is the last resort */
+    struct sockaddr unspec;
+    memset (&unspec, 0, sizeof(unspec));
+    unspec.sa_family = AF_UNSPEC;
+
+    if (glb_connect (sockfd, &unspec, sizeof(unspec))) {
+        int const ret = glb_socket_reopen (sockfd, family);
+        if (ret) {
             errno = -ret;
-        }
-        else {
-            if (orig_flags == block_flags) {
-                // socket was blocking, no voodoo was made.
-                return 0;
-            }
-            else {
-                // socket was non-blocking, temporarily reverted to blocking
-                // for non-blocking socket connect() is expected to return -1
-                // and set errno to EINPROGRESS
-                errno = EINPROGRESS;
-            }
+            return -1;
         }
     }
 
+    int const ret = router_connect_dst (router, sockfd, family, router->seed,
+                                        dst, handle);
+    assert (ret <= 0);
+
+    if (0 == ret) return 0;
+
+    /* running out of destinations says less than the last refusal */
+    errno = (-EHOSTDOWN == ret) ? error : -ret;
     return -1;
 }
 
+void glb_router_share(glb_router_t* const router, glb_shm_t* const shm)
+{
+    int i;
+
+    GLB_MUTEX_LOCK (&router->lock);
+
+    router->shm = shm;
+
+    for (i = 0; i < router->n_dst; i++) {
+        router_dst_t* const d = &router->dst[i];
+        d->shm_dst = glb_shm_dst (shm, &d->dst.addr);
+        router_dst_update_usage (router, d);
+    }
+
+    GLB_MUTEX_UNLOCK (&router->lock);
+}
+
+void glb_router_atfork_prepare(glb_router_t* const router)
+{
+    GLB_MUTEX_LOCK (&router->lock);
+}
+
+void glb_router_atfork_parent(glb_router_t* const router)
+{
+    GLB_MUTEX_UNLOCK (&router->lock);
+}
+
+/* child does not own connections of the parent, only the local counts are
+ * dropped: shared ones are the parent's to discount */
+void glb_router_atfork_child(glb_router_t* const router)
+{
+    int i;
+
+    for (i = 0; i < router->n_dst; i++) {
+        router_dst_t* const d = &router->dst[i];
+        d->conns = 0;
+        router_dst_update_usage (router, d);
+    }
+
+    router->conns = 0;
+
+    GLB_MUTEX_UNLOCK (&router->lock);
+}
+
+void glb_router_disconnect(glb_router_t*              const router,
+                           const glb_router_handle_t* const handle)
+{
+    GLB_MUTEX_LOCK (&router->lock);
+
+    router_dst_t* const d = router_dst_by_handle (router, handle);
+
+    // connection that outlived its destination was discounted already
+    if (GLB_LIKELY(d != NULL)) router_dst_conns_add (router, d, -1);
+
+    GLB_MUTEX_UNLOCK (&router->lock);
+}
+
 size_t
 glb_router_print_info (glb_router_t* router, char* buf, size_t buf_len)
 {
     size_t len = 0;
     int    n_dst;
+    int    total_conns;
     int    i;
 
     len += snprintf(buf + len, buf_len - len, "Router:\n"
-                    "-----------------------------------------\n"
-                    "        Address       :   weight    map  \n");
-    if (len == buf_len) {
-        buf[len - 1] = '\0';
-        return (len - 1);
+                    "-----------------------------------------------\n"
+                    "        Address       :   weight    map  conns\n");
+    if (len >= buf_len) {
+        buf[buf_len - 1] = '\0';
+        return (buf_len - 1);
     }
 
     GLB_MUTEX_LOCK (&router->lock);
@@ -972,27 +1710,30 @@ glb_router_print_info (glb_router_t* router, char* buf, size_t buf_len)
         router_dst_t* d = &router->dst[i];
         glb_sockaddr_str_t addr = glb_sockaddr_to_astr (&d->dst.addr);
 
-        len += snprintf (buf + len, buf_len - len, "%s : %8.3f %7.3f\n",
-                         addr.str, d->dst.weight, d->map);
+        len += snprintf (buf + len, buf_len - len, "%s : %8.3f %7.3f %5d\n",
+                         addr.str, d->dst.weight, router->hot.map[i],
+                         router_dst_conns (router, d));
 
-        if (len == buf_len) {
-            buf[len - 1] = '\0';
+        if (len >= buf_len) {
+            buf[buf_len - 1] = '\0';
             GLB_MUTEX_UNLOCK (&router->lock);
-            return (len - 1);
+            return (buf_len - 1);
         }
     }
 
     n_dst = router->n_dst;
+    total_conns = router->conns;
 
     GLB_MUTEX_UNLOCK (&router->lock);
 
     len += snprintf (buf + len, buf_len - len,
-                     "-----------------------------------------\n"
-                     "Destinations: %d\n", n_dst);
+                     "-----------------------------------------------\n"
+                     "Destinations: %d, total connections: %d\n",
+                     n_dst, total_conns);
 
-    if (len == buf_len) {
-        buf[len - 1] = '\0';
-        return (len - 1);
+    if (len >= buf_len) {
+        buf[buf_len - 1] = '\0';
+        return (buf_len - 1);
     }
 
     return len;
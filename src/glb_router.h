@@ -9,9 +9,26 @@
 
 #include "glb_cnf.h"
 #include "glb_wdog_backend.h"
+#ifndef GLBD
+#include "glb_shm.h"
+#endif
+
+#include <stdint.h>
 
 typedef struct glb_router glb_router_t;
 
+/*! Stable reference to the destination a connection was routed to: slot in
+ *  router destination table and slot generation. Slot of a removed
+ *  destination changes generation, so stale handles are safely ignored. */
+typedef struct glb_router_handle
+{
+    uint32_t slot;
+    uint32_t gen;
+} glb_router_handle_t;
+
+/*! Handle that never refers to any destination */
+#define GLB_ROUTER_HANDLE_NONE ((glb_router_handle_t){ UINT32_MAX, 0 })
+
 extern glb_router_t*
 glb_router_create (const glb_cnf_t* cnf);
 
@@ -28,32 +45,57 @@ extern int
 glb_router_change_dst (glb_router_t* router, const glb_dst_t* dst,
                        glb_backend_thread_ctx_t* probe_ctx);
 
+/*!
+ * Applies n destination changes like glb_router_change_dst() does, but under
+ * a single lock acquisition and with a single rebuild of routing state.
+ * @param probe_ctx array of n watchdog contexts, can be NULL
+ * @param res array to store n results of individual changes, can be NULL
+ * @return 0 or the first negative error code
+ */
+extern int
+glb_router_change_dsts (glb_router_t* router, int n, const glb_dst_t* dst,
+                        glb_backend_thread_ctx_t* const* probe_ctx, int* res);
+
 #ifdef GLBD
 
+/*! What connection outcome tells about the health of its destination.
+ *  Errors feed passive outlier detection in the router. */
+typedef enum glb_router_result
+{
+    GLB_ROUTER_NONE = 0, // says nothing about destination (e.g. client left)
+    GLB_ROUTER_OK,       // destination served the connection
+    GLB_ROUTER_ERROR,    // destination closed connection before replying
+    GLB_ROUTER_FAILED    // could not connect to destination
+} glb_router_result_t;
+
 /*!
- * Finds destination for connection and copies its address to dst_addr.
+ * Finds destination for connection, copies its address to dst_addr and
+ * its handle to dst_handle.
  * @param src_hint 4-byte hash of client address if available
  * @return 0 if found, -EHOSTDOWN if not
  */
 extern int
-glb_router_choose_dst (glb_router_t*   const router,
-                       uint32_t        const src_hint,
-                       glb_sockaddr_t* const dst_addr);
+glb_router_choose_dst (glb_router_t*        const router,
+                       uint32_t             const src_hint,
+                       glb_sockaddr_t*      const dst_addr,
+                       glb_router_handle_t* const dst_handle);
 
 /*!
- * Atomically marks destination referenced by dst_addr as unavailable plus
- * finds new destination and copies its address to dst_addr.
+ * Atomically marks destination referenced by dst_handle as unavailable plus
+ * finds new destination and copies its address and handle to dst_addr and
+ * dst_handle.
  * @param src_hint 4-byte hash of client address if available
  * @return 0 if found, -EHOSTDOWN if not
  */
 extern int
-glb_router_choose_dst_again (glb_router_t*   const router,
-                             uint32_t        const src_hint,
-                             glb_sockaddr_t* const dst_addr);
+glb_router_choose_dst_again (glb_router_t*        const router,
+                             uint32_t             const src_hint,
+                             glb_sockaddr_t*      const dst_addr,
+                             glb_router_handle_t* const dst_handle);
 
 /*!
  * Returns file descriptor of a new destinaiton conneciton and fills
- * dst_addr with real server address
+ * dst_addr and dst_handle with real server address and its handle
  *
  * Not thread-safe. Supposed to be called ONLY from the listener main loop.
  *
@@ -61,18 +103,88 @@ glb_router_choose_dst_again (glb_router_t*   const router,
  */
 extern int
 glb_router_connect (glb_router_t* router, const glb_sockaddr_t* src_addr,
-                    glb_sockaddr_t* dst_addr, int* sock);
+                    glb_sockaddr_t* dst_addr, glb_router_handle_t* dst_handle,
+                    int* sock);
 
 /*!
- * Decrements connection reference count for destination
+ * Decrements connection reference count for destination, O(1), and accounts
+ * connection outcome. Destination is marked failed on GLB_ROUTER_FAILED and
+ * may be ejected if errors dominate its recent connections.
+ * Stale handles of removed destinations are ignored.
  */
 extern void
-glb_router_disconnect (glb_router_t* router, const glb_sockaddr_t* dst_addr,
-                       bool failed);
+glb_router_disconnect (glb_router_t* router,
+                       const glb_router_handle_t* dst_handle,
+                       glb_router_result_t result);
+
+/*!
+ * Finds the least used live destination other than writer for read-only
+ * statements and copies its address and handle to dst_addr and dst_handle.
+ * Connection is accounted like the one from glb_router_choose_dst().
+ * @return 0 if found, -EHOSTDOWN if not
+ */
+extern int
+glb_router_choose_reader (glb_router_t*              const router,
+                          const glb_router_handle_t* const writer,
+                          glb_sockaddr_t*            const dst_addr,
+                          glb_router_handle_t*       const dst_handle);
+
+/*!
+ * Atomically switches routing parameters - policy, top, extra and max_conn -
+ * to those of cnf. Established connections are not affected.
+ */
+extern void
+glb_router_reconfig (glb_router_t* router, const glb_cnf_t* cnf);
 
 #else /* GLBD */
 
-extern int glb_router_connect(glb_router_t* const router, int const sockfd);
+/*!
+ * Connects sockfd of a given address family to a chosen destination and
+ * stores its address in dst and its handle in handle. Connection is
+ * accounted until glb_router_disconnect().
+ * If destination is of a different family (e.g. UNIX socket), sockfd is
+ * replaced with a new socket under the same descriptor number.
+ * Non-blocking socket is only connecting on return (-1 and EINPROGRESS),
+ * if connection is refused later, glb_router_reconnect() fails over.
+ * @return 0 or -1 and errno like connect()
+ */
+extern int glb_router_connect(glb_router_t* const router, int const sockfd,
+                              int const family, glb_sockaddr_t* const dst,
+                              glb_router_handle_t* const handle);
+
+/*!
+ * Marks dst, destination of a refused non-blocking connection, failed and
+ * connects sockfd to the next one, storing its address in dst and handle in
+ * handle.
+ * @param error the reason the connection to dst failed
+ * @return like glb_router_connect(), errno is error when there are no more
+ *         destinations to try
+ */
+extern int glb_router_reconnect(glb_router_t* const router, int const sockfd,
+                                int const error, glb_sockaddr_t* const dst,
+                                glb_router_handle_t* const handle);
+
+/*!
+ * Discounts connection routed to destination referenced by handle, O(1).
+ * Stale handles of removed destinations are ignored.
+ */
+extern void glb_router_disconnect(glb_router_t*              const router,
+                                  const glb_router_handle_t* const handle);
+
+/*!
+ * Makes router share destination failure marks and connection counts with
+ * other processes through shm segment.
+ */
+extern void glb_router_share(glb_router_t* const router, glb_shm_t* const shm);
+
+/*!
+ * fork() handlers: prepare locks router, parent unlocks it, child also
+ * forgets connections accounted by the parent - they are not child's to
+ * close, so they must not skew its destination choice.
+ */
+extern void glb_router_atfork_prepare(glb_router_t* const router);
+extern void glb_router_atfork_parent(glb_router_t* const router);
+extern void glb_router_atfork_child(glb_router_t* const router);
 
 #endif /* GLBD */
 
@@ -0,0 +1,260 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * $Id$
+ */
+
+#include "glb_select.h"
+
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define SELECT_AVX2 1
+#  include <immintrin.h>
+#endif
+
+static inline bool
+select_is_good (const double*  const weight,
+                const int64_t* const failed,
+                int            const i,
+                double         const min_weight,
+                int64_t        const deadline)
+{
+    return (weight[i] >= min_weight && failed[i] < deadline);
+}
+
+static double
+select_weights_scalar (double*        const map,
+                       const double*  const weight,
+                       const int64_t* const failed,
+                       int            const n,
+                       double         const min_weight,
+                       int64_t        const deadline)
+{
+    double total = 0.0;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        map[i] = select_is_good (weight, failed, i, min_weight, deadline) ?
+            weight[i] : 0.0;
+        total += map[i];
+    }
+
+    return total;
+}
+
+static int
+select_max_scalar (const double*  const usage,
+                   const double*  const weight,
+                   const int64_t* const failed,
+                   int            const n,
+                   double         const min_weight,
+                   int64_t        const deadline)
+{
+    double max_usage = 0.0;
+    int    ret = -1;
+    int    i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (usage[i] > max_usage &&
+            select_is_good (weight, failed, i, min_weight, deadline))
+        {
+            ret = i;
+            max_usage = usage[i];
+        }
+    }
+
+    return ret;
+}
+
+#ifdef SELECT_AVX2
+
+#define SELECT_AVX2_FN __attribute__((target("avx2")))
+
+// all-ones lanes for good destinations
+static inline __m256d SELECT_AVX2_FN
+select_good_avx2 (const double*  const weight,
+                  const int64_t* const failed,
+                  int            const i,
+                  __m256d        const min_weight,
+                  __m256i        const deadline)
+{
+    __m256d const w = _mm256_loadu_pd (weight + i);
+    __m256i const f = _mm256_loadu_si256 ((const __m256i*)(failed + i));
+
+    return _mm256_and_pd (_mm256_cmp_pd (w, min_weight, _CMP_GE_OQ),
+                          _mm256_castsi256_pd (_mm256_cmpgt_epi64(deadline,f)));
+}
+
+static double SELECT_AVX2_FN
+select_weights_avx2 (double*        const map,
+                     const double*  const weight,
+                     const int64_t* const failed,
+                     int            const n,
+                     double         const min_weight,
+                     int64_t        const deadline)
+{
+    __m256d const mw = _mm256_set1_pd (min_weight);
+    __m256i const dl = _mm256_set1_epi64x (deadline);
+    __m256d sum = _mm256_setzero_pd();
+    double  s[4];
+    int     i;
+
+    for (i = 0; i + 4 <= n; i += 4)
+    {
+        __m256d const good = select_good_avx2 (weight, failed, i, mw, dl);
+        __m256d const m = _mm256_and_pd (good, _mm256_loadu_pd (weight + i));
+
+        _mm256_storeu_pd (map + i, m);
+        sum = _mm256_add_pd (sum, m);
+    }
+
+    _mm256_storeu_pd (s, sum);
+
+    return (s[0] + s[1]) + (s[2] + s[3]) +
+        select_weights_scalar (map + i, weight + i, failed + i, n - i,
+                               min_weight, deadline);
+}
+
+// usage of good destinations, 0.0 for the rest
+static inline __m256d SELECT_AVX2_FN
+select_usage_avx2 (const double*  const usage,
+                   const double*  const weight,
+                   const int64_t* const failed,
+                   int            const i,
+                   __m256d        const min_weight,
+                   __m256i        const deadline)
+{
+    return _mm256_and_pd (select_good_avx2 (weight, failed, i,
+                                            min_weight, deadline),
+                          _mm256_loadu_pd (usage + i));
+}
+
+/* Two passes: maximum with independent accumulators (no loop-carried blend
+ * dependency), then the first index holding it, which is what scalar loop
+ * with strict comparison returns. */
+static int SELECT_AVX2_FN
+select_max_avx2 (const double*  const usage,
+                 const double*  const weight,
+                 const int64_t* const failed,
+                 int            const n,
+                 double         const min_weight,
+                 int64_t        const deadline)
+{
+    __m256d const mw = _mm256_set1_pd (min_weight);
+    __m256i const dl = _mm256_set1_epi64x (deadline);
+    __m256d max0 = _mm256_setzero_pd();
+    __m256d max1 = _mm256_setzero_pd();
+    int     i;
+
+    for (i = 0; i + 8 <= n; i += 8)
+    {
+        max0 = _mm256_max_pd (max0, select_usage_avx2 (usage, weight, failed,
+                                                       i, mw, dl));
+        max1 = _mm256_max_pd (max1, select_usage_avx2 (usage, weight, failed,
+                                                       i + 4, mw, dl));
+    }
+
+    if (i + 4 <= n)
+    {
+        max0 = _mm256_max_pd (max0, select_usage_avx2 (usage, weight, failed,
+                                                       i, mw, dl));
+        i += 4;
+    }
+
+    int const vec_end = i;
+    double m[4];
+    _mm256_storeu_pd (m, _mm256_max_pd (max0, max1));
+
+    double max_usage = m[0];
+    if (m[1] > max_usage) max_usage = m[1];
+    if (m[2] > max_usage) max_usage = m[2];
+    if (m[3] > max_usage) max_usage = m[3];
+
+    int ret = -1;
+
+    /* tail indices are bigger than any above, so strict comparison */
+    for (; i < n; i++)
+    {
+        if (usage[i] > max_usage &&
+            select_is_good (weight, failed, i, min_weight, deadline))
+        {
+            ret = i;
+            max_usage = usage[i];
+        }
+    }
+
+    if (ret >= 0 || max_usage <= 0.0) return ret;
+
+    /* maximum is in the vectorized part, find its first occurrence */
+    __m256d const mx = _mm256_set1_pd (max_usage);
+
+    for (i = 0; i < vec_end; i += 4)
+    {
+        int const eq = _mm256_movemask_pd (_mm256_cmp_pd (
+            select_usage_avx2 (usage, weight, failed, i, mw, dl),
+            mx, _CMP_EQ_OQ));
+
+        if (eq) return i + __builtin_ctz (eq);
+    }
+
+    assert (0);
+    return -1;
+}
+
+#endif /* SELECT_AVX2 */
+
+double
+(*glb_select_weights) (double*, const double*, const int64_t*, int, double,
+                       int64_t) = select_weights_scalar;
+
+int
+(*glb_select_max) (const double*, const double*, const int64_t*, int, double,
+                   int64_t) = select_max_scalar;
+
+static const char* select_impl = "scalar";
+
+const char*
+glb_select_impl (void)
+{
+    return select_impl;
+}
+
+int
+glb_select_use (const char* const impl)
+{
+    if (!strcmp (impl, "scalar"))
+    {
+        glb_select_weights = select_weights_scalar;
+        glb_select_max     = select_max_scalar;
+        select_impl        = "scalar";
+        return 0;
+    }
+
+#ifdef SELECT_AVX2
+    __builtin_cpu_init();
+
+    if (!strcmp (impl, "avx2") && __builtin_cpu_supports ("avx2"))
+    {
+        glb_select_weights = select_weights_avx2;
+        glb_select_max     = select_max_avx2;
+        select_impl        = "avx2";
+        return 0;
+    }
+#endif /* SELECT_AVX2 */
+
+    return -ENOTSUP;
+}
+
+static void select_init (void) __attribute__((constructor));
+
+static void
+select_init (void)
+{
+    glb_select_use ("avx2"); // stays scalar if it is not supported
+}
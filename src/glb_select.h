@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * Destination selection kernels over structure-of-arrays destination table.
+ *
+ * Destination i is "good" if weight[i] >= min_weight and failed[i] < deadline
+ * (deadline is current time minus retry interval). Kernels are vectorized
+ * where CPU allows (AVX2 is detected at startup) and fall back to scalar code
+ * otherwise. Arrays need not be aligned, but should be for best performance.
+ *
+ * $Id$
+ */
+
+#ifndef _glb_select_h_
+#define _glb_select_h_
+
+#include <stdint.h>
+
+/*! Fills map[i] with weight[i] for good destinations and 0.0 for the rest.
+ *  @return total weight of good destinations */
+extern double
+(*glb_select_weights) (double*        map,
+                       const double*  weight,
+                       const int64_t* failed,
+                       int            n,
+                       double         min_weight,
+                       int64_t        deadline);
+
+/*! @return index of the first good destination with the biggest positive
+ *          usage or -1 if there is none */
+extern int
+(*glb_select_max) (const double*  usage,
+                   const double*  weight,
+                   const int64_t* failed,
+                   int            n,
+                   double         min_weight,
+                   int64_t        deadline);
+
+/*! @return index of the first element of a non-decreasing map that is
+ *          greater than m, n if there is none. O(log n), branchless. */
+static inline int
+glb_select_above (const double* const map, int n, double const m)
+{
+    const double* base = map;
+
+    if (n <= 0) return 0;
+
+    while (n > 1)
+    {
+        int const half = n >> 1;
+        base = (base[half] <= m) ? base + half : base;
+        n -= half;
+    }
+
+    return (base - map) + (*base <= m);
+}
+
+/*! @return name of the kernel set in use */
+extern const char*
+glb_select_impl (void);
+
+/*! Switches to the kernel set of a given name: "scalar" or "avx2".
+ *  Not thread-safe, meant for tests and benchmarks.
+ *  @return 0 or -ENOTSUP if the set is not available on this CPU */
+extern int
+glb_select_use (const char* impl);
+
+#endif // _glb_select_h_
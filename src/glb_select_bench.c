@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * Checks that vectorized destination selection kernels return the same
+ * results as scalar ones on random inputs and measures per-choice cost
+ * against the number of destinations. Run by "make check".
+ *
+ * $Id$
+ */
+
+#include "glb_select.h"
+#include "glb_time.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#define BENCH_MAX_DST    4096
+#define BENCH_MIN_WEIGHT 0.5
+#define BENCH_DEADLINE   1000000
+#define BENCH_ELEMS      (1 << 22) // elements to process per measurement
+
+typedef struct bench_set
+{
+    double*  usage;
+    double*  weight;
+    int64_t* failed;
+    double*  map;
+} bench_set_t;
+
+static const char* const bench_impls[] = { "scalar", "avx2" };
+#define BENCH_IMPLS (sizeof(bench_impls)/sizeof(bench_impls[0]))
+
+static volatile double bench_sink;
+
+/* Small sets of values make ties, bad destinations with the biggest usage
+ * and failure marks right at the deadline common. */
+static void
+bench_fill (bench_set_t* const s, int const n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        s->weight[i] = (rand() % 8) * 0.25;
+        s->usage[i]  = (rand() % 16) * 0.125;
+        s->failed[i] = (rand() % 4) ?
+            BENCH_DEADLINE - 1 - rand() % 1000 : BENCH_DEADLINE + rand() % 2;
+    }
+}
+
+static bool
+bench_alloc (bench_set_t* const s)
+{
+    s->usage  = malloc (BENCH_MAX_DST * sizeof(double));
+    s->weight = malloc (BENCH_MAX_DST * sizeof(double));
+    s->failed = malloc (BENCH_MAX_DST * sizeof(int64_t));
+    s->map    = malloc (BENCH_MAX_DST * sizeof(double));
+
+    return (s->usage && s->weight && s->failed && s->map);
+}
+
+static void
+bench_free (bench_set_t* const s)
+{
+    free (s->usage);
+    free (s->weight);
+    free (s->failed);
+    free (s->map);
+}
+
+/* @return true if the kernels in use give the same results as scalar ones */
+static bool
+bench_check_n (bench_set_t* const s, double* const ref_map, int const n)
+{
+    const char* const impl = glb_select_impl();
+
+    bench_fill (s, n);
+
+    glb_select_use ("scalar");
+    double const ref_total = glb_select_weights (ref_map, s->weight, s->failed,
+                                                 n, BENCH_MIN_WEIGHT,
+                                                 BENCH_DEADLINE);
+    int const ref_max = glb_select_max (s->usage, s->weight, s->failed, n,
+                                        BENCH_MIN_WEIGHT, BENCH_DEADLINE);
+    glb_select_use (impl);
+
+    double const total = glb_select_weights (s->map, s->weight, s->failed, n,
+                                             BENCH_MIN_WEIGHT, BENCH_DEADLINE);
+    int const max = glb_select_max (s->usage, s->weight, s->failed, n,
+                                    BENCH_MIN_WEIGHT, BENCH_DEADLINE);
+
+    /* summation order differs, but quarters are summed exactly */
+    if (total != ref_total || memcmp (s->map, ref_map, n * sizeof(double)))
+    {
+        fprintf (stderr, "%s glb_select_weights() mismatch at n = %d: "
+                 "total %f vs %f\n", impl, n, total, ref_total);
+        return false;
+    }
+
+    if (max != ref_max)
+    {
+        fprintf (stderr, "%s glb_select_max() mismatch at n = %d: "
+                 "%d vs %d\n", impl, n, max, ref_max);
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+bench_check (bench_set_t* const s)
+{
+    static const int big[] = { 1000, 1021, 1024, 4093, 4096 };
+    double* const ref_map = malloc (BENCH_MAX_DST * sizeof(double));
+    bool ret = true;
+    int  trial, n;
+
+    if (!ref_map) return false;
+
+    for (trial = 0; trial < 200 && ret; trial++)
+    {
+        for (n = 0; n <= 67 && ret; n++) ret = bench_check_n (s, ref_map, n);
+    }
+
+    for (n = 0; n < (int)(sizeof(big)/sizeof(big[0])) && ret; n++)
+    {
+        for (trial = 0; trial < 20 && ret; trial++)
+        {
+            ret = bench_check_n (s, ref_map, big[n]);
+        }
+    }
+
+    free (ref_map);
+
+    return ret;
+}
+
+/* @return nanoseconds per call */
+static double
+bench_max (const bench_set_t* const s, int const n, int const loops)
+{
+    glb_time_t const start = glb_time_mono();
+    int sum = 0;
+    int i;
+
+    for (i = 0; i < loops; i++)
+    {
+        sum += glb_select_max (s->usage, s->weight, s->failed, n,
+                               BENCH_MIN_WEIGHT, BENCH_DEADLINE);
+    }
+
+    bench_sink = sum;
+
+    return (double)(glb_time_mono() - start) / loops;
+}
+
+static double
+bench_weights (const bench_set_t* const s, int const n, int const loops)
+{
+    glb_time_t const start = glb_time_mono();
+    double sum = 0.0;
+    int i;
+
+    for (i = 0; i < loops; i++)
+    {
+        sum += glb_select_weights (s->map, s->weight, s->failed, n,
+                                   BENCH_MIN_WEIGHT, BENCH_DEADLINE);
+    }
+
+    bench_sink = sum;
+
+    return (double)(glb_time_mono() - start) / loops;
+}
+
+static double
+bench_above (const bench_set_t* const s, int const n, int const loops)
+{
+    double const total = n > 0 ? s->map[n - 1] : 0.0;
+    glb_time_t const start = glb_time_mono();
+    int sum = 0;
+    int i;
+
+    for (i = 0; i < loops; i++)
+    {
+        sum += glb_select_above (s->map, n, total * (i & 1023) / 1024.0);
+    }
+
+    bench_sink = sum;
+
+    return (double)(glb_time_mono() - start) / loops;
+}
+
+static void
+bench_run (bench_set_t* const s)
+{
+    int n;
+    size_t k;
+
+    printf ("     n  kernels     max, ns  weights, ns    above, ns\n");
+
+    for (n = 4; n <= BENCH_MAX_DST; n <<= 2)
+    {
+        int const loops = BENCH_ELEMS / n;
+
+        bench_fill (s, n);
+
+        for (k = 0; k < BENCH_IMPLS; k++)
+        {
+            if (glb_select_use (bench_impls[k])) continue;
+
+            double const max_ns = bench_max (s, n, loops);
+            double const weights_ns = bench_weights (s, n, loops);
+            int i;
+
+            /* cumulative map as router_redo_map() makes it */
+            for (i = 1; i < n; i++) s->map[i] += s->map[i - 1];
+
+            printf ("%6d  %-7s %11.1f %12.1f %12.1f\n", n, bench_impls[k],
+                    max_ns, weights_ns, bench_above (s, n, loops));
+        }
+    }
+}
+
+int
+main (void)
+{
+    bench_set_t s;
+    int ret = EXIT_SUCCESS;
+
+    if (!bench_alloc (&s))
+    {
+        fprintf (stderr, "Failed to allocate destination arrays\n");
+        bench_free (&s);
+        return EXIT_FAILURE;
+    }
+
+    srand (1);
+
+    size_t k;
+    for (k = 1; k < BENCH_IMPLS; k++)
+    {
+        if (glb_select_use (bench_impls[k]))
+        {
+            printf ("%s kernels not supported, comparison skipped\n",
+                    bench_impls[k]);
+            continue;
+        }
+
+        if (!bench_check (&s))
+        {
+            ret = EXIT_FAILURE;
+            goto out;
+        }
+
+        printf ("%s kernels match scalar ones\n", bench_impls[k]);
+    }
+
+    bench_run (&s);
+
+out:
+    bench_free (&s);
+    return ret;
+}
@@ -0,0 +1,440 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * Segment is all zeroes when created and this is a valid empty state, so
+ * processes can race to create it without any further synchronization.
+ * Destination records are allocated once and never freed, process slots
+ * are claimed with CAS on pid and freed by reclaiming.
+ *
+ * Processes adding the same address concurrently claim different records,
+ * so a record is claimed first and becomes visible to lookups (READY) only
+ * when it is the only claim for its address. A claimant that sees a READY
+ * record or a claim at lower index gives its record up, one that sees only
+ * claims at higher indices waits for them to be decided. So the highest
+ * claim decides without waiting, and of the claims that see each other the
+ * lowest index wins.
+ *
+ * $Id$
+ */
+
+#include "glb_shm.h"
+#include "glb_log.h"
+#include "glb_misc.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sched.h>   // sched_yield()
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+
+#define SHM_MAGIC 0x474c4232 // "GLB2", bump if layout changes
+#define SHM_DSTS  128
+#define SHM_PROCS 512
+
+enum
+{
+    SHM_DST_FREE = 0, // address is being written if owner is set
+    SHM_DST_CLAIMED,  // address is written, competing with other claims
+    SHM_DST_READY     // the record of address for everybody
+};
+
+typedef struct shm_dst
+{
+    glb_sockaddr_t addr;
+    int32_t        state;
+    int32_t        owner;  // pid of claimant, 0 - none, -1 - being reclaimed
+    int32_t        conns;  // total over all processes
+    int32_t        pad;
+    int64_t        failed; // last time connection failed
+} shm_dst_t;
+
+typedef struct shm_proc
+{
+    int32_t pid;             // 0 - free slot, -1 - being reclaimed
+    int32_t conns[SHM_DSTS]; // connections of this process
+} shm_proc_t;
+
+typedef struct shm_seg
+{
+    uint32_t   magic;
+    uint32_t   pad;
+    shm_dst_t  dst[SHM_DSTS];
+    shm_proc_t proc[SHM_PROCS];
+} shm_seg_t;
+
+struct glb_shm
+{
+    shm_seg_t* seg;
+    int        proc; // own slot, -1 if there was no free slot
+    glb_shm_t* next; // list of attached segments for fork handler
+};
+
+#define SHM_LOAD(x)  __atomic_load_n (&(x), __ATOMIC_ACQUIRE)
+/* claims must see each other: sequentially consistent store and loads */
+#define SHM_LOAD_SC(x)    __atomic_load_n (&(x), __ATOMIC_SEQ_CST)
+#define SHM_STORE_SC(x,v) __atomic_store_n (&(x), (v), __ATOMIC_SEQ_CST)
+#define SHM_STORE(x,v) __atomic_store_n (&(x), (v), __ATOMIC_RELEASE)
+#define SHM_ADD(x,v) __atomic_add_fetch (&(x), (v), __ATOMIC_RELAXED)
+#define SHM_CAS(x,o,n)                                                  \
+    __atomic_compare_exchange_n (&(x), &(o), (n), false,                \
+                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+static pthread_mutex_t shm_list_lock = PTHREAD_MUTEX_INITIALIZER;
+static glb_shm_t*      shm_list      = NULL;
+
+/* @return slot claimed for this process or -1 if there is none */
+static int
+shm_claim_proc (shm_seg_t* const seg)
+{
+    int32_t const pid = getpid();
+    int i;
+
+    for (i = 0; i < SHM_PROCS; i++)
+    {
+        int32_t free_pid = 0;
+
+        if (SHM_CAS (seg->proc[i].pid, free_pid, pid))
+        {
+            /* reclaimer zeroes counts before freeing the slot */
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+/* child counts its connections separately from the parent. Prefork servers
+ * start new children to replace dead ones, so it is a good time to reclaim. */
+static void
+shm_atfork_child (void)
+{
+    glb_shm_t* shm;
+
+    for (shm = shm_list; shm; shm = shm->next)
+    {
+        shm->proc = -1;
+        glb_shm_reclaim (shm);
+        shm->proc = shm_claim_proc (shm->seg);
+    }
+}
+
+glb_shm_t*
+glb_shm_attach (const char* const name)
+{
+    char path[256];
+
+    snprintf (path, sizeof(path), "%s%s", '/' == name[0] ? "" : "/", name);
+
+    int const fd = shm_open (path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+
+    if (fd < 0)
+    {
+        glb_log_error ("Failed to open shared memory '%s': %d (%s)",
+                       path, errno, strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    void* addr = MAP_FAILED;
+    int err = 0;
+
+    /* concurrent truncation to the same size does not touch the contents */
+    if (fstat (fd, &st) ||
+        (st.st_size < (off_t)sizeof(shm_seg_t) &&
+         ftruncate (fd, sizeof(shm_seg_t))))
+    {
+        err = errno;
+    }
+    else
+    {
+        addr = mmap (NULL, sizeof(shm_seg_t), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+        if (MAP_FAILED == addr) err = errno;
+    }
+
+    close (fd);
+
+    if (err)
+    {
+        glb_log_error ("Failed to map shared memory '%s': %d (%s)",
+                       path, err, strerror(err));
+        errno = err;
+        return NULL;
+    }
+
+    shm_seg_t* const seg = addr;
+    uint32_t magic = 0;
+
+    if (!SHM_CAS (seg->magic, magic, SHM_MAGIC) && SHM_MAGIC != magic)
+    {
+        glb_log_error ("Shared memory '%s' has incompatible layout %x",
+                       path, magic);
+        munmap (addr, sizeof(shm_seg_t));
+        errno = EPROTO;
+        return NULL;
+    }
+
+    glb_shm_t* const ret = malloc (sizeof(glb_shm_t));
+
+    if (!ret)
+    {
+        munmap (addr, sizeof(shm_seg_t));
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    ret->seg  = seg;
+    ret->proc = -1;
+
+    glb_shm_reclaim (ret);
+
+    ret->proc = shm_claim_proc (seg);
+
+    if (ret->proc < 0)
+    {
+        glb_log_warn ("No free process slots in shared memory '%s', "
+                      "connections will not be reclaimed if process dies.",
+                      path);
+    }
+
+    GLB_MUTEX_LOCK (&shm_list_lock);
+
+    if (!shm_list) pthread_atfork (NULL, NULL, shm_atfork_child);
+
+    ret->next = shm_list;
+    shm_list  = ret;
+
+    GLB_MUTEX_UNLOCK (&shm_list_lock);
+
+    return ret;
+}
+
+/* @return index of the first ready record of addr or SHM_DSTS if none */
+static int
+shm_find_dst (const shm_seg_t* const seg, const glb_sockaddr_t* const addr)
+{
+    int i;
+
+    for (i = 0; i < SHM_DSTS; i++)
+    {
+        if (SHM_DST_READY == SHM_LOAD (seg->dst[i].state) &&
+            glb_sockaddr_is_equal (&seg->dst[i].addr, addr)) return i;
+    }
+
+    return SHM_DSTS;
+}
+
+/* @return true if process is gone (EPERM means it exists, but belongs to
+ *         another user) */
+static inline bool
+shm_pid_dead (int32_t const pid)
+{
+    return (0 != kill (pid, 0) && ESRCH == errno);
+}
+
+/* frees claimed record */
+static inline void
+shm_release_dst (shm_dst_t* const d)
+{
+    SHM_STORE (d->state, SHM_DST_FREE);
+    SHM_STORE (d->owner, 0);
+}
+
+/* frees claim of a dead process */
+static void
+shm_reclaim_dst (shm_dst_t* const d)
+{
+    int32_t pid = SHM_LOAD (d->owner);
+
+    if (pid <= 0 || SHM_DST_READY == SHM_LOAD (d->state) ||
+        !shm_pid_dead (pid)) return;
+
+    if (!SHM_CAS (d->owner, pid, -1)) return; // somebody else got it
+
+    /* dead process won't make it ready any more */
+    shm_release_dst (d);
+}
+
+/* @return index of claimed free record with addr written or SHM_DSTS */
+static int
+shm_claim_dst (shm_seg_t* const seg, const glb_sockaddr_t* const addr)
+{
+    int32_t const pid = getpid();
+    int i;
+
+    for (i = 0; i < SHM_DSTS; i++)
+    {
+        shm_dst_t* const d = &seg->dst[i];
+        int32_t owner = 0;
+
+        if (SHM_DST_FREE != SHM_LOAD (d->state)) continue;
+
+        if (SHM_CAS (d->owner, owner, pid))
+        {
+            d->addr = *addr;
+            SHM_STORE_SC (d->state, SHM_DST_CLAIMED);
+            return i;
+        }
+    }
+
+    return SHM_DSTS;
+}
+
+enum
+{
+    SHM_CLAIM_WON,
+    SHM_CLAIM_LOST,
+    SHM_CLAIM_WAIT
+};
+
+/* decides claim i against other records of the same address, *ready is set
+ * to a ready record if there is one */
+static int
+shm_claim_decide (shm_seg_t* const seg, int const i,
+                  const glb_sockaddr_t* const addr, int* const ready)
+{
+    bool higher = false;
+    int  j;
+
+    *ready = SHM_DSTS;
+
+    for (j = 0; j < SHM_DSTS; j++)
+    {
+        shm_dst_t* const d = &seg->dst[j];
+
+        if (j == i) continue;
+
+        int32_t const state = SHM_LOAD_SC (d->state);
+
+        if (SHM_DST_FREE == state ||
+            !glb_sockaddr_is_equal (&d->addr, addr)) continue;
+
+        if (SHM_DST_READY == state)
+        {
+            *ready = j;
+            return SHM_CLAIM_LOST;
+        }
+
+        /* concurrent claim that is stuck in a dead process */
+        shm_reclaim_dst (d);
+        if (SHM_DST_CLAIMED != SHM_LOAD_SC (d->state)) continue;
+
+        if (j < i) return SHM_CLAIM_LOST;
+
+        higher = true;
+    }
+
+    return (higher ? SHM_CLAIM_WAIT : SHM_CLAIM_WON);
+}
+
+int
+glb_shm_dst (glb_shm_t* const shm, const glb_sockaddr_t* const addr)
+{
+    shm_seg_t* const seg = shm->seg;
+
+    while (true)
+    {
+        int i = shm_find_dst (seg, addr);
+
+        if (i < SHM_DSTS) return i;
+
+        i = shm_claim_dst (seg, addr);
+
+        if (SHM_DSTS == i) return -ENOSPC;
+
+        int ready;
+        int res;
+
+        /* higher claims decide without waiting for lower ones */
+        while (SHM_CLAIM_WAIT == (res = shm_claim_decide (seg, i, addr,
+                                                          &ready)))
+        {
+            sched_yield();
+        }
+
+        if (SHM_CLAIM_WON == res)
+        {
+            SHM_STORE_SC (seg->dst[i].state, SHM_DST_READY);
+            return i;
+        }
+
+        /* record was never ready, so nobody else uses it */
+        shm_release_dst (&seg->dst[i]);
+
+        if (ready < SHM_DSTS) return ready;
+
+        sched_yield(); // let the winner make its record ready
+    }
+}
+
+int
+glb_shm_conns (const glb_shm_t* const shm, int const dst)
+{
+    int32_t const ret = SHM_LOAD (shm->seg->dst[dst].conns);
+
+    return (ret > 0 ? ret : 0); // may be behind reclaiming
+}
+
+void
+glb_shm_conns_add (glb_shm_t* const shm, int const dst, int const delta)
+{
+    if (shm->proc >= 0) SHM_ADD (shm->seg->proc[shm->proc].conns[dst], delta);
+
+    SHM_ADD (shm->seg->dst[dst].conns, delta);
+}
+
+int64_t
+glb_shm_failed (const glb_shm_t* const shm, int const dst)
+{
+    return SHM_LOAD (shm->seg->dst[dst].failed);
+}
+
+void
+glb_shm_set_failed (glb_shm_t* const shm, int const dst, int64_t const t)
+{
+    int64_t old = SHM_LOAD (shm->seg->dst[dst].failed);
+
+    while (old < t && !SHM_CAS (shm->seg->dst[dst].failed, old, t));
+}
+
+int
+glb_shm_reclaim (glb_shm_t* const shm)
+{
+    shm_seg_t* const seg = shm->seg;
+    int ret = 0;
+    int i;
+
+    for (i = 0; i < SHM_PROCS; i++)
+    {
+        shm_proc_t* const p = &seg->proc[i];
+        int32_t pid = SHM_LOAD (p->pid);
+
+        if (pid <= 0 || i == shm->proc || !shm_pid_dead (pid)) continue;
+
+        if (!SHM_CAS (p->pid, pid, -1)) continue; // somebody else got it
+
+        int d;
+        for (d = 0; d < SHM_DSTS; d++)
+        {
+            int32_t const c = __atomic_exchange_n (&p->conns[d], 0,
+                                                   __ATOMIC_RELAXED);
+            if (c) SHM_ADD (seg->dst[d].conns, -c);
+        }
+
+        SHM_STORE (p->pid, 0);
+        ret++;
+    }
+
+    if (ret) glb_log_debug ("Reclaimed %d process slots", ret);
+
+    /* destination claims of processes that died while adding them */
+    for (i = 0; i < SHM_DSTS; i++) shm_reclaim_dst (&seg->dst[i]);
+
+    return ret;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * Router state shared by all libglb processes on a host: a POSIX shared
+ * memory segment with per-destination connection counts and failure marks.
+ * Destinations are identified by address, so routers of different
+ * processes and services need not have the same destination lists.
+ *
+ * Every process counts its connections in its own slot as well, so that
+ * counts of a process which exited without closing them can be reclaimed.
+ *
+ * $Id$
+ */
+
+#ifndef _glb_shm_h_
+#define _glb_shm_h_
+
+#include "glb_socket.h"
+
+#include <stdint.h>
+
+typedef struct glb_shm glb_shm_t;
+
+/*!
+ * Attaches to the segment of a given name, creating it if necessary.
+ * Counts of processes that are gone are reclaimed.
+ * @return segment handle or NULL in case of error (errno is set)
+ */
+extern glb_shm_t*
+glb_shm_attach (const char* name);
+
+/*!
+ * @return index of destination record in the segment, allocating it if
+ *         necessary, or negative error code if the table is full.
+ */
+extern int
+glb_shm_dst (glb_shm_t* shm, const glb_sockaddr_t* addr);
+
+/*! @return number of connections to destination from all processes */
+extern int
+glb_shm_conns (const glb_shm_t* shm, int dst);
+
+/*! Adds delta to the number of connections of this process to destination */
+extern void
+glb_shm_conns_add (glb_shm_t* shm, int dst, int delta);
+
+/*! @return last time connection to destination failed in any process */
+extern int64_t
+glb_shm_failed (const glb_shm_t* shm, int dst);
+
+/*! Marks destination failed at time t unless it is marked later already */
+extern void
+glb_shm_set_failed (glb_shm_t* shm, int dst, int64_t t);
+
+/*!
+ * Subtracts connection counts of processes that are gone from destination
+ * totals and frees their slots.
+ * @return number of slots reclaimed
+ */
+extern int
+glb_shm_reclaim (glb_shm_t* shm);
+
+#endif // _glb_shm_h_
@@ -12,6 +12,9 @@
 volatile sig_atomic_t
 glb_terminate = 0;
 
+volatile sig_atomic_t
+glb_reload = 0;
+
 const char*
 glb_fifo_name = NULL;
 
@@ -34,7 +37,9 @@ signal_handler(int signum)
         fifo_cleanup();
         glb_log_fatal ("Child unexpectedly terminated.");
         exit (EXIT_FAILURE);
-    case SIGHUP:
+    case SIGHUP: // reload configuration, main loop takes care of it
+        glb_reload = 1;
+        return;
     case SIGTERM:
     case SIGINT:
     case SIGQUIT:
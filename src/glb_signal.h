@@ -14,6 +14,9 @@
 extern volatile sig_atomic_t
 glb_terminate;
 
+extern volatile sig_atomic_t
+glb_reload;
+
 extern const char*
 glb_fifo_name;
 
@@ -12,6 +12,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <netdb.h>
@@ -37,11 +38,24 @@ glb_socket_init(const glb_cnf_t* cnf)
 // maximum IP address length = 21: aaa.bbb.ccc.ddd:ppppp
 //                                                ^ position 15
 
+static inline glb_sockaddr_str_t
+sockaddr_unix_str (const glb_sockaddr_t* addr)
+{
+    glb_sockaddr_str_t ret = {{ 0, }};
+
+    snprintf (ret.str, sizeof(ret.str), GLB_SOCKADDR_UNIX "%s",
+              addr->un.sun_path);
+
+    return ret;
+}
+
 glb_sockaddr_str_t
 glb_sockaddr_to_str (const glb_sockaddr_t* addr)
 {
-    uint8_t* a = (void*)&addr->sin_addr.s_addr;
-    uint16_t p = ntohs (addr->sin_port);
+    if (glb_sockaddr_is_unix (addr)) return sockaddr_unix_str (addr);
+
+    uint8_t* a = (void*)&addr->in.sin_addr.s_addr;
+    uint16_t p = ntohs (addr->in.sin_port);
     glb_sockaddr_str_t ret = {{ 0, }};
 
     snprintf (ret.str, sizeof(ret.str),
@@ -53,8 +67,10 @@ glb_sockaddr_to_str (const glb_sockaddr_t* addr)
 glb_sockaddr_str_t
 glb_sockaddr_to_astr (const glb_sockaddr_t* addr)
 {
-    uint8_t* a = (void*)&addr->sin_addr.s_addr;
-    uint16_t p = ntohs (addr->sin_port);
+    if (glb_sockaddr_is_unix (addr)) return sockaddr_unix_str (addr);
+
+    uint8_t* a = (void*)&addr->in.sin_addr.s_addr;
+    uint16_t p = ntohs (addr->in.sin_port);
     glb_sockaddr_str_t ret = {{ 0, }};
 
     char ip[16];
@@ -83,6 +99,24 @@ glb_sockaddr_init (glb_sockaddr_t* addr,
                    const char*     hostname,
                    uint16_t        port)
 {
+    if (glb_sockaddr_str_is_unix (hostname))
+    {
+        const char* const path = hostname + sizeof(GLB_SOCKADDR_UNIX) - 1;
+        size_t const path_len = strlen (path);
+
+        if (0 == path_len || path_len >= sizeof(addr->un.sun_path))
+        {
+            glb_log_error ("Invalid UNIX socket path: '%s'", path);
+            return -EINVAL;
+        }
+
+        memset (addr, 0, sizeof(*addr));
+        addr->un.sun_family = AF_UNIX;
+        memcpy (addr->un.sun_path, path, path_len);
+
+        return 0;
+    }
+
     struct hostent* host = gethostbyname (hostname);
 
     if (host == NULL)
@@ -92,9 +126,9 @@ glb_sockaddr_init (glb_sockaddr_t* addr,
     }
 
     memset (addr, 0, sizeof(*addr));
-    addr->sin_addr   = *(struct in_addr *) host->h_addr;
-    addr->sin_port   = htons (port);
-    addr->sin_family = AF_INET;
+    addr->in.sin_addr   = *(struct in_addr *) host->h_addr;
+    addr->in.sin_port   = htons (port);
+    addr->in.sin_family = AF_INET;
 
     return 0;
 }
@@ -102,19 +136,21 @@ glb_sockaddr_init (glb_sockaddr_t* addr,
 void
 glb_sockaddr_set_port (glb_sockaddr_t* addr, uint16_t port)
 {
-    addr->sin_port   = htons (port);
+    if (!glb_sockaddr_is_unix (addr)) addr->in.sin_port = htons (port);
 }
 
 short
 glb_sockaddr_get_port (const glb_sockaddr_t* addr)
 {
-    return ntohs (addr->sin_port);
+    return glb_sockaddr_is_unix (addr) ? 0 : ntohs (addr->in.sin_port);
 }
 
 glb_sockaddr_str_t
 glb_sockaddr_get_host (const glb_sockaddr_t* addr)
 {
-    uint8_t* a = (void*)&addr->sin_addr.s_addr;
+    if (glb_sockaddr_is_unix (addr)) return sockaddr_unix_str (addr);
+
+    uint8_t* a = (void*)&addr->in.sin_addr.s_addr;
     glb_sockaddr_str_t ret = {{ 0, }};
 
     snprintf (ret.str, sizeof(ret.str) - 1,
@@ -150,7 +186,12 @@ fnv32a_mix(const void* buf, size_t buf_len)
 uint32_t
 glb_sockaddr_hash (const glb_sockaddr_t* addr)
 {
-    return fnv32a_mix (&addr->sin_addr, sizeof(addr->sin_addr));
+    if (glb_sockaddr_is_unix (addr))
+        return fnv32a_mix (addr->un.sun_path,
+                           strnlen (addr->un.sun_path,
+                                    sizeof(addr->un.sun_path)));
+
+    return fnv32a_mix (&addr->in.sin_addr, sizeof(addr->in.sin_addr));
 }
 
 int
@@ -279,8 +320,36 @@ glb_socket_setopt (int sock, uint32_t const optflags)
 
 #endif /* GLBD */
 
-int
-glb_socket_create (const struct sockaddr_in* addr, uint32_t const optflags)
+// Removes UNIX socket file left by a previous process if nobody listens on it
+static bool
+socket_unlink_stale (const glb_sockaddr_t* const addr)
+{
+    struct stat st;
+
+    if (lstat (addr->un.sun_path, &st) || !S_ISSOCK(st.st_mode)) return false;
+
+    int const sock = socket (PF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) return false;
+
+    bool const stale =
+        connect (sock, &addr->sa, glb_sockaddr_len (addr)) &&
+        ECONNREFUSED == errno;
+
+    close (sock);
+
+    if (stale && !unlink (addr->un.sun_path))
+    {
+        glb_log_info ("Removed stale UNIX socket '%s'", addr->un.sun_path);
+        return true;
+    }
+
+    return false;
+}
+
+static int
+socket_create (const glb_sockaddr_t* const addr,
+               int                   const family,
+               uint32_t              const optflags)
 {
     int sock;
     int err;
@@ -288,9 +357,9 @@ glb_socket_create (const struct sockaddr_in* addr, uint32_t const optflags)
     /* Create the socket. We don't want CLOEXEC for libglb as we don't
      * know if application will fork. Libglb opens only control sockets. */
 #if defined(SOCK_CLOEXEC) && defined(GLBD)
-    sock = socket (PF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sock = socket (family, SOCK_STREAM | SOCK_CLOEXEC, 0);
 #else
-    sock = socket (PF_INET, SOCK_STREAM, 0);
+    sock = socket (family, SOCK_STREAM, 0);
 #endif
     if (sock < 0)
     {
@@ -303,10 +372,28 @@ glb_socket_create (const struct sockaddr_in* addr, uint32_t const optflags)
 #ifndef SOCK_CLOEXEC
     if ((err = glb_fd_setfd (sock, FD_CLOEXEC, true))) goto error;
 #endif /* !SOCK_CLOEXEC */
-    if ((err = glb_socket_setopt (sock, optflags)))    goto error;
+    if (AF_UNIX == family)
+    {
+        // TCP options don't apply
+        if ((optflags & GLB_SOCK_NONBLOCK) &&
+            (err = glb_fd_setfl (sock, O_NONBLOCK, true)))   goto error;
+    }
+    else if ((err = glb_socket_setopt (sock, optflags)))    goto error;
 #endif /* GLBD */
 
-    if (bind (sock, (struct sockaddr *) addr, sizeof (*addr)) < 0)
+    if (NULL == addr) return sock; // no bind
+
+    int ret = bind (sock, &addr->sa, glb_sockaddr_len (addr));
+
+    if (ret < 0 && EADDRINUSE == errno && AF_UNIX == family)
+    {
+        if (socket_unlink_stale (addr))
+            ret = bind (sock, &addr->sa, glb_sockaddr_len (addr));
+        else
+            errno = EADDRINUSE;
+    }
+
+    if (ret < 0)
     {
         err = -errno;
         glb_log_error ("Failed to bind socket: %d (%s)", -err, strerror(-err));
@@ -321,3 +408,44 @@ error:
     return err;
 }
 
+int
+glb_socket_create (const glb_sockaddr_t* const addr, uint32_t const optflags)
+{
+    return socket_create (addr, addr->sa.sa_family, optflags);
+}
+
+int
+glb_socket_create_to (const glb_sockaddr_t* const dst,
+                      const glb_sockaddr_t* const local,
+                      uint32_t              const optflags)
+{
+    if (glb_sockaddr_is_unix (dst))
+        return socket_create (NULL, AF_UNIX, optflags);
+
+    return socket_create (local, local->sa.sa_family, optflags);
+}
+
+int
+glb_socket_reopen (int const sock, int const family)
+{
+    int const fl = fcntl (sock, F_GETFL);
+    int const fd = fcntl (sock, F_GETFD);
+
+    if (fl < 0 || fd < 0) return -errno;
+
+    int const tmp = socket (family, SOCK_STREAM, 0);
+
+    if (tmp < 0) return -errno;
+
+    int ret = 0;
+
+    if (fcntl (tmp, F_SETFL, fl) || dup2 (tmp, sock) < 0 ||
+        fcntl (sock, F_SETFD, fd))
+    {
+        ret = -errno;
+    }
+
+    close (tmp);
+
+    return ret;
+}
@@ -9,9 +9,44 @@
 
 #include <stdbool.h>
 #include <string.h> // for memcmp() and stuff
+#include <stddef.h> // for offsetof()
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
 
-typedef struct sockaddr_in glb_sockaddr_t;
+/*! Socket address: either IPv4 or UNIX domain socket path */
+typedef union glb_sockaddr
+{
+    struct sockaddr    sa;
+    struct sockaddr_in in;
+    struct sockaddr_un un;
+} glb_sockaddr_t;
+
+/*! Address string prefix that denotes UNIX domain socket path */
+#define GLB_SOCKADDR_UNIX "unix:"
+
+static inline bool
+glb_sockaddr_str_is_unix (const char* str)
+{
+    return (!strncmp (str, GLB_SOCKADDR_UNIX, sizeof(GLB_SOCKADDR_UNIX) - 1));
+}
+
+static inline bool
+glb_sockaddr_is_unix (const glb_sockaddr_t* addr)
+{
+    return (AF_UNIX == addr->sa.sa_family);
+}
+
+/*! Returns the length of the address to pass to bind()/connect() */
+static inline socklen_t
+glb_sockaddr_len (const glb_sockaddr_t* addr)
+{
+    if (glb_sockaddr_is_unix (addr))
+        return (offsetof(struct sockaddr_un, sun_path) +
+                strlen (addr->un.sun_path) + 1);
+
+    return sizeof(addr->in);
+}
 
 #ifdef GLBD
 
@@ -24,7 +59,10 @@ glb_socket_init(const struct glb_cnf* cnf);
 
 typedef struct glb_sockaddr_str
 {
-    char str[22]; /* Maximum length of IPv4 address is 21 chars + '\0' */
+    /* Maximum length of IPv4 address is 21 chars + '\0',
+     * UNIX socket address is prefix + path */
+    char str[sizeof(GLB_SOCKADDR_UNIX) - 1 +
+             sizeof(((struct sockaddr_un*)0)->sun_path)];
 } glb_sockaddr_str_t;
 
 /*! Return a nul-terminated string containing socKet address. */
@@ -40,10 +78,16 @@ static inline bool
 glb_sockaddr_is_equal (const glb_sockaddr_t* left,
                        const glb_sockaddr_t* right)
 {
-    return (!memcmp(left, right, sizeof (glb_sockaddr_t)));
+    if (left->sa.sa_family != right->sa.sa_family) return false;
+
+    if (glb_sockaddr_is_unix (left))
+        return (!strcmp (left->un.sun_path, right->un.sun_path));
+
+    return (left->in.sin_port        == right->in.sin_port &&
+            left->in.sin_addr.s_addr == right->in.sin_addr.s_addr);
 }
 
-// Initialize glb_sockaddr_t struct
+// Initialize glb_sockaddr_t struct, hostname "unix:/path" denotes UNIX socket
 extern long
 glb_sockaddr_init (glb_sockaddr_t* addr, const char* hostname, uint16_t port);
 
@@ -67,6 +111,19 @@ glb_sockaddr_get_host (const glb_sockaddr_t* addr);
 extern int
 glb_socket_create (const glb_sockaddr_t* addr, uint32_t optflags);
 
+// Returns socket (file descriptor) to connect to dst: bound to local address
+// for IPv4 destinations and unbound for UNIX socket ones
+extern int
+glb_socket_create_to (const glb_sockaddr_t* dst,
+                      const glb_sockaddr_t* local,
+                      uint32_t              optflags);
+
+// Replaces socket with a new one of a given address family under the same
+// file descriptor number, preserving file descriptor flags.
+// Returns 0 or negative error code
+extern int
+glb_socket_reopen (int sock, int family);
+
 #ifdef GLBD
 
 extern uint32_t
@@ -0,0 +1,293 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * $Id$
+ */
+
+#include "glb_sockmap.h"
+#include "glb_log.h"
+
+#include <linux/bpf.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <string.h>
+#include <stddef.h> // offsetof()
+#include <errno.h>
+
+/* just enough of BPF assembler for the programs below */
+#define SM_INSN(c,d,s,o,i) \
+    ((struct bpf_insn){ .code = (c), .dst_reg = (d), .src_reg = (s), \
+                        .off = (o), .imm = (i) })
+#define SM_MOV64_REG(d,s)   SM_INSN(BPF_ALU64 | BPF_MOV | BPF_X, d, s, 0, 0)
+#define SM_MOV64_IMM(d,i)   SM_INSN(BPF_ALU64 | BPF_MOV | BPF_K, d, 0, 0, i)
+#define SM_ADD64_IMM(d,i)   SM_INSN(BPF_ALU64 | BPF_ADD | BPF_K, d, 0, 0, i)
+#define SM_LDX_W(d,s,o)     SM_INSN(BPF_LDX | BPF_W | BPF_MEM, d, s, o, 0)
+#define SM_STX_W(d,s,o)     SM_INSN(BPF_STX | BPF_W | BPF_MEM, d, s, o, 0)
+#define SM_JEQ_IMM(d,i,o)   SM_INSN(BPF_JMP | BPF_JEQ | BPF_K, d, 0, o, i)
+#define SM_CALL(f)          SM_INSN(BPF_JMP | BPF_CALL, 0, 0, 0, f)
+#define SM_EXIT()           SM_INSN(BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+#define SM_LD_MAP_FD(d,fd)  \
+    SM_INSN(BPF_LD | BPF_DW | BPF_IMM, d, BPF_PSEUDO_MAP_FD, 0, fd), \
+    SM_INSN(0, 0, 0, 0, 0)
+
+#define SM_SKB(field) offsetof(struct __sk_buff, field)
+
+static int sm_sockmap = -1; // fd -> socket
+static int sm_peers   = -1; // glb_sockmap_key_t -> peer fd
+static int sm_parser  = -1;
+static int sm_verdict = -1;
+
+static inline long
+sm_bpf (int cmd, union bpf_attr* attr)
+{
+    return syscall (__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+static int
+sm_map_create (enum bpf_map_type type, int key_size, int max_entries)
+{
+    union bpf_attr attr;
+
+    memset (&attr, 0, sizeof(attr));
+    attr.map_type    = type;
+    attr.key_size    = key_size;
+    attr.value_size  = sizeof(uint32_t);
+    attr.max_entries = max_entries;
+
+    return sm_bpf (BPF_MAP_CREATE, &attr);
+}
+
+static int
+sm_prog_load (const struct bpf_insn* insns, int n_insns, const char* name)
+{
+    static char    log[4096];
+    union bpf_attr attr;
+
+    memset (&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_SK_SKB;
+    attr.insns     = (uintptr_t)insns;
+    attr.insn_cnt  = n_insns;
+    attr.license   = (uintptr_t)"GPL";
+    attr.log_buf   = (uintptr_t)log;
+    attr.log_size  = sizeof(log);
+    attr.log_level = 1;
+
+    log[0] = '\0';
+
+    int const ret = sm_bpf (BPF_PROG_LOAD, &attr);
+    if (ret < 0 && log[0] != '\0') {
+        glb_log_debug ("BPF %s program rejected:\n%s", name, log);
+    }
+
+    return ret;
+}
+
+static int
+sm_prog_attach (int prog, enum bpf_attach_type type)
+{
+    union bpf_attr attr;
+
+    memset (&attr, 0, sizeof(attr));
+    attr.target_fd     = sm_sockmap;
+    attr.attach_bpf_fd = prog;
+    attr.attach_type   = type;
+
+    return sm_bpf (BPF_PROG_ATTACH, &attr);
+}
+
+static int
+sm_map_update (int map, const void* key, uint32_t value)
+{
+    union bpf_attr attr;
+
+    memset (&attr, 0, sizeof(attr));
+    attr.map_fd = map;
+    attr.key    = (uintptr_t)key;
+    attr.value  = (uintptr_t)&value;
+    attr.flags  = BPF_ANY;
+
+    return sm_bpf (BPF_MAP_UPDATE_ELEM, &attr);
+}
+
+static void
+sm_map_delete (int map, const void* key)
+{
+    union bpf_attr attr;
+
+    memset (&attr, 0, sizeof(attr));
+    attr.map_fd = map;
+    attr.key    = (uintptr_t)key;
+
+    sm_bpf (BPF_MAP_DELETE_ELEM, &attr);
+}
+
+static int
+sm_load_programs (void)
+{
+    /* whole skb is a message */
+    const struct bpf_insn parser[] = {
+        SM_LDX_W     (BPF_REG_0, BPF_REG_1, SM_SKB(len)),
+        SM_EXIT      ()
+    };
+
+    /* key = 4-tuple on stack; peer = lookup(sm_peers, key);
+     * return peer ? sk_redirect_map(skb, sm_sockmap, *peer, 0) : SK_PASS */
+    const struct bpf_insn verdict[] = {
+        SM_MOV64_REG (BPF_REG_6, BPF_REG_1),
+        SM_LDX_W     (BPF_REG_2, BPF_REG_6, SM_SKB(local_ip4)),
+        SM_STX_W     (BPF_REG_10, BPF_REG_2, -16),
+        SM_LDX_W     (BPF_REG_2, BPF_REG_6, SM_SKB(remote_ip4)),
+        SM_STX_W     (BPF_REG_10, BPF_REG_2, -12),
+        SM_LDX_W     (BPF_REG_2, BPF_REG_6, SM_SKB(local_port)),
+        SM_STX_W     (BPF_REG_10, BPF_REG_2, -8),
+        SM_LDX_W     (BPF_REG_2, BPF_REG_6, SM_SKB(remote_port)),
+        SM_STX_W     (BPF_REG_10, BPF_REG_2, -4),
+        SM_LD_MAP_FD (BPF_REG_1, sm_peers),
+        SM_MOV64_REG (BPF_REG_2, BPF_REG_10),
+        SM_ADD64_IMM (BPF_REG_2, -16),
+        SM_CALL      (BPF_FUNC_map_lookup_elem),
+        SM_JEQ_IMM   (BPF_REG_0, 0, 7),
+        SM_LDX_W     (BPF_REG_3, BPF_REG_0, 0),
+        SM_MOV64_REG (BPF_REG_1, BPF_REG_6),
+        SM_LD_MAP_FD (BPF_REG_2, sm_sockmap),
+        SM_MOV64_IMM (BPF_REG_4, 0),
+        SM_CALL      (BPF_FUNC_sk_redirect_map),
+        SM_EXIT      (),
+        SM_MOV64_IMM (BPF_REG_0, SK_PASS), // no peer
+        SM_EXIT      ()
+    };
+
+    sm_parser = sm_prog_load (parser, sizeof(parser)/sizeof(parser[0]),
+                              "parser");
+    if (sm_parser < 0) return -errno;
+
+    sm_verdict = sm_prog_load (verdict, sizeof(verdict)/sizeof(verdict[0]),
+                               "verdict");
+    if (sm_verdict < 0) return -errno;
+
+    if (sm_prog_attach (sm_parser,  BPF_SK_SKB_STREAM_PARSER))  return -errno;
+    if (sm_prog_attach (sm_verdict, BPF_SK_SKB_STREAM_VERDICT)) return -errno;
+
+    return 0;
+}
+
+int
+glb_sockmap_init (int const max_fd)
+{
+    int ret;
+
+    sm_sockmap = sm_map_create (BPF_MAP_TYPE_SOCKMAP, sizeof(uint32_t), max_fd);
+    if (sm_sockmap < 0) {
+        ret = -errno;
+        goto fail;
+    }
+
+    sm_peers = sm_map_create (BPF_MAP_TYPE_HASH, sizeof(glb_sockmap_key_t),
+                              max_fd);
+    if (sm_peers < 0) {
+        ret = -errno;
+        goto fail;
+    }
+
+    if ((ret = sm_load_programs ())) goto fail;
+
+    return 0;
+
+fail:
+    glb_log_warn ("Kernel forwarding through BPF sockmap unavailable: %d (%s)",
+                  -ret, strerror (-ret));
+    glb_sockmap_destroy ();
+    return ret;
+}
+
+void
+glb_sockmap_destroy (void)
+{
+    if (sm_verdict >= 0) { close (sm_verdict); sm_verdict = -1; }
+    if (sm_parser  >= 0) { close (sm_parser);  sm_parser  = -1; }
+    if (sm_peers   >= 0) { close (sm_peers);   sm_peers   = -1; }
+    if (sm_sockmap >= 0) { close (sm_sockmap); sm_sockmap = -1; }
+}
+
+bool
+glb_sockmap_enabled (void)
+{
+    return (sm_verdict >= 0);
+}
+
+static int
+sm_key_init (int const fd, glb_sockmap_key_t* const key)
+{
+    struct sockaddr_in local, remote;
+    socklen_t          local_len  = sizeof(local);
+    socklen_t          remote_len = sizeof(remote);
+
+    if (getsockname (fd, (struct sockaddr*)&local,  &local_len) ||
+        getpeername (fd, (struct sockaddr*)&remote, &remote_len)) {
+        return -errno;
+    }
+
+    if (AF_INET != local.sin_family || AF_INET != remote.sin_family)
+        return -EAFNOSUPPORT;
+
+    key->local_ip4   = local.sin_addr.s_addr;
+    key->remote_ip4  = remote.sin_addr.s_addr;
+    key->local_port  = ntohs (local.sin_port);
+    /* sk_skb program loads remote port as skc_dport << 16 on little-endian,
+     * i.e. network order 16-bit value in the upper half of host order u32 */
+    key->remote_port = htonl (ntohs (remote.sin_port));
+
+    return 0;
+}
+
+int
+glb_sockmap_add (int const fd1, glb_sockmap_key_t* const key1,
+                 int const fd2, glb_sockmap_key_t* const key2)
+{
+    uint32_t const k1 = fd1;
+    uint32_t const k2 = fd2;
+    int ret;
+
+    if (!glb_sockmap_enabled()) return -ENOTSUP;
+
+    if ((ret = sm_key_init (fd1, key1)) || (ret = sm_key_init (fd2, key2)))
+        return ret;
+
+    /* sockets first: without peer entries the data is just passed to
+     * userspace, while redirect to a socket not in the sockmap drops it */
+    if (sm_map_update (sm_sockmap, &k1, fd1)) return -errno;
+
+    if (sm_map_update (sm_sockmap, &k2, fd2)) {
+        ret = -errno;
+        goto del_sock1;
+    }
+
+    if (sm_map_update (sm_peers, key1, fd2)) {
+        ret = -errno;
+        goto del_sock2;
+    }
+
+    if (sm_map_update (sm_peers, key2, fd1)) {
+        ret = -errno;
+        sm_map_delete (sm_peers, key1);
+        goto del_sock2;
+    }
+
+    return 0;
+
+del_sock2:
+    sm_map_delete (sm_sockmap, &k2);
+del_sock1:
+    sm_map_delete (sm_sockmap, &k1);
+    return ret;
+}
+
+void
+glb_sockmap_del (const glb_sockmap_key_t* const key1,
+                 const glb_sockmap_key_t* const key2)
+{
+    sm_map_delete (sm_peers, key1);
+    sm_map_delete (sm_peers, key2);
+}
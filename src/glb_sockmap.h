@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * Kernel-side forwarding of established connections through a BPF sockmap.
+ *
+ * Both sockets of a connection are inserted into a process-wide sockmap
+ * indexed by file descriptor. An sk_skb verdict program looks up the peer
+ * descriptor by the receiving socket 4-tuple and redirects the data straight
+ * to the peer socket, so pool threads only see close and error events.
+ * Anything that does not have a peer entry is passed to userspace as usual.
+ *
+ * $Id$
+ */
+
+#ifndef _glb_sockmap_h_
+#define _glb_sockmap_h_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* 4-tuple of the receiving socket as seen by the sk_skb program:
+ * addresses in network byte order, local port in host order, remote port
+ * as a 32-bit network order value (16-bit port in the upper half) */
+typedef struct glb_sockmap_key
+{
+    uint32_t local_ip4;
+    uint32_t remote_ip4;
+    uint32_t local_port;
+    uint32_t remote_port;
+} glb_sockmap_key_t;
+
+/*! Creates the maps and loads the programs.
+ *  @return 0 or negative error code if BPF is not usable on this system */
+extern int
+glb_sockmap_init (int max_fd);
+
+extern void
+glb_sockmap_destroy (void);
+
+/*! @return true if glb_sockmap_init() succeeded */
+extern bool
+glb_sockmap_enabled (void);
+
+/*! Starts forwarding between sockets fd1 and fd2 in kernel.
+ *  Keys are filled for the later glb_sockmap_del() call.
+ *  @return 0 or negative error code, in the latter case nothing changed. */
+extern int
+glb_sockmap_add (int fd1, glb_sockmap_key_t* key1,
+                 int fd2, glb_sockmap_key_t* key2);
+
+/*! Removes peer entries for a pair of sockets. Must be called before the
+ *  sockets are closed (sockets themselves leave the sockmap on close). */
+extern void
+glb_sockmap_del (const glb_sockmap_key_t* key1, const glb_sockmap_key_t* key2);
+
+#endif // _glb_sockmap_h_
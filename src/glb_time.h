@@ -22,6 +22,20 @@ glb_time_now()
     return (tv.tv_sec * 1000000000LL + tv.tv_usec * 1000);
 }
 
+/*! Returns current monotonic time in nanoseconds. Unlike glb_time_now() it
+ *  is not affected by system clock adjustments, so use it for intervals. */
+static inline glb_time_t
+glb_time_mono()
+{
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000000LL + ts.tv_nsec);
+#else
+    return glb_time_now();
+#endif
+}
+
 /*! Returns current time in struct timespec format */
 static inline struct timespec
 glb_timespec_now()
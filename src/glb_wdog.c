@@ -36,6 +36,11 @@ add/remove destinations
 #include "glb_wdog.h"
 #include "glb_wdog_backend.h"
 #include "glb_wdog_exec.h"
+#include "glb_wdog_mysql.h"
+#include "glb_wdog_tcp.h"
+#include "glb_wdog_http.h"
+#include "glb_wdog_agent.h"
+#include "glb_wdog_sched.h"
 #include "glb_dst.h"
 #include "glb_log.h"
 #include "glb_socket.h"
@@ -51,20 +56,43 @@ add/remove destinations
 
 #define WDOG_MAX_FAIL_COUNT 8
 
+/* Load reported by backend reduces weight as 1/(1 + WDOG_LOAD_GAIN*load),
+ * but not below WDOG_LOAD_MIN of the original weight. Load is smoothed
+ * over several results, rising faster than falling. */
+#define WDOG_LOAD_GAIN      3.0
+#define WDOG_LOAD_MIN       0.1
+#define WDOG_LOAD_RISE      1 // weight of the old value when load rises
+#define WDOG_LOAD_FALL      3 // weight of the old value when load falls
+#define WDOG_SCHED_THREADS  2 // for event-driven backends
+
 typedef struct wdog_dst
 {
     glb_wdog_check_t          result;
     glb_dst_t                 dst;
     double                    weight;
+    long                      max_conns;//! connection limit set in router
     glb_backend_thread_ctx_t* ctx;      //! backend thread context
     int                       fail_count;
     bool                      memb_changed;
     bool                      explicit; //! was added explicitly, never remove
 } wdog_dst_t;
 
+/*! Router changes collected over a pass of wdog_collect_results() to be
+ *  applied in one batch. Arrays are parallel to suit glb_router_change_dsts()*/
+typedef struct wdog_changes
+{
+    glb_dst_t*                 dst;
+    glb_backend_thread_ctx_t** ctx;
+    int*                       idx; // index of destination in wdog->dst
+    int*                       res;
+    int                        n;
+    int                        size;
+} wdog_changes_t;
+
 struct glb_wdog
 {
     glb_backend_t    backend;
+    glb_sched_t*     sched;    // probe scheduler for event-driven backend
     const glb_cnf_t* cnf;
     glb_router_t*    router;
     glb_pool_t*      pool;
@@ -73,16 +101,18 @@ struct glb_wdog
     pthread_cond_t   cond;
     bool             quit;
     bool             join;
+    bool             pushed;   // backend published results on its own
     long long        interval; // nsec
     struct timespec  next;
     int              n_dst;
     wdog_dst_t*      dst;
+    wdog_changes_t   chg;
 };
 
 static glb_backend_thread_ctx_t*
 wdog_backend_thread_ctx_create (glb_backend_ctx_t* const backend,
                                 const glb_dst_t*   const dst,
-                                long long          const interval)
+                                const glb_cnf_t*   const cnf)
 {
     glb_sockaddr_str_t const h    = glb_sockaddr_get_host (&dst->addr);
     short              const port = glb_sockaddr_get_port (&dst->addr);
@@ -100,7 +130,11 @@ wdog_backend_thread_ctx_create (glb_backend_ctx_t* const backend,
             pthread_cond_init  (&ret->cond, NULL);
             ret->host = host;
             ret->port = port;
-            ret->interval = interval;
+            ret->interval = cnf->interval;
+            ret->interval_min = cnf->interval_min ? cnf->interval_min :
+                                                    cnf->interval;
+            ret->interval_max = cnf->interval_max ? cnf->interval_max :
+                                                    cnf->interval;
             return ret;
         }
 
@@ -158,7 +192,7 @@ wdog_change_dst (glb_wdog_t*      const wdog,
 
         glb_backend_thread_ctx_t* ctx =
             wdog_backend_thread_ctx_create (wdog->backend.ctx, dst,
-                                            wdog->cnf->interval);
+                                            wdog->cnf);
 
         if (!ctx) {
             i = -ENOMEM;
@@ -174,13 +208,17 @@ wdog_change_dst (glb_wdog_t*      const wdog,
                 bool success = false;
                 wdog->dst = tmp;
 
-                GLB_MUTEX_LOCK (&ctx->lock);
-                {
+                if (wdog->sched) {
+                    ctx->errn = -glb_sched_add (wdog->sched, ctx);
+                    success = !ctx->errn;
+                }
+                else {
+                    GLB_MUTEX_LOCK (&ctx->lock);
                     pthread_create (&ctx->id, NULL, wdog->backend.thread, ctx);
                     pthread_cond_wait (&ctx->cond, &ctx->lock);
                     success = !ctx->join;
+                    GLB_MUTEX_UNLOCK (&ctx->lock);
                 }
-                GLB_MUTEX_UNLOCK (&ctx->lock);
 
                 if (success)
                 {
@@ -196,7 +234,7 @@ wdog_change_dst (glb_wdog_t*      const wdog,
                 }
                 else {
                     i = -ctx->errn;
-                    pthread_join (ctx->id, NULL);
+                    if (!wdog->sched) pthread_join (ctx->id, NULL);
                     glb_log_error ("Backend thread for '%s:hu' failed: %d (%s)",
                                    ctx->host, ctx->port, -i, strerror (-i));
                     wdog_backend_thread_ctx_destroy (ctx);
@@ -216,6 +254,7 @@ wdog_change_dst (glb_wdog_t*      const wdog,
             GLB_MUTEX_LOCK (&d->ctx->lock);
             d->ctx->quit = true;
             pthread_cond_signal (&d->ctx->cond);
+            glb_sched_kick (d->ctx);
             GLB_MUTEX_UNLOCK (&d->ctx->lock);
             /* thread will be joined context will be cleaned up later */
         }
@@ -262,6 +301,34 @@ glb_wdog_change_dst (glb_wdog_t*      const wdog,
 }
 
 
+void
+glb_wdog_reconfig (glb_wdog_t* const wdog)
+{
+    const glb_cnf_t* const cnf = wdog->cnf;
+    glb_time_t const min = cnf->interval_min ? cnf->interval_min :
+                                               cnf->interval;
+    glb_time_t const max = cnf->interval_max ? cnf->interval_max :
+                                               cnf->interval;
+    int i;
+
+    GLB_MUTEX_LOCK (&wdog->lock);
+
+    for (i = 0; i < wdog->n_dst; i++) {
+        glb_backend_thread_ctx_t* const ctx = wdog->dst[i].ctx;
+
+        GLB_MUTEX_LOCK (&ctx->lock);
+        ctx->interval     = cnf->interval;
+        ctx->interval_min = min;
+        ctx->interval_max = max;
+        GLB_MUTEX_UNLOCK (&ctx->lock);
+    }
+
+    /* see glb_wdog_create(), the next pass is scheduled with the new one */
+    wdog->interval = min * 1.1;
+
+    GLB_MUTEX_UNLOCK (&wdog->lock);
+}
+
 static int
 wdog_backend_factory (const glb_cnf_t* cnf,
                       glb_backend_t*   backend)
@@ -286,6 +353,26 @@ wdog_backend_factory (const glb_cnf_t* cnf,
     {
         return glb_backend_exec_init (backend, spec);
     }
+    else if (!strcmp (cnf->watchdog, "mexec"))
+    {
+        return glb_backend_mexec_init (backend, spec);
+    }
+    else if (!strcmp (cnf->watchdog, "mysql"))
+    {
+        return glb_backend_mysql_init (backend, spec);
+    }
+    else if (!strcmp (cnf->watchdog, "tcp"))
+    {
+        return glb_backend_tcp_init (backend, spec);
+    }
+    else if (!strcmp (cnf->watchdog, "http"))
+    {
+        return glb_backend_http_init (backend, spec);
+    }
+    else if (!strcmp (cnf->watchdog, "agent"))
+    {
+        return glb_backend_agent_init (backend, spec);
+    }
     else
     {
         glb_log_error ("'%s' watchdog not implemented.", cnf->watchdog);
@@ -297,6 +384,7 @@ static inline int
 wdog_copy_result (wdog_dst_t* const d, double* const max_lat, int const lf)
 {
     double const old_lat    = d->result.latency;
+    double const old_load   = d->result.load;
     char*  const others     = d->result.others;
     size_t const others_len = d->result.others_len;
 
@@ -321,6 +409,7 @@ wdog_copy_result (wdog_dst_t* const d, double* const max_lat, int const lf)
                                d->ctx->host, d->ctx->port, WDOG_MAX_FAIL_COUNT);
                 d->ctx->quit = true;
                 pthread_cond_signal (&d->ctx->cond);
+                glb_sched_kick (d->ctx);
             }
         }
         else { // remote destination is live, handle others string
@@ -370,16 +459,28 @@ wdog_copy_result (wdog_dst_t* const d, double* const max_lat, int const lf)
 //        glb_sockaddr_str_t a = glb_sockaddr_to_str (&d->dst.addr);
 //        glb_log_debug ("%s latency: %6.4f", a.str, d->result.latency);
 
+        int const ol = d->result.load > old_load ?
+            WDOG_LOAD_RISE : WDOG_LOAD_FALL;
+        d->result.load = (d->result.load + old_load * ol) / (ol + 1);
     }
     else {
-        // preserve previously measured latency
+        // preserve previously measured latency and load
         d->result.latency = old_lat;
+        d->result.load    = old_load;
     }
 
     return 0;
 }
 
-// returns latency adjusted weight
+static inline double
+wdog_load_factor (double const load)
+{
+    double const f = 1.0 / (1.0 + WDOG_LOAD_GAIN * load);
+    return (f > WDOG_LOAD_MIN ? f : WDOG_LOAD_MIN);
+}
+
+/* returns latency and load adjusted weight. Weight suggested by backend
+ * replaces the configured one, reported capacity scales it. */
 static inline double
 wdog_result_weight (wdog_dst_t* const d, double const max_lat,
                     bool const use_latency)
@@ -394,10 +495,19 @@ wdog_result_weight (wdog_dst_t* const d, double const max_lat,
     case GLB_DST_AVOID:
         return 0.0;
     case GLB_DST_READY:
+    {
+        double const base = d->result.weight_set ?
+            d->result.weight : d->dst.weight;
+        double const cap  = d->result.capacity > 0 ? d->result.capacity : 1.0;
+        double const w    = wdog_load_factor (d->result.load) * base * cap;
+
+        if (w <= 0.0) return 0.0; // suggested to drain
+
         if (max_lat > 0 && use_latency)
-            return d->dst.weight * max_lat / d->result.latency;
+            return w * max_lat / d->result.latency;
         else
-            return d->dst.weight;
+            return w;
+    }
     }
 
     return 0.0;
@@ -488,6 +598,56 @@ wdog_process_membership_change (glb_wdog_t* wdog, const char* const memb_str)
     return 0;
 }
 
+static int
+wdog_changes_reserve (wdog_changes_t* const chg, int const size)
+{
+    if (size <= chg->size) return 0;
+
+    void* tmp;
+
+    if (!(tmp = realloc (chg->dst, size * sizeof(*chg->dst)))) return -ENOMEM;
+    chg->dst = tmp;
+    if (!(tmp = realloc (chg->ctx, size * sizeof(*chg->ctx)))) return -ENOMEM;
+    chg->ctx = tmp;
+    if (!(tmp = realloc (chg->idx, size * sizeof(*chg->idx)))) return -ENOMEM;
+    chg->idx = tmp;
+    if (!(tmp = realloc (chg->res, size * sizeof(*chg->res)))) return -ENOMEM;
+    chg->res = tmp;
+
+    chg->size = size;
+
+    return 0;
+}
+
+static void
+wdog_changes_free (wdog_changes_t* const chg)
+{
+    free (chg->dst);
+    free (chg->ctx);
+    free (chg->idx);
+    free (chg->res);
+}
+
+// accounts for the result of router change
+static void
+wdog_weight_changed (glb_wdog_t* const wdog, wdog_dst_t* const d,
+                     const glb_dst_t* const dst, int const ret)
+{
+    glb_log_debug ("Changing weight for '%s:%hu': %6.3f -> %6.3f, "
+                   "max conns: %ld -> %ld:  %d (%s)",
+                   d->ctx->host, d->ctx->port, d->weight, dst->weight,
+                   d->max_conns, dst->max_conns,
+                   ret, strerror (ret > 0 ? 0 : -ret));
+
+    if (ret >= 0) {
+        if (dst->weight < 0.0 && wdog->pool) { // clean up the pool!
+            glb_pool_drop_dst (wdog->pool, &d->dst.addr);
+        }
+        d->weight    = dst->weight;
+        d->max_conns = dst->max_conns;
+    }
+}
+
 // collects and processes results, returns the number of results collected
 static int
 wdog_collect_results (glb_wdog_t* const wdog)
@@ -507,20 +667,35 @@ wdog_collect_results (glb_wdog_t* const wdog)
     int const old_n_dst = wdog->n_dst;
     int memb_source = -1;
 
+    /* if there's no memory for batch, changes are applied one by one */
+    wdog_changes_t* const chg =
+        wdog_changes_reserve (&wdog->chg, wdog->n_dst) ? NULL : &wdog->chg;
+
     for (i = wdog->n_dst - 1; i >= 0; i--) // reverse order for ease of cleanup
     {
         wdog_dst_t* d = &wdog->dst[i];
         double new_weight;
+        long   new_max_conns = d->max_conns;
 
         if (d->ctx->join) {
-            pthread_join (d->ctx->id, NULL);
+            if (!wdog->sched) pthread_join (d->ctx->id, NULL);
             glb_log_debug ("Joined thread for '%s:%hu'",
                            d->ctx->host, d->ctx->port);
+            if (d->weight >= 0.0) { // still in router list
+                glb_dst_t dst = d->dst;
+                dst.weight = -1.0;
+                glb_router_change_dst (wdog->router, &dst, NULL);
+            }
             wdog_dst_free (d);
             wdog->n_dst--;
             if (i < wdog->n_dst) {
                 // not the last in the list, copy the last one over this
                 *d = wdog->dst[wdog->n_dst];
+
+                int k;
+                for (k = 0; chg && k < chg->n; k++) {
+                    if (chg->idx[k] == wdog->n_dst) chg->idx[k] = i;
+                }
             }
             continue;
         }
@@ -529,6 +704,8 @@ wdog_collect_results (glb_wdog_t* const wdog)
             results++;
             new_weight = wdog_result_weight (d, max_lat,
                                              wdog->cnf->lat_factor > 0);
+            if (GLB_DST_READY == d->result.state)
+                new_max_conns = d->result.max_conns;
 
             if (wdog->cnf->discover && memb_source < 0 &&
                 GLB_DST_READY == d->result.state && d->result.others)
@@ -540,6 +717,12 @@ wdog_collect_results (glb_wdog_t* const wdog)
                 memb_source = i;
             }
         }
+        else if (wdog->sched &&
+                 glb_time_now() - d->result.timestamp <
+                 glb_sched_result_ttl (d->ctx)) {
+            // next result is not due yet
+            new_weight = d->weight;
+        }
         else {
             // have not heard from the backend thread, put dest on hold
             if (d->weight >= 0.0) {
@@ -556,25 +739,40 @@ wdog_collect_results (glb_wdog_t* const wdog)
 
         static double const WEIGHT_TOLERANCE = 0.1; // 10%
 
-        if (new_weight != d->weight &&
-            (new_weight <= 0.0 ||
-             fabs(d->weight/new_weight - 1.0) > WEIGHT_TOLERANCE)) {
+        if ((new_weight != d->weight &&
+             (new_weight <= 0.0 ||
+              fabs(d->weight/new_weight - 1.0) > WEIGHT_TOLERANCE)) ||
+            new_max_conns != d->max_conns) {
             glb_dst_t dst = d->dst;
-            dst.weight = new_weight;
-            int ret = glb_router_change_dst (wdog->router, &dst, d->ctx);
+            dst.weight    = new_weight;
+            dst.max_conns = new_max_conns;
+
+            if (chg) {
+                chg->dst[chg->n] = dst;
+                chg->ctx[chg->n] = d->ctx;
+                chg->idx[chg->n] = i;
+                chg->n++;
+            }
+            else {
+                int const ret = glb_router_change_dst (wdog->router, &dst,
+                                                       d->ctx);
+                wdog_weight_changed (wdog, d, &dst, ret);
+            }
+        }
+    }
 
-            glb_log_debug ("Changing weight for '%s:%hu': %6.3f -> %6.3f:  "
-                           "%d (%s)",
-                           d->ctx->host, d->ctx->port, d->weight, new_weight,
-                           ret, strerror (ret > 0 ? 0 : -ret));
+    if (chg && chg->n > 0) {
+        // whole cluster may change at once, apply it in one go
+        glb_router_change_dsts (wdog->router, chg->n, chg->dst, chg->ctx,
+                                chg->res);
 
-            if (ret >= 0) {
-                if (new_weight < 0.0 && wdog->pool) { // clean up the pool!
-                    glb_pool_drop_dst (wdog->pool, &d->dst.addr);
-                }
-                d->weight = new_weight;
-            }
+        int k;
+        for (k = 0; k < chg->n; k++) {
+            wdog_weight_changed (wdog, &wdog->dst[chg->idx[k]],
+                                 &chg->dst[k], chg->res[k]);
         }
+
+        chg->n = 0;
     }
 
     if (old_n_dst != wdog->n_dst) {
@@ -639,6 +837,12 @@ wdog_main_loop (void* arg)
         do {
             err = pthread_cond_timedwait (&wdog->cond, &wdog->lock,
                                           &wdog->next);
+
+            if (wdog->pushed && !wdog->quit) {
+                // collect pushed results now, regular pass stays on schedule
+                wdog->pushed = false;
+                wdog_collect_results (wdog);
+            }
         } while (err != ETIMEDOUT && !wdog->quit);
 
         if (wdog->quit) break;
@@ -651,6 +855,18 @@ wdog_main_loop (void* arg)
     return NULL;
 }
 
+// called by backend when it has published results on its own
+static void
+wdog_notify (void* const arg)
+{
+    glb_wdog_t* const wdog = arg;
+
+    GLB_MUTEX_LOCK (&wdog->lock);
+    wdog->pushed = true;
+    pthread_cond_signal (&wdog->cond);
+    GLB_MUTEX_UNLOCK (&wdog->lock);
+}
+
 static void
 wdog_dst_cleanup (glb_wdog_t* wdog)
 {
@@ -668,15 +884,23 @@ wdog_dst_cleanup (glb_wdog_t* wdog)
         {
             d->ctx->quit = true;
             pthread_cond_signal (&d->ctx->cond);
+            glb_sched_kick (d->ctx);
         }
         GLB_MUTEX_UNLOCK (&d->ctx->lock);
     }
 
+    bool const threads = !wdog->sched;
+
+    if (wdog->sched) { // closes all probes
+        glb_sched_destroy (wdog->sched);
+        wdog->sched = NULL;
+    }
+
     // join the threads and free contexts
     for (i = 0; i < wdog->n_dst; i++)
     {
         wdog_dst_t* d = &wdog->dst[i];
-        pthread_join (d->ctx->id, NULL);
+        if (threads) pthread_join (d->ctx->id, NULL);
         if (d->weight >= 0.0) glb_pool_drop_dst (wdog->pool, &d->dst.addr);
         wdog_dst_free (d);
     }
@@ -701,10 +925,22 @@ glb_wdog_create (const glb_cnf_t* cnf, glb_router_t* router, glb_pool_t* pool)
             return NULL;
         }
 
-        assert (ret->backend.thread);
+        ret->backend.notify     = wdog_notify;
+        ret->backend.notify_arg = ret;
+
+        assert (ret->backend.thread || ret->backend.step);
         assert (ret->backend.ctx || !ret->backend.destroy);
         assert (ret->backend.destroy || !ret->backend.ctx);
 
+        if (!ret->backend.thread) {
+            ret->sched = glb_sched_create (&ret->backend, WDOG_SCHED_THREADS);
+            if (!ret->sched) {
+                if (ret->backend.destroy) ret->backend.destroy(ret->backend.ctx);
+                free (ret);
+                return NULL;
+            }
+        }
+
         ret->cnf    = cnf;
         ret->router = router;
         ret->pool   = pool;
@@ -713,8 +949,11 @@ glb_wdog_create (const glb_cnf_t* cnf, glb_router_t* router, glb_pool_t* pool)
         pthread_cond_init  (&ret->cond, NULL);
 
         /* making this slightly bigger than backend polling interval
-         * to make sure that there is always a ready result for us to collect */
-        ret->interval = cnf->interval * 1.1;
+         * to make sure that there is always a ready result for us to collect.
+         * With adaptive intervals results are collected at the shortest one
+         * and then may be not ready, see wdog_collect_results() */
+        ret->interval = (cnf->interval_min ? cnf->interval_min :
+                                             cnf->interval) * 1.1;
 
         int i;
         for (i = 0; i < cnf->n_dst; i++) {
@@ -750,7 +989,8 @@ glb_wdog_destroy(glb_wdog_t* wdog)
     wdog_dst_cleanup (wdog);
     pthread_cond_destroy  (&wdog->cond);
     pthread_mutex_destroy (&wdog->lock);
-    wdog->backend.destroy (wdog->backend.ctx);
+    if (wdog->backend.destroy) wdog->backend.destroy (wdog->backend.ctx);
+    wdog_changes_free (&wdog->chg);
     free (wdog->dst);
     free (wdog);
 }
@@ -771,9 +1011,9 @@ glb_wdog_print_info (glb_wdog_t* wdog, char* buf, size_t buf_len)
                "------------------------------------------------------------\n"
                "        Address       : exp  setw     state    lat     curw\n");
 
-    if (len == buf_len) {
-        buf[len - 1] = '\0';
-        return (len - 1);
+    if (len >= buf_len) {
+        buf[buf_len - 1] = '\0';
+        return (buf_len - 1);
     }
 
     GLB_MUTEX_LOCK (&wdog->lock);
@@ -793,10 +1033,10 @@ glb_wdog_print_info (glb_wdog_t* wdog, char* buf, size_t buf_len)
                          d->weight
             );
 
-        if (len == buf_len) {
-            buf[len - 1] = '\0';
+        if (len >= buf_len) {
+            buf[buf_len - 1] = '\0';
             GLB_MUTEX_UNLOCK (&wdog->lock);
-            return (len - 1);
+            return (buf_len - 1);
         }
     }
 
@@ -808,9 +1048,9 @@ glb_wdog_print_info (glb_wdog_t* wdog, char* buf, size_t buf_len)
                     "------------------------------------------------------------\n"
                     "Destinations: %d\n", n_dst);
 
-    if (len == buf_len) {
-        buf[len - 1] = '\0';
-        return (len - 1);
+    if (len >= buf_len) {
+        buf[buf_len - 1] = '\0';
+        return (buf_len - 1);
     }
 
     return len;
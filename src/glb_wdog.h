@@ -19,6 +19,10 @@ glb_wdog_create (const glb_cnf_t* cnf, glb_router_t* router, glb_pool_t* pool);
 extern int
 glb_wdog_change_dst (glb_wdog_t* wdog, const glb_dst_t* dst);
 
+/*! Applies changed check interval settings of the configuration */
+extern void
+glb_wdog_reconfig (glb_wdog_t* wdog);
+
 extern void
 glb_wdog_destroy (glb_wdog_t* wdog);
 
@@ -0,0 +1,642 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * This is backend that does not poll destinations. Instead agents running
+ * next to destinations keep connections to a listening socket and push
+ * destination state the moment it changes, one line per update:
+ *
+ *     <host:port> <state> [others] [key=value ...]
+ *
+ * where the part after the address is the same as exec backend answer.
+ * Updates are published to watchdog right away. Scheduler still steps every
+ * destination at check interval, which repeats the last pushed state
+ * (no traffic is involved) or reports destination not found if its agent
+ * has been silent for longer than timeout or has disconnected.
+ *
+ * There is no authentication, so updates are only accepted from the
+ * destination itself: agent must connect from destination host address
+ * (any local agent for UNIX socket destinations). Listening address is
+ * loopback by default.
+ *
+ * $Id$
+ */
+
+#include "glb_wdog_agent.h"
+#include "glb_socket.h"
+#include "glb_cnf.h"  // glb_parse_addr()
+#include "glb_misc.h"
+#include "glb_log.h"
+
+#include <stdlib.h>   // calloc()/free()/realloc()
+#include <string.h>   // strerror()/strdup()
+#include <errno.h>
+#include <ctype.h>    // isspace()
+#include <unistd.h>   // close()/read()/pipe()
+#include <fcntl.h>    // FD_CLOEXEC
+#include <poll.h>     // poll()
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h> // ntohl()
+
+#define AGENT_DEFAULT_TIMEOUT 3.0   // seconds
+#define AGENT_BUF_SIZE        4096  // longest update line
+#define AGENT_LISTEN_BACKLOG  16
+
+static const char agent_addr_default[] = "127.0.0.1";
+
+typedef struct agent_conn
+{
+    glb_sockaddr_t peer;
+    int    sock;
+    size_t len;
+    char   buf[AGENT_BUF_SIZE];
+} agent_conn_t;
+
+typedef struct agent_probe
+{
+    glb_backend_thread_ctx_t* ctx;
+    glb_sockaddr_t   addr;
+    glb_wdog_check_t last;     // last pushed update, others in last_buf
+    char*            last_buf;
+    size_t           last_size;
+    glb_time_t       updated;  // when last update was received, 0 - never
+    int              conn;     // socket that update came over, -1 - none
+    bool             silent;   // silence was logged
+    char*            step_buf; // others returned from step(), scheduler's
+    size_t           step_size;
+    char*            pub_buf;  // others published by agent thread,
+    size_t           pub_size; // protected by ctx->lock
+} agent_probe_t;
+
+struct glb_backend_ctx
+{
+    const glb_backend_t* backend;  // for notify()
+    glb_sockaddr_t       addr;
+    glb_time_t           timeout;
+    int                  sock;     // listening socket
+    int                  wake[2];  // pipe to stop the thread
+    pthread_t            thd;
+    bool                 started;
+    pthread_mutex_t      lock;     // protects probes list and their updates
+    agent_probe_t**      probes;
+    int                  n_probes;
+    agent_conn_t**       conns;    // accessed only by agent thread
+    int                  n_conns;
+};
+
+/* copies string to a buffer growing it if needed, @return buffer or NULL */
+static char*
+agent_copy_str (char** const buf, size_t* const size, const char* const str)
+{
+    size_t const len = strlen (str) + 1;
+
+    if (len > *size) {
+        char* const tmp = realloc (*buf, len);
+        if (!tmp) return NULL;
+        *buf  = tmp;
+        *size = len;
+    }
+
+    memcpy (*buf, str, len);
+    return *buf;
+}
+
+/* result that destination state amounts to by the time now,
+ * others point to p->last_buf. Must be called with backend lock held. */
+static void
+agent_result (glb_backend_ctx_t* const b, agent_probe_t* const p,
+              glb_time_t const now, glb_wdog_check_t* const res)
+{
+    glb_backend_thread_ctx_t* const ctx = p->ctx;
+
+    if (p->conn >= 0 && now - p->updated <= b->timeout) {
+        *res = p->last;
+        if (p->silent) {
+            glb_log_info ("Agent for '%s:%hu' is back.", ctx->host, ctx->port);
+            p->silent = false;
+        }
+    }
+    else {
+        memset (res, 0, sizeof(*res));
+        res->state = GLB_DST_NOTFOUND;
+        res->ready = true;
+        if (!p->silent) {
+            if (p->updated) {
+                glb_log_warn ("Agent for '%s:%hu' %s.", ctx->host, ctx->port,
+                              p->conn >= 0 ? "timed out" : "disconnected");
+            }
+            else {
+                glb_log_info ("No agent for '%s:%hu' yet.",
+                              ctx->host, ctx->port);
+            }
+            p->silent = true;
+        }
+    }
+}
+
+/* makes result visible to watchdog without waiting for the next step.
+ * Must be called with backend lock held. */
+static void
+agent_publish (glb_backend_ctx_t* const b, agent_probe_t* const p,
+               glb_time_t const start)
+{
+    glb_backend_thread_ctx_t* const ctx = p->ctx;
+    glb_time_t const now = glb_time_now();
+    glb_wdog_check_t res;
+
+    agent_result (b, p, now, &res);
+
+    res.timestamp = now;
+    res.latency   = glb_time_seconds (glb_time_mono() - start);
+
+    GLB_MUTEX_LOCK (&ctx->lock);
+
+    if (res.others) {
+        res.others = agent_copy_str (&p->pub_buf, &p->pub_size, res.others);
+        res.others_len = res.others ? p->pub_size : 0;
+    }
+
+    ctx->result = res;
+    glb_backend_set_checked (ctx, &res);
+
+    GLB_MUTEX_UNLOCK (&ctx->lock);
+}
+
+static agent_probe_t*
+agent_find_probe (glb_backend_ctx_t* const b, const glb_sockaddr_t* const addr)
+{
+    int i;
+
+    for (i = 0; i < b->n_probes; i++) {
+        if (glb_sockaddr_is_equal (&b->probes[i]->addr, addr))
+            return b->probes[i];
+    }
+
+    return NULL;
+}
+
+/* @return true if agent connection c may update destination p:
+ * it must come from destination address. Access to UNIX socket is
+ * controlled by file permissions, destination on UNIX socket is local. */
+static bool
+agent_peer_allowed (const agent_conn_t* const c, const agent_probe_t* const p)
+{
+    if (glb_sockaddr_is_unix (&c->peer)) return true;
+
+    if (glb_sockaddr_is_unix (&p->addr)) // any loopback address
+        return (127 == (ntohl (c->peer.in.sin_addr.s_addr) >> 24));
+
+    return (c->peer.in.sin_addr.s_addr == p->addr.in.sin_addr.s_addr);
+}
+
+/* handles single update line, @return true if it was published */
+static bool
+agent_update (glb_backend_ctx_t* const b, agent_conn_t* const c,
+              char* const line, glb_time_t const start)
+{
+    char* rest = line;
+    while (*rest && !isspace (*rest)) rest++;
+    if (*rest) *rest++ = '\0';
+
+    glb_sockaddr_t addr;
+    glb_wdog_check_t res;
+
+    memset (&res, 0, sizeof(res));
+
+    if (glb_parse_addr (&addr, line, "127.0.0.1")) {
+        glb_log_error ("Bad destination address in agent update: '%s'", line);
+        return false;
+    }
+
+    if (glb_backend_parse_result (rest, &res)) return false;
+
+    bool ret = false;
+
+    GLB_MUTEX_LOCK (&b->lock);
+
+    agent_probe_t* const p = agent_find_probe (b, &addr);
+
+    if (p && !agent_peer_allowed (c, p)) {
+        glb_sockaddr_str_t const peer = glb_sockaddr_get_host (&c->peer);
+        glb_log_warn ("Rejected agent update for '%s' from %s: agents may "
+                      "only update their own destinations.", line, peer.str);
+    }
+    else if (p) {
+        if (res.others) {
+            res.others = agent_copy_str (&p->last_buf, &p->last_size,
+                                         res.others);
+            res.others_len = res.others ? p->last_size : 0;
+        }
+
+        p->last    = res;
+        p->updated = glb_time_now();
+        p->conn    = c->sock;
+
+        agent_publish (b, p, start);
+        ret = true;
+    }
+    else {
+        glb_log_debug ("Agent update for unknown destination '%s'", line);
+    }
+
+    GLB_MUTEX_UNLOCK (&b->lock);
+
+    return ret;
+}
+
+/* reads and handles available updates, @return negative errno if connection
+ * must be closed, otherwise number of published updates */
+static int
+agent_read (glb_backend_ctx_t* const b, agent_conn_t* const c)
+{
+    glb_time_t const start = glb_time_mono();
+
+    ssize_t const ret = read (c->sock, c->buf + c->len,
+                              sizeof(c->buf) - 1 - c->len);
+
+    if (ret <= 0) return (ret < 0 ? -errno : -ECONNRESET);
+
+    c->len += ret;
+    c->buf[c->len] = '\0';
+
+    int   published = 0;
+    char* line = c->buf;
+    char* nl;
+
+    while ((nl = strchr (line, '\n'))) {
+        *nl = '\0';
+        if (nl > line && agent_update (b, c, line, start)) published++;
+        line = nl + 1;
+    }
+
+    c->len -= line - c->buf;
+    memmove (c->buf, line, c->len);
+
+    if (c->len >= sizeof(c->buf) - 1) {
+        glb_log_error ("Agent update too long: '%.64s...'", c->buf);
+        return -EMSGSIZE;
+    }
+
+    return published;
+}
+
+static void
+agent_accept (glb_backend_ctx_t* const b)
+{
+    glb_sockaddr_t peer;
+    socklen_t      peer_len = sizeof(peer);
+
+    memset (&peer, 0, sizeof(peer));
+
+    int const sock = accept (b->sock, &peer.sa, &peer_len);
+
+    if (sock < 0) {
+        glb_log_warn ("Failed to accept agent connection: %d (%s)",
+                      errno, strerror (errno));
+        return;
+    }
+
+    agent_conn_t*  const c   = calloc (1, sizeof(*c));
+    agent_conn_t** const tmp = c ? realloc (b->conns,
+                                            (b->n_conns + 1) * sizeof(c))
+                                 : NULL;
+    if (!tmp) {
+        glb_log_error ("Failed to allocate agent connection.");
+        free (c);
+        close (sock);
+        return;
+    }
+
+    glb_fd_setfd (sock, FD_CLOEXEC, true);
+
+    c->peer = peer;
+    c->sock = sock;
+    b->conns = tmp;
+    b->conns[b->n_conns++] = c;
+}
+
+/* closes connection, destinations last updated over it are failed at once,
+ * @return number of published updates */
+static int
+agent_disconnect (glb_backend_ctx_t* const b, int const idx, int const err)
+{
+    agent_conn_t* const c = b->conns[idx];
+    glb_time_t const start = glb_time_mono();
+    int published = 0;
+    int i;
+
+    glb_log_debug ("Agent connection closed: %d (%s)", -err, strerror(-err));
+
+    GLB_MUTEX_LOCK (&b->lock);
+
+    for (i = 0; i < b->n_probes; i++) {
+        agent_probe_t* const p = b->probes[i];
+        if (p->conn == c->sock) {
+            p->conn = -1;
+            agent_publish (b, p, start);
+            published++;
+        }
+    }
+
+    GLB_MUTEX_UNLOCK (&b->lock);
+
+    close (c->sock);
+    free (c);
+    b->conns[idx] = b->conns[--b->n_conns];
+
+    return published;
+}
+
+static void*
+agent_thread (void* arg)
+{
+    glb_backend_ctx_t* const b = arg;
+    struct pollfd* fds = NULL;
+    int n_fds = 0;
+
+    while (true) {
+        int const n = b->n_conns + 2;
+
+        if (n > n_fds) {
+            struct pollfd* const tmp = realloc (fds, n * sizeof(*fds));
+            if (!tmp) {
+                glb_log_error ("Failed to allocate agent poll set.");
+                usleep (100000);
+                continue;
+            }
+            fds   = tmp;
+            n_fds = n;
+        }
+
+        int i;
+        fds[0].fd = b->wake[0]; fds[0].events = POLLIN;
+        fds[1].fd = b->sock;    fds[1].events = POLLIN;
+        for (i = 0; i < b->n_conns; i++) {
+            fds[i + 2].fd     = b->conns[i]->sock;
+            fds[i + 2].events = POLLIN;
+        }
+
+        if (poll (fds, n, -1) < 0) {
+            if (EINTR == errno) continue;
+            glb_log_error ("Agent poll failed: %d (%s)",errno,strerror(errno));
+            usleep (100000);
+            continue;
+        }
+
+        if (fds[0].revents) break;
+
+        int published = 0;
+
+        // in reverse order, as disconnect moves the last connection over
+        for (i = b->n_conns - 1; i >= 0; i--) {
+            if (!fds[i + 2].revents) continue;
+
+            int const ret = agent_read (b, b->conns[i]);
+
+            if (ret >= 0)
+                published += ret;
+            else
+                published += agent_disconnect (b, i, ret);
+        }
+
+        if (fds[1].revents) agent_accept (b);
+
+        if (published > 0 && b->backend->notify)
+            b->backend->notify (b->backend->notify_arg);
+    }
+
+    while (b->n_conns > 0) agent_disconnect (b, b->n_conns - 1, 0);
+
+    free (fds);
+    return NULL;
+}
+
+static int
+agent_step (glb_backend_thread_ctx_t* const ctx,
+            int*                      const fd,
+            bool                      const timeout,
+            glb_wdog_check_t*         const res)
+{
+    agent_probe_t*     const p = ctx->probe;
+    glb_backend_ctx_t* const b = ctx->backend;
+
+    (void)fd; (void)timeout; // never waits for anything
+
+    GLB_MUTEX_LOCK (&b->lock);
+
+    agent_result (b, p, glb_time_now(), res);
+
+    if (res->others) {
+        res->others = agent_copy_str (&p->step_buf, &p->step_size,
+                                      res->others);
+        res->others_len = res->others ? p->step_size : 0;
+    }
+
+    GLB_MUTEX_UNLOCK (&b->lock);
+
+    return 0;
+}
+
+static int
+agent_open (glb_backend_thread_ctx_t* const ctx)
+{
+    glb_backend_ctx_t* const b = ctx->backend;
+    agent_probe_t*     const p = calloc (1, sizeof(*p));
+
+    if (!p) return -ENOMEM;
+
+    long const err = glb_sockaddr_init (&p->addr, ctx->host, ctx->port);
+
+    if (err) {
+        free (p);
+        return err;
+    }
+
+    p->ctx  = ctx;
+    p->conn = -1;
+
+    GLB_MUTEX_LOCK (&b->lock);
+
+    agent_probe_t** const tmp = realloc (b->probes,
+                                         (b->n_probes + 1) * sizeof(p));
+    if (tmp) {
+        b->probes = tmp;
+        b->probes[b->n_probes++] = p;
+    }
+
+    GLB_MUTEX_UNLOCK (&b->lock);
+
+    if (!tmp) {
+        free (p);
+        return -ENOMEM;
+    }
+
+    ctx->probe = p;
+
+    return 0;
+}
+
+static void
+agent_close (glb_backend_thread_ctx_t* const ctx)
+{
+    agent_probe_t*     const p = ctx->probe;
+    glb_backend_ctx_t* const b = ctx->backend;
+    int i;
+
+    GLB_MUTEX_LOCK (&b->lock);
+
+    for (i = 0; i < b->n_probes; i++) {
+        if (b->probes[i] == p) {
+            b->probes[i] = b->probes[--b->n_probes];
+            break;
+        }
+    }
+
+    GLB_MUTEX_UNLOCK (&b->lock);
+
+    // published result must not point to the buffer any more
+    GLB_MUTEX_LOCK (&ctx->lock);
+    if (ctx->result.others == p->pub_buf) {
+        ctx->result.others     = NULL;
+        ctx->result.others_len = 0;
+    }
+    GLB_MUTEX_UNLOCK (&ctx->lock);
+
+    free (p->last_buf);
+    free (p->step_buf);
+    free (p->pub_buf);
+    free (p);
+}
+
+static void
+agent_destroy (glb_backend_ctx_t* const b)
+{
+    if (b->started) {
+        char const c = 0;
+        if (write (b->wake[1], &c, 1) < 0) { /* pipe is full, so awake */ }
+        pthread_join (b->thd, NULL);
+    }
+
+    if (b->wake[0] >= 0) close (b->wake[0]);
+    if (b->wake[1] >= 0) close (b->wake[1]);
+    if (b->sock >= 0)    close (b->sock);
+
+    pthread_mutex_destroy (&b->lock);
+    free (b->probes);
+    free (b->conns);
+    free (b);
+}
+
+/* spec: [-t timeout] [addr:]port */
+static int
+agent_parse_spec (glb_backend_ctx_t* const b, char* const spec)
+{
+    const char** tok;
+    int          tok_num;
+
+    if (glb_parse_token_string (spec, &tok, &tok_num, '\0')) return -ENOMEM;
+
+    const char* addr = NULL;
+    int ret = 0;
+    int i;
+
+    for (i = 0; i < tok_num && !ret; i++)
+    {
+        if (!strncmp (tok[i], "-t", 2)) {
+            const char* const val = tok[i][2] ? tok[i] + 2 :
+                (i + 1 < tok_num ? tok[++i] : NULL);
+            char* endptr;
+            double const t = val ? strtod (val, &endptr) : 0.0;
+
+            if (!val || *endptr || t <= 0.0) {
+                glb_log_error ("Invalid agent timeout: '%s'", val ? val : "");
+                ret = -EINVAL;
+            }
+            else {
+                b->timeout = glb_time_from_double (t);
+            }
+        }
+        else if (!addr) {
+            addr = tok[i];
+        }
+        else {
+            glb_log_error ("Unsupported 'agent' backend option: '%s'", tok[i]);
+            ret = -EINVAL;
+        }
+    }
+
+    if (!ret && !addr) {
+        glb_log_error ("'agent' backend needs address to listen at.");
+        ret = -EINVAL;
+    }
+
+    if (!ret) ret = glb_parse_addr (&b->addr, addr, agent_addr_default);
+
+    free (tok);
+
+    return ret;
+}
+
+static int
+agent_init (glb_backend_t* const backend, const char* spec)
+{
+    glb_backend_ctx_t* const b = calloc (1, sizeof(*b));
+
+    if (!b) return -ENOMEM;
+
+    b->backend = backend;
+    b->timeout = glb_time_from_double (AGENT_DEFAULT_TIMEOUT);
+    b->sock    = b->wake[0] = b->wake[1] = -1;
+    pthread_mutex_init (&b->lock, NULL);
+
+    int err = 0;
+
+    while (spec && isspace (*spec)) spec++; // tokenizer expects no leading
+
+    char* const tmp = strdup (spec ? spec : "");
+
+    if (tmp) {
+        err = agent_parse_spec (b, tmp);
+        free (tmp);
+    }
+    else {
+        err = -ENOMEM;
+    }
+
+    if (!err) {
+        b->sock = glb_socket_create (&b->addr, 0);
+        if (b->sock < 0) err = b->sock;
+    }
+
+    if (!err && listen (b->sock, AGENT_LISTEN_BACKLOG)) {
+        err = -errno;
+        glb_log_error ("Agent listen() failed: %d (%s)", -err, strerror(-err));
+    }
+
+    if (!err && pipe (b->wake)) err = -errno;
+
+    if (!err) {
+        glb_fd_setfd (b->wake[0], FD_CLOEXEC, true);
+        glb_fd_setfd (b->wake[1], FD_CLOEXEC, true);
+        err = -pthread_create (&b->thd, NULL, agent_thread, b);
+        b->started = !err;
+    }
+
+    if (err) {
+        agent_destroy (b);
+        return err;
+    }
+
+    glb_sockaddr_str_t const a = glb_sockaddr_to_str (&b->addr);
+    glb_log_info ("Listening for agents at %s", a.str);
+
+    backend->ctx     = b;
+    backend->destroy = agent_destroy;
+    backend->open    = agent_open;
+    backend->step    = agent_step;
+    backend->close   = agent_close;
+
+    return 0;
+}
+
+glb_backend_init_t glb_backend_agent_init = agent_init;
@@ -0,0 +1,14 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * $Id$
+ */
+
+#ifndef _glb_wdog_agent_h_
+#define _glb_wdog_agent_h_
+
+#include "glb_wdog_backend.h"
+
+extern glb_backend_init_t glb_backend_agent_init;
+
+#endif // _glb_wdog_agent_h_
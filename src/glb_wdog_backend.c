@@ -8,6 +8,10 @@
  */
 
 #include "glb_wdog_backend.h"
+#include "glb_wdog_sched.h"
+#include "glb_socket.h"
+#include "glb_misc.h" // glb_fd_setfl()
+#include "glb_log.h"
 
 const char* glb_dst_state_str[] =
 {
@@ -17,6 +21,7 @@ const char* glb_dst_state_str[] =
 #include <stdlib.h>   // calloc()/free()/abort()
 #include <string.h>   // strdup()
 #include <errno.h>    // ENOMEM
+#include <ctype.h>    // isspace()
 #include <sys/time.h> // gettimeofday()
 
 void
@@ -33,6 +38,7 @@ glb_backend_probe (glb_backend_thread_ctx_t* const ctx,
     {
         ctx->waiting++;
         pthread_cond_signal (&ctx->cond);
+        glb_sched_kick (ctx); // event-driven backend has no thread to signal
         if (!pthread_cond_timedwait (&ctx->cond, &ctx->lock, until))
             *res = ctx->result;
     }
@@ -40,6 +46,151 @@ glb_backend_probe (glb_backend_thread_ctx_t* const ctx,
     if (pthread_mutex_unlock (&ctx->lock)) abort();
 }
 
+void
+glb_backend_probe_async (glb_backend_thread_ctx_t* const ctx)
+{
+    if (pthread_mutex_lock (&ctx->lock)) abort();
+
+    if (!ctx->quit && !ctx->join)
+    {
+        ctx->waiting++;
+        pthread_cond_signal (&ctx->cond);
+        glb_sched_kick (ctx);
+    }
+
+    if (pthread_mutex_unlock (&ctx->lock)) abort();
+}
+
+int
+glb_backend_connect (const glb_sockaddr_t* const addr, int* const sock)
+{
+    *sock = socket (addr->sa.sa_family, SOCK_STREAM, 0);
+    if (*sock < 0) return -errno;
+
+    int err;
+    if ((err = glb_fd_setfd (*sock, FD_CLOEXEC, true)) ||
+        (err = glb_fd_setfl (*sock, O_NONBLOCK, true))) return err;
+
+    if (!connect (*sock, &addr->sa, glb_sockaddr_len (addr)))
+        return GLB_BACKEND_READ;
+
+    return (EINPROGRESS == errno ? GLB_BACKEND_WRITE : -errno);
+}
+
+int
+glb_backend_connected (int const sock)
+{
+    int       err = 0;
+    socklen_t err_len = sizeof(err);
+
+    if (getsockopt (sock, SOL_SOCKET, SO_ERROR, &err, &err_len)) err = errno;
+
+    return -err;
+}
+
+/* parses value of optional key=value field of the answer, unknown keys are
+ * ignored for forward compatibility. @return 0 or EPROTO */
+static int
+backend_parse_value (const char* const key, const char* const val,
+                     glb_wdog_check_t* const r)
+{
+    char* endptr;
+
+    if (!strcmp (key, "load")) {
+        r->load = strtod (val, &endptr);
+        if (r->load < 0) return EPROTO;
+    }
+    else if (!strcmp (key, "capacity")) {
+        r->capacity = strtod (val, &endptr);
+        if (r->capacity < 0) return EPROTO;
+    }
+    else if (!strcmp (key, "weight")) {
+        r->weight = strtod (val, &endptr);
+        r->weight_set = true;
+    }
+    else if (!strcmp (key, "max_conns")) {
+        r->max_conns = strtol (val, &endptr, 10);
+        if (r->max_conns < 0) return EPROTO;
+    }
+    else {
+        return 0;
+    }
+
+    return (endptr == val || '\0' != *endptr ? EPROTO : 0);
+}
+
+/* field is left intact for error reporting. @return 0 or EPROTO */
+static int
+backend_parse_field (char* const field, glb_wdog_check_t* const r)
+{
+    char* const val = strchr (field, '=');
+
+    *val = '\0';
+    int const ret = backend_parse_value (field, val + 1, r);
+    *val = '=';
+
+    return ret;
+}
+
+int
+glb_backend_parse_result (char* const line, glb_wdog_check_t* const r)
+{
+    char* endptr;
+    long st = strtol (line, &endptr, 10);
+
+    if (('\0' == endptr[0] || isspace(endptr[0])) &&
+        st >= GLB_DST_NOTFOUND && st <= GLB_DST_READY)
+    {
+        r->state = st;
+
+        /* everything but key=value fields is the list of other members,
+         * separated by whitespace or ',' as before the fields were added.
+         * Members are moved together, so that the list does not change
+         * with field values. */
+        char* p = endptr;
+        char* w = NULL; // end of the list gathered so far
+
+        while (true) {
+            while (isspace ((unsigned char)*p)) p++;
+            if ('\0' == *p) break;
+
+            char* const tok = p;
+            while ('\0' != *p && !isspace ((unsigned char)*p)) p++;
+
+            char const sep = *p;
+            *p = '\0';
+
+            if (strchr (tok, '=')) {
+                if (backend_parse_field (tok, r)) {
+                    glb_log_error ("Bad '%s' value in check result", tok);
+                    return -EPROTO;
+                }
+            }
+            else {
+                if (!w) r->others = w = tok;
+                else    *w++ = ' ';
+
+                memmove (w, tok, p - tok);
+                w += p - tok;
+            }
+
+            *p = sep;
+        }
+
+        if (r->others) {
+            *w = '\0';
+            r->others_len = w - r->others;
+        }
+
+        r->ready = true;
+        return 0;
+    }
+
+    glb_log_error ("Failed to parse check result: '%s'", line);
+    return -EPROTO;
+}
+
+
 /*! Sample dummy backend context. */
 struct glb_backend_ctx
 {
@@ -96,7 +247,9 @@ backend_dummy_thread (void* arg)
         ctx->result.latency = 1.0;          // same latency for all destinations
         ctx->result.others  = NULL;         // no auto-discovered destinations
         ctx->result.others_len = 0;
+        ctx->result.timestamp = glb_time_now();
         ctx->result.ready   = true;         // new data ready
+        glb_backend_set_checked (ctx, &ctx->result);
 
         backend_timespec_add (&next, ctx->interval); // next wakeup
 
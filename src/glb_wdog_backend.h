@@ -42,12 +42,20 @@ typedef struct glb_wdog_check
     glb_dst_state_t state;    //! observed state of the destination
     glb_time_t      timestamp;//! result timestamp
     double          latency;  //! communication latency (seconds)
+    double          load;     //! load factor: 0 - idle (or unknown),
+                              //! 1 - at capacity, can be higher
+    double          capacity; //! relative capacity, 0 - not reported
+    double          weight;   //! suggested weight if weight_set
+    long            max_conns;//! connection limit, 0 - not reported
+    bool            weight_set;
     char*           others;   //! other cluster memebers if any in the usual fmt
     size_t          others_len; //! length of others buffer, not actual string
     bool            ready;    //! check ready
 } glb_wdog_check_t;
 
 
+struct glb_sched_item;
+
 /*! This structure is passed to every backend thread as a void* argument.
  *  Access to this structure is protected by lock member. */
 typedef struct glb_backend_thread_ctx
@@ -59,11 +67,18 @@ typedef struct glb_backend_thread_ctx
     char*              host;    //! address of the destination to watch
     uint16_t           port;
     glb_time_t         interval;//! check interval (nanoseconds)
+    glb_time_t         interval_min; //! adaptive check interval bounds
+    glb_time_t         interval_max; //! (event-driven backends)
     glb_wdog_check_t   result;  //! check result
+    glb_time_t         checked; //! timestamp of the last READY result,
+                                //! read by router without lock
     unsigned int       waiting; //! someone is waiting for result
     bool               quit;    //! signal for thread to quit
     bool               join;    //! thread is ready to be joined
     int                errn;    //! errno
+    struct glb_sched_item* sched; //! event-driven backend: scheduler entry
+    void*              probe;   //! event-driven backend: private probe state,
+                                //! accessed only by scheduler thread
 } glb_backend_thread_ctx_t;
 
 
@@ -72,6 +87,26 @@ extern void glb_backend_probe (glb_backend_thread_ctx_t* ctx,
                                glb_wdog_check_t*         res,
                                const struct timespec*    until);
 
+/*! Request on-demand probe without waiting for the result. */
+extern void glb_backend_probe_async (glb_backend_thread_ctx_t* ctx);
+
+/*! Publishes check result timestamp for lockless freshness checks,
+ *  to be called with ctx->lock held when ready result is set. */
+static inline void
+glb_backend_set_checked (glb_backend_thread_ctx_t* const ctx,
+                         const glb_wdog_check_t*   const res)
+{
+    if (GLB_DST_READY == res->state)
+        __atomic_store_n (&ctx->checked, res->timestamp, __ATOMIC_RELAXED);
+}
+
+/*! @return timestamp of the last READY result, can be called without lock */
+static inline glb_time_t
+glb_backend_checked (const glb_backend_thread_ctx_t* const ctx)
+{
+    return __atomic_load_n (&ctx->checked, __ATOMIC_RELAXED);
+}
+
 
 /*! Backend watchdog thread. glb_backend_ctx structure will be passed to it in
  *  the void* argument. It is to poll destination supplied in addr/port at
@@ -82,13 +117,70 @@ extern void glb_backend_probe (glb_backend_thread_ctx_t* ctx,
 typedef void* (*glb_backend_thread_t) (void* arg);
 
 
+/*! Event-driven backends don't have a thread per destination. Instead probes
+ *  are non-blocking state machines run by a few watchdog scheduler threads
+ *  (see glb_wdog_sched.h). Scheduler calls step() to start a probe at the
+ *  check interval, then on every event requested by the previous step() and
+ *  once more with timeout set if the probe takes longer than the interval
+ *  (but at least a second). */
+#define GLB_BACKEND_READ  1 //! wait for descriptor to become readable
+#define GLB_BACKEND_WRITE 2 //! wait for descriptor to become writable
+
+/*! Sets up probe state (ctx->probe) for a new destination.
+ *  Called before the first step(). Return negative errno in case of error. */
+typedef int (*glb_backend_open_t) (glb_backend_thread_ctx_t* ctx);
+
+/*! Runs the probe until it has to wait. *fd is -1 when new probe starts,
+ *  otherwise the descriptor returned by the previous call which got ready.
+ *  Backend owns descriptors, scheduler only watches them while probe is in
+ *  progress. The timestamp and latency of result are filled by scheduler.
+ *  @return GLB_BACKEND_READ/GLB_BACKEND_WRITE to wait for on *fd,
+ *          0 if the probe is finished and res is filled (res->ready false
+ *          means no result, e.g. after timeout), negative errno if the
+ *          destination can't be watched any longer. */
+typedef int (*glb_backend_step_t) (glb_backend_thread_ctx_t* ctx,
+                                   int*                      fd,
+                                   bool                      timeout,
+                                   glb_wdog_check_t*         res);
+
+/*! Releases probe state, aborting probe in progress. */
+typedef void (*glb_backend_close_t) (glb_backend_thread_ctx_t* ctx);
+
+/*! Parses check result in the text format shared by external checkers:
+ *  state, optionally followed by comma-separated list of other members and
+ *  key=value hints in any order. Unknown keys are ignored.
+ *  res->others points into the line.
+ *  @return 0 or -EPROTO */
+extern int glb_backend_parse_result (char* line, glb_wdog_check_t* res);
+
+union glb_sockaddr;
+
+/*! Starts non-blocking connection to the destination for event-driven probe.
+ *  @param sock new socket, to be closed by the caller even on error
+ *  @return GLB_BACKEND_WRITE if connection is in progress, GLB_BACKEND_READ
+ *          if it is established already, negative errno otherwise */
+extern int glb_backend_connect (const union glb_sockaddr* addr, int* sock);
+
+/*! Checks the outcome of connection attempt when socket became writable.
+ *  @return 0 or negative errno */
+extern int glb_backend_connected (int sock);
+
+
 /*! This is a struct that needs to be initialized by backend constructor below.
- *  thd can't be null, ctx and destroy both must be either NULL or not. */
+ *  Either thread or open/step/close must be set, ctx and destroy both must be
+ *  either NULL or not. */
 typedef struct glb_backend
 {
     glb_backend_ctx_t*    ctx;     //! common backend context
-    glb_backend_thread_t  thread;  //! backend loop - can't be NULL
+    glb_backend_thread_t  thread;  //! backend loop - NULL if event-driven
     glb_backend_destroy_t destroy; //! backend cleanup
+    glb_backend_open_t    open;    //! event-driven probe methods
+    glb_backend_step_t    step;
+    glb_backend_close_t   close;
+    void                (*notify) (void* arg); //! set by watchdog after init:
+    void*                 notify_arg;  //! backends that publish results on
+                                       //! their own call it to have them
+                                       //! collected without waiting
 } glb_backend_t;
 
 
@@ -10,6 +10,8 @@
 #include "glb_wdog_exec.h"
 #include "glb_proc.h"
 #include "glb_log.h"
+#include "glb_misc.h"
+#include "glb_time.h"
 #if GLBD
 #include "glb_signal.h"
 #else
@@ -22,17 +24,39 @@ bool const glb_terminate = false;
 #include <sys/time.h> // gettimeofday()
 #include <stddef.h>   // ptrdiff_t
 #include <ctype.h>    // isspace()
+#include <fcntl.h>    // O_NONBLOCK
+#include <unistd.h>   // read()
+#include <sys/wait.h> // waitpid()
+#include <signal.h>   // kill()
+#include <poll.h>     // poll()
+#include <pthread.h>
+
+struct exec_mux;
 
 struct glb_backend_ctx
 {
-    const char* cmd;
-    char* envp[];
+    const char*     cmd;
+    pthread_mutex_t lock;      // protects exiting list and mux
+    pid_t*          exiting;   // closed processes that did not exit yet
+    int             n_exiting;
+    struct exec_mux* mux;      // multiplexed mode helper process
+    char*           envp[];
 };
 
 
 static void
 exec_destroy_ctx (glb_backend_ctx_t* ctx)
 {
+    int i;
+    for (i = 0; i < ctx->n_exiting; i++)
+    {
+        /* had enough time to react to 'quit' */
+        kill (ctx->exiting[i], SIGTERM);
+        waitpid (ctx->exiting[i], NULL, 0);
+    }
+    free (ctx->exiting);
+    pthread_mutex_destroy (&ctx->lock);
+
     free ((void*)ctx->cmd);
 
     char** tmp;
@@ -66,6 +90,7 @@ exec_create_ctx (const char* cmd)
 
     if (!ret) return NULL;
 
+    pthread_mutex_init (&ret->lock, NULL);
     ret->cmd = strdup(cmd);
 
     envp  = environ;
@@ -114,7 +139,7 @@ exec_create_cmd (const glb_backend_thread_ctx_t* ctx)
     size_t const cmd_len  = strlen(cmd);
 
     /* we need to insert host:port as a first argument to command */
-    size_t const ret_len = cmd_len + strlen(ctx->host) + 7;
+    size_t const ret_len = cmd_len + strlen(ctx->host) + 8; // " :65535\0"
     char* ret = malloc (ret_len);
 
     if (ret)
@@ -151,183 +176,705 @@ exec_send_cmd (const char* cmd, FILE* stream)
     return EIO;
 }
 
-static void*
-exec_thread (void* arg)
+#define EXEC_BUF_SIZE 4096
+
+/* Per-destination state: the process is started once and then asked to
+ * "poll" the destination at every check, the answer is read without blocking
+ * by the watchdog scheduler. */
+typedef struct exec_probe
+{
+    pid_t  pid;
+    FILE*  std_in;
+    FILE*  std_out;
+    int    out_fd;   // std_out descriptor, read directly
+    int    skip;     // answers to timed out polls to be skipped
+    size_t len;      // bytes in buf
+    size_t consumed; // bytes of the last answer in buf
+    char*  cmd;
+    char*  pargv[4];
+    char   buf[EXEC_BUF_SIZE];
+    char   line[EXEC_BUF_SIZE]; // last answer
+} exec_probe_t;
+
+static void
+exec_probe_free (exec_probe_t* const p)
+{
+    if (p->std_in)  fclose (p->std_in);
+    if (p->std_out) fclose (p->std_out);
+
+    free (p->pargv[2]); free (p->pargv[1]); free (p->pargv[0]);
+    free (p->cmd);
+    free (p);
+}
+
+static int
+exec_open (glb_backend_thread_ctx_t* const ctx)
 {
-    glb_backend_thread_ctx_t* ctx = arg;
+    exec_probe_t* const p = calloc (1, sizeof(*p));
+
+    if (!p) return -ENOMEM;
+
+    p->pid = -1;
+    p->cmd = exec_create_cmd (ctx);
+    if (!p->cmd) goto enomem;
 
-    char* cmd = NULL;
+    p->pargv[0] = strdup ("sh");
+    p->pargv[1] = strdup ("-c");
+    p->pargv[2] = strdup (p->cmd);
+    if (!p->pargv[0] || !p->pargv[1] || !p->pargv[2]) goto enomem;
 
-    /* read buffer */
-    size_t const res_size = 4096;
-    char*  const res_buf  = malloc (res_size);
-    if (!res_buf) {
-        ctx->errn = ENOMEM;
-        pthread_cond_signal (&ctx->cond);
-        goto init_error;
+    int err = glb_proc_start (&p->pid, p->pargv, ctx->backend->envp,
+                              &p->std_in, &p->std_out, NULL);
+
+    glb_log_debug ("exec probe errno: %d (%s), pid: %lld, cmd: '%s'",
+                   err, strerror(err), (long long)p->pid, p->cmd);
+
+    if (!err) {
+        p->out_fd = fileno (p->std_out);
+        err = -glb_fd_setfl (p->out_fd, O_NONBLOCK, true);
     }
 
-    cmd = exec_create_cmd (ctx);
-    if (!cmd) {
-        ctx->errn = ENOMEM;
-        pthread_cond_signal (&ctx->cond);
-        goto init_error;
+    if (err) {
+        if (p->pid > 0) glb_proc_end (p->pid);
+        exec_probe_free (p);
+        return -err;
     }
 
-    char* pargv[4] = { strdup ("sh"), strdup ("-c"), strdup (cmd), NULL };
+    ctx->probe = p;
+    return 0;
+
+enomem:
+    exec_probe_free (p);
+    return -ENOMEM;
+}
+
+static int
+exec_step (glb_backend_thread_ctx_t* const ctx,
+           int*                      const fd,
+           bool                      const timeout,
+           glb_wdog_check_t*         const res)
+{
+    exec_probe_t* const p = ctx->probe;
 
-    if (!pargv[0] || !pargv[1] || !pargv[2]) {
-        ctx->errn = ENOMEM;
-        goto init_error;
+    if (timeout) {
+        /* the answer may still come, it must not be taken for the next one.
+         * Without result destination is put on hold by watchdog. */
+        p->skip++;
+        glb_log_warn ("Check of '%s:%hu' timed out.", ctx->host, ctx->port);
+        return 0;
     }
 
-    pid_t pid     = -1;
-    FILE* std_in  = NULL;
-    FILE* std_out = NULL;
+    if (*fd < 0) { // new poll
+        int const err = exec_send_cmd ("poll\n", p->std_in);
+        if (err) {
+            glb_log_error ("Failed to send 'poll' cmd to script: %d (%s)",
+                           err, strerror (err));
+            return -err;
+        }
+        *fd = p->out_fd;
+        return GLB_BACKEND_READ;
+    }
 
-    ctx->errn = glb_proc_start (&pid, pargv, ctx->backend->envp,
-                                &std_in, &std_out, NULL);
+    while (true) {
+        /* drop previously returned answer */
+        if (p->consumed > 0) {
+            p->len -= p->consumed;
+            memmove (p->buf, p->buf + p->consumed, p->len);
+            p->consumed = 0;
+        }
 
-init_error:
+        char* const nl = memchr (p->buf, '\n', p->len);
 
-    glb_log_debug ("exec thread: %lld, errno: %d (%s), pid: %lld, cmd: '%s'",
-                   ctx->id, ctx->errn, strerror(ctx->errn),(long long)pid, cmd);
+        if (nl) {
+            p->consumed = nl - p->buf + 1;
 
-    /* this will skip main loop and fall through to cleanup */
-    if (ctx->errn) ctx->quit = true;
+            if (p->skip > 0) { p->skip--; continue; }
 
-    struct timespec next = glb_timespec_now(); /* establish starting point */
+            /* result others point to line till the next step */
+            memcpy (p->line, p->buf, p->consumed);
+            p->line[p->consumed] = '\0'; // newline stays, as with fgets()
 
-    /* failure to lock/unlock the mutex is absolutely fatal */
-    if (pthread_mutex_lock (&ctx->lock)) abort();
+            return glb_backend_parse_result (p->line, res);
+        }
 
-    pthread_cond_signal (&ctx->cond);
+        if (p->len >= sizeof(p->buf) - 1) {
+            p->buf[sizeof(p->buf) - 1] = '\0';
+            glb_log_error ("Failed to parse process output: '%s'", p->buf);
+            return -EPROTO;
+        }
 
-    while (!ctx->quit) /* MAIN LOOP */
-    {
-        if (pthread_mutex_unlock (&ctx->lock)) abort();
+        ssize_t const ret = read (p->out_fd, p->buf + p->len,
+                                  sizeof(p->buf) - 1 - p->len);
 
-        struct glb_wdog_check r = { 0, 0, 0, 0, 0 };
+        if (ret > 0) {
+            p->len += ret;
+        }
+        else if (ret < 0 && (EAGAIN == errno || EINTR == errno)) {
+            return GLB_BACKEND_READ;
+        }
+        else {
+            int const err = ret < 0 ? errno : EPIPE; // EOF
+            if (!glb_terminate) {
+                glb_log_error ("Failed to read process output: %d (%s)",
+                               err, strerror(err));
+            }
+            return -err;
+        }
+    }
+}
 
-        glb_time_t start = glb_time_now();
+/* Reaps exited processes from the exiting list and adds pid there unless
+ * it has exited too. */
+static void
+exec_reap (glb_backend_ctx_t* const b, pid_t const pid)
+{
+    int status;
 
-        assert (std_in);
+    pthread_mutex_lock (&b->lock);
 
-        ctx->errn = exec_send_cmd ("poll\n", std_in);
+    int i = 0;
+    while (i < b->n_exiting)
+    {
+        if (waitpid (b->exiting[i], &status, WNOHANG) != 0)
+        {
+            b->n_exiting--;
+            b->exiting[i] = b->exiting[b->n_exiting];
+        }
+        else i++;
+    }
 
-        if (!ctx->errn)
+    if (waitpid (pid, &status, WNOHANG) == 0)
+    {
+        pid_t* const tmp = realloc (b->exiting,
+                                    (b->n_exiting + 1) * sizeof(pid_t));
+        if (tmp)
+        {
+            b->exiting = tmp;
+            b->exiting[b->n_exiting] = pid;
+            b->n_exiting++;
+        }
+        else
         {
-            assert (std_out);
+            glb_log_error ("Failed to remember process %lld, it may become "
+                           "a zombie.", (long long)pid);
+        }
+    }
 
-            char* ret = fgets (res_buf, res_size, std_out);
+    pthread_mutex_unlock (&b->lock);
+}
 
-            if (ret)
-            {
-                r.timestamp = glb_time_now();
-                r.latency   = glb_time_seconds (r.timestamp - start);
-
-                char* endptr;
-                long st = strtol (res_buf, &endptr, 10);
-                if (('\0' == endptr[0] || isspace(endptr[0])) &&
-                    st >= GLB_DST_NOTFOUND && st <= GLB_DST_READY)
-                {
-                    r.state = st;
-                    if ('\0' != endptr[0]) {
-                        endptr++;
-                        r.others_len = strlen (endptr);
-                        if (r.others_len > 0) r.others = endptr;
-                    }
-                    r.ready = true;
-                }
-                else {
-                    ctx->errn = EPROTO;
-                    res_buf[res_size - 1] = '\0';
-                    glb_log_error ("Failed to parse process output: '%s'",
-                                   res_buf);
-                }
-            }
-            else if (!glb_terminate) {
-                ctx->errn = errno;
-                glb_log_error ("Failed to read process output: %d (%s)",
-                               errno, strerror(errno));
-            }
+static void
+exec_close (glb_backend_thread_ctx_t* const ctx)
+{
+    exec_probe_t* const p = ctx->probe;
+
+    if (p->pid > 0 && !glb_terminate) {
+        int err = exec_send_cmd ("quit\n", p->std_in);
+        if (err) {
+            glb_log_error ("Failed to send 'quit' to the process");
         }
-        else {
-            glb_log_error ("Failed to send 'poll' cmd to script: %d (%s)",
-                           ctx->errn, strerror (ctx->errn));
+
+        /* EOF on stdin for scripts that don't understand 'quit' */
+        fclose (p->std_in);
+        p->std_in = NULL;
+
+        /* scheduler thread serves other destinations, so don't wait for
+         * the process here: if it is still busy, it is reaped later */
+        exec_reap (ctx->backend, p->pid);
+    }
+
+    exec_probe_free (p);
+}
+
+static int
+exec_init (glb_backend_t* backend, const char* spec)
+{
+    if (!spec || strlen(spec) == 0) {
+        glb_log_error ("'exec' backend requires non-empty command line.");
+        return -EINVAL;
+    }
+
+    glb_backend_ctx_t* ctx = exec_create_ctx (spec);
+
+    if (!ctx) return -ENOMEM;
+
+    backend->ctx     = ctx;
+    backend->destroy = exec_destroy_ctx;
+    backend->open    = exec_open;
+    backend->step    = exec_step;
+    backend->close   = exec_close;
+
+    return 0;
+}
+
+glb_backend_init_t glb_backend_exec_init = exec_init;
+
+/*
+ * Multiplexed mode: a single long-lived helper process serves all
+ * destinations, so it can run checks concurrently and share connections.
+ *
+ * to helper:   "poll <tag> <host:port>\n" - check destination,
+ *              "close <host:port>\n"      - destination is no longer watched,
+ *              "quit\n"                   - followed by EOF on stdin.
+ * from helper: "<tag> <answer>\n"         - answer is the same as in exec
+ *                                           mode, in any order.
+ *
+ * Helper output is read by a dedicated thread which hands answers over to
+ * probes through their wake pipes, so scheduler threads never block on it.
+ * If helper dies, it is restarted on the next poll, but at most once in
+ * EXEC_MUX_RESTART.
+ */
+
+#define EXEC_MUX_RESTART 1000000000LL // 1 sec
+
+typedef struct exec_mux_probe
+{
+    int          wake[2]; // reader signals answer through it
+    int          slot;    // index in mux probes array, first part of the tag
+    unsigned int seq;     // number of the last poll, second part of the tag
+    bool         pending; // poll was sent
+    bool         done;    // answer is in line or helper has failed
+    int          error;   // helper failure, no answer
+    char*        addr;    // host:port
+    char         line[EXEC_BUF_SIZE]; // answer
+} exec_mux_probe_t;
+
+typedef struct exec_mux
+{
+    pid_t              pid;      // helper process
+    FILE*              std_in;
+    FILE*              std_out;
+    int                in_fd;    // std_in descriptor, written directly
+    int                stop[2];  // pipe to stop reader thread
+    pthread_t          reader;
+    bool               reading;  // reader thread is started
+    bool               failed;   // helper output is closed
+    int                error;    // last logged error, to log it only once
+    glb_time_t         started;  // helper start time
+    char*              pargv[4];
+    exec_mux_probe_t** probes;   // indexed by slot
+    int                n_probes;
+} exec_mux_t;
+
+// stops reader thread and closes helper streams
+static void
+exec_mux_cleanup (exec_mux_t* const m)
+{
+    if (m->reading) {
+        char const c = 0;
+        if (write (m->stop[1], &c, 1) < 0) { /* reader exits anyway */ }
+        pthread_join (m->reader, NULL);
+        m->reading = false;
+    }
+
+    if (m->stop[0] >= 0) close (m->stop[0]);
+    if (m->stop[1] >= 0) close (m->stop[1]);
+    m->stop[0] = m->stop[1] = -1;
+
+    if (m->std_in)  fclose (m->std_in);
+    if (m->std_out) fclose (m->std_out);
+    m->std_in = m->std_out = NULL;
+    m->in_fd  = -1;
+}
+
+// hands answer line over to the probe it is tagged for
+static void
+exec_mux_answer (glb_backend_ctx_t* const b, char* const line)
+{
+    exec_mux_t* const m = b->mux;
+    char* endptr;
+
+    unsigned long const slot = strtoul (line, &endptr, 10);
+    if ('.' != endptr[0]) goto error;
+
+    unsigned long const seq = strtoul (endptr + 1, &endptr, 10);
+    if (!isspace (endptr[0])) goto error;
+
+    const char* const answer = endptr + 1; // newline stays, as with fgets()
+
+    pthread_mutex_lock (&b->lock);
+
+    exec_mux_probe_t* const p = slot < (unsigned long)m->n_probes ?
+                                m->probes[slot] : NULL;
+
+    if (p && p->pending && !p->done && p->seq == seq) {
+        snprintf (p->line, sizeof(p->line), "%s", answer);
+        p->done = true;
+        char const c = 0;
+        if (write (p->wake[1], &c, 1) < 0) { /* pipe is full, so awake */ }
+    }
+    else {
+        glb_log_debug ("Skipping late answer: '%s'", line);
+    }
+
+    pthread_mutex_unlock (&b->lock);
+    return;
+
+error:
+    glb_log_error ("Failed to parse process output: '%s'", line);
+}
+
+static void*
+exec_mux_reader (void* arg)
+{
+    glb_backend_ctx_t* const b = arg;
+    exec_mux_t* const m = b->mux;
+
+    char   buf[EXEC_BUF_SIZE + 32]; // answer and tag
+    size_t len = 0;
+    int    err;
+
+    struct pollfd pfds[2] = {
+        { .fd = fileno (m->std_out), .events = POLLIN, .revents = 0 },
+        { .fd = m->stop[0],          .events = POLLIN, .revents = 0 }
+    };
+
+    while (true) {
+        if (poll (pfds, 2, -1) < 0) {
+            if (EINTR == errno) continue;
+            err = errno;
+            break;
         }
 
-        /* We want to check working nodes very frequently to learn when they
-         * go down. For failed nodes we can make longer intervals to minimize
-         * the noise. */
-        int interval_mod = r.state > GLB_DST_NOTFOUND ? 1 : 10;
+        if (pfds[1].revents) return NULL; // stopped
 
-        glb_timespec_add (&next, ctx->interval * interval_mod); // next wakeup
+        ssize_t const ret = read (pfds[0].fd, buf + len,
+                                  sizeof(buf) - 1 - len);
 
-        if (pthread_mutex_lock (&ctx->lock)) abort();
+        if (ret <= 0) {
+            if (ret < 0 && EINTR == errno) continue;
+            err = ret < 0 ? errno : EPIPE; // EOF
+            break;
+        }
 
-        switch (ctx->waiting)
-        {
-        case 0:                                       break;
-        case 1:  pthread_cond_signal    (&ctx->cond); break;
-        default: pthread_cond_broadcast (&ctx->cond);
+        len += ret;
+
+        char* begin = buf;
+        char* nl;
+
+        while ((nl = memchr (begin, '\n', buf + len - begin))) {
+            char const c = nl[1];
+            nl[1] = '\0';
+            exec_mux_answer (b, begin);
+            nl[1] = c;
+            begin = nl + 1;
+        }
+
+        len -= begin - buf;
+        memmove (buf, begin, len);
+
+        if (len >= sizeof(buf) - 1) {
+            buf[len] = '\0';
+            glb_log_error ("Failed to parse process output: '%s'", buf);
+            len = 0;
         }
-        ctx->waiting = 0;
+    }
 
-        ctx->result  = r;
+    if (!glb_terminate) {
+        glb_log_error ("Failed to read helper process output: %d (%s)",
+                       err, strerror(err));
+    }
 
-        if (ctx->errn) break;
+    exec_reap (b, m->pid);
 
-        if (ETIMEDOUT != pthread_cond_timedwait (&ctx->cond, &ctx->lock, &next))
-        {
-            /* interrupted by a signal, shift the beginning of next interval */
-            next = glb_timespec_now();
+    /* outstanding polls won't get answers */
+    pthread_mutex_lock (&b->lock);
+
+    m->failed = true;
+
+    int i;
+    for (i = 0; i < m->n_probes; i++) {
+        exec_mux_probe_t* const p = m->probes[i];
+
+        if (p && p->pending && !p->done) {
+            p->done  = true;
+            p->error = err;
+            char const c = 0;
+            if (write (p->wake[1], &c, 1) < 0) { /* already awake */ }
         }
-    } /* MAIN LOOP */
+    }
 
-    glb_log_debug ("Watchdog thread for '%s:%hu' exiting: %d (%s)",
-                   ctx->host, ctx->port, ctx->errn, strerror(ctx->errn));
+    pthread_mutex_unlock (&b->lock);
 
-    memset (&ctx->result, 0, sizeof(ctx->result));
-    ctx->result.state = GLB_DST_NOTFOUND;
-    ctx->join = true; /* ready to be joined */
+    return NULL;
+}
 
-    if (pthread_mutex_unlock(&ctx->lock)) abort();
+// (re)starts helper process, must be called with backend lock held
+static int
+exec_mux_start (glb_backend_ctx_t* const b)
+{
+    exec_mux_t* const m = b->mux;
+    glb_time_t const now = glb_time_mono();
 
-//cleanup:
+    if (m->started && now - m->started < EXEC_MUX_RESTART) return EAGAIN;
 
-    if (pid > 0 && !glb_terminate) {
-        assert(std_in);
-        assert(std_out);
+    m->started = now;
 
-        int err = exec_send_cmd ("quit\n", std_in);
-        if (err) {
-            glb_log_error ("Failed to send 'quit' to the process");
+    /* reader thread of the failed helper does not need the lock any more */
+    exec_mux_cleanup (m);
+
+    int err = glb_proc_start (&m->pid, m->pargv, b->envp,
+                              &m->std_in, &m->std_out, NULL);
+
+    glb_log_debug ("exec helper errno: %d (%s), pid: %lld, cmd: '%s'",
+                   err, strerror(err), (long long)m->pid, b->cmd);
+
+    if (err) {
+        m->failed = true;
+        return err;
+    }
+
+    m->in_fd = fileno (m->std_in);
+    err = -glb_fd_setfl (m->in_fd, O_NONBLOCK, true);
+
+    if (!err && pipe (m->stop)) err = errno;
+
+    if (!err) {
+        (void)glb_fd_setfd (m->stop[0], FD_CLOEXEC, true);
+        (void)glb_fd_setfd (m->stop[1], FD_CLOEXEC, true);
+        (void)glb_fd_setfl (m->stop[1], O_NONBLOCK, true);
+
+        m->failed = false;
+        err = pthread_create (&m->reader, NULL, exec_mux_reader, b);
+        m->reading = !err;
+    }
+
+    if (err) {
+        exec_mux_cleanup (m);
+        kill (m->pid, SIGTERM);
+        glb_proc_end (m->pid);
+        m->failed = true;
+        return err;
+    }
+
+    glb_log_info ("Started helper process %lld: '%s'", (long long)m->pid,
+                  b->cmd);
+
+    return 0;
+}
+
+// sends a short line to the helper, must be called with backend lock held
+static int
+exec_mux_send (exec_mux_t* const m, const char* const line)
+{
+    size_t  const len = strlen (line);
+    /* lines are shorter than PIPE_BUF, so written whole or not at all */
+    ssize_t const ret = write (m->in_fd, line, len);
+
+    return ((size_t)ret == len ? 0 : (ret < 0 ? errno : EIO));
+}
+
+// sends poll request for the probe, must be called with backend lock held
+static int
+exec_mux_poll (glb_backend_ctx_t* const b, exec_mux_probe_t* const p)
+{
+    exec_mux_t* const m = b->mux;
+    int err = 0;
+
+    if (!m->std_in || m->failed) err = exec_mux_start (b);
+
+    if (!err) {
+        char req[EXEC_BUF_SIZE];
+
+        p->seq++;
+        snprintf (req, sizeof(req), "poll %d.%u %s\n", p->slot, p->seq,
+                  p->addr);
+
+        err = exec_mux_send (m, req);
+    }
+
+    if (!err) {
+        p->pending = true;
+        p->done    = false;
+        p->error   = 0;
+        m->error   = 0;
+    }
+    else if (err != m->error && !glb_terminate) {
+        glb_log_error ("Failed to send 'poll' to helper process: %d (%s)",
+                       err, strerror (err));
+        m->error = err;
+    }
+
+    return err;
+}
+
+static int
+exec_mux_step (glb_backend_thread_ctx_t* const ctx,
+               int*                      const fd,
+               bool                      const timeout,
+               glb_wdog_check_t*         const res)
+{
+    glb_backend_ctx_t* const b = ctx->backend;
+    exec_mux_probe_t*  const p = ctx->probe;
+    char buf[16];
+    int  err;
+
+    while (read (p->wake[0], buf, sizeof(buf)) > 0); // drain wake pipe
+
+    pthread_mutex_lock (&b->lock);
+
+    if (timeout) {
+        /* a late answer won't match the next poll tag.
+         * Without result destination is put on hold by watchdog. */
+        p->pending = false;
+        pthread_mutex_unlock (&b->lock);
+        glb_log_warn ("Check of '%s:%hu' timed out.", ctx->host, ctx->port);
+        return 0;
+    }
+
+    if (*fd < 0) { // new poll
+        err = exec_mux_poll (b, p);
+        pthread_mutex_unlock (&b->lock);
+
+        if (err) return 0; // no result, helper problem is not destination's
+
+        *fd = p->wake[0];
+        return GLB_BACKEND_READ;
+    }
+
+    if (!p->done) { // woken up for previous answer
+        pthread_mutex_unlock (&b->lock);
+        return GLB_BACKEND_READ;
+    }
+
+    p->pending = false; // reader won't touch line any more
+    err = p->error;
+
+    pthread_mutex_unlock (&b->lock);
+
+    if (err) return 0; // helper failed, no result
+
+    /* result others point to line till the next step */
+    return glb_backend_parse_result (p->line, res);
+}
+
+static void
+exec_mux_probe_free (exec_mux_probe_t* const p)
+{
+    if (p->wake[0] >= 0) close (p->wake[0]);
+    if (p->wake[1] >= 0) close (p->wake[1]);
+    free (p->addr);
+    free (p);
+}
+
+static int
+exec_mux_open (glb_backend_thread_ctx_t* const ctx)
+{
+    glb_backend_ctx_t* const b = ctx->backend;
+    exec_mux_t*        const m = b->mux;
+    exec_mux_probe_t*  const p = calloc (1, sizeof(*p));
+
+    if (!p) return -ENOMEM;
+
+    p->wake[0] = p->wake[1] = -1;
+
+    if (pipe (p->wake)) {
+        int const err = errno;
+        exec_mux_probe_free (p);
+        return -err;
+    }
+
+    (void)glb_fd_setfl (p->wake[0], O_NONBLOCK, true);
+    (void)glb_fd_setfl (p->wake[1], O_NONBLOCK, true);
+    (void)glb_fd_setfd (p->wake[0], FD_CLOEXEC, true);
+    (void)glb_fd_setfd (p->wake[1], FD_CLOEXEC, true);
+
+    p->addr = malloc (strlen (ctx->host) + 7); // ":65535\0"
+    if (!p->addr) goto enomem;
+    sprintf (p->addr, "%s:%hu", ctx->host, ctx->port);
+
+    pthread_mutex_lock (&b->lock);
+
+    for (p->slot = 0; p->slot < m->n_probes; p->slot++) {
+        if (!m->probes[p->slot]) break;
+    }
+
+    if (p->slot == m->n_probes) {
+        exec_mux_probe_t** const tmp =
+            realloc (m->probes, (m->n_probes + 1) * sizeof(*tmp));
+
+        if (!tmp) {
+            pthread_mutex_unlock (&b->lock);
+            goto enomem;
         }
 
-        err = glb_proc_end(pid);
-        if (err) {
-            glb_log_error ("Failed to end process %lld: %d (%s)",
-                           (long long)pid, err, strerror(err));
+        m->probes = tmp;
+        m->n_probes++;
+    }
+
+    m->probes[p->slot] = p;
+
+    pthread_mutex_unlock (&b->lock);
+
+    ctx->probe = p;
+    return 0;
+
+enomem:
+    exec_mux_probe_free (p);
+    return -ENOMEM;
+}
+
+static void
+exec_mux_close (glb_backend_thread_ctx_t* const ctx)
+{
+    glb_backend_ctx_t* const b = ctx->backend;
+    exec_mux_t*        const m = b->mux;
+    exec_mux_probe_t*  const p = ctx->probe;
+
+    pthread_mutex_lock (&b->lock);
+
+    if (m->std_in && !m->failed && !glb_terminate) {
+        char req[EXEC_BUF_SIZE];
+        snprintf (req, sizeof(req), "close %s\n", p->addr);
+        (void)exec_mux_send (m, req); // just a hint for helper
+    }
+
+    m->probes[p->slot] = NULL;
+
+    pthread_mutex_unlock (&b->lock);
+
+    exec_mux_probe_free (p);
+}
+
+static void
+exec_mux_destroy_ctx (glb_backend_ctx_t* const b)
+{
+    exec_mux_t* const m = b->mux;
+
+    /* failed helper has been taken care of by its reader thread */
+    bool exited = !m->std_in || m->failed;
+
+    if (!exited) {
+        if (!glb_terminate) (void)exec_mux_send (m, "quit\n");
+
+        fclose (m->std_in); // EOF for helpers that don't understand 'quit'
+        m->std_in = NULL;
+
+        /* give helper a second to exit by itself */
+        int i;
+        for (i = 0; i < 100 && 0 == waitpid (m->pid, NULL, WNOHANG); i++) {
+            usleep (10000);
         }
 
+        exited = (i < 100);
     }
 
-    if (std_in)  fclose (std_in);
-    if (std_out) fclose (std_out);
+    exec_mux_cleanup (m);
 
-    free (pargv[2]); free (pargv[1]); free (pargv[0]);
-    free (cmd);
-    free (res_buf);
+    if (!exited) exec_reap (b, m->pid); // killed in exec_destroy_ctx()
 
-    return NULL;
+    free (m->probes);
+    free (m->pargv[2]); free (m->pargv[1]); free (m->pargv[0]);
+    free (m);
+
+    exec_destroy_ctx (b);
 }
 
 static int
-exec_init (glb_backend_t* backend, const char* spec)
+exec_mux_init (glb_backend_t* backend, const char* spec)
 {
     if (!spec || strlen(spec) == 0) {
-        glb_log_error ("'exec' backend requires non-empty command line.");
+        glb_log_error ("'mexec' backend requires non-empty command line.");
         return -EINVAL;
     }
 
@@ -335,12 +882,34 @@ exec_init (glb_backend_t* backend, const char* spec)
 
     if (!ctx) return -ENOMEM;
 
+    exec_mux_t* const m = calloc (1, sizeof(*m));
+
+    if (!m) {
+        exec_destroy_ctx (ctx);
+        return -ENOMEM;
+    }
+
+    m->pid      = -1;
+    m->in_fd    = -1;
+    m->stop[0]  = m->stop[1] = -1;
+    m->pargv[0] = strdup ("sh");
+    m->pargv[1] = strdup ("-c");
+    m->pargv[2] = strdup (spec);
+    ctx->mux    = m;
+
+    if (!m->pargv[0] || !m->pargv[1] || !m->pargv[2]) {
+        exec_mux_destroy_ctx (ctx);
+        return -ENOMEM;
+    }
+
     backend->ctx     = ctx;
-    backend->thread  = exec_thread;
-    backend->destroy = exec_destroy_ctx;
+    backend->destroy = exec_mux_destroy_ctx;
+    backend->open    = exec_mux_open;
+    backend->step    = exec_mux_step;
+    backend->close   = exec_mux_close;
 
     return 0;
 }
 
-glb_backend_init_t glb_backend_exec_init = exec_init;
+glb_backend_init_t glb_backend_mexec_init = exec_mux_init;
 
@@ -10,5 +10,6 @@
 #include "glb_wdog_backend.h"
 
 extern glb_backend_init_t glb_backend_exec_init;
+extern glb_backend_init_t glb_backend_mexec_init;
 
 #endif // _glb_wdog_exec_h_
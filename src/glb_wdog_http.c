@@ -0,0 +1,527 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * This is backend that checks HTTP servers with GET requests sent over
+ * a persistent HTTP/1.1 connection to each destination.
+ *
+ * Backend options: [<path>] [<string>]
+ * path defaults to "/", if string is given, it must be found in the first
+ * HTTP_BODY_SIZE bytes of the response body for destination to be READY.
+ * Response status is mapped to destination state as follows:
+ *   2xx      - READY (NOTREADY if body does not match)
+ *   429      - AVOID
+ *   503      - NOTREADY
+ *   anything else - NOTFOUND
+ *
+ * $Id$
+ */
+
+#include "glb_wdog_http.h"
+#include "glb_socket.h"
+#include "glb_log.h"
+#include "glb_misc.h"
+
+#include <stdlib.h>   // calloc()/free()/strtoul()
+#include <stdio.h>    // snprintf()
+#include <string.h>   // strdup()
+#include <strings.h>  // strncasecmp()
+#include <errno.h>
+#include <assert.h>
+#include <ctype.h>    // isspace()
+#include <unistd.h>   // close()
+#include <sys/socket.h>
+
+struct glb_backend_ctx
+{
+    char* path;
+    char* match; // string expected in response body, NULL if any body will do
+};
+
+static void
+http_destroy_ctx (glb_backend_ctx_t* const ctx)
+{
+    free (ctx->path);
+    free (ctx->match);
+    free (ctx);
+}
+
+/* probe */
+
+typedef enum http_phase
+{
+    HTTP_CLOSED = 0,
+    HTTP_CONNECTING,
+    HTTP_IDLE,       // connected, between probes
+    HTTP_HEAD,       // reading status line and headers
+    HTTP_BODY,       // reading body of known length
+    HTTP_CHUNK_SIZE, // reading chunk size line
+    HTTP_CHUNK_DATA, // reading chunk
+    HTTP_CHUNK_END,  // reading CRLF after chunk
+    HTTP_TRAILER,    // reading trailer after the last chunk
+    HTTP_EOF         // reading body until connection is closed
+} http_phase_t;
+
+#define HTTP_BUF_SIZE  16384 // response headers must fit in it
+#define HTTP_BODY_SIZE 4096  // body prefix kept for matching
+
+typedef struct http_probe
+{
+    glb_sockaddr_t addr;
+    int            sock;
+    http_phase_t   phase;
+    bool           reused;   // request is sent over connection of older probe
+    bool           received; // something was received in this probe
+    bool           close;    // server closes connection after response
+    int            error;    // last logged error, to log failures only once
+    int            status;   // response status code
+    size_t         left;     // body or chunk bytes left to read
+    size_t         len;      // bytes in buf
+    size_t         body_len; // bytes in body
+    char*          req;      // request, it is the same every time
+    size_t         req_len;
+    char           buf[HTTP_BUF_SIZE];
+    char           body[HTTP_BODY_SIZE + 1];
+} http_probe_t;
+
+static void
+http_disconnect (http_probe_t* const p)
+{
+    if (p->sock >= 0) close (p->sock);
+
+    p->sock  = -1;
+    p->phase = HTTP_CLOSED;
+    p->len   = 0;
+}
+
+static int
+http_connect (http_probe_t* const p)
+{
+    assert (p->sock < 0);
+
+    int const ret = glb_backend_connect (&p->addr, &p->sock);
+
+    p->reused = false;
+
+    if (GLB_BACKEND_WRITE == ret) p->phase = HTTP_CONNECTING;
+
+    return ret;
+}
+
+static int
+http_send_request (http_probe_t* const p)
+{
+    p->status   = 0;
+    p->close    = false;
+    p->body_len = 0;
+    p->phase    = HTTP_HEAD;
+
+    /* short request to a socket that has nothing else to send */
+    ssize_t const ret = send (p->sock, p->req, p->req_len, MSG_NOSIGNAL);
+
+    if ((size_t)ret == p->req_len) return GLB_BACKEND_READ;
+
+    return (ret < 0 ? -errno : -EMSGSIZE);
+}
+
+static void
+http_body (http_probe_t* const p, const char* const data, size_t const len)
+{
+    size_t const n = len < HTTP_BODY_SIZE - p->body_len ?
+                     len : HTTP_BODY_SIZE - p->body_len;
+
+    memcpy (p->body + p->body_len, data, n);
+    p->body_len += n;
+}
+
+// finds header value, returns NULL if header is not there
+static const char*
+http_header (const char* head, const char* const name)
+{
+    size_t const name_len = strlen (name);
+
+    while ((head = strstr (head, "\r\n")) != NULL) {
+        head += 2;
+        if (!strncasecmp (head, name, name_len) && ':' == head[name_len]) {
+            head += name_len + 1;
+            while (' ' == *head || '\t' == *head) head++;
+            return head;
+        }
+    }
+
+    return NULL;
+}
+
+// true if header value (till the end of line) contains the token
+static bool
+http_header_has (const char* const val, const char* const token)
+{
+    size_t const token_len = strlen (token);
+    const char* p;
+
+    if (!val) return false;
+
+    for (p = val; *p && '\r' != *p; p++) {
+        if (!strncasecmp (p, token, token_len)) return true;
+    }
+
+    return false;
+}
+
+/* parses status line and headers, head is nul-terminated
+ * @return 0 or negative errno */
+static int
+http_parse_head (http_probe_t* const p, const char* const head)
+{
+    int minor;
+
+    if (2 != sscanf (head, "HTTP/1.%d %d", &minor, &p->status) ||
+        p->status < 100 || p->status > 999) return -EPROTO;
+
+    const char* const conn = http_header (head, "Connection");
+
+    p->close = http_header_has (conn, "close") ||
+               (0 == minor && !http_header_has (conn, "keep-alive"));
+
+    if (p->status < 200 || 204 == p->status || 304 == p->status) {
+        // no body. 1xx are not expected for GET, will be taken as final
+        p->phase = HTTP_IDLE;
+        return 0;
+    }
+
+    const char* const len = http_header (head, "Content-Length");
+
+    if (http_header_has (http_header (head, "Transfer-Encoding"), "chunked")) {
+        p->phase = HTTP_CHUNK_SIZE;
+    }
+    else if (len) {
+        char* endptr;
+        p->left  = strtoul (len, &endptr, 10);
+        if (endptr == len) return -EPROTO;
+        p->phase = p->left > 0 ? HTTP_BODY : HTTP_IDLE;
+    }
+    else {
+        p->close = true;
+        p->phase = HTTP_EOF;
+    }
+
+    return 0;
+}
+
+/* consumes buffered response data
+ * @return 0 when response is complete, GLB_BACKEND_READ if more is needed,
+ *         negative errno on error */
+static int
+http_parse (http_probe_t* const p)
+{
+    size_t off = 0;
+    int    ret = GLB_BACKEND_READ;
+
+    while (GLB_BACKEND_READ == ret && off < p->len) {
+        char* const  data  = p->buf + off;
+        size_t const avail = p->len - off;
+        char*        eol;
+
+        switch (p->phase)
+        {
+        case HTTP_HEAD:
+        {
+            p->buf[p->len] = '\0'; // buffer has extra byte for this
+            char* const end = strstr (data, "\r\n\r\n");
+
+            if (!end) goto more;
+
+            end[2] = '\0';
+            ret = http_parse_head (p, data);
+            off += end + 4 - data;
+            if (!ret) ret = (HTTP_IDLE == p->phase ? 0 : GLB_BACKEND_READ);
+            break;
+        }
+        case HTTP_BODY:
+        case HTTP_CHUNK_DATA:
+        {
+            size_t const n = avail < p->left ? avail : p->left;
+
+            http_body (p, data, n);
+            off     += n;
+            p->left -= n;
+
+            if (0 == p->left) {
+                if (HTTP_BODY == p->phase) {
+                    p->phase = HTTP_IDLE;
+                    ret = 0;
+                }
+                else {
+                    p->phase = HTTP_CHUNK_END;
+                }
+            }
+            break;
+        }
+        case HTTP_EOF:
+            http_body (p, data, avail);
+            off += avail;
+            break;
+        case HTTP_CHUNK_SIZE:
+        case HTTP_CHUNK_END:
+        case HTTP_TRAILER:
+            if (!(eol = memchr (data, '\n', avail))) goto more;
+
+            off += eol + 1 - data;
+
+            if (HTTP_CHUNK_END == p->phase) {
+                p->phase = HTTP_CHUNK_SIZE;
+            }
+            else if (HTTP_TRAILER == p->phase) {
+                if (eol == data || (eol == data + 1 && '\r' == data[0])) {
+                    p->phase = HTTP_IDLE; // empty line ends trailer
+                    ret = 0;
+                }
+            }
+            else {
+                char* endptr;
+                p->left = strtoul (data, &endptr, 16);
+
+                if (endptr == data) ret = -EPROTO;
+                else p->phase = p->left > 0 ? HTTP_CHUNK_DATA : HTTP_TRAILER;
+            }
+            break;
+        case HTTP_CLOSED:
+        case HTTP_CONNECTING:
+        case HTTP_IDLE:
+            ret = -EPROTO; // unsolicited data
+            break;
+        }
+    }
+
+more:
+    if (off > 0) {
+        p->len -= off;
+        memmove (p->buf, p->buf + off, p->len);
+    }
+
+    if (GLB_BACKEND_READ == ret && p->len >= sizeof(p->buf) - 1)
+        ret = -EMSGSIZE; // line or headers too long
+
+    return ret;
+}
+
+static int
+http_advance (http_probe_t* const p)
+{
+    if (HTTP_CONNECTING == p->phase) {
+        int const err = glb_backend_connected (p->sock);
+        return (err ? err : http_send_request (p));
+    }
+
+    while (true) {
+        int const ret = http_parse (p);
+
+        if (GLB_BACKEND_READ != ret) return ret;
+
+        ssize_t const n = recv (p->sock, p->buf + p->len,
+                                sizeof(p->buf) - 1 - p->len, 0);
+
+        if (n > 0) {
+            p->len += n;
+            p->received = true;
+        }
+        else if (n < 0 && (EAGAIN == errno || EINTR == errno)) {
+            return GLB_BACKEND_READ;
+        }
+        else if (0 == n && HTTP_EOF == p->phase) {
+            return 0;
+        }
+        else {
+            return (n < 0 ? -errno : -ECONNRESET);
+        }
+    }
+}
+
+// starts new probe: new request or new connection
+static int
+http_start (http_probe_t* const p)
+{
+    p->received = false;
+
+    if (HTTP_IDLE == p->phase) {
+        p->reused = true;
+        return http_send_request (p);
+    }
+
+    http_disconnect (p);
+
+    int const ret = http_connect (p);
+
+    return (GLB_BACKEND_READ == ret ? http_send_request (p) : ret);
+}
+
+static glb_dst_state_t
+http_state (const glb_backend_ctx_t* const ctx, http_probe_t* const p)
+{
+    if (p->status >= 200 && p->status < 300) {
+        p->body[p->body_len] = '\0';
+
+        if (!ctx->match || strstr (p->body, ctx->match))
+            return GLB_DST_READY;
+
+        return GLB_DST_NOTREADY;
+    }
+
+    switch (p->status)
+    {
+    case 429: return GLB_DST_AVOID;
+    case 503: return GLB_DST_NOTREADY;
+    default:  return GLB_DST_NOTFOUND;
+    }
+}
+
+static int
+http_step (glb_backend_thread_ctx_t* const ctx,
+           int*                      const fd,
+           bool                      const timeout,
+           glb_wdog_check_t*         const res)
+{
+    http_probe_t* const p = ctx->probe;
+
+    if (timeout) {
+        /* late response can't be told from the next one, start afresh.
+         * Without result destination is put on hold by watchdog. */
+        glb_log_warn ("Check of '%s:%hu' timed out.", ctx->host, ctx->port);
+        http_disconnect (p);
+        return 0;
+    }
+
+    int ret = *fd < 0 ? http_start (p) : http_advance (p);
+
+    if (ret < 0 && p->reused && !p->received) {
+        /* server might have closed idle connection, try a fresh one */
+        http_disconnect (p);
+        ret = http_connect (p);
+        if (GLB_BACKEND_READ == ret) ret = http_send_request (p);
+    }
+
+    if (ret > 0) {
+        *fd = p->sock;
+        return ret;
+    }
+
+    if (ret < 0) {
+        if (-ret != p->error) {
+            glb_log_info ("Check of '%s:%hu' failed: %d (%s)",
+                          ctx->host, ctx->port, -ret, strerror (-ret));
+        }
+        p->error = -ret;
+        http_disconnect (p);
+        res->state = GLB_DST_NOTFOUND;
+    }
+    else {
+        if (p->error) {
+            glb_log_info ("Check of '%s:%hu' succeeded.",ctx->host,ctx->port);
+        }
+        p->error   = 0;
+        res->state = http_state (ctx->backend, p);
+
+        if (p->close) http_disconnect (p);
+    }
+
+    res->ready = true;
+    return 0;
+}
+
+static int
+http_open (glb_backend_thread_ctx_t* const ctx)
+{
+    http_probe_t* const p = calloc (1, sizeof(*p));
+
+    if (!p) return -ENOMEM;
+
+    long err = glb_sockaddr_init (&p->addr, ctx->host, ctx->port);
+
+    if (err) {
+        free (p);
+        return err;
+    }
+
+    /* there is no meaningful host name for UNIX socket */
+    char host[sizeof(glb_sockaddr_str_t) + 8];
+    if (glb_sockaddr_is_unix (&p->addr))
+        snprintf (host, sizeof(host), "localhost");
+    else
+        snprintf (host, sizeof(host), "%s:%hu", ctx->host, ctx->port);
+
+    static const char fmt[] =
+        "GET %s HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "User-Agent: glb\r\n"
+        "Accept: */*\r\n"
+        "\r\n";
+
+    p->req_len = strlen (ctx->backend->path) + strlen (host) + sizeof(fmt);
+    p->req     = malloc (p->req_len);
+
+    if (!p->req) {
+        free (p);
+        return -ENOMEM;
+    }
+
+    p->req_len = snprintf (p->req, p->req_len, fmt, ctx->backend->path, host);
+    p->sock    = -1;
+    ctx->probe = p;
+
+    return 0;
+}
+
+static void
+http_close (glb_backend_thread_ctx_t* const ctx)
+{
+    http_probe_t* const p = ctx->probe;
+
+    http_disconnect (p);
+    free (p->req);
+    free (p);
+}
+
+static int
+http_init (glb_backend_t* const backend, const char* spec)
+{
+    glb_backend_ctx_t* const ctx = calloc (1, sizeof(*ctx));
+
+    if (!ctx) return -ENOMEM;
+
+    while (spec && isspace (*spec)) spec++;
+
+    if (spec && *spec) {
+        const char* const end = spec + strcspn (spec, " \t");
+        const char*       match = end;
+
+        ctx->path = strndup (spec, end - spec);
+
+        while (isspace (*match)) match++;
+        if (*match) ctx->match = strdup (match);
+
+        if (!ctx->path || (*match && !ctx->match)) goto enomem;
+    }
+    else if (!(ctx->path = strdup ("/"))) {
+        goto enomem;
+    }
+
+    if ('/' != ctx->path[0]) {
+        glb_log_error ("'http' backend path must start with '/': '%s'",
+                       ctx->path);
+        http_destroy_ctx (ctx);
+        return -EINVAL;
+    }
+
+    backend->ctx     = ctx;
+    backend->destroy = http_destroy_ctx;
+    backend->open    = http_open;
+    backend->step    = http_step;
+    backend->close   = http_close;
+
+    return 0;
+
+enomem:
+    http_destroy_ctx (ctx);
+    return -ENOMEM;
+}
+
+glb_backend_init_t glb_backend_http_init = http_init;
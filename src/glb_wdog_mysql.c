@@ -0,0 +1,703 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * This is backend that polls MySQL/Galera servers natively: it keeps an
+ * authenticated connection to each destination and queries wsrep status
+ * variables over it, so no processes are spawned and no new connections
+ * are made while the server is fine. Results are the same as of
+ * files/mysql.sh script with exec backend.
+ *
+ * Backend options mimic those of mysql.sh:
+ *   -d <state> -u<user> -p<password>
+ * where the state is assigned to Galera donor node (see mysql.sh), user and
+ * password can also be given as separate arguments or as --user=<user> and
+ * --password=<password>. Only mysql_native_password authentication is
+ * supported.
+ *
+ * Besides the state, backend reports node load derived from replication
+ * backlog (wsrep_local_recv_queue, wsrep_local_send_queue), Threads_running
+ * and flow control: flow control pauses the whole cluster, so the share of
+ * time paused since the previous probe (wsrep_flow_control_paused_ns) is
+ * accounted only to the node that requested the pause
+ * (wsrep_flow_control_sent). This lets watchdog direct new connections away
+ * from a node that lags behind the cluster.
+ *
+ * $Id$
+ */
+
+#include "glb_wdog_mysql.h"
+#include "glb_mysql.h"
+#include "glb_socket.h"
+#include "glb_log.h"
+#include "glb_misc.h"
+
+#include <stdlib.h>   // calloc()/free()/strtol()
+#include <string.h>   // strdup()
+#include <strings.h>  // strncasecmp()
+#include <errno.h>
+#include <assert.h>
+#include <ctype.h>    // isspace()
+#include <unistd.h>   // close()
+#include <sys/socket.h>
+
+struct glb_backend_ctx
+{
+    char*           user;
+    char*           password;
+    glb_dst_state_t donor;     // state to assign to Galera donor node
+};
+
+static void
+mysql_destroy_ctx (glb_backend_ctx_t* const ctx)
+{
+    free (ctx->user);
+    free (ctx->password);
+    free (ctx);
+}
+
+/* option value, either glued to the option or the next token */
+static const char*
+mysql_opt_value (const char** const tok, int const tok_num, int* const i,
+                 size_t const opt_len)
+{
+    if (tok[*i][opt_len] != '\0') return tok[*i] + opt_len;
+    if (*i + 1 < tok_num) return tok[++(*i)];
+    return NULL;
+}
+
+static int
+mysql_parse_spec (glb_backend_ctx_t* const ctx, char* const spec)
+{
+    const char** tok;
+    int          tok_num;
+
+    if (glb_parse_token_string (spec, &tok, &tok_num, '\0')) return -ENOMEM;
+
+    int ret = 0;
+    int i;
+
+    for (i = 0; i < tok_num && !ret; i++)
+    {
+        const char* val = NULL;
+        char**      dst = NULL;
+
+        if (!strncmp (tok[i], "--user=", 7)) {
+            val = tok[i] + 7; dst = &ctx->user;
+        }
+        else if (!strncmp (tok[i], "--password=", 11)) {
+            val = tok[i] + 11; dst = &ctx->password;
+        }
+        else if (!strncmp (tok[i], "-u", 2)) {
+            val = mysql_opt_value (tok, tok_num, &i, 2); dst = &ctx->user;
+        }
+        else if (!strncmp (tok[i], "-p", 2)) {
+            val = mysql_opt_value (tok, tok_num, &i, 2); dst = &ctx->password;
+        }
+        else if (!strncmp (tok[i], "-d", 2)) {
+            val = mysql_opt_value (tok, tok_num, &i, 2);
+
+            char* endptr;
+            long const st = val ? strtol (val, &endptr, 10) : -1;
+
+            if (st < GLB_DST_NOTFOUND || st > GLB_DST_READY || *endptr) {
+                glb_log_error ("Invalid donor state: '%s'", val ? val : "");
+                ret = -EINVAL;
+            }
+            else {
+                ctx->donor = st;
+            }
+            continue;
+        }
+        else {
+            glb_log_error ("Unsupported 'mysql' backend option: '%s'", tok[i]);
+            ret = -EINVAL;
+            continue;
+        }
+
+        if (!val) {
+            glb_log_error ("Missing value for '%s'", tok[i]);
+            ret = -EINVAL;
+        }
+        else {
+            free (*dst);
+            if (!(*dst = strdup (val))) ret = -ENOMEM;
+        }
+    }
+
+    free (tok);
+
+    return ret;
+}
+
+/* probe */
+
+typedef enum mysql_phase
+{
+    MYSQL_CLOSED = 0,
+    MYSQL_CONNECTING,
+    MYSQL_GREETING,  // waiting for server greeting
+    MYSQL_AUTH,      // waiting for authentication result
+    MYSQL_IDLE,      // logged in, between probes
+    MYSQL_COLUMNS,   // waiting for result set column count
+    MYSQL_DEFS,      // skipping column definitions
+    MYSQL_ROWS       // reading status variables
+} mysql_phase_t;
+
+#define MYSQL_BUF_SIZE 16384 // enough for wsrep_incoming_addresses of a big
+                             // cluster, longer responses are an error
+
+static const char mysql_query[] =
+    "SHOW STATUS WHERE Variable_name IN "
+    "('wsrep_local_state', 'wsrep_incoming_addresses', "
+    "'wsrep_local_recv_queue', 'wsrep_local_send_queue', "
+    "'wsrep_flow_control_paused_ns', 'wsrep_flow_control_sent', "
+    "'Threads_running')";
+
+/* values of load metrics that make load factor 1.0 (node at capacity) */
+#define MYSQL_LOAD_RECV_QUEUE 16.0 // default Galera flow control limit
+#define MYSQL_LOAD_SEND_QUEUE 16.0
+#define MYSQL_LOAD_THREADS    64.0 // concurrently running statements
+
+typedef struct mysql_probe
+{
+    glb_sockaddr_t addr;
+    int            sock;
+    mysql_phase_t  phase;
+    bool           reused;   // query is sent over connection of older probe
+    bool           received; // something was received in this probe
+    int            error;    // last logged error, to log failures only once
+    long           state;    // wsrep_local_state, -1 if not found
+    long           recv_queue; // wsrep_local_recv_queue
+    long           send_queue; // wsrep_local_send_queue
+    long           threads;    // Threads_running
+    long long      fc_paused;  // wsrep_flow_control_paused_ns, -1 if not found
+    long long      fc_sent;    // wsrep_flow_control_sent, -1 if not found
+    long long      fc_paused_last; // values of the previous probe, -1 if none
+    long long      fc_sent_last;
+    glb_time_t     fc_time;    // time of the previous sample
+    size_t         len;      // bytes in buf
+    uint8_t        buf[MYSQL_BUF_SIZE];
+    char           others[MYSQL_BUF_SIZE];
+} mysql_probe_t;
+
+static void
+mysql_disconnect (mysql_probe_t* const p)
+{
+    if (p->sock >= 0) {
+        if (p->phase >= MYSQL_IDLE) { // be polite
+            uint8_t buf[GLB_MYSQL_HDR_LEN + 1];
+            long const len = glb_mysql_cmd_write (GLB_MYSQL_COM_QUIT, NULL, 0,
+                                                  buf, sizeof(buf));
+            if (len > 0) send (p->sock, buf, len, MSG_NOSIGNAL|MSG_DONTWAIT);
+        }
+        close (p->sock);
+    }
+
+    p->sock  = -1;
+    p->phase = MYSQL_CLOSED;
+    p->len   = 0;
+}
+
+static int
+mysql_send (mysql_probe_t* const p, const uint8_t* const buf, long const len)
+{
+    if (len < 0) return len;
+
+    /* short requests to a socket that has nothing else to send */
+    ssize_t const ret = send (p->sock, buf, len, MSG_NOSIGNAL);
+
+    if (ret == len) return 0;
+
+    return (ret < 0 ? -errno : -EMSGSIZE);
+}
+
+static int
+mysql_connect (mysql_probe_t* const p)
+{
+    assert (p->sock < 0);
+
+    int const ret = glb_backend_connect (&p->addr, &p->sock);
+
+    p->reused = false;
+    p->phase  = GLB_BACKEND_READ == ret ? MYSQL_GREETING : MYSQL_CONNECTING;
+
+    return ret;
+}
+
+static int
+mysql_send_query (mysql_probe_t* const p)
+{
+    uint8_t buf[GLB_MYSQL_HDR_LEN + sizeof(mysql_query)];
+
+    p->state      = -1;
+    p->recv_queue = 0;
+    p->send_queue = 0;
+    p->threads    = 0;
+    p->fc_paused  = -1;
+    p->fc_sent    = -1;
+    p->others[0]  = '\0';
+    p->phase      = MYSQL_COLUMNS;
+
+    int const err = mysql_send (p, buf,
+                                glb_mysql_cmd_write (GLB_MYSQL_COM_QUERY,
+                                                     mysql_query,
+                                                     sizeof(mysql_query) - 1,
+                                                     buf, sizeof(buf)));
+    return (err ? err : GLB_BACKEND_READ);
+}
+
+static int
+mysql_send_login (const glb_backend_ctx_t* const ctx, mysql_probe_t* const p,
+                  const uint8_t* const payload, size_t const len,
+                  uint8_t const seq)
+{
+    glb_mysql_greeting_t g;
+
+    if (glb_mysql_greeting_parse (&g, payload, len) ||
+        g.scramble_len < GLB_MYSQL_AUTH_LEN) return -EPROTO;
+
+    glb_mysql_login_t l;
+    memset (&l, 0, sizeof(l));
+
+    l.caps = GLB_MYSQL_CLIENT_LONG_PASSWORD | GLB_MYSQL_CLIENT_PROTOCOL_41 |
+             GLB_MYSQL_CLIENT_SECURE_CONNECTION | GLB_MYSQL_CLIENT_PLUGIN_AUTH;
+    l.head[6] = 0; l.head[7] = 1;  // max packet 16M
+    l.head[8] = 33;                // utf8_general_ci
+
+    if (strlen (ctx->user) >= sizeof(l.user)) return -ENAMETOOLONG;
+    strcpy (l.user, ctx->user);
+
+    uint8_t auth[GLB_MYSQL_AUTH_LEN];
+    size_t const auth_len = glb_mysql_native_password (ctx->password,
+                                                       g.scramble, auth);
+    uint8_t buf[256 + sizeof(l.user)];
+
+    return mysql_send (p, buf,
+                       glb_mysql_login_write (&l, GLB_MYSQL_NATIVE_PASSWORD,
+                                              auth, auth_len, seq,
+                                              buf, sizeof(buf)));
+}
+
+// answers authentication switch request, only to mysql_native_password
+static int
+mysql_send_auth (const glb_backend_ctx_t* const ctx, mysql_probe_t* const p,
+                 const uint8_t* const payload, size_t const len,
+                 uint8_t const seq)
+{
+    size_t const plugin_len = strnlen ((const char*)payload + 1, len - 1);
+
+    if (strcmp ((const char*)payload + 1, GLB_MYSQL_NATIVE_PASSWORD) ||
+        1 + plugin_len + 1 + GLB_MYSQL_AUTH_LEN > len) {
+        return -EPROTONOSUPPORT;
+    }
+
+    uint8_t buf[GLB_MYSQL_HDR_LEN + GLB_MYSQL_AUTH_LEN];
+    size_t const auth_len =
+        glb_mysql_native_password (ctx->password, payload + 1 + plugin_len + 1,
+                                   buf + GLB_MYSQL_HDR_LEN);
+
+    glb_mysql_pkt_hdr (buf, auth_len, seq);
+
+    return mysql_send (p, buf, GLB_MYSQL_HDR_LEN + auth_len);
+}
+
+static void
+mysql_log_err (const glb_backend_thread_ctx_t* const ctx,
+               const uint8_t* const payload, size_t const len)
+{
+    // error code, '#', SQLSTATE
+    int const skip = len >= 9 && '#' == payload[3] ? 9 : 3;
+    int const msg_len = len > (size_t)skip ? (int)len - skip : 0;
+
+    glb_log_error ("'%s:%hu' refused check: %d: %.*s", ctx->host, ctx->port,
+                   len >= 3 ? payload[1] | (payload[2] << 8) : 0,
+                   msg_len, (const char*)payload + skip);
+}
+
+// copies wsrep_incoming_addresses value dropping empty entries (garbd)
+static void
+mysql_copy_others (char* const others, const uint8_t* const val,
+                   size_t const len)
+{
+    size_t i, n = 0;
+
+    for (i = 0; i < len; i++) {
+        if (',' == val[i] && (0 == n || ',' == others[n - 1])) continue;
+        others[n++] = val[i];
+    }
+
+    if (n > 0 && ',' == others[n - 1]) n--;
+
+    others[n] = '\0';
+}
+
+static inline bool
+mysql_var_is (const uint8_t* const name, uint64_t const name_len,
+              const char* const var)
+{
+    return (name_len == strlen (var) &&
+            !strncasecmp ((const char*)name, var, name_len));
+}
+
+static long long
+mysql_var_value (const uint8_t* const val, uint64_t const val_len)
+{
+    char tmp[24] = { 0, };
+    memcpy (tmp, val, val_len < sizeof(tmp) ? val_len : sizeof(tmp) - 1);
+    return strtoll (tmp, NULL, 10);
+}
+
+// reads row of two lenenc strings: variable name and value
+static int
+mysql_parse_row (mysql_probe_t* const p, const uint8_t* const payload,
+                 size_t const len)
+{
+    uint64_t name_len, val_len;
+    size_t   off = glb_mysql_lenenc (payload, len, &name_len);
+
+    if (!off || off + name_len > len) return -EPROTO;
+
+    const uint8_t* const name = payload + off;
+    off += name_len;
+
+    size_t const n = glb_mysql_lenenc (payload + off, len - off, &val_len);
+
+    if (!n || off + n + val_len > len) return 0; // NULL value
+
+    const uint8_t* const val = payload + off + n;
+
+    if (mysql_var_is (name, name_len, "wsrep_local_state")) {
+        p->state = mysql_var_value (val, val_len);
+    }
+    else if (mysql_var_is (name, name_len, "wsrep_incoming_addresses")) {
+        mysql_copy_others (p->others, val, val_len); // fits: len < buf size
+    }
+    else if (mysql_var_is (name, name_len, "wsrep_local_recv_queue")) {
+        p->recv_queue = mysql_var_value (val, val_len);
+    }
+    else if (mysql_var_is (name, name_len, "wsrep_local_send_queue")) {
+        p->send_queue = mysql_var_value (val, val_len);
+    }
+    else if (mysql_var_is (name, name_len, "wsrep_flow_control_paused_ns")) {
+        p->fc_paused = mysql_var_value (val, val_len);
+    }
+    else if (mysql_var_is (name, name_len, "wsrep_flow_control_sent")) {
+        p->fc_sent = mysql_var_value (val, val_len);
+    }
+    else if (mysql_var_is (name, name_len, "Threads_running")) {
+        p->threads = mysql_var_value (val, val_len);
+    }
+
+    return 0;
+}
+
+/* Handles complete server packet.
+ * @return GLB_BACKEND_READ to go on reading, 0 when the result is ready or
+ *         negative error code */
+static int
+mysql_handle_packet (const glb_backend_thread_ctx_t* const ctx,
+                     mysql_probe_t*                  const p,
+                     const uint8_t*                  const payload,
+                     size_t                          const len,
+                     uint8_t                         const seq)
+{
+    bool const err = len > 0 && GLB_MYSQL_ERR == payload[0];
+
+    if (err && p->phase != MYSQL_ROWS) {
+        if (EACCES != p->error) mysql_log_err (ctx, payload, len);
+        return -EACCES;
+    }
+
+    switch (p->phase)
+    {
+    case MYSQL_GREETING:
+    {
+        int const ret = mysql_send_login (ctx->backend, p, payload, len,
+                                          seq + 1);
+        if (ret) return ret;
+        p->phase = MYSQL_AUTH;
+        return GLB_BACKEND_READ;
+    }
+    case MYSQL_AUTH:
+        if (len > 0 && GLB_MYSQL_OK == payload[0]) return mysql_send_query (p);
+
+        if (len > 0 && GLB_MYSQL_EOF == payload[0]) { // auth switch
+            int const ret = mysql_send_auth (ctx->backend, p, payload, len,
+                                             seq + 1);
+            return (ret ? ret : GLB_BACKEND_READ);
+        }
+
+        return -EPROTONOSUPPORT;
+    case MYSQL_COLUMNS:
+        p->phase = MYSQL_DEFS;
+        return GLB_BACKEND_READ;
+    case MYSQL_DEFS:
+        if (glb_mysql_is_eof (payload, len)) p->phase = MYSQL_ROWS;
+        return GLB_BACKEND_READ;
+    case MYSQL_ROWS:
+        if (err) return -EPROTO;
+
+        if (glb_mysql_is_eof (payload, len)) {
+            p->phase = MYSQL_IDLE;
+            return 0;
+        }
+
+        {
+            int const ret = mysql_parse_row (p, payload, len);
+            return (ret ? ret : GLB_BACKEND_READ);
+        }
+    case MYSQL_CLOSED:
+    case MYSQL_CONNECTING:
+    case MYSQL_IDLE:
+        break;
+    }
+
+    return -EPROTO; // unsolicited data
+}
+
+static int
+mysql_advance (const glb_backend_thread_ctx_t* const ctx,
+               mysql_probe_t*                  const p)
+{
+    if (MYSQL_CONNECTING == p->phase) {
+        int const err = glb_backend_connected (p->sock);
+        if (err) return err;
+
+        p->phase = MYSQL_GREETING;
+        return GLB_BACKEND_READ;
+    }
+
+    while (true) {
+        if (p->len >= GLB_MYSQL_HDR_LEN) {
+            size_t const len = glb_mysql_pkt_len (p->buf);
+            size_t const pkt = GLB_MYSQL_HDR_LEN + len;
+
+            if (pkt > sizeof(p->buf)) return -EMSGSIZE;
+
+            if (p->len >= pkt) {
+                int const ret = mysql_handle_packet (ctx, p,
+                                                     p->buf + GLB_MYSQL_HDR_LEN,
+                                                     len,
+                                                     glb_mysql_pkt_seq(p->buf));
+                p->len -= pkt;
+                memmove (p->buf, p->buf + pkt, p->len);
+
+                if (GLB_BACKEND_READ != ret) return ret;
+                continue;
+            }
+        }
+
+        ssize_t const ret = recv (p->sock, p->buf + p->len,
+                                  sizeof(p->buf) - p->len, 0);
+
+        if (ret > 0) {
+            p->len += ret;
+            p->received = true;
+        }
+        else if (ret < 0 && (EAGAIN == errno || EINTR == errno)) {
+            return GLB_BACKEND_READ;
+        }
+        else {
+            return (ret < 0 ? -errno : -ECONNRESET);
+        }
+    }
+}
+
+// starts new probe: new query or new connection
+static int
+mysql_start (mysql_probe_t* const p)
+{
+    p->received = false;
+
+    if (MYSQL_IDLE == p->phase) {
+        p->reused = true;
+        return mysql_send_query (p);
+    }
+
+    mysql_disconnect (p);
+    return mysql_connect (p);
+}
+
+static glb_dst_state_t
+mysql_wsrep_state (long const state, glb_dst_state_t const donor)
+{
+    switch (state)
+    {
+    case -1: // not a Galera node, but it accepted connection and query
+    case 4:  return GLB_DST_READY;    // SYNCED
+    case 3:  return GLB_DST_AVOID;    // JOINED
+    case 2:  return donor;            // DONOR
+    case 1:                           // JOINING
+    case 5:  return GLB_DST_NOTREADY; // ERROR
+    default: return GLB_DST_NOTFOUND;
+    }
+}
+
+static inline double
+mysql_max (double const a, double const b)
+{
+    return (a > b ? a : b);
+}
+
+/* load factor is that of the most saturated resource */
+static double
+mysql_load (mysql_probe_t* const p)
+{
+    double load = p->recv_queue / MYSQL_LOAD_RECV_QUEUE;
+
+    load = mysql_max (load, p->send_queue / MYSQL_LOAD_SEND_QUEUE);
+    // one of the running threads is this probe
+    load = mysql_max (load, (p->threads - 1) / MYSQL_LOAD_THREADS);
+
+    glb_time_t const now = glb_time_now();
+
+    if (p->fc_paused >= 0 && p->fc_sent >= 0) {
+        /* counters are reset when server restarts, skip such sample */
+        if (p->fc_sent_last >= 0 && p->fc_sent > p->fc_sent_last &&
+            p->fc_paused >= p->fc_paused_last && now > p->fc_time) {
+            // this node made the cluster wait: it is at capacity or beyond
+            double const paused = (double)(p->fc_paused - p->fc_paused_last) /
+                (now - p->fc_time);
+            load = mysql_max (load, 1.0 + (paused < 1.0 ? paused : 1.0));
+        }
+
+        p->fc_paused_last = p->fc_paused;
+        p->fc_sent_last   = p->fc_sent;
+        p->fc_time        = now;
+    }
+
+    return mysql_max (load, 0.0);
+}
+
+static int
+mysql_step (glb_backend_thread_ctx_t* const ctx,
+            int*                      const fd,
+            bool                      const timeout,
+            glb_wdog_check_t*         const res)
+{
+    mysql_probe_t* const p = ctx->probe;
+
+    if (timeout) {
+        /* late response can't be told from the next one, start afresh.
+         * Without result destination is put on hold by watchdog. */
+        glb_log_warn ("Check of '%s:%hu' timed out.", ctx->host, ctx->port);
+        mysql_disconnect (p);
+        return 0;
+    }
+
+    int ret = *fd < 0 ? mysql_start (p) : mysql_advance (ctx, p);
+
+    if (ret < 0 && p->reused && !p->received) {
+        /* server might have closed idle connection, try a fresh one */
+        mysql_disconnect (p);
+        ret = mysql_connect (p);
+    }
+
+    if (ret > 0) {
+        *fd = p->sock;
+        return ret;
+    }
+
+    if (ret < 0) {
+        if (-ret != p->error && EACCES != -ret) {
+            glb_log_info ("Check of '%s:%hu' failed: %d (%s)",
+                          ctx->host, ctx->port, -ret, strerror (-ret));
+        }
+        p->error = -ret;
+        mysql_disconnect (p);
+        res->state = GLB_DST_NOTFOUND; // as if mysql client failed
+    }
+    else {
+        if (p->error) {
+            glb_log_info ("Check of '%s:%hu' succeeded.",ctx->host,ctx->port);
+        }
+        p->error   = 0;
+        res->state = mysql_wsrep_state (p->state, ctx->backend->donor);
+        res->load  = mysql_load (p);
+
+        if (p->others[0]) {
+            res->others     = p->others;
+            res->others_len = strlen (p->others);
+        }
+    }
+
+    res->ready = true;
+    return 0;
+}
+
+static int
+mysql_open (glb_backend_thread_ctx_t* const ctx)
+{
+    mysql_probe_t* const p = calloc (1, sizeof(*p));
+
+    if (!p) return -ENOMEM;
+
+    long const err = glb_sockaddr_init (&p->addr, ctx->host, ctx->port);
+
+    if (err) {
+        free (p);
+        return err;
+    }
+
+    p->sock           = -1;
+    p->fc_paused_last = -1;
+    p->fc_sent_last   = -1;
+    ctx->probe        = p;
+
+    return 0;
+}
+
+static void
+mysql_close (glb_backend_thread_ctx_t* const ctx)
+{
+    mysql_probe_t* const p = ctx->probe;
+
+    mysql_disconnect (p);
+    free (p);
+}
+
+static int
+mysql_init (glb_backend_t* const backend, const char* spec)
+{
+    glb_backend_ctx_t* const ctx = calloc (1, sizeof(*ctx));
+
+    if (!ctx) return -ENOMEM;
+
+    ctx->donor = GLB_DST_AVOID; // mysql.sh default
+
+    int err = 0;
+
+    while (spec && isspace (*spec)) spec++; // tokenizer expects no leading
+
+    if (spec && strlen(spec) > 0) {
+        char* const tmp = strdup (spec);
+
+        if (tmp) {
+            err = mysql_parse_spec (ctx, tmp);
+            free (tmp);
+        }
+        else {
+            err = -ENOMEM;
+        }
+    }
+
+    if (!err && !ctx->user     && !(ctx->user     = strdup ("")))
+        err = -ENOMEM;
+    if (!err && !ctx->password && !(ctx->password = strdup ("")))
+        err = -ENOMEM;
+
+    if (err) {
+        mysql_destroy_ctx (ctx);
+        return err;
+    }
+
+    backend->ctx     = ctx;
+    backend->destroy = mysql_destroy_ctx;
+    backend->open    = mysql_open;
+    backend->step    = mysql_step;
+    backend->close   = mysql_close;
+
+    return 0;
+}
+
+glb_backend_init_t glb_backend_mysql_init = mysql_init;
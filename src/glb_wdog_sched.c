@@ -0,0 +1,749 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * Watchdog probe scheduler implementation.
+ *
+ * Every destination is an item that belongs to one scheduler thread and
+ * always sits in its timer heap: either with the time of the next probe or,
+ * while the probe is in progress, with the probe timeout. Other threads
+ * never touch items, they put them on the thread kick list (new items,
+ * quit and on-demand probe requests) and wake the thread up through a pipe.
+ *
+ * Probe interval of every destination adapts to its behavior between
+ * ctx->interval_min and ctx->interval_max and is randomly jittered, so that
+ * probes of different destinations don't come in bursts.
+ *
+ * $Id$
+ */
+
+#include "glb_wdog_sched.h"
+#include "glb_log.h"
+#include "glb_misc.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#define SCHED_READ  EPOLLIN
+#define SCHED_WRITE EPOLLOUT
+#else
+#include <poll.h>
+#define SCHED_READ  POLLIN
+#define SCHED_WRITE POLLOUT
+#endif /* USE_EPOLL */
+
+#define SCHED_MIN_TIMEOUT 1000000000LL // probe timeout at least 1 sec
+#define SCHED_FAIL_FACTOR 10 // check unreachable destinations less often
+#define SCHED_JITTER      0.1  // +-10% of the interval
+#define SCHED_LAT_RISE    2.0  // latency is rising if that much over average
+
+typedef struct sched_thd sched_thd_t;
+
+typedef struct glb_sched_item
+{
+    glb_backend_thread_ctx_t* ctx;
+    sched_thd_t*              thd;
+    struct glb_sched_item*    kick_next;
+    char*                     others;   // result others buffer, owned here
+    size_t                    others_size;
+    glb_time_t                deadline; // next probe or probe timeout
+    glb_time_t                start;    // of probe in progress, 0 if none
+    glb_time_t                interval; // current probe interval
+    double                    latency;  // average probe latency
+    int                       state;    // last probe state, -1 if none
+    int                       heap_idx; // -1 until thread picks item up
+    int                       fd;       // watched descriptor, -1 if none
+    uint32_t                  ops;      // events watched on fd
+    bool                      kicked;
+} sched_item_t;
+
+struct sched_thd
+{
+    glb_sched_t*    sched;
+    pthread_t       id;
+    pthread_mutex_t lock;      // protects kick list, n_items and quit
+    sched_item_t*   kick;      // kick list
+    int             n_items;   // including those yet on kick list
+    bool            quit;
+    unsigned int    seed;      // for jitter
+    int             wake[2];   // pipe to interrupt waiting
+#ifdef USE_EPOLL
+    int             epoll_fd;
+    struct epoll_event* events;
+    int             events_len;
+#else
+    struct pollfd*  pfds;
+    sched_item_t**  pitems;    // item of each pollfd
+    int             pfds_len;
+#endif /* USE_EPOLL */
+    sched_item_t**  heap;      // only accessed by the thread
+    int             heap_len;
+    int             heap_size;
+};
+
+struct glb_sched
+{
+    glb_backend_t   backend;
+    int             n_thds;
+    sched_thd_t     thd[];
+};
+
+/* timer heap */
+
+static inline void
+sched_heap_set (sched_thd_t* const t, int const idx, sched_item_t* const item)
+{
+    t->heap[idx] = item;
+    item->heap_idx = idx;
+}
+
+static void
+sched_heap_up (sched_thd_t* const t, int idx)
+{
+    sched_item_t* const item = t->heap[idx];
+
+    while (idx > 0) {
+        int const parent = (idx - 1) >> 1;
+        if (t->heap[parent]->deadline <= item->deadline) break;
+        sched_heap_set (t, idx, t->heap[parent]);
+        idx = parent;
+    }
+
+    sched_heap_set (t, idx, item);
+}
+
+static void
+sched_heap_down (sched_thd_t* const t, int idx)
+{
+    sched_item_t* const item = t->heap[idx];
+
+    while (true) {
+        int child = (idx << 1) + 1;
+        if (child >= t->heap_len) break;
+        if (child + 1 < t->heap_len &&
+            t->heap[child + 1]->deadline < t->heap[child]->deadline) child++;
+        if (item->deadline <= t->heap[child]->deadline) break;
+        sched_heap_set (t, idx, t->heap[child]);
+        idx = child;
+    }
+
+    sched_heap_set (t, idx, item);
+}
+
+// item deadline changed
+static inline void
+sched_heap_fix (sched_thd_t* const t, sched_item_t* const item)
+{
+    sched_heap_up   (t, item->heap_idx);
+    sched_heap_down (t, item->heap_idx);
+}
+
+static int
+sched_heap_push (sched_thd_t* const t, sched_item_t* const item)
+{
+    if (t->heap_len == t->heap_size) {
+        int const size = t->heap_size ? t->heap_size * 2 : 16;
+        void* const tmp = realloc (t->heap, size * sizeof(t->heap[0]));
+        if (!tmp) return -ENOMEM;
+        t->heap = tmp;
+        t->heap_size = size;
+    }
+
+    sched_heap_set (t, t->heap_len++, item);
+    sched_heap_up  (t, item->heap_idx);
+
+    return 0;
+}
+
+static void
+sched_heap_remove (sched_thd_t* const t, sched_item_t* const item)
+{
+    int const idx = item->heap_idx;
+    sched_item_t* const last = t->heap[--t->heap_len];
+
+    item->heap_idx = -1;
+
+    if (last != item) {
+        sched_heap_set (t, idx, last);
+        sched_heap_fix (t, last);
+    }
+}
+
+/* descriptor watching */
+
+static void
+sched_watch (sched_thd_t* const t, sched_item_t* const item,
+             int const fd, int const ops)
+{
+    uint32_t const events = ((ops & GLB_BACKEND_READ)  ? SCHED_READ  : 0) |
+                            ((ops & GLB_BACKEND_WRITE) ? SCHED_WRITE : 0);
+#ifdef USE_EPOLL
+    struct epoll_event e = { events, { .ptr = item } };
+
+    /* backend may have closed the old descriptor (then it is gone from epoll
+     * set already), or even got the same number for a new one */
+    if (item->fd >= 0 && item->fd != fd)
+        epoll_ctl (t->epoll_fd, EPOLL_CTL_DEL, item->fd, NULL);
+
+    if (fd >= 0 &&
+        (item->fd != fd ||
+         epoll_ctl (t->epoll_fd, EPOLL_CTL_MOD, fd, &e)) &&
+        epoll_ctl (t->epoll_fd, EPOLL_CTL_ADD, fd, &e)) {
+        glb_log_error ("Failed to watch backend descriptor %d: %d (%s)",
+                       fd, errno, strerror (errno));
+    }
+#else
+    (void)t; // poll set is rebuilt from the heap on every wait
+#endif /* USE_EPOLL */
+
+    item->fd  = fd;
+    item->ops = events;
+}
+
+/* item lifecycle */
+
+// publishes finished probe result and wakes up those waiting for it
+static void
+sched_item_result (sched_item_t* const item, glb_wdog_check_t* const res)
+{
+    glb_backend_thread_ctx_t* const ctx = item->ctx;
+
+    GLB_MUTEX_LOCK (&ctx->lock); // watchdog may be reading the old others
+
+    if (res->ready && res->others) {
+        size_t const len = strlen (res->others) + 1;
+
+        if (len > item->others_size) {
+            void* const tmp = realloc (item->others, len);
+            if (tmp) {
+                item->others      = tmp;
+                item->others_size = len;
+            }
+        }
+
+        if (len <= item->others_size) {
+            memcpy (item->others, res->others, len);
+            res->others     = item->others;
+            res->others_len = len; // watchdog copies it with terminating 0
+        }
+        else {
+            res->others     = NULL;
+            res->others_len = 0;
+        }
+    }
+
+    ctx->result = *res;
+    if (res->ready) glb_backend_set_checked (ctx, res);
+
+    switch (ctx->waiting)
+    {
+    case 0:                                       break;
+    case 1:  pthread_cond_signal    (&ctx->cond); break;
+    default: pthread_cond_broadcast (&ctx->cond);
+    }
+    ctx->waiting = 0;
+
+    GLB_MUTEX_UNLOCK (&ctx->lock);
+}
+
+// closes the probe and lets watchdog free ctx
+static void
+sched_item_remove (sched_thd_t* const t, sched_item_t* const item,
+                   int const errn)
+{
+    glb_backend_thread_ctx_t* const ctx = item->ctx;
+
+    sched_watch (t, item, -1, 0);
+    if (item->heap_idx >= 0) sched_heap_remove (t, item);
+
+    t->sched->backend.close (ctx);
+    ctx->probe = NULL;
+
+    /* ctx may be freed as soon as join is set */
+    glb_log_debug ("Watchdog probe for '%s:%hu' closed: %d (%s)",
+                   ctx->host, ctx->port, errn, strerror(errn));
+
+    GLB_MUTEX_LOCK (&ctx->lock);
+    memset (&ctx->result, 0, sizeof(ctx->result));
+    ctx->result.state = GLB_DST_NOTFOUND;
+    ctx->errn  = errn;
+    ctx->sched = NULL; // no more kicks
+    ctx->join  = true; // ready to be freed
+    pthread_cond_broadcast (&ctx->cond);
+    GLB_MUTEX_UNLOCK (&ctx->lock);
+
+    GLB_MUTEX_LOCK (&t->lock);
+    if (item->kicked) { // kicked meanwhile, unlink
+        sched_item_t** k;
+        for (k = &t->kick; *k != item; k = &(*k)->kick_next);
+        *k = item->kick_next;
+    }
+    t->n_items--;
+    GLB_MUTEX_UNLOCK (&t->lock);
+
+    free (item->others);
+    free (item);
+}
+
+static inline glb_time_t
+sched_timeout (const glb_backend_thread_ctx_t* const ctx)
+{
+    return ctx->interval > SCHED_MIN_TIMEOUT ? ctx->interval:SCHED_MIN_TIMEOUT;
+}
+
+glb_time_t
+glb_sched_result_ttl (const glb_backend_thread_ctx_t* const ctx)
+{
+    return ctx->interval_max * (1.0 + SCHED_JITTER) + sched_timeout (ctx);
+}
+
+// @return random time within [0, max)
+static inline glb_time_t
+sched_random (sched_thd_t* const t, glb_time_t const max)
+{
+    return max * ((double)rand_r (&t->seed) / ((double)RAND_MAX + 1.0));
+}
+
+/* Adapts probe interval to the result: while destination state changes it
+ * is probed at the minimal interval, while latency rises - twice as often as
+ * before and while it stays the same the interval doubles up to the maximum.
+ * For unreachable destinations the maximum is SCHED_FAIL_FACTOR times
+ * longer to minimize the noise.
+ * @return interval till the next probe with jitter */
+static glb_time_t
+sched_item_interval (sched_thd_t*            const t,
+                     sched_item_t*           const item,
+                     const glb_wdog_check_t* const res)
+{
+    glb_backend_thread_ctx_t* const ctx = item->ctx;
+
+    int const state = res->ready ? (int)res->state : GLB_DST_NOTFOUND;
+
+    /* bounds can be changed by configuration reload */
+    GLB_MUTEX_LOCK (&ctx->lock);
+    glb_time_t const min = ctx->interval_min;
+    glb_time_t       max = ctx->interval_max;
+    GLB_MUTEX_UNLOCK (&ctx->lock);
+
+    if (GLB_DST_NOTFOUND == state) max *= SCHED_FAIL_FACTOR;
+
+    if (state != item->state) {
+        item->interval = min;
+    }
+    else if (res->ready && item->latency > 0 &&
+             res->latency > item->latency * SCHED_LAT_RISE) {
+        item->interval /= 2;
+    }
+    else {
+        item->interval *= 2;
+    }
+
+    if (item->interval < min) item->interval = min;
+    if (item->interval > max) item->interval = max;
+
+    item->state = state;
+
+    if (res->ready && GLB_DST_NOTFOUND != state) {
+        item->latency = item->latency > 0 ?
+            (item->latency * 3 + res->latency) / 4 : res->latency;
+    }
+
+    glb_time_t const jitter = item->interval * SCHED_JITTER;
+
+    return item->interval - jitter + sched_random (t, jitter * 2);
+}
+
+// runs backend probe step: on timer, descriptor event or probe timeout
+static void
+sched_item_step (sched_thd_t* const t, sched_item_t* const item,
+                 glb_time_t const now, bool const timeout)
+{
+    glb_backend_thread_ctx_t* const ctx = item->ctx;
+    glb_wdog_check_t res;
+    bool const start = !item->start;
+    int fd = start ? -1 : item->fd;
+
+    if (start) item->start = now;
+
+    memset (&res, 0, sizeof(res));
+    res.state = GLB_DST_NOTFOUND;
+
+    int const ret = t->sched->backend.step (ctx, &fd, timeout, &res);
+
+    if (ret > 0) {
+        assert (fd >= 0);
+        sched_watch (t, item, fd, ret);
+
+        if (start) { // set probe timeout
+            item->deadline = now + sched_timeout (ctx);
+            sched_heap_fix (t, item);
+        }
+        else if (timeout) {
+            glb_log_error ("Backend probe for '%s:%hu' ignored timeout.",
+                           ctx->host, ctx->port);
+            sched_item_remove (t, item, ETIMEDOUT);
+        }
+        return;
+    }
+
+    sched_watch (t, item, -1, 0);
+
+    if (ret < 0) {
+        sched_item_remove (t, item, -ret);
+        return;
+    }
+
+    if (res.ready) {
+        res.timestamp = glb_time_now();
+        res.latency   = glb_time_seconds (glb_time_mono() - item->start);
+    }
+
+    sched_item_result (item, &res);
+
+    item->deadline = item->start + sched_item_interval (t, item, &res);
+    item->start    = 0;
+    sched_heap_fix (t, item);
+}
+
+static void
+sched_handle_kicks (sched_thd_t* const t, glb_time_t const now)
+{
+    GLB_MUTEX_LOCK (&t->lock);
+    sched_item_t* item = t->kick;
+    t->kick = NULL;
+    GLB_MUTEX_UNLOCK (&t->lock);
+
+    while (item) {
+        glb_backend_thread_ctx_t* const ctx = item->ctx;
+        sched_item_t* const next = item->kick_next;
+
+        GLB_MUTEX_LOCK (&t->lock);
+        item->kicked = false;
+        GLB_MUTEX_UNLOCK (&t->lock);
+
+        GLB_MUTEX_LOCK (&ctx->lock);
+        bool const quit    = ctx->quit;
+        bool const waiting = ctx->waiting > 0;
+        GLB_MUTEX_UNLOCK (&ctx->lock);
+
+        if (item->heap_idx < 0) { // new item, spread first probes
+            item->deadline = now + sched_random (t, ctx->interval_min);
+            if (sched_heap_push (t, item)) {
+                sched_item_remove (t, item, ENOMEM);
+                item = next;
+                continue;
+            }
+        }
+
+        if (quit) {
+            sched_item_remove (t, item, 0);
+        }
+        else if (waiting && !item->start) { // on-demand probe
+            item->deadline = now;
+            sched_heap_fix (t, item);
+        }
+
+        item = next;
+    }
+}
+
+static void
+sched_wake (sched_thd_t* const t)
+{
+    char const c = 0;
+    if (write (t->wake[1], &c, 1) < 0 && EAGAIN != errno) {
+        glb_log_error ("Failed to wake up scheduler thread: %d (%s)",
+                       errno, strerror (errno));
+    }
+}
+
+void
+glb_sched_kick (glb_backend_thread_ctx_t* const ctx)
+{
+    sched_item_t* const item = ctx->sched;
+
+    if (!item) return; // already closed
+
+    sched_thd_t* const t = item->thd;
+
+    GLB_MUTEX_LOCK (&t->lock);
+    if (!item->kicked) {
+        item->kicked    = true;
+        item->kick_next = t->kick;
+        t->kick         = item;
+    }
+    GLB_MUTEX_UNLOCK (&t->lock);
+
+    sched_wake (t);
+}
+
+// @return number of ready descriptors or negative errno
+static int
+sched_wait (sched_thd_t* const t, int const timeout_ms)
+{
+    int ret;
+
+#ifdef USE_EPOLL
+    if (t->events_len < t->heap_len + 1) {
+        int const len = t->heap_len + 1;
+        void* const tmp = realloc (t->events, len * sizeof(t->events[0]));
+        if (tmp) {
+            t->events     = tmp;
+            t->events_len = len;
+        }
+    }
+
+    ret = epoll_wait (t->epoll_fd, t->events, t->events_len, timeout_ms);
+#else
+    int n = 0;
+    int i;
+
+    if (t->pfds_len < t->heap_len + 1) {
+        int const len = t->heap_len + 1;
+        void* const tmp1 = realloc (t->pfds,   len * sizeof(t->pfds[0]));
+        if (tmp1) t->pfds = tmp1;
+        void* const tmp2 = realloc (t->pitems, len * sizeof(t->pitems[0]));
+        if (tmp2) t->pitems = tmp2;
+        if (tmp1 && tmp2) t->pfds_len = len;
+    }
+
+    t->pfds[n].fd     = t->wake[0];
+    t->pfds[n].events = POLLIN;
+    t->pitems[n++]    = NULL;
+
+    for (i = 0; i < t->heap_len && n < t->pfds_len; i++) {
+        sched_item_t* const item = t->heap[i];
+        if (item->fd >= 0) {
+            t->pfds[n].fd     = item->fd;
+            t->pfds[n].events = item->ops;
+            t->pitems[n++]    = item;
+        }
+    }
+
+    ret = poll (t->pfds, n, timeout_ms);
+#endif /* USE_EPOLL */
+
+    return (ret >= 0 ? ret : -errno);
+}
+
+// dispatches ready descriptors returned by sched_wait()
+static void
+sched_dispatch (sched_thd_t* const t, int n, glb_time_t const now)
+{
+    int i;
+
+#ifdef USE_EPOLL
+    for (i = 0; i < n; i++) {
+        sched_item_t* const item = t->events[i].data.ptr;
+#else
+    for (i = 0; n > 0; i++) {
+        if (!t->pfds[i].revents) continue;
+        n--;
+        sched_item_t* const item = t->pitems[i];
+#endif /* USE_EPOLL */
+        if (item) {
+            /* item may have been finished by a previous event */
+            if (item->start && item->fd >= 0)
+                sched_item_step (t, item, now, false);
+        }
+        else {
+            char buf[64];
+            while (read (t->wake[0], buf, sizeof(buf)) > 0);
+        }
+    }
+}
+
+static void*
+sched_thread (void* arg)
+{
+    sched_thd_t* const t = arg;
+
+    while (true) {
+        glb_time_t now = glb_time_mono();
+
+        GLB_MUTEX_LOCK (&t->lock);
+        bool const quit = t->quit;
+        GLB_MUTEX_UNLOCK (&t->lock);
+
+        if (quit) break;
+
+        sched_handle_kicks (t, now);
+
+        while (t->heap_len > 0 && t->heap[0]->deadline <= now) {
+            sched_item_t* const item = t->heap[0];
+            sched_item_step (t, item, now, item->start != 0);
+        }
+
+        int timeout_ms = -1;
+        if (t->heap_len > 0) {
+            timeout_ms = (t->heap[0]->deadline - now + 999999) / 1000000;
+        }
+
+        int const ret = sched_wait (t, timeout_ms);
+
+        if (ret < 0) {
+            if (-ret != EINTR) {
+                glb_log_error ("Scheduler wait failed: %d (%s)",
+                               -ret, strerror (-ret));
+                usleep (100000); // avoid busy loop
+            }
+            continue;
+        }
+
+        sched_dispatch (t, ret, glb_time_mono());
+    }
+
+    /* close destinations that are still here */
+    sched_handle_kicks (t, glb_time_mono());
+    while (t->heap_len > 0) sched_item_remove (t, t->heap[0], 0);
+
+    return NULL;
+}
+
+int
+glb_sched_add (glb_sched_t* const sched, glb_backend_thread_ctx_t* const ctx)
+{
+    sched_item_t* const item = calloc (1, sizeof(*item));
+
+    if (!item) return -ENOMEM;
+
+    int const err = sched->backend.open (ctx);
+
+    if (err < 0) {
+        free (item);
+        return err;
+    }
+
+    /* least loaded thread */
+    sched_thd_t* t = &sched->thd[0];
+    int i;
+    for (i = 1; i < sched->n_thds; i++) {
+        if (sched->thd[i].n_items < t->n_items) t = &sched->thd[i];
+    }
+
+    item->ctx      = ctx;
+    item->thd      = t;
+    item->heap_idx = -1;
+    item->fd       = -1;
+    item->interval = ctx->interval;
+    item->state    = -1;
+
+    GLB_MUTEX_LOCK (&t->lock);
+    t->n_items++;
+    GLB_MUTEX_UNLOCK (&t->lock);
+
+    GLB_MUTEX_LOCK (&ctx->lock);
+    ctx->sched = item;
+    glb_sched_kick (ctx);
+    GLB_MUTEX_UNLOCK (&ctx->lock);
+
+    return 0;
+}
+
+static int
+sched_thd_init (glb_sched_t* const sched, sched_thd_t* const t)
+{
+    t->sched   = sched;
+    t->wake[0] = t->wake[1] = -1;
+    t->seed    = glb_time_now() + (t - sched->thd);
+#ifdef USE_EPOLL
+    t->epoll_fd = -1;
+#endif /* USE_EPOLL */
+    pthread_mutex_init (&t->lock, NULL);
+
+    if (pipe (t->wake)) return -errno;
+
+    (void)glb_fd_setfl (t->wake[0], O_NONBLOCK, true);
+    (void)glb_fd_setfl (t->wake[1], O_NONBLOCK, true);
+    (void)glb_fd_setfd (t->wake[0], FD_CLOEXEC, true);
+    (void)glb_fd_setfd (t->wake[1], FD_CLOEXEC, true);
+
+#ifdef USE_EPOLL
+    t->epoll_fd = epoll_create (128);
+    if (t->epoll_fd < 0) return -errno;
+    (void)glb_fd_setfd (t->epoll_fd, FD_CLOEXEC, true);
+
+    struct epoll_event e = { EPOLLIN, { .ptr = NULL } };
+    if (epoll_ctl (t->epoll_fd, EPOLL_CTL_ADD, t->wake[0], &e)) return -errno;
+#endif /* USE_EPOLL */
+
+    int const ret = pthread_create (&t->id, NULL, sched_thread, t);
+
+    return -ret;
+}
+
+static void
+sched_thd_fini (sched_thd_t* const t)
+{
+#ifdef USE_EPOLL
+    if (t->epoll_fd >= 0) close (t->epoll_fd);
+    free (t->events);
+#else
+    free (t->pfds);
+    free (t->pitems);
+#endif /* USE_EPOLL */
+    if (t->wake[0] >= 0) close (t->wake[0]);
+    if (t->wake[1] >= 0) close (t->wake[1]);
+    free (t->heap);
+    pthread_mutex_destroy (&t->lock);
+}
+
+static void
+sched_destroy (glb_sched_t* const sched, int const n_started)
+{
+    int i;
+
+    for (i = 0; i < n_started; i++) {
+        sched_thd_t* const t = &sched->thd[i];
+
+        GLB_MUTEX_LOCK (&t->lock);
+        t->quit = true;
+        GLB_MUTEX_UNLOCK (&t->lock);
+
+        sched_wake (t);
+        pthread_join (t->id, NULL);
+        sched_thd_fini (t);
+    }
+
+    free (sched);
+}
+
+glb_sched_t*
+glb_sched_create (const glb_backend_t* const backend, int const n_thds)
+{
+    assert (backend->open && backend->step && backend->close);
+    assert (n_thds > 0);
+
+    glb_sched_t* const ret = calloc (1, sizeof(*ret) +
+                                     n_thds * sizeof(sched_thd_t));
+    if (!ret) return NULL;
+
+    ret->backend = *backend;
+    ret->n_thds  = n_thds;
+
+    int i;
+    for (i = 0; i < n_thds; i++) {
+        int const err = sched_thd_init (ret, &ret->thd[i]);
+
+        if (err) {
+            glb_log_error ("Failed to start watchdog scheduler thread: "
+                           "%d (%s)", -err, strerror (-err));
+            sched_thd_fini (&ret->thd[i]);
+            sched_destroy (ret, i);
+            return NULL;
+        }
+    }
+
+    return ret;
+}
+
+void
+glb_sched_destroy (glb_sched_t* const sched)
+{
+    sched_destroy (sched, sched->n_thds);
+}
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * Watchdog probe scheduler for event-driven backends: a few threads, each
+ * with its own set of destinations, descriptor polling and a timer heap of
+ * next probe and probe timeout deadlines.
+ *
+ * $Id$
+ */
+
+#ifndef _glb_wdog_sched_h_
+#define _glb_wdog_sched_h_
+
+#include "glb_wdog_backend.h"
+
+typedef struct glb_sched glb_sched_t;
+
+/*! Starts scheduler threads for event-driven backend */
+extern glb_sched_t*
+glb_sched_create (const glb_backend_t* backend, int n_threads);
+
+/*! Closes remaining destinations and joins scheduler threads */
+extern void
+glb_sched_destroy (glb_sched_t* sched);
+
+/*! Opens backend probe for the destination and starts checking it at
+ *  ctx->interval. When ctx->quit is set (followed by glb_sched_kick()),
+ *  probe is closed and ctx->join is set, after that ctx may be freed.
+ *  @return 0 or negative errno from backend open() */
+extern int
+glb_sched_add (glb_sched_t* sched, glb_backend_thread_ctx_t* ctx);
+
+/*! @return the longest time till the next result of the destination:
+ *  the longest probe interval with jitter plus probe timeout. */
+extern glb_time_t
+glb_sched_result_ttl (const glb_backend_thread_ctx_t* ctx);
+
+/*! Makes scheduler look at changed ctx->quit or ctx->waiting.
+ *  Must be called with ctx->lock held. */
+extern void
+glb_sched_kick (glb_backend_thread_ctx_t* ctx);
+
+#endif // _glb_wdog_sched_h_
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2013 Codership Oy <info@codership.com>
+ *
+ * This is backend that checks that destinations accept TCP connections.
+ * Every check is a non-blocking connect() which is closed right after it
+ * succeeds, so check latency is connection round trip time.
+ *
+ * $Id$
+ */
+
+#include "glb_wdog_tcp.h"
+#include "glb_socket.h"
+#include "glb_log.h"
+
+#include <stdlib.h>   // calloc()/free()
+#include <string.h>   // strerror()
+#include <errno.h>
+#include <unistd.h>   // close()
+
+typedef struct tcp_probe
+{
+    glb_sockaddr_t addr;
+    int            sock;
+    int            error; // last logged error, to log failures only once
+} tcp_probe_t;
+
+static void
+tcp_disconnect (tcp_probe_t* const p)
+{
+    if (p->sock >= 0) close (p->sock);
+    p->sock = -1;
+}
+
+static int
+tcp_step (glb_backend_thread_ctx_t* const ctx,
+          int*                      const fd,
+          bool                      const timeout,
+          glb_wdog_check_t*         const res)
+{
+    tcp_probe_t* const p = ctx->probe;
+    int ret;
+
+    if (timeout) {
+        /* Without result destination is put on hold by watchdog. */
+        glb_log_warn ("Check of '%s:%hu' timed out.", ctx->host, ctx->port);
+        tcp_disconnect (p);
+        return 0;
+    }
+
+    if (*fd < 0) {
+        ret = glb_backend_connect (&p->addr, &p->sock);
+
+        if (GLB_BACKEND_WRITE == ret) {
+            *fd = p->sock;
+            return ret;
+        }
+    }
+    else {
+        ret = glb_backend_connected (p->sock);
+    }
+
+    tcp_disconnect (p);
+
+    if (ret < 0) {
+        if (-ret != p->error) {
+            glb_log_info ("Check of '%s:%hu' failed: %d (%s)",
+                          ctx->host, ctx->port, -ret, strerror (-ret));
+        }
+        p->error   = -ret;
+        res->state = GLB_DST_NOTFOUND;
+    }
+    else {
+        if (p->error) {
+            glb_log_info ("Check of '%s:%hu' succeeded.",ctx->host,ctx->port);
+        }
+        p->error   = 0;
+        res->state = GLB_DST_READY;
+    }
+
+    res->ready = true;
+    return 0;
+}
+
+static int
+tcp_open (glb_backend_thread_ctx_t* const ctx)
+{
+    tcp_probe_t* const p = calloc (1, sizeof(*p));
+
+    if (!p) return -ENOMEM;
+
+    long const err = glb_sockaddr_init (&p->addr, ctx->host, ctx->port);
+
+    if (err) {
+        free (p);
+        return err;
+    }
+
+    p->sock = -1;
+    ctx->probe = p;
+
+    return 0;
+}
+
+static void
+tcp_close (glb_backend_thread_ctx_t* const ctx)
+{
+    tcp_probe_t* const p = ctx->probe;
+
+    tcp_disconnect (p);
+    free (p);
+}
+
+static int
+tcp_init (glb_backend_t* const backend, const char* const spec)
+{
+    if (spec && strlen(spec) > 0) {
+        glb_log_error ("'tcp' backend takes no options: '%s'", spec);
+        return -EINVAL;
+    }
+
+    backend->open  = tcp_open;
+    backend->step  = tcp_step;
+    backend->close = tcp_close;
+
+    return 0;
+}
+
+glb_backend_init_t glb_backend_tcp_init = tcp_init;